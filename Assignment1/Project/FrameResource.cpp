@@ -1,15 +1,47 @@
 #include "FrameResource.h"
 
-FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount)
+FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT instanceCount,
+    UINT indirectItemCount, UINT localLightCount, UINT workerCount)
 {
     ThrowIfFailed(device->CreateCommandAllocator(
         D3D12_COMMAND_LIST_TYPE_DIRECT,
 		IID_PPV_ARGS(CmdListAlloc.GetAddressOf())));
 
+    WorkerCmdListAllocs.resize(workerCount);
+    WorkerCmdLists.resize(workerCount);
+    for(UINT i = 0; i < workerCount; ++i)
+    {
+        ThrowIfFailed(device->CreateCommandAllocator(
+            D3D12_COMMAND_LIST_TYPE_DIRECT,
+            IID_PPV_ARGS(WorkerCmdListAllocs[i].GetAddressOf())));
+
+        ThrowIfFailed(device->CreateCommandList(
+            0,
+            D3D12_COMMAND_LIST_TYPE_DIRECT,
+            WorkerCmdListAllocs[i].Get(),
+            nullptr,
+            IID_PPV_ARGS(WorkerCmdLists[i].GetAddressOf())));
+
+        // Start off in a closed state like the main command list.
+        ThrowIfFailed(WorkerCmdLists[i]->Close());
+    }
+
   //  FrameCB = std::make_unique<UploadBuffer<FrameConstants>>(device, 1, true);
     PassCB = std::make_unique<UploadBuffer<PassConstants>>(device, passCount, true);
     MaterialCB = std::make_unique<UploadBuffer<MaterialConstants>>(device, materialCount, true);
+    MaterialBuffer = std::make_unique<UploadBuffer<MaterialConstants>>(device, materialCount, false);
     ObjectCB = std::make_unique<UploadBuffer<ObjectConstants>>(device, objectCount, true);
+    InstanceBuffer = std::make_unique<UploadBuffer<InstanceData>>(device, instanceCount, false);
+    IndirectItems = std::make_unique<UploadBuffer<IndirectItem>>(device, indirectItemCount, false);
+    LocalLights = std::make_unique<UploadBuffer<Light>>(device, localLightCount, false);
+
+    ThrowIfFailed(device->CreateCommittedResource(
+        &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+        D3D12_HEAP_FLAG_NONE,
+        &CD3DX12_RESOURCE_DESC::Buffer(sizeof(UINT)),
+        D3D12_RESOURCE_STATE_COPY_DEST,
+        nullptr,
+        IID_PPV_ARGS(IndirectCountReadback.GetAddressOf())));
 }
 
 FrameResource::~FrameResource()
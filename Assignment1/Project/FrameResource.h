@@ -4,12 +4,104 @@
 #include "../../Common/MathHelper.h"
 #include "../../Common/UploadBuffer.h"
 
+struct RenderItem;
+
 struct ObjectConstants
 {
     DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
 	DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
 };
 
+// Per-instance data read by the instanced vertex shader through a structured buffer.
+struct InstanceData
+{
+    DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
+    DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+};
+
+// Per render item record read by the GPU culling shader (Shaders/Cull.hlsl)
+// with everything needed to emit the item's draw: its world bounding sphere,
+// the addresses of its constants in this frame resource, its geometry views
+// and the draw arguments of each level of detail.  With -bindless, Material
+// holds the material index instead of the material constants address.
+const UINT IndirectMaxLods = 4;
+struct IndirectItem
+{
+    DirectX::XMFLOAT4 WorldSphere = { 0.0f, 0.0f, 0.0f, 0.0f };
+    D3D12_GPU_VIRTUAL_ADDRESS ObjectCB = 0;
+    UINT64 Material = 0;
+    D3D12_VERTEX_BUFFER_VIEW VertexBufferView = {};
+    D3D12_INDEX_BUFFER_VIEW IndexBufferView = {};
+    UINT LodCount = 1;
+    UINT Pad[3] = {};
+
+    // IndexCount, StartIndexLocation, BaseVertexLocation, unused.
+    DirectX::XMUINT4 Lods[IndirectMaxLods];
+};
+
+// One ExecuteIndirect command, written by the culling shader: bind the
+// object and material constants and the geometry, then draw.  Material is
+// the root CBV address, or with -bindless the two material root constants.
+struct IndirectCommand
+{
+    D3D12_GPU_VIRTUAL_ADDRESS ObjectCB;
+    UINT64 Material;
+    D3D12_VERTEX_BUFFER_VIEW VertexBufferView;
+    D3D12_INDEX_BUFFER_VIEW IndexBufferView;
+    D3D12_DRAW_INDEXED_ARGUMENTS DrawArgs;
+    UINT Pad;
+};
+
+// Root constants of the culling shader.  Planes are world space and point
+// inwards.
+struct CullConstants
+{
+    DirectX::XMFLOAT4 FrustumPlanes[6];
+    DirectX::XMFLOAT3 EyePosW = { 0.0f, 0.0f, 0.0f };
+    float ProjScale = 0.0f;
+    DirectX::XMFLOAT4 LodScreenSizes = { 0.0f, 0.0f, 0.0f, 0.0f };
+    UINT ItemCount = 0;
+    UINT FrustumCullingEnabled = 0;
+    UINT LodEnabled = 0;
+    UINT Pad = 0;
+};
+
+// Constants of the occlusion test of the culling shader, the camera the
+// depth pyramid was rendered with and the pyramid's size; see
+// HiZBuffer::SetCamera.
+struct HiZConstants
+{
+    DirectX::XMFLOAT4X4 View = MathHelper::Identity4x4();
+    float ProjScaleX = 0.0f;
+    float ProjScaleY = 0.0f;
+    float DepthA = 0.0f;
+    float DepthB = 0.0f;
+    UINT DepthWidth = 0;
+    UINT DepthHeight = 0;
+    UINT LevelCount = 0;
+    UINT Enabled = 0;
+};
+
+// Clustered lighting.  The cluster grid and cluster buffer layout mirror
+// LightingUtil.hlsl: each cluster owns ClusterStride entries, a light count
+// followed by light indices.
+const UINT ClusterCountX = 16;
+const UINT ClusterCountY = 9;
+const UINT ClusterCountZ = 24;
+const UINT ClusterStride = 64;
+const UINT MaxLocalLights = 4096;
+
+// Root constants of the light binning shader (Shaders/ClusterLights.hlsl).
+struct ClusterConstants
+{
+    DirectX::XMFLOAT4X4 View = MathHelper::Identity4x4();
+    DirectX::XMFLOAT4X4 InvProj = MathHelper::Identity4x4();
+    float NearZ = 0.0f;
+    float FarZ = 0.0f;
+    UINT NumPointLights = 0;
+    UINT NumSpotLights = 0;
+};
+
 struct PassConstants
 {
     DirectX::XMFLOAT4X4 View = MathHelper::Identity4x4();
@@ -42,13 +134,23 @@ struct Vertex
     DirectX::XMFLOAT3 Normal;
 };
 
+// Compressed layout used with -packedvertices: half precision position, with
+// w unused, and an octahedral encoded normal in two 16-bit snorms.  12 bytes
+// instead of 24.
+struct PackedVertex
+{
+    DirectX::PackedVector::XMHALF4 Pos;
+    DirectX::PackedVector::XMSHORTN2 Normal;
+};
+
 // Stores the resources needed for the CPU to build the command lists
 // for a frame.  
 struct FrameResource
 {
 public:
     
-    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount);
+    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT instanceCount,
+        UINT indirectItemCount, UINT localLightCount, UINT workerCount);
     FrameResource(const FrameResource& rhs) = delete;
     FrameResource& operator=(const FrameResource& rhs) = delete;
     ~FrameResource();
@@ -57,13 +159,51 @@ public:
     // So each frame needs their own allocator.
     Microsoft::WRL::ComPtr<ID3D12CommandAllocator> CmdListAlloc;
 
+    // One allocator/command list pair per recording thread for parallel
+    // command list recording.  The lists are created closed.
+    std::vector<Microsoft::WRL::ComPtr<ID3D12CommandAllocator>> WorkerCmdListAllocs;
+    std::vector<Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>> WorkerCmdLists;
+
     // We cannot update a cbuffer until the GPU is done processing the commands
     // that reference it.  So each frame needs their own cbuffers.
    // std::unique_ptr<UploadBuffer<FrameConstants>> FrameCB = nullptr;
     std::unique_ptr<UploadBuffer<PassConstants>> PassCB = nullptr;
     std::unique_ptr<UploadBuffer<MaterialConstants>> MaterialCB = nullptr;
+
+    // The same constants as one structured buffer for -bindless, where a draw
+    // selects its material with a root constant instead of a root CBV.
+    std::unique_ptr<UploadBuffer<MaterialConstants>> MaterialBuffer = nullptr;
     std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
 
+    // Instance data of every instance batch drawn this frame.  Batches occupy
+    // contiguous ranges so a batch is bound by offsetting the root SRV.
+    std::unique_ptr<UploadBuffer<InstanceData>> InstanceBuffer = nullptr;
+
+    // Records of the opaque render items for the GPU-driven path, indexed by
+    // the item's CullIndex.  The visible count the culling shader produced
+    // for this frame is copied back to IndirectCountReadback.
+    std::unique_ptr<UploadBuffer<IndirectItem>> IndirectItems = nullptr;
+    Microsoft::WRL::ComPtr<ID3D12Resource> IndirectCountReadback = nullptr;
+    bool GpuDriven = false;
+
+    // Point lights followed by spot lights, binned into clusters each frame.
+    std::unique_ptr<UploadBuffer<Light>> LocalLights = nullptr;
+
+    // Coarse levels of the depth pyramid built this frame, copied back for the
+    // CPU occlusion test along with the view the depth was rendered with.
+    // Sized with the window by the app.
+    Microsoft::WRL::ComPtr<ID3D12Resource> HiZReadback = nullptr;
+    DirectX::XMFLOAT4X4 HiZView = MathHelper::Identity4x4();
+    bool HiZPending = false;
+
+    // Packed text of the stats overlay, see TextOverlay.  Created by the app.
+    std::unique_ptr<UploadBuffer<UINT>> OverlayText = nullptr;
+
+    // Render items and materials whose constants changed since this frame
+    // resource was last used.  Filled by MarkDirty, drained by the cbuffer updates.
+    std::vector<RenderItem*> DirtyRitems;
+    std::vector<Material*> DirtyMaterials;
+
     // Fence value to mark commands up to this fence point.  This lets us
     // check if these frame resources are still in use by the GPU.
     UINT64 Fence = 0;
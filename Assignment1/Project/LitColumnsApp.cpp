@@ -6,7 +6,27 @@
 #include "../../Common/MathHelper.h"
 #include "../../Common/UploadBuffer.h"
 #include "../../Common/GeometryGenerator.h"
+#include "../../Common/MeshBatchBuilder.h"
+#include "../../Common/MeshOptimizer.h"
+#include "../../Common/FrustumCuller.h"
+#include "../../Common/ThreadPool.h"
+#include "../../Common/UploadRingBuffer.h"
+#include "../../Common/MeshFile.h"
+#include "../../Common/UploadQueue.h"
+#include "../../Common/Benchmark.h"
+#include "../../Common/TransformStore.h"
+#include "../../Common/ObjectPool.h"
+#include "../../Common/HiZBuffer.h"
+#include "../../Common/ShaderCache.h"
+#include "../../Common/PipelineStateCache.h"
+#include "../../Common/DynamicResolution.h"
+#include "../../Common/TextOverlay.h"
+#include "../../Common/CellStreamer.h"
 #include "FrameResource.h"
+#include <cstring>
+#include <future>
+#include <map>
+#include <tuple>
 
 using Microsoft::WRL::ComPtr;
 using namespace DirectX;
@@ -15,7 +35,166 @@ using namespace DirectX::PackedVector;
 #pragma comment(lib, "d3dcompiler.lib")
 #pragma comment(lib, "D3D12.lib")
 
-const int gNumFrameResources = 3;
+// Range of the -frames command line option.  DirtyFrameMask has one bit per
+// frame resource.
+const int MinFrameResources = 1;
+const int MaxFrameResources = 4;
+
+// Bytes of the upload ring a frame takes besides the streamed object
+// constants of the cell slots' items, for the Hi-Z constants.
+const UINT64 UploadRingFrameByteSize = 64*1024;
+
+// Benchmark runs use a fixed time step so every run renders the same frames.
+// The warm-up frames are rendered but not timed.
+const double BenchmarkTimeStep = 1.0 / 60.0;
+const UINT BenchmarkWarmupFrames = 30;
+const UINT DefaultBenchmarkFrames = 600;
+
+// Distance between neighbouring castles of the -castles grid; a castle's floor
+// grid is 20 x 30 units.
+const float CastleSpacingX = 24.0f;
+const float CastleSpacingZ = 34.0f;
+
+// 150 x 150 castles is about 1.1M render items.
+const int MaxCastleGridSize = 150;
+
+// With -streaming the castle grid is divided into cells of StreamingCellSize
+// x StreamingCellSize castles.  A cell is made resident once it comes within
+// StreamLoadDistance of the camera and unloaded past StreamUnloadDistance, and
+// at most MaxResidentCells cells, or -streamcells, are resident at once.  The
+// cells' bounds take every castle to be CastleHeight tall.
+const UINT StreamingCellSize = 4;
+const float StreamLoadDistance = 250.0f;
+const float StreamUnloadDistance = 300.0f;
+const float CastleHeight = 12.0f;
+
+// Enough for every cell within the unload distance of the camera.
+const UINT MaxResidentCells = 40;
+
+// With -streaming every cell draws from the one shape geometry, read from a
+// mesh file baked from the generated shapes.  The file is stamped with a hash
+// of what the shapes are generated from, CastleShapes and the optimizer
+// settings, and baked again when that changes.  Changes to the generator or optimizer code
+// do not show in the hash; bump CellMeshBakeVersion with them.
+const wchar_t* CellMeshDirectory = L"Cells";
+const UINT CellMeshBakeVersion = 1;
+
+// Render items, transform nodes and lights in one castle, reserved up front
+// for the whole grid, or for the cell slots with -streaming.
+const UINT RitemsPerCastle = 50;
+const UINT TransformNodesPerCastle = 61;
+const UINT PointLightsPerCastle = 6;
+const UINT SpotLightsPerCastle = 2;
+
+// Levels of detail per submesh, and the projected size, as a fraction of the
+// viewport height, below which each level after the first is used.
+const UINT MaxLodLevels = 4;
+const float LodScreenSizes[MaxLodLevels - 1] = { 0.15f, 0.06f, 0.025f };
+static_assert(MaxLodLevels == IndirectMaxLods, "IndirectItem must hold every level of detail");
+
+// Scene pass PSOs, one set for plain and one for instanced drawing.  After a
+// depth pre-pass the shaded passes use the Equal PSOs, which test depth EQUAL
+// and do not write it.
+enum ScenePso
+{
+	ScenePsoShaded,
+	ScenePsoClustered,
+	ScenePsoShadedEqual,
+	ScenePsoClusteredEqual,
+	ScenePsoDepthOnly,
+	ScenePsoCount
+};
+
+// Descriptors of the depth pyramid in mSrvDescriptorHeap: an SRV of the depth
+// buffer, an SRV and a UAV of each pyramid level, and an SRV of the whole
+// pyramid.  16 levels cover the largest depth buffer.
+const UINT HiZMaxLevels = 16;
+const UINT HiZDepthSrvIndex = 0;
+const UINT HiZLevelSrvIndex = HiZDepthSrvIndex + 1;
+const UINT HiZLevelUavIndex = HiZLevelSrvIndex + HiZMaxLevels;
+const UINT HiZPyramidSrvIndex = HiZLevelUavIndex + HiZMaxLevels;
+
+// Followed by an SRV of the dynamic resolution scene buffer.
+const UINT SceneSrvIndex = HiZPyramidSrvIndex + 1;
+const UINT SrvHeapDescriptorCount = SceneSrvIndex + 1;
+
+// The CPU occlusion test reads back the pyramid from the first level at most
+// this wide.
+const UINT HiZReadbackMaxWidth = 128;
+
+// State of the pyramid levels between builds: read by the culling shader and
+// copied back for the CPU.
+const D3D12_RESOURCE_STATES HiZReadState =
+	D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_COPY_SOURCE;
+
+// Compiled shaders are cached here, relative to the working directory like
+// the shader sources.
+const wchar_t* ShaderCacheDirectory = L"Shaders\\Cache";
+
+// The driver's compiled pipelines, see PipelineStateCache.
+const wchar_t* PipelineLibraryFile = L"Shaders\\Cache\\LitColumns.psolib";
+
+// A shader the app compiles: its name in mShaders and its compile arguments.
+// Defines is null terminated, or empty for no defines.
+struct ShaderPermutation
+{
+	std::string Name;
+	std::wstring Filename;
+	std::vector<D3D_SHADER_MACRO> Defines;
+	std::string EntryPoint;
+	std::string Target;
+};
+
+// The simulation advances in steps of this many seconds, see RunSimulation.
+// When it falls further behind than MaxSimulationSteps steps, after a
+// breakpoint say, the remaining time is dropped instead of simulated.
+const double SimulationStep = 1.0 / 120.0;
+const UINT MaxSimulationSteps = 30;
+
+// State the simulation advances one fixed step at a time: the orbit camera,
+// which follows the mouse or the benchmark camera path, and the brightness
+// of each torch.
+struct SimulationState
+{
+	double Time = 0.0;
+	float Theta = 0.0f;
+	float Phi = 0.0f;
+	float Radius = 0.0f;
+	std::vector<float> TorchFlicker;
+};
+
+// What the simulation reads, copied when a simulation job starts so the job
+// shares nothing with the window thread.
+struct SimulationInput
+{
+	double TargetTime = 0.0;
+	float Theta = 0.0f;
+	float Phi = 0.0f;
+	float Radius = 0.0f;
+	bool FollowCameraPath = false;
+};
+
+// What a frame draws: the simulation state at the frame's time, interpolated
+// between the two steps around it.
+struct SceneSnapshot
+{
+	XMFLOAT3 EyePos = { 0.0f, 0.0f, 0.0f };
+	XMFLOAT4X4 View = MathHelper::Identity4x4();
+	std::vector<float> TorchFlicker;
+};
+
+// CPU scopes summed into a benchmark frame's CPU time; D3DApp::Run adds these.
+const char* BenchmarkCpuScopes[] = { "Update", "Draw" };
+
+// TransformStore::WriteConstants writes a world matrix followed by a texture
+// transform into each of these.
+static_assert(offsetof(ObjectConstants, TexTransform) == sizeof(XMFLOAT4X4), "ObjectConstants layout");
+static_assert(offsetof(InstanceData, TexTransform) == sizeof(XMFLOAT4X4), "InstanceData layout");
+
+// Shaders/Cull.hlsl reads and writes these with 4-byte packing.
+static_assert(sizeof(IndirectItem) == 144, "IndirectItem layout");
+static_assert(sizeof(IndirectCommand) == 72, "IndirectCommand layout");
+static_assert(sizeof(CullConstants) % 4 == 0, "CullConstants are set as root constants");
 
 // Lightweight structure stores parameters to draw a shape.  This will
 // vary from app-to-app.
@@ -23,21 +202,22 @@ struct RenderItem
 {
 	RenderItem() = default;
 
-    // World matrix of the shape that describes the object's local space
-    // relative to the world space, which defines the position, orientation,
-    // and scale of the object in the world.
-    XMFLOAT4X4 World = MathHelper::Identity4x4();
+	// Index of the item's world matrix and texture transform in mTransforms.
+	// The world matrix describes the object's local space relative to the world
+	// space, which defines the position, orientation, and scale of the object.
+	UINT TransformIndex = -1;
 
-	XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+	// Because we have an object cbuffer for each FrameResource, a change to the object
+	// data has to be applied to each FrameResource.  Call MarkDirty after modifying the
+	// object data to queue it on every frame resource.  Bit i is set while FrameResource
+	// i has the item in its DirtyRitems list.
+	UINT DirtyFrameMask = 0;
 
-	// Dirty flag indicating the object data has changed and we need to update the constant buffer.
-	// Because we have an object cbuffer for each FrameResource, we have to apply the
-	// update to each FrameResource.  Thus, when we modify obect data we should set 
-	// NumFramesDirty = gNumFrameResources so that each frame resource gets the update.
-	int NumFramesDirty = gNumFrameResources;
-
-	// Index into GPU constant buffer corresponding to the ObjectCB for this render item.
+	// Index into GPU constant buffer corresponding to the ObjectCB for this render item,
+	// or -1 for the items of the cell slots.  Their constants are streamed through
+	// mUploadRing every frame they may be drawn, and RingCB is their address in it.
 	UINT ObjCBIndex = -1;
+	D3D12_GPU_VIRTUAL_ADDRESS RingCB = 0;
 
 	Material* Mat = nullptr;
 	MeshGeometry* Geo = nullptr;
@@ -49,6 +229,140 @@ struct RenderItem
     UINT IndexCount = 0;
     UINT StartIndexLocation = 0;
     int BaseVertexLocation = 0;
+
+    // Local space bounds of the submesh, used for frustum culling.
+    BoundingBox Bounds;
+
+    // Index of the item's world space box in mCuller.
+    UINT CullIndex = -1;
+
+    // Set by the culling pass each frame.
+    bool Visible = true;
+
+    // False for the items of a cell slot castle that has no place in a
+    // resident cell; an inactive item is never drawn.
+    bool Active = true;
+
+    // Indices of the pipeline state and geometry used to build the sort key.
+    UINT PsoIndex = 0;
+    UINT GeoIndex = 0;
+
+    // Id of the submesh in mSubmeshes and the level of detail the draw
+    // arguments above are taken from.  SelectLods picks the level each frame.
+    UINT Submesh = 0;
+    UINT Lod = 0;
+
+    // World space bounds, kept in step with the world matrix by MarkDirty.
+    BoundingSphere WorldSphere;
+
+    // PSO | geometry | material | depth, rebuilt each frame by SortVisibleRitems
+    // so that items sharing state are drawn back to back.
+    UINT64 SortKey = 0;
+};
+
+// A submesh, finest level of detail first, and the id of the geometry it is
+// drawn from.
+struct SceneSubmesh
+{
+	UINT GeoIndex = 0;
+	UINT LodCount = 1;
+	SubmeshGeometry Lods[MaxLodLevels];
+};
+
+// Ids of the submeshes and materials the castle is built from, looked up by
+// name once so that BuildCastle does no string lookups.
+struct CastlePalette
+{
+	UINT Box = 0;
+	UINT Grid = 0;
+	UINT Sphere = 0;
+	UINT Cylinder = 0;
+	UINT Diamond = 0;
+	UINT Wedge = 0;
+	UINT Octahedron = 0;
+	UINT TriPrism = 0;
+	UINT Hexagon = 0;
+	UINT Octagon = 0;
+	UINT Cone = 0;
+	UINT Pyramid = 0;
+	UINT Container = 0;
+	UINT Star = 0;
+
+	UINT BricksMat = 0;
+	UINT StoneMat = 0;
+	UINT TileMat = 0;
+	UINT WedgeMat = 0;
+	UINT DiaMat = 0;
+	UINT OctahedronMat = 0;
+	UINT SkyMat = 0;
+	UINT GoldMat = 0;
+	UINT ShineBlueMat = 0;
+	UINT ShineRedMat = 0;
+	UINT WallMat = 0;
+};
+
+// A cell of the streaming world, a block of castles.  A resident cell is
+// drawn with the castles of the cell slot it is bound to.
+struct WorldCell
+{
+	UINT Slot = -1;
+};
+
+// The render items, transform nodes and lights of StreamingCellSize x
+// StreamingCellSize castles, built once at startup.  Binding the slot to a
+// cell moves its castles into the cell's places; castles left without a
+// place, past the edge of the grid or in an unbound slot, are inactive.
+struct CellSlot
+{
+	UINT Cell = -1;
+
+	// The first render item and lights of the slot's castles, which have
+	// RitemsPerCastle items, PointLightsPerCastle point lights and
+	// SpotLightsPerCastle spot lights each, in the order of Castles.
+	size_t FirstRitem = 0;
+	UINT FirstPointLight = 0;
+	UINT FirstSpotLight = 0;
+
+	// Root transform node of each castle.
+	std::vector<UINT> Castles;
+};
+
+// Counts of the draw and state setting calls recorded by a draw pass.  Calls
+// that would rebind the state already bound on the command list are skipped.
+struct DrawStats
+{
+	UINT DrawCalls = 0;
+	UINT StateChanges = 0;
+	UINT StateChangesSkipped = 0;
+
+	DrawStats& operator+=(const DrawStats& rhs)
+	{
+		DrawCalls += rhs.DrawCalls;
+		StateChanges += rhs.StateChanges;
+		StateChangesSkipped += rhs.StateChangesSkipped;
+		return *this;
+	}
+};
+
+// Group of render items that draw the same submesh with the same material.
+// The instances at each level of detail are issued with a single
+// DrawIndexedInstanced call, with each item's per-instance data read from the
+// FrameResource instance buffer.
+struct InstanceBatch
+{
+	Material* Mat = nullptr;
+	MeshGeometry* Geo = nullptr;
+
+	D3D12_PRIMITIVE_TOPOLOGY PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+
+	const SceneSubmesh* Submesh = nullptr;
+
+	std::vector<RenderItem*> Instances;
+
+	// Range of the instance buffer holding this batch's instances at each level
+	// of detail for the current frame.  Rebuilt each frame by UpdateInstanceBuffer.
+	UINT StartInstance[MaxLodLevels] = {};
+	UINT InstanceCount[MaxLodLevels] = {};
 };
 
 class LitColumnsApp : public D3DApp
@@ -61,6 +375,22 @@ public:
 
     virtual bool Initialize()override;
 
+	// Reads the frame pacing and benchmark options.  Must be called before Initialize.
+	void ParseCommandLine(const char* cmdLine);
+
+	// With -precompileshaders the app only fills the shader cache with every
+	// permutation, for both vertex layouts, and exits without creating a
+	// window or device.  Returns false if a shader failed to compile.
+	bool PrecompileShadersOnly()const;
+	bool PrecompileShaders();
+
+	// With -checkgeometry the app only checks the GeometryGenerator overloads
+	// that build into caller memory against the MeshData versions, see
+	// GeometryGenerator::CheckPointerOverloads, and exits.  Returns false if
+	// any shape disagrees.
+	bool CheckGeometryOnly()const;
+	bool CheckGeometry();
+
 private:
     virtual void OnResize()override;
     virtual void Update(const GameTimer& gt)override;
@@ -69,23 +399,137 @@ private:
     virtual void OnMouseDown(WPARAM btnState, int x, int y)override;
     virtual void OnMouseUp(WPARAM btnState, int x, int y)override;
     virtual void OnMouseMove(WPARAM btnState, int x, int y)override;
+    virtual void OnKeyUp(WPARAM key)override;
+    virtual std::wstring FrameStatsText()const override;
 
     void OnKeyboardInput(const GameTimer& gt);
-	void UpdateCamera(const GameTimer& gt);
-	void AnimateMaterials(const GameTimer& gt);
+	// Takes the frame's snapshot and, when pipelined, starts building the
+	// next frame's.  RunSimulation steps the simulation up to the input's
+	// target time and writes the snapshot at that time.  It returns the
+	// milliseconds it took rather than adding them to the profiler itself,
+	// since on a job it runs while the window thread begins the next frame.
+	void UpdateSimulation(const GameTimer& gt);
+	double RunSimulation(const SimulationInput& input, SceneSnapshot& snapshot);
+	void StepSimulation(SimulationState& state, const SimulationInput& input)const;
+	void UpdateTransforms(const GameTimer& gt);
+	void CullRenderItems(const GameTimer& gt);
+	void SelectLods(const GameTimer& gt);
+	void SortVisibleRitems(const GameTimer& gt);
 	void UpdateObjectCBs(const GameTimer& gt);
+	void UpdateStreamedCBs(const GameTimer& gt);
 	void UpdateMaterialCBs(const GameTimer& gt);
 	void UpdateMainPassCB(const GameTimer& gt);
+	void UpdateInstanceBuffer(const GameTimer& gt);
+	void UpdateLightBuffer(const GameTimer& gt);
+
+	// Move to the next frame resource and wait until the GPU is done with it.
+	void AdvanceFrameResource();
+
+	// Queue a render item or material for a constant buffer update on every
+	// frame resource.  Call after changing its data.  The geometry overload
+	// queues every item drawn from geo, once its buffers have changed.
+	void MarkDirty(RenderItem* ri);
+	void MarkDirty(Material* mat);
+	void MarkDirty(const MeshGeometry* geo);
+
+	void SetScenePassState(ID3D12GraphicsCommandList* cmdList);
+
+	// GPU-driven path: CullOnGpu fills the indirect command buffer and
+	// DrawOpaqueIndirect issues it.
+	void CullOnGpu(ID3D12GraphicsCommandList* cmdList);
+	void DrawOpaqueIndirect(ID3D12GraphicsCommandList* cmdList, DrawStats& stats, bool depthOnly = false);
+
+	// Clustered lighting: BinLights fills the cluster buffer for the frame's
+	// lights.  The opaque PSOs use the clustered pixel shader while it is on.
+	void BinLights(ID3D12GraphicsCommandList* cmdList);
+
+	// Reduces the previous frame's depth to the depth pyramid before the depth
+	// buffer is cleared, and queues the coarse levels for readback.
+	void BuildHiZ(ID3D12GraphicsCommandList* cmdList);
+
+	// Dynamic resolution: UpdateRenderScale feeds the controller the GPU time
+	// of the frames read back since the last call.  RecordPresent upscales the
+	// scene buffer to the back buffer if it is in use and hands the back
+	// buffer back to present.
+	void UpdateRenderScale();
+	void Upscale(ID3D12GraphicsCommandList* cmdList);
+	void RecordPresent(ID3D12GraphicsCommandList* cmdList);
+
+	// Stats overlay: UpdateOverlay prints the latest instrumented frame into
+	// the frame resource's text buffer and DrawOverlay draws it over the back
+	// buffer before it is presented.
+	void UpdateOverlay();
+	void DrawOverlay(ID3D12GraphicsCommandList* cmdList);
+
+	// PSOs of the scene pass for the current lighting and pre-pass settings,
+	// or of the depth pre-pass.
+	UINT ScenePsoIndex(bool depthOnly)const;
+	ID3D12PipelineState* OpaquePSO(bool depthOnly = false)const;
+	ID3D12PipelineState* InstancedPSO(bool depthOnly = false)const;
+	void DrawOpaqueSlice(ID3D12GraphicsCommandList* cmdList, UINT slice, UINT sliceCount, DrawStats& stats, bool depthOnly = false);
+	void RecordOpaquePassParallel(UINT opaqueScope);
+
+	// Stops the profiler capture and writes it to profile.csv and profile.json.
+	void WriteProfile();
+
+	// Stops the instrumentation trace and writes it to trace.json.
+	void WriteTrace();
+
+	void BuildCameraPath();
+	void UpdateBenchmark();
+	void FinishBenchmark();
 
     void BuildRootSignature();
+    void CreateRootSignature(const CD3DX12_ROOT_SIGNATURE_DESC& desc, ComPtr<ID3D12RootSignature>& rootSig);
+    void CreateRootSignature(const D3D12_ROOT_SIGNATURE_DESC1& desc, ComPtr<ID3D12RootSignature>& rootSig);
+    static std::vector<ShaderPermutation> ShaderPermutations(bool packedVertices, bool bindlessMaterials);
     void BuildShadersAndInputLayout();
     void BuildShapeGeometry();
-	//void BuildSkullGeometry();
+	void BuildShapeBatch(MeshBatchBuilder& batch);
+    MeshGeometry* BuildBatchGeometry(const std::string& name, const MeshBatchBuilder& batch);
+	void UploadGeometry(MeshGeometry* geo, const void* vertices, const void* indices);
+	void BuildSkullGeometry();
+
+	// -streaming: BuildCellGeometry takes the place of BuildShapeGeometry and
+	// loads the shapes from the cells' mesh file, baking the file first if it
+	// is missing or was baked from other shapes.  BuildCells divides the castle
+	// grid into cells and BuildCellSlots builds the castles they are drawn
+	// with.  UpdateStreaming binds the slots to the cells resident around the
+	// camera.
+	void BuildCellGeometry();
+	bool LoadCellMeshFile(const std::wstring& filename, MeshFile& file);
+	std::wstring CellMeshFile()const;
+	void BuildCells();
+	void BuildCellSlots(const CastlePalette& ids);
+	void BindCellSlot(UINT slot, UINT cell);
+	void UnbindCellSlot(UINT slot);
+	void PlaceSlotCastle(const CellSlot& slot, UINT castle, bool active, FXMMATRIX castleWorld);
+	void UpdateStreaming();
     void BuildPSOs();
+    void BuildScenePSOs(bool msaa, bool background);
     void BuildFrameResources();
+	void BuildUploadRing();
+    void BuildIndirectResources();
+    void BuildClusterResources();
+    void BuildDescriptorHeaps();
+    void BuildHiZResources();
+    void BuildSceneBufferSrv();
     void BuildMaterials();
+    void AddMaterial(const Material& mat);
+    UINT FindMaterial(const std::string& name)const;
+    UINT AddGeometry(MeshGeometry* geo);
+    UINT FindSubmesh(const std::string& name)const;
     void BuildRenderItems();
-    void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
+	XMFLOAT3 CastleCenter(UINT row, UINT col)const;
+    CastlePalette BuildCastlePalette()const;
+    UINT BuildCastle(const CastlePalette& ids, FXMMATRIX castleWorld);
+    void BuildCastleLights(FXMMATRIX castleWorld);
+    void PlaceCastleLights(UINT firstPoint, UINT firstSpot, FXMMATRIX castleWorld, bool lit);
+    UINT AddTransformNode(UINT parent, FXMMATRIX local);
+    void AddRenderItem(UINT submesh, UINT mat, UINT parent, FXMMATRIX local, CXMMATRIX texTransform);
+    void BuildInstanceBatches();
+    void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems, size_t begin, size_t end, DrawStats& stats);
+    void DrawInstanceBatches(ID3D12GraphicsCommandList* cmdList, const std::vector<InstanceBatch>& batches, size_t begin, size_t end, DrawStats& stats);
  
 private:
 
@@ -93,27 +537,263 @@ private:
     FrameResource* mCurrFrameResource = nullptr;
     int mCurrFrameResourceIndex = 0;
 
+	// Frames the CPU may record ahead of the GPU.  1 gives the lowest latency,
+	// 3 or 4 the highest throughput.
+	int mNumFrameResources = 3;
+
+	// When set, the CPU only work of a frame (input, camera, culling, sorting)
+	// is done before waiting for its frame resource, overlapping it with the
+	// GPU's work on earlier frames at the cost of sampling input earlier.
+	bool mLateFenceWait = false;
+
+	// Frames to capture with -profile before writing the profile.  Press 'T'
+	// to start and stop a capture by hand.
+	UINT mProfileFrameCount = 0;
+
+	// Frames to trace with -trace before writing trace.json.  Press 'R' to
+	// start and stop a trace by hand.
+	UINT mTraceFrameCount = 0;
+
+	// The instrumentation overlay, shown from the start with -overlay and
+	// toggled with 'S'.
+	bool mShowOverlay = false;
+	TextOverlay mOverlay;
+
+	// The scene is a grid of copies of the castle, 1x1 unless set with -castles.
+	// Each castle adds 50 render items.
+	UINT mCastleRows = 1;
+	UINT mCastleColumns = 1;
+
+	// -optimizemeshes reorders the generated meshes with MeshOptimizer, and
+	// -packedvertices stores every mesh in the 12 byte PackedVertex layout.
+	bool mOptimizeMeshes = false;
+	bool mPackedVertices = false;
+
+	// Generate the shape meshes and fill the geometry buffers on the thread
+	// pool at startup.  Turned off with -serialbuild.
+	bool mParallelGeometryBuild = true;
+
+	// Frame pipeline.  The snapshot a frame draws is built by a simulation job
+	// on the thread pool while the previous frame is culled and recorded, so
+	// the simulation costs the window thread nothing unless the job is late.
+	// The job predicts the next frame's time from the last frame time and
+	// sees mouse input from the frame before it, one frame later than the
+	// serial simulation does.  -serialsim runs the simulation on the window
+	// thread instead, as does a pool without threads.  mSimPrev and mSimNext
+	// belong to whichever thread runs the simulation; the window thread
+	// reads mSnapshots[mSnapshotIndex] while a job writes the other snapshot.
+	bool mPipelinedSimulation = true;
+	SimulationState mSimPrev;
+	SimulationState mSimNext;
+	SceneSnapshot mSnapshots[2];
+	UINT mSnapshotIndex = 0;
+	std::future<double> mSimulationJob;
+
+	// Set by -precompileshaders; see PrecompileShaders.
+	bool mPrecompileShaders = false;
+
+	// Set by -checkgeometry; see CheckGeometry.
+	bool mCheckGeometry = false;
+
+	// Benchmark mode (-benchmark N).  The window is hidden and the camera
+	// follows mCameraPath with a fixed time step; after the warm-up, N frames
+	// are timed and written to benchmark.json, then the app exits.  With
+	// -nopresent the frames are rendered but never presented, so the swap
+	// chain does not limit the frame rate.
+	UINT mBenchmarkFrameCount = 0;
+	UINT mBenchmarkFrame = 0;
+	UINT64 mLastProfiledFrame = 0;
+	bool mPresentEnabled = true;
+	std::wstring mCameraPathFile;
+	CameraPath mCameraPath;
+	BenchmarkRecorder mBenchmark;
+
     UINT mCbvSrvDescriptorSize = 0;
 
     ComPtr<ID3D12RootSignature> mRootSignature = nullptr;
 
 	ComPtr<ID3D12DescriptorHeap> mSrvDescriptorHeap = nullptr;
 
-	std::unordered_map<std::string, std::unique_ptr<MeshGeometry>> mGeometries;
-	std::unordered_map<std::string, std::unique_ptr<Material>> mMaterials;
+	// Geometries are allocated from mGeometryPool and referred to by id, their
+	// index in mGeometries.  The submeshes of every geometry share one table,
+	// and each records the id of its geometry.
+	ObjectPool<MeshGeometry> mGeometryPool;
+	std::vector<MeshGeometry*> mGeometries;
+	std::vector<SceneSubmesh> mSubmeshes;
+	std::unordered_map<std::string, UINT> mSubmeshIndices;
+
+	// The render items drawn from each geometry, indexed by geometry id, so
+	// that a geometry whose buffers change queues only its own items.
+	std::vector<std::vector<RenderItem*>> mGeometryRitems;
+
+	// Materials are stored contiguously and referred to by id, their index in
+	// mMaterials; names are only used to look the ids up.  The vector is not
+	// resized after BuildMaterials, so pointers into it stay valid.
+	std::vector<Material> mMaterials;
+	std::unordered_map<std::string, UINT> mMaterialIndices;
+
 	std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;
 	std::unordered_map<std::string, ComPtr<ID3DBlob>> mShaders;
 
     std::vector<D3D12_INPUT_ELEMENT_DESC> mInputLayout;
 
-    ComPtr<ID3D12PipelineState> mOpaquePSO = nullptr;
+    // Indexed by ScenePso.
+    ComPtr<ID3D12PipelineState> mOpaquePSOs[ScenePsoCount];
+    ComPtr<ID3D12PipelineState> mInstancedPSOs[ScenePsoCount];
+
+	// Every PSO comes from here.  The scene PSOs for the other sample count
+	// are created in the background, so toggling 4X MSAA does not stall on
+	// pipeline compiles.  mPsoMsaaState is the sample count of mOpaquePSOs
+	// and mInstancedPSOs.
+	std::unique_ptr<PipelineStateCache> mPsoCache;
+	bool mPsoMsaaState = false;
+
+	// Press 'Z' to toggle the depth pre-pass.  The opaque items are drawn
+	// depth only first, so the shaded pass runs the pixel shader once per
+	// pixel instead of once per covering surface.
+	bool mDepthPrePass = true;
+
+	// Hi-Z occlusion culling; press 'H' to toggle.  At the start of each frame
+	// the previous frame's depth is reduced to a pyramid of farthest depths.
+	// The culling shader tests against the pyramid directly.  The CPU culling
+	// pass tests against the coarse levels after they are read back, which
+	// lags the depth by the frame resources in flight, so items coming out
+	// from behind an occluder can appear a few frames late.  Not available
+	// with 4X MSAA.
+	bool mOcclusionCullingEnabled = true;
+	bool mHiZFrame = false;
+	bool mLastDepthValid = false;
+	XMFLOAT4X4 mLastDepthView = MathHelper::Identity4x4();
+	UINT mHiZLevelCount = 0;
+	UINT mOccludedCount = 0;
+	HiZBuffer mHiZ;
+	std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> mHiZFootprints;
+	ComPtr<ID3D12Resource> mHiZTexture = nullptr;
+	ComPtr<ID3D12RootSignature> mHiZRootSignature = nullptr;
+	ComPtr<ID3D12PipelineState> mHiZPSO = nullptr;
+
+	// -dynres MS turns on dynamic resolution, see D3DApp::mDynamicResolution,
+	// with the render scale picked for a GPU frame time of MS milliseconds.
+	// The depth pyramid is not built while the scale is in use, since the
+	// depth only covers part of the depth buffer.
+	double mDynResTargetMs = 0.0;
+	std::unique_ptr<DynamicResolution> mDynResController;
+	UINT64 mDynResLastFrame = 0;
+	ComPtr<ID3D12RootSignature> mUpscaleRootSignature = nullptr;
+	ComPtr<ID3D12PipelineState> mUpscalePSO = nullptr;
+
+	ComPtr<ID3D12RootSignature> mOverlayRootSignature = nullptr;
+	ComPtr<ID3D12PipelineState> mOverlayPSO = nullptr;
+
+	// Torches and spotlights of the castles, drawn with clustered forward
+	// lighting.  Each frame the lights are written to the frame resource, point
+	// lights first, and a compute pass bins them into the clusters of
+	// mClusterLightBuffer, which the clustered pixel shader reads.  Press 'K'
+	// to toggle; when off only the directional lights are evaluated.
+	std::vector<Light> mPointLights;
+	std::vector<Light> mSpotLights;
+	bool mClusteredLighting = true;
+	ClusterConstants mClusterConstants;
+	ComPtr<ID3D12RootSignature> mClusterRootSignature = nullptr;
+	ComPtr<ID3D12PipelineState> mClusterPSO = nullptr;
+	ComPtr<ID3D12Resource> mClusterLightBuffer = nullptr;
+	D3D12_RESOURCE_STATES mClusterLightBufferState = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
  
-	// List of all the render items.
-	std::vector<std::unique_ptr<RenderItem>> mAllRitems;
+	// Transform hierarchy.  Each castle is a node with its pieces and groups of
+	// pieces below it.  mTransformOwners holds the render item drawn with each
+	// node, or null for group nodes.
+	TransformStore mTransforms;
+	std::vector<RenderItem*> mTransformOwners;
+	std::vector<std::uint32_t> mChangedTransforms;
+
+	// Transforms and destination slots gathered for TransformStore::WriteConstants.
+	std::vector<std::uint32_t> mWriteTransforms;
+	std::vector<std::uint32_t> mWriteSlots;
+
+	// Items with an ObjectCB slot, and the items whose constants are streamed
+	// through the upload ring this frame.
+	UINT mObjectCBCount = 0;
+	std::vector<RenderItem*> mStreamedRitems;
+
+	// List of all the render items.  The items are allocated from mRitemPool in
+	// blocks, in creation order.
+	ObjectPool<RenderItem> mRitemPool;
+	std::vector<RenderItem*> mAllRitems;
 
 	// Render items divided by PSO.
 	std::vector<RenderItem*> mOpaqueRitems;
 
+	// World space bounds of mOpaqueRitems, in the same order.  Press 'C' to
+	// toggle frustum culling.
+	FrustumCuller mCuller;
+	BoundingFrustum mCamFrustum;
+	bool mFrustumCullingEnabled = true;
+
+	// Opaque render items that passed the culling pass this frame.
+	std::vector<RenderItem*> mVisibleRitems;
+	std::vector<std::uint32_t> mVisibleIndices;
+	UINT mCulledCount = 0;
+
+	// Press 'O' to toggle sorting the visible list by state and depth.
+	bool mSortingEnabled = true;
+
+	// Press 'L' to toggle distance based level of detail selection.
+	bool mLodEnabled = true;
+
+	// Press 'G' to toggle the GPU-driven path, or start with it on with
+	// -gpudriven.  A compute shader culls the opaque items and picks their
+	// levels of detail, and the opaque pass is a single ExecuteIndirect.  Items
+	// whose geometry is not resident, and inactive items, have empty records
+	// the shader skips.
+	bool mGpuDrivenEnabled = false;
+	UINT mGpuVisibleCount = 0;
+	ComPtr<ID3D12RootSignature> mCullRootSignature = nullptr;
+	ComPtr<ID3D12PipelineState> mCullPSO = nullptr;
+	ComPtr<ID3D12CommandSignature> mCommandSignature = nullptr;
+	ComPtr<ID3D12Resource> mIndirectCommandBuffer = nullptr;
+	ComPtr<ID3D12Resource> mIndirectCountBuffer = nullptr;
+	std::unique_ptr<UploadBuffer<UINT>> mIndirectCountReset = nullptr;
+
+	// -bindless.  The materials are one structured buffer per frame resource
+	// and a draw selects its material with a root constant, so switching
+	// material costs one 32-bit root value instead of a root CBV.
+	bool mBindlessMaterials = false;
+
+	// State changes recorded and avoided by the last frame's opaque pass.  With
+	// parallel recording each worker counts into its own slot.
+	DrawStats mDrawStats;
+	std::vector<DrawStats> mWorkerDrawStats;
+
+	// Opaque render items grouped by submesh and material for instanced drawing.
+	std::vector<InstanceBatch> mInstanceBatches;
+
+	// Press 'I' to toggle between instanced batches and one draw per render item.
+	bool mInstancingEnabled = true;
+
+	// Press 'P' to toggle recording the opaque pass on mNumRecordingThreads
+	// threads, each into its own FrameResource command list.
+	bool mParallelRecording = false;
+	UINT mNumRecordingThreads = 1;
+	std::unique_ptr<ThreadPool> mThreadPool;
+	std::vector<ID3D12CommandList*> mSubmitLists;
+
+	// Constants written once per frame: the Hi-Z pass constants, and the
+	// object constants of the cell slots' items.
+	std::unique_ptr<UploadRingBuffer> mUploadRing;
+
+	// Geometry is uploaded on this copy queue and drawn once its upload completes.
+	std::unique_ptr<UploadQueue> mUploadQueue;
+
+	// World streaming, see CellStreamer; on with -streaming, or -streamcells N
+	// to make at most N cells resident at once.  Only the castles of the cell
+	// slots are built, and they all draw from the one shape geometry.
+	bool mStreamingEnabled = false;
+	UINT mMaxResidentCells = MaxResidentCells;
+	std::unique_ptr<CellStreamer> mCellStreamer;
+	std::vector<WorldCell> mCells;
+	std::vector<CellSlot> mCellSlots;
+	std::vector<UINT> mFreeCellSlots;
+
     PassConstants mMainPassCB;
 
 	XMFLOAT3 mEyePos = { 0.0f, 0.0f, 0.0f };
@@ -138,6 +818,14 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
     try
     {
         LitColumnsApp theApp(hInstance);
+        theApp.ParseCommandLine(cmdLine);
+
+        // Run as a build step, so report failure through the exit code.
+        if(theApp.PrecompileShadersOnly())
+            return theApp.PrecompileShaders() ? 0 : 1;
+        if(theApp.CheckGeometryOnly())
+            return theApp.CheckGeometry() ? 0 : 1;
+
         if(!theApp.Initialize())
             return 0;
 
@@ -157,8 +845,207 @@ LitColumnsApp::LitColumnsApp(HINSTANCE hInstance)
 
 LitColumnsApp::~LitColumnsApp()
 {
+	// The job reads the app, so it must finish first.
+	if(mSimulationJob.valid())
+		mSimulationJob.wait();
+
     if(md3dDevice != nullptr)
         FlushCommandQueue();
+
+	// Default buffers are released with their geometries, so the copies into
+	// them must be done.
+	if(mUploadQueue != nullptr)
+		mUploadQueue->WaitIdle();
+
+	// Written on exit so the next run loads the pipelines this one compiled.
+	if(mPsoCache != nullptr)
+		mPsoCache->Save();
+}
+
+// Options:
+//   -frames N    number of frame resources in flight, 1 to 4 (default 3)
+//   -latency N   use a waitable swap chain with a maximum frame latency of N
+//   -latewait    do the CPU only work of a frame before waiting on its frame resource
+//   -profile N   capture N frames of CPU/GPU timings and write profile.csv/profile.json
+//   -trace N     trace N frames of instrumentation zones and counters into trace.json
+//   -overlay     show the instrumentation overlay from the start
+//   -benchmark N time N frames along the camera path and write benchmark.json
+//   -campath F   camera path file for -benchmark (see CameraPath::Load)
+//   -nopresent   render the benchmark frames without presenting them
+//   -castles R C build the scene from an R x C grid of castles
+//   -optimizemeshes  reorder the generated meshes for the vertex cache and overdraw
+//   -packedvertices  use half precision positions and octahedral encoded normals
+//   -serialbuild     generate and copy the startup geometry on the main thread only
+//   -serialsim       run the simulation on the main thread instead of ahead of each frame
+//   -streaming       stream the castles in cells around the camera
+//   -streamcells N   stream with at most N cells resident (default 40)
+//   -gpudriven       cull and draw the opaque items with a compute shader and ExecuteIndirect
+//   -bindless        read the materials from a structured buffer indexed by a root constant
+//   -dynres MS       scale the scene resolution to keep the GPU frame time near MS milliseconds
+//   -precompileshaders  compile every shader permutation into the shader cache and exit
+//   -checkgeometry   check the generator's caller-memory mesh builds and exit
+void LitColumnsApp::ParseCommandLine(const char* cmdLine)
+{
+	// The benchmark project builds an executable that benchmarks by default.
+#ifdef LITCOLUMNS_BENCHMARK
+	mBenchmarkFrameCount = DefaultBenchmarkFrames;
+#endif
+
+	std::istringstream args(cmdLine);
+	std::string arg;
+	while(args >> arg)
+	{
+		int value = 0;
+		if(arg == "-frames" && args >> value)
+		{
+			mNumFrameResources = MathHelper::Clamp(value, MinFrameResources, MaxFrameResources);
+		}
+		else if(arg == "-latency" && args >> value)
+		{
+			mWaitableSwapChain = true;
+			mMaxFrameLatency = (UINT)MathHelper::Clamp(value, 1, 16);
+		}
+		else if(arg == "-latewait")
+		{
+			mLateFenceWait = true;
+		}
+		else if(arg == "-profile" && args >> value)
+		{
+			mProfileFrameCount = (UINT)MathHelper::Max(value, 0);
+		}
+		else if(arg == "-trace" && args >> value)
+		{
+			mTraceFrameCount = (UINT)MathHelper::Max(value, 0);
+		}
+		else if(arg == "-overlay")
+		{
+			mShowOverlay = true;
+		}
+		else if(arg == "-benchmark" && args >> value)
+		{
+			mBenchmarkFrameCount = (UINT)MathHelper::Max(value, 0);
+		}
+		else if(arg == "-campath" && args >> arg)
+		{
+			mCameraPathFile = AnsiToWString(arg);
+		}
+		else if(arg == "-nopresent")
+		{
+			mPresentEnabled = false;
+		}
+		else if(arg == "-castles" && args >> value)
+		{
+			int columns = 0;
+			if(args >> columns)
+			{
+				mCastleRows = (UINT)MathHelper::Clamp(value, 1, MaxCastleGridSize);
+				mCastleColumns = (UINT)MathHelper::Clamp(columns, 1, MaxCastleGridSize);
+			}
+		}
+		else if(arg == "-optimizemeshes")
+		{
+			mOptimizeMeshes = true;
+		}
+		else if(arg == "-packedvertices")
+		{
+			mPackedVertices = true;
+		}
+		else if(arg == "-serialbuild")
+		{
+			mParallelGeometryBuild = false;
+		}
+		else if(arg == "-serialsim")
+		{
+			mPipelinedSimulation = false;
+		}
+		else if(arg == "-streaming")
+		{
+			mStreamingEnabled = true;
+		}
+		else if(arg == "-streamcells" && args >> value)
+		{
+			mStreamingEnabled = true;
+			mMaxResidentCells = (UINT)MathHelper::Max(value, 1);
+		}
+		else if(arg == "-gpudriven")
+		{
+			mGpuDrivenEnabled = true;
+		}
+		else if(arg == "-bindless")
+		{
+			mBindlessMaterials = true;
+		}
+		else if(arg == "-dynres" && args >> arg)
+		{
+			double targetMs = atof(arg.c_str());
+			if(targetMs > 0.0)
+			{
+				mDynamicResolution = true;
+				mDynResTargetMs = targetMs;
+			}
+		}
+		else if(arg == "-precompileshaders")
+		{
+			mPrecompileShaders = true;
+		}
+		else if(arg == "-checkgeometry")
+		{
+			mCheckGeometry = true;
+		}
+	}
+
+	if(mBenchmarkFrameCount > 0)
+		mHeadless = true;
+
+	// Nothing signals the frame latency object if the swap chain never presents.
+	if(!mPresentEnabled)
+		mWaitableSwapChain = false;
+}
+
+bool LitColumnsApp::PrecompileShadersOnly()const
+{
+	return mPrecompileShaders;
+}
+
+bool LitColumnsApp::PrecompileShaders()
+{
+	// The permutations shared by several modes are compiled once; the later
+	// passes find them in the cache.
+	ShaderCache cache(ShaderCacheDirectory);
+	try
+	{
+		for(bool packedVertices : { false, true })
+		{
+			for(bool bindlessMaterials : { false, true })
+			{
+				for(auto& p : ShaderPermutations(packedVertices, bindlessMaterials))
+					cache.Load(p.Filename, p.Defines.empty() ? nullptr : p.Defines.data(), p.EntryPoint, p.Target);
+			}
+		}
+	}
+	catch(DxException& e)
+	{
+		// d3dUtil::CompileShader has already written the compiler's errors to
+		// the debug output.
+		OutputDebugStringW((e.ToString() + L"\n").c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool LitColumnsApp::CheckGeometryOnly()const
+{
+	return mCheckGeometry;
+}
+
+bool LitColumnsApp::CheckGeometry()
+{
+	GeometryGenerator geoGen;
+	bool passed = geoGen.CheckPointerOverloads();
+	OutputDebugStringW(passed ? L"GeometryGenerator check passed.\n" :
+		L"GeometryGenerator pointer overloads disagree with the MeshData versions.\n");
+	return passed;
 }
 
 bool LitColumnsApp::Initialize()
@@ -166,6 +1053,18 @@ bool LitColumnsApp::Initialize()
     if(!D3DApp::Initialize())
         return false;
 
+	if(mProfileFrameCount > 0)
+		mProfiler->StartCapture();
+
+	if(mTraceFrameCount > 0)
+		Instrumentation::StartTrace();
+
+	if(mBenchmarkFrameCount > 0)
+	{
+		mTimer.SetFixedTimeStep(BenchmarkTimeStep);
+		BuildCameraPath();
+	}
+
     // Reset the command list to prep for initialization commands.
     ThrowIfFailed(mCommandList->Reset(mDirectCmdListAlloc.Get(), nullptr));
 
@@ -173,15 +1072,51 @@ bool LitColumnsApp::Initialize()
 	// so we have to query this information.
     mCbvSrvDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 
+	// The calling thread records one slice of the opaque pass itself, so the pool
+	// only needs the remaining recording threads.
+	mNumRecordingThreads = MathHelper::Clamp(std::thread::hardware_concurrency(), 1u, 8u);
+	mThreadPool = std::make_unique<ThreadPool>(mNumRecordingThreads - 1);
+
+	mUploadQueue = std::make_unique<UploadQueue>(md3dDevice.Get());
+
     BuildRootSignature();
     BuildShadersAndInputLayout();
-    BuildShapeGeometry();
-	//BuildSkullGeometry();
+	if(mStreamingEnabled)
+		BuildCellGeometry();
+	else
+		BuildShapeGeometry();
+	BuildSkullGeometry();
 	BuildMaterials();
     BuildRenderItems();
+    BuildInstanceBatches();
     BuildFrameResources();
+	BuildUploadRing();
+    BuildIndirectResources();
+    BuildClusterResources();
+    BuildDescriptorHeaps();
+    BuildHiZResources();
+    BuildSceneBufferSrv();
+
+	if(mDynamicResolution)
+		mDynResController = std::make_unique<DynamicResolution>(mDynResTargetMs);
+
+	// The simulation starts at time zero with every torch lit.  Without
+	// worker threads a queued simulation job would never run.
+	mSimNext.TorchFlicker.assign(mPointLights.size(), 1.0f);
+	mSimPrev = mSimNext;
+	mPipelinedSimulation = mPipelinedSimulation && mThreadPool->ThreadCount() > 0;
+
+	mPsoCache = std::make_unique<PipelineStateCache>(md3dDevice.Get(), PipelineLibraryFile);
     BuildPSOs();
 
+	mWorkerDrawStats.resize(mNumRecordingThreads);
+
+	// Queue everything for its initial constant buffer upload.
+	for(auto ri : mAllRitems)
+		MarkDirty(ri);
+	for(auto& mat : mMaterials)
+		MarkDirty(&mat);
+
     // Execute the initialization commands.
     ThrowIfFailed(mCommandList->Close());
     ID3D12CommandList* cmdsLists[] = { mCommandList.Get() };
@@ -200,31 +1135,151 @@ void LitColumnsApp::OnResize()
     // The window resized, so update the aspect ratio and recompute the projection matrix.
     XMMATRIX P = XMMatrixPerspectiveFovLH(0.25f*MathHelper::Pi, AspectRatio(), 1.0f, 1000.0f);
     XMStoreFloat4x4(&mProj, P);
+
+	// The view space frustum only changes with the projection.
+	BoundingFrustum::CreateFromMatrix(mCamFrustum, P);
+
+	// The depth pyramid is sized with the depth buffer.  On the first resize
+	// Initialize has not built it yet.
+	if(mSrvDescriptorHeap != nullptr)
+	{
+		BuildHiZResources();
+		BuildSceneBufferSrv();
+	}
+
+	// The frame time at the old size says nothing about the new one.
+	if(mDynResController != nullptr)
+	{
+		mDynResController->Reset();
+		SetRenderScale(mDynResController->Scale());
+	}
+
+	// Toggling 4X MSAA recreates the swap chain and resizes.  The GPU is idle
+	// here, so the scene PSOs can be swapped.
+	if(mPsoCache != nullptr && mPsoMsaaState != m4xMsaaState)
+	{
+		BuildScenePSOs(m4xMsaaState, false);
+		mPsoMsaaState = m4xMsaaState;
+	}
 }
 
 void LitColumnsApp::Update(const GameTimer& gt)
 {
+	// Make geometry whose copy queue upload has finished available for drawing.
+	mUploadQueue->Poll();
+
+	// Before the transforms are updated, so that the castles of the cells made
+	// resident now are moved into place this frame.
+	if(mCellStreamer != nullptr)
+		UpdateStreaming();
+
+	// Before the pass constants and the viewport of the frame are used.
+	if(mDynResController != nullptr && DynamicResolutionActive())
+		UpdateRenderScale();
+
+	if(mProfileFrameCount > 0 && mProfiler->CapturedFrameCount() >= mProfileFrameCount)
+	{
+		WriteProfile();
+		mProfileFrameCount = 0;
+	}
+
+	if(mTraceFrameCount > 0 && Instrumentation::TracedFrameCount() >= mTraceFrameCount)
+	{
+		WriteTrace();
+		mTraceFrameCount = 0;
+	}
+
+	if(mBenchmarkFrameCount > 0)
+		UpdateBenchmark();
+
+	// Normally wait first so the frame samples input as late as possible.
+	if(!mLateFenceWait)
+		AdvanceFrameResource();
+
     OnKeyboardInput(gt);
-	UpdateCamera(gt);
+	UpdateSimulation(gt);
+	UpdateTransforms(gt);
+
+	// On the GPU-driven path the culling shader does the culling and level of
+	// detail selection instead.
+	if(mGpuDrivenEnabled)
+	{
+		// The shader's occluded items are counted as culled.
+		mVisibleRitems.clear();
+		mOccludedCount = 0;
+	}
+	else
+	{
+		CullRenderItems(gt);
+		SelectLods(gt);
+		SortVisibleRitems(gt);
+	}
+
+	if(mLateFenceWait)
+		AdvanceFrameResource();
+
+	{
+		ProfileScope scope(mProfiler.get(), "UpdateObjectCBs");
+		UpdateObjectCBs(gt);
+		UpdateStreamedCBs(gt);
+	}
+	UpdateMaterialCBs(gt);
+	UpdateMainPassCB(gt);
+	UpdateInstanceBuffer(gt);
+	UpdateLightBuffer(gt);
 
+	if(mShowOverlay)
+		UpdateOverlay();
+}
+
+void LitColumnsApp::AdvanceFrameResource()
+{
     // Cycle through the circular frame resource array.
-    mCurrFrameResourceIndex = (mCurrFrameResourceIndex + 1) % gNumFrameResources;
+    mCurrFrameResourceIndex = (mCurrFrameResourceIndex + 1) % mNumFrameResources;
     mCurrFrameResource = mFrameResources[mCurrFrameResourceIndex].get();
 
     // Has the GPU finished processing the commands of the current frame resource?
     // If not, wait until the GPU has completed commands up to this fence point.
-    if(mCurrFrameResource->Fence != 0 && mFence->GetCompletedValue() < mCurrFrameResource->Fence)
+    if(mCurrFrameResource->Fence != 0)
     {
-        HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
-        ThrowIfFailed(mFence->SetEventOnCompletion(mCurrFrameResource->Fence, eventHandle));
-        WaitForSingleObject(eventHandle, INFINITE);
-        CloseHandle(eventHandle);
+        INSTRUMENT_ZONE("FenceWait");
+        WaitForFence(mCurrFrameResource->Fence);
     }
 
-	AnimateMaterials(gt);
-	UpdateObjectCBs(gt);
-	UpdateMaterialCBs(gt);
-	UpdateMainPassCB(gt);
+	// The GPU is done with the frame, so its visible count can be read back.
+	if(mCurrFrameResource->GpuDriven)
+	{
+		UINT* count = nullptr;
+		CD3DX12_RANGE readRange(0, sizeof(UINT));
+		ThrowIfFailed(mCurrFrameResource->IndirectCountReadback->Map(0, &readRange, reinterpret_cast<void**>(&count)));
+		mGpuVisibleCount = *count;
+		mCurrFrameResource->IndirectCountReadback->Unmap(0, &CD3DX12_RANGE(0, 0));
+
+		mCulledCount = (UINT)mOpaqueRitems.size() - mGpuVisibleCount;
+		mCurrFrameResource->GpuDriven = false;
+	}
+
+	// Likewise the depth pyramid levels it copied back.
+	if(mCurrFrameResource->HiZPending)
+	{
+		BYTE* data = nullptr;
+		ThrowIfFailed(mCurrFrameResource->HiZReadback->Map(0, nullptr, reinterpret_cast<void**>(&data)));
+		for(UINT level = mHiZ.FirstLevel(); level < mHiZ.LevelCount(); ++level)
+		{
+			const auto& footprint = mHiZFootprints[level - mHiZ.FirstLevel()];
+			const UINT width = mHiZ.LevelWidth(level);
+			float* dest = mHiZ.LevelData(level);
+			for(UINT y = 0; y < mHiZ.LevelHeight(level); ++y)
+			{
+				CopyMemory(dest + (size_t)y*width, data + footprint.Offset + (size_t)y*footprint.Footprint.RowPitch,
+					width*sizeof(float));
+			}
+		}
+		mCurrFrameResource->HiZReadback->Unmap(0, &CD3DX12_RANGE(0, 0));
+
+		mHiZ.SetCamera(XMLoadFloat4x4(&mCurrFrameResource->HiZView), XMLoadFloat4x4(&mProj));
+		mCurrFrameResource->HiZPending = false;
+	}
 }
 
 void LitColumnsApp::Draw(const GameTimer& gt)
@@ -237,43 +1292,114 @@ void LitColumnsApp::Draw(const GameTimer& gt)
 
     // A command list can be reset after it has been added to the command queue via ExecuteCommandList.
     // Reusing the command list reuses memory.
-    ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), mOpaquePSO.Get()));
+    ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), OpaquePSO()));
+
+	mDrawStats = DrawStats();
+
+	// The depth buffer still holds the previous frame's depth.
+	mHiZFrame = mOcclusionCullingEnabled && mLastDepthValid && !m4xMsaaState && !DynamicResolutionActive();
+	if(mHiZFrame)
+	{
+		UINT hiZScope = mProfiler->BeginScope(mCommandList.Get(), "HiZ");
+		BuildHiZ(mCommandList.Get());
+		mProfiler->EndScope(mCommandList.Get(), hiZScope);
+	}
 
-    mCommandList->RSSetViewports(1, &mScreenViewport);
-    mCommandList->RSSetScissorRects(1, &mScissorRect);
+	UINT clearScope = mProfiler->BeginScope(mCommandList.Get(), "Clear");
 
-    // Indicate a state transition on the resource usage.
-	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
-		D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
+    // Indicate a state transition on the resource usage.  With dynamic
+	// resolution the scene buffer is drawn to and the back buffer is only
+	// written by the upscale.
+	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(SceneBuffer(),
+		DynamicResolutionActive() ? D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE : D3D12_RESOURCE_STATE_PRESENT,
+		D3D12_RESOURCE_STATE_RENDER_TARGET));
 
-    // Clear the back buffer and depth buffer.
-    mCommandList->ClearRenderTargetView(CurrentBackBufferView(), Colors::LightSteelBlue, 0, nullptr);
+    // Clear the part of the scene target drawn to and the depth buffer.
+    mCommandList->ClearRenderTargetView(SceneBufferView(), Colors::LightSteelBlue, 1, &mScissorRect);
     mCommandList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
 
-    // Specify the buffers we are going to render to.
-    mCommandList->OMSetRenderTargets(1, &CurrentBackBufferView(), true, &DepthStencilView());
+	mProfiler->EndScope(mCommandList.Get(), clearScope);
 
-	mCommandList->SetGraphicsRootSignature(mRootSignature.Get());
+	if(mGpuDrivenEnabled)
+	{
+		UINT cullScope = mProfiler->BeginScope(mCommandList.Get(), "GpuCull");
+		CullOnGpu(mCommandList.Get());
+		mProfiler->EndScope(mCommandList.Get(), cullScope);
+	}
 
-	auto passCB = mCurrFrameResource->PassCB->Resource();
-	mCommandList->SetGraphicsRootConstantBufferView(2, passCB->GetGPUVirtualAddress());
+	if(mClusteredLighting)
+	{
+		UINT lightScope = mProfiler->BeginScope(mCommandList.Get(), "LightBinning");
+		BinLights(mCommandList.Get());
+		mProfiler->EndScope(mCommandList.Get(), lightScope);
+	}
 
-    DrawRenderItems(mCommandList.Get(), mOpaqueRitems);
+	// With parallel recording the pre-pass is still recorded here, so every
+	// worker's shaded slice is drawn against the complete depth.
+	if(mDepthPrePass)
+	{
+		UINT prePassScope = mProfiler->BeginScope(mCommandList.Get(), "DepthPrePass");
+		SetScenePassState(mCommandList.Get());
+		if(mGpuDrivenEnabled)
+			DrawOpaqueIndirect(mCommandList.Get(), mDrawStats, true);
+		else
+			DrawOpaqueSlice(mCommandList.Get(), 0, 1, mDrawStats, true);
+		mProfiler->EndScope(mCommandList.Get(), prePassScope);
+	}
 
-    // Indicate a state transition on the resource usage.
-	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
-		D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
+	// The opaque scope spans the worker lists when recording in parallel.
+	UINT opaqueScope = mProfiler->BeginScope(mCommandList.Get(), "Opaque");
 
-    // Done recording commands.
-    ThrowIfFailed(mCommandList->Close());
+	// A single ExecuteIndirect gains nothing from parallel recording.
+	if(mParallelRecording && !mGpuDrivenEnabled)
+	{
+		// The main command list only holds the clears and the passes before the
+		// opaque pass.  The worker command lists record the opaque pass and are
+		// submitted after it in slice order.
+		ThrowIfFailed(mCommandList->Close());
 
-    // Add the command list to the queue for execution.
-    ID3D12CommandList* cmdsLists[] = { mCommandList.Get() };
-    mCommandQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
+		RecordOpaquePassParallel(opaqueScope);
+
+		for(auto& stats : mWorkerDrawStats)
+			mDrawStats += stats;
+
+		mSubmitLists.clear();
+		mSubmitLists.push_back(mCommandList.Get());
+		for(auto& cmdList : mCurrFrameResource->WorkerCmdLists)
+			mSubmitLists.push_back(cmdList.Get());
+
+		mCommandQueue->ExecuteCommandLists((UINT)mSubmitLists.size(), mSubmitLists.data());
+	}
+	else
+	{
+		SetScenePassState(mCommandList.Get());
+
+		mProfiler->BeginPipelineStats(mCommandList.Get(), 0);
+		if(mGpuDrivenEnabled)
+			DrawOpaqueIndirect(mCommandList.Get(), mDrawStats);
+		else
+			DrawOpaqueSlice(mCommandList.Get(), 0, 1, mDrawStats);
+		mProfiler->EndPipelineStats(mCommandList.Get(), 0);
+
+		mProfiler->EndScope(mCommandList.Get(), opaqueScope);
+		RecordPresent(mCommandList.Get());
+
+		// Done recording commands.
+		ThrowIfFailed(mCommandList->Close());
+
+		// Add the command list to the queue for execution.
+		ID3D12CommandList* cmdsLists[] = { mCommandList.Get() };
+		mCommandQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
+	}
 
     // Swap the back and front buffers
-    ThrowIfFailed(mSwapChain->Present(0, 0));
-	mCurrBackBuffer = (mCurrBackBuffer + 1) % SwapChainBufferCount;
+	if(mPresentEnabled)
+	{
+		ProfileScope scope(mProfiler.get(), "Present");
+		INSTRUMENT_ZONE("Present");
+		ThrowIfFailed(mSwapChain->Present(0, 0));
+		mCurrBackBuffer = (mCurrBackBuffer + 1) % SwapChainBufferCount;
+	}
 
     // Advance the fence value to mark commands up to this fence point.
     mCurrFrameResource->Fence = ++mCurrentFence;
@@ -282,32 +1408,496 @@ void LitColumnsApp::Draw(const GameTimer& gt)
     // Because we are on the GPU timeline, the new fence point won't be 
     // set until the GPU finishes processing all the commands prior to this Signal().
     mCommandQueue->Signal(mFence.Get(), mCurrentFence);
+
+	// This frame's per-draw constants can be reused once the GPU passes the fence.
+	mUploadRing->EndFrame(mCurrentFence);
+
+	// Next frame's depth pyramid is built from this frame's depth.
+	mLastDepthView = mView;
+	mLastDepthValid = true;
+
+	// Time each frame after the warm-up.  The last warm-up frame only starts
+	// the recorder's clock.
+	if(mBenchmarkFrameCount > 0)
+	{
+		++mBenchmarkFrame;
+		if(mBenchmarkFrame >= BenchmarkWarmupFrames && mBenchmarkFrame <= BenchmarkWarmupFrames + mBenchmarkFrameCount)
+			mBenchmark.FrameCompleted(mDrawStats.DrawCalls);
+	}
 }
 
-void LitColumnsApp::OnMouseDown(WPARAM btnState, int x, int y)
+void LitColumnsApp::SetScenePassState(ID3D12GraphicsCommandList* cmdList)
 {
-    mLastMousePos.x = x;
-    mLastMousePos.y = y;
+	// Command lists do not inherit state, so every list drawing part of the
+	// scene has to bind this itself.
+	cmdList->RSSetViewports(1, &mScreenViewport);
+	cmdList->RSSetScissorRects(1, &mScissorRect);
 
-    SetCapture(mhMainWnd);
+	// Specify the buffers we are going to render to.
+	cmdList->OMSetRenderTargets(1, &SceneBufferView(), true, &DepthStencilView());
+
+	cmdList->SetGraphicsRootSignature(mRootSignature.Get());
+
+	auto passCB = mCurrFrameResource->PassCB->Resource();
+	cmdList->SetGraphicsRootConstantBufferView(2, passCB->GetGPUVirtualAddress());
+
+	if(mBindlessMaterials)
+		cmdList->SetGraphicsRootShaderResourceView(6, mCurrFrameResource->MaterialBuffer->Resource()->GetGPUVirtualAddress());
+
+	if(mClusteredLighting)
+	{
+		cmdList->SetGraphicsRootShaderResourceView(4, mCurrFrameResource->LocalLights->Resource()->GetGPUVirtualAddress());
+		cmdList->SetGraphicsRootShaderResourceView(5, mClusterLightBuffer->GetGPUVirtualAddress());
+	}
 }
 
-void LitColumnsApp::OnMouseUp(WPARAM btnState, int x, int y)
+void LitColumnsApp::UpdateRenderScale()
 {
-    ReleaseCapture();
+	const ProfiledFrame& frame = mProfiler->LatestFrame();
+	if(frame.FrameIndex == mDynResLastFrame)
+		return;
+	mDynResLastFrame = frame.FrameIndex;
+
+	// The scopes cover the frame's GPU work.
+	double gpuMs = 0.0;
+	for(auto& scope : frame.GpuTimes)
+		gpuMs += scope.second;
+
+	SetRenderScale(mDynResController->Update(gpuMs));
 }
 
-void LitColumnsApp::OnMouseMove(WPARAM btnState, int x, int y)
+void LitColumnsApp::Upscale(ID3D12GraphicsCommandList* cmdList)
 {
-    if((btnState & MK_LBUTTON) != 0)
-    {
-        // Make each pixel correspond to a quarter of a degree.
-        float dx = XMConvertToRadians(0.25f*static_cast<float>(x - mLastMousePos.x));
-        float dy = XMConvertToRadians(0.25f*static_cast<float>(y - mLastMousePos.y));
+	D3D12_RESOURCE_BARRIER barriers[2] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(mSceneBuffer.Get(),
+			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE),
+		CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
+			D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET)
+	};
+	cmdList->ResourceBarrier(_countof(barriers), barriers);
+
+	// The whole back buffer is written, so it needs no clear.
+	D3D12_VIEWPORT viewport = { 0.0f, 0.0f, (float)mClientWidth, (float)mClientHeight, 0.0f, 1.0f };
+	D3D12_RECT scissorRect = { 0, 0, mClientWidth, mClientHeight };
+	cmdList->RSSetViewports(1, &viewport);
+	cmdList->RSSetScissorRects(1, &scissorRect);
+	cmdList->OMSetRenderTargets(1, &CurrentBackBufferView(), true, nullptr);
+
+	ID3D12DescriptorHeap* descriptorHeaps[] = { mSrvDescriptorHeap.Get() };
+	cmdList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+	cmdList->SetGraphicsRootSignature(mUpscaleRootSignature.Get());
+	cmdList->SetPipelineState(mUpscalePSO.Get());
+
+	// Bilinear taps at most half a texel in from the drawn edge stay inside it.
+	float constants[4] =
+	{
+		(float)RenderWidth() / mClientWidth,
+		(float)RenderHeight() / mClientHeight,
+		(RenderWidth() - 0.5f) / mClientWidth,
+		(RenderHeight() - 0.5f) / mClientHeight
+	};
+	cmdList->SetGraphicsRoot32BitConstants(0, 4, constants, 0);
+	cmdList->SetGraphicsRootDescriptorTable(1, CD3DX12_GPU_DESCRIPTOR_HANDLE(
+		mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart(), SceneSrvIndex, mCbvSrvDescriptorSize));
 
+	cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	cmdList->DrawInstanced(3, 1, 0, 0);
+}
 
+void LitColumnsApp::RecordPresent(ID3D12GraphicsCommandList* cmdList)
+{
+	if(DynamicResolutionActive())
+	{
+		UINT upscaleScope = mProfiler->BeginScope(cmdList, "Upscale");
+		Upscale(cmdList);
+		mProfiler->EndScope(cmdList, upscaleScope);
+	}
 
-        // Update angles based on input to orbit camera around box.
+	if(mShowOverlay)
+	{
+		UINT overlayScope = mProfiler->BeginScope(cmdList, "Overlay");
+		DrawOverlay(cmdList);
+		mProfiler->EndScope(cmdList, overlayScope);
+	}
+
+	UINT presentScope = mProfiler->BeginScope(cmdList, "Present");
+
+	// Indicate a state transition on the resource usage.
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
+		D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
+
+	mProfiler->EndScope(cmdList, presentScope);
+}
+
+void LitColumnsApp::UpdateOverlay()
+{
+	mOverlay.Clear();
+
+	if(!Instrumentation::Enabled())
+		mOverlay.Print("INSTRUMENTATION OFF");
+
+	if(Instrumentation::HistoryCount() > 0)
+	{
+		const InstrumentedFrame& frame = Instrumentation::History(0);
+
+		double averageMs = 0.0;
+		double maxMs = 0.0;
+		Instrumentation::FrameTimes(averageMs, maxMs);
+
+		mOverlay.Print("FRAME %6.2f MS  AVG %6.2f  MAX %6.2f", frame.FrameMs, averageMs, maxMs);
+		mOverlay.Print("DRAWS %llu  TRIANGLES %llu", frame.Counter(InstrumentCounter::DrawCalls),
+			frame.Counter(InstrumentCounter::Triangles));
+		mOverlay.Print("CONSTANTS %.1f KB", frame.Counter(InstrumentCounter::ConstantBytes) / 1024.0);
+		mOverlay.Print("FENCE WAIT %6.2f MS  PRESENT %6.2f MS", frame.ZoneMs("FenceWait"), frame.ZoneMs("Present"));
+	}
+
+	// The scopes cover the frame's GPU work.
+	double gpuMs = 0.0;
+	for(auto& scope : mProfiler->LatestFrame().GpuTimes)
+		gpuMs += scope.second;
+	mOverlay.Print("GPU %6.2f MS", gpuMs);
+
+	size_t visibleCount = mGpuDrivenEnabled ? mGpuVisibleCount : mVisibleRitems.size();
+	mOverlay.Print("VISIBLE %zu  CULLED %u  OCCLUDED %u", visibleCount, mCulledCount, mOccludedCount);
+	if(mCellStreamer != nullptr)
+	{
+		mOverlay.Print("CELLS %u/%u  FREE SLOTS %zu", mCellStreamer->ResidentCellCount(),
+			mCellStreamer->CellCount(), mFreeCellSlots.size());
+	}
+	if(DynamicResolutionActive())
+		mOverlay.Print("SCALE %d%%", (int)(100.0f*GetRenderScale() + 0.5f));
+
+	if(Instrumentation::IsTracing())
+		mOverlay.Print("TRACE %zu FRAMES", Instrumentation::TracedFrameCount());
+
+	mOverlay.CopyTo(reinterpret_cast<UINT*>(mCurrFrameResource->OverlayText->MappedData()));
+}
+
+void LitColumnsApp::DrawOverlay(ID3D12GraphicsCommandList* cmdList)
+{
+	// Matches cbOverlay in TextOverlay.hlsl.
+	struct OverlayConstants
+	{
+		XMFLOAT2 Origin;
+		XMFLOAT2 TargetSize;
+		UINT Columns;
+		UINT Rows;
+		UINT Scale;
+		UINT Stride;
+	};
+
+	OverlayConstants constants;
+	constants.Origin = XMFLOAT2(8.0f, 8.0f);
+	constants.TargetSize = XMFLOAT2((float)mClientWidth, (float)mClientHeight);
+	constants.Columns = mOverlay.UsedColumns();
+	constants.Rows = mOverlay.UsedRows();
+	constants.Scale = mClientHeight >= 1440 ? 3 : 2;
+	constants.Stride = TextOverlay::Columns;
+
+	// The scene pass may have drawn to a scaled viewport or the scene buffer.
+	D3D12_VIEWPORT viewport = { 0.0f, 0.0f, (float)mClientWidth, (float)mClientHeight, 0.0f, 1.0f };
+	D3D12_RECT scissorRect = { 0, 0, mClientWidth, mClientHeight };
+	cmdList->RSSetViewports(1, &viewport);
+	cmdList->RSSetScissorRects(1, &scissorRect);
+	cmdList->OMSetRenderTargets(1, &CurrentBackBufferView(), true, nullptr);
+
+	cmdList->SetGraphicsRootSignature(mOverlayRootSignature.Get());
+	cmdList->SetPipelineState(mOverlayPSO.Get());
+	cmdList->SetGraphicsRoot32BitConstants(0, sizeof(OverlayConstants)/4, &constants, 0);
+	cmdList->SetGraphicsRootShaderResourceView(1, mCurrFrameResource->OverlayText->Resource()->GetGPUVirtualAddress());
+
+	// One quad covering the panel.
+	cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+	cmdList->DrawInstanced(4, 1, 0, 0);
+}
+
+void LitColumnsApp::CullOnGpu(ID3D12GraphicsCommandList* cmdList)
+{
+	const UINT itemCount = (UINT)mOpaqueRitems.size();
+
+	// Gribb and Hartmann: the frustum planes are sums and differences of the
+	// columns of the view-projection matrix, here in world space.
+	XMMATRIX viewProj = XMMatrixMultiply(XMLoadFloat4x4(&mView), XMLoadFloat4x4(&mProj));
+	XMMATRIX cols = XMMatrixTranspose(viewProj);
+	XMVECTOR planes[6] =
+	{
+		cols.r[3] + cols.r[0], cols.r[3] - cols.r[0],
+		cols.r[3] + cols.r[1], cols.r[3] - cols.r[1],
+		cols.r[2],             cols.r[3] - cols.r[2],
+	};
+
+	CullConstants cullConstants;
+	for(int i = 0; i < 6; ++i)
+		XMStoreFloat4(&cullConstants.FrustumPlanes[i], XMPlaneNormalize(planes[i]));
+	cullConstants.EyePosW = mEyePos;
+	cullConstants.ProjScale = mProj(1, 1);
+	cullConstants.LodScreenSizes = XMFLOAT4(LodScreenSizes[0], LodScreenSizes[1], LodScreenSizes[2], 0.0f);
+	cullConstants.ItemCount = itemCount;
+	cullConstants.FrustumCullingEnabled = mFrustumCullingEnabled ? 1 : 0;
+	cullConstants.LodEnabled = mLodEnabled ? 1 : 0;
+
+	// Too large for the root constants, so streamed as a root CBV.
+	HiZConstants hiZConstants;
+	if(mHiZFrame)
+	{
+		XMStoreFloat4x4(&hiZConstants.View, XMMatrixTranspose(XMLoadFloat4x4(&mCurrFrameResource->HiZView)));
+		hiZConstants.ProjScaleX = mProj(0, 0);
+		hiZConstants.ProjScaleY = mProj(1, 1);
+		hiZConstants.DepthA = mProj(2, 2);
+		hiZConstants.DepthB = mProj(3, 2);
+		hiZConstants.DepthWidth = mClientWidth;
+		hiZConstants.DepthHeight = mClientHeight;
+		hiZConstants.LevelCount = mHiZLevelCount;
+		hiZConstants.Enabled = 1;
+	}
+	auto hiZCB = mUploadRing->Allocate(sizeof(HiZConstants));
+	CopyMemory(hiZCB.CpuAddress, &hiZConstants, sizeof(HiZConstants));
+
+	// Reset the command count, then let the shader append to the buffers.
+	cmdList->CopyBufferRegion(mIndirectCountBuffer.Get(), 0, mIndirectCountReset->Resource(), 0, sizeof(UINT));
+
+	D3D12_RESOURCE_BARRIER toUav[] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(mIndirectCountBuffer.Get(),
+			D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+		CD3DX12_RESOURCE_BARRIER::Transition(mIndirectCommandBuffer.Get(),
+			D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+	};
+	cmdList->ResourceBarrier(_countof(toUav), toUav);
+
+	cmdList->SetComputeRootSignature(mCullRootSignature.Get());
+	cmdList->SetPipelineState(mCullPSO.Get());
+	cmdList->SetComputeRoot32BitConstants(0, sizeof(CullConstants)/4, &cullConstants, 0);
+	cmdList->SetComputeRootShaderResourceView(1, mCurrFrameResource->IndirectItems->Resource()->GetGPUVirtualAddress());
+	cmdList->SetComputeRootUnorderedAccessView(2, mIndirectCommandBuffer->GetGPUVirtualAddress());
+	cmdList->SetComputeRootUnorderedAccessView(3, mIndirectCountBuffer->GetGPUVirtualAddress());
+	cmdList->SetComputeRootConstantBufferView(4, hiZCB.GpuAddress);
+
+	ID3D12DescriptorHeap* descriptorHeaps[] = { mSrvDescriptorHeap.Get() };
+	cmdList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+	cmdList->SetComputeRootDescriptorTable(5, CD3DX12_GPU_DESCRIPTOR_HANDLE(
+		mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart(), HiZPyramidSrvIndex, mCbvSrvDescriptorSize));
+	cmdList->Dispatch((itemCount + 63) / 64, 1, 1);
+
+	const D3D12_RESOURCE_STATES countReadState =
+		D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT | D3D12_RESOURCE_STATE_COPY_SOURCE;
+	D3D12_RESOURCE_BARRIER toIndirect[] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(mIndirectCountBuffer.Get(),
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, countReadState),
+		CD3DX12_RESOURCE_BARRIER::Transition(mIndirectCommandBuffer.Get(),
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT),
+	};
+	cmdList->ResourceBarrier(_countof(toIndirect), toIndirect);
+
+	// Read back by AdvanceFrameResource once the frame has completed.
+	cmdList->CopyBufferRegion(mCurrFrameResource->IndirectCountReadback.Get(), 0,
+		mIndirectCountBuffer.Get(), 0, sizeof(UINT));
+	mCurrFrameResource->GpuDriven = true;
+}
+
+void LitColumnsApp::DrawOpaqueIndirect(ID3D12GraphicsCommandList* cmdList, DrawStats& stats, bool depthOnly)
+{
+	// Every command binds its own constants and geometry, so one call draws all
+	// the visible opaque items with the opaque PSO.
+	cmdList->SetPipelineState(OpaquePSO(depthOnly));
+	cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+	cmdList->ExecuteIndirect(mCommandSignature.Get(), (UINT)mOpaqueRitems.size(),
+		mIndirectCommandBuffer.Get(), 0, mIndirectCountBuffer.Get(), 0);
+	stats.DrawCalls++;
+
+	// The GPU picks the draws and their levels of detail, so the CPU knows
+	// neither the count nor the triangles.
+	INSTRUMENT_COUNT(DrawCalls, 1);
+
+	// The shaded pass comes last; the pre-pass leaves the count to it.
+	if(depthOnly)
+		return;
+
+	// Ready for the next frame's reset.
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mIndirectCountBuffer.Get(),
+		D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT | D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_COPY_DEST));
+}
+
+void LitColumnsApp::BinLights(ID3D12GraphicsCommandList* cmdList)
+{
+	if(mClusterLightBufferState != D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
+	{
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mClusterLightBuffer.Get(),
+			mClusterLightBufferState, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+	}
+
+	const UINT clusterCount = ClusterCountX*ClusterCountY*ClusterCountZ;
+
+	cmdList->SetComputeRootSignature(mClusterRootSignature.Get());
+	cmdList->SetPipelineState(mClusterPSO.Get());
+	cmdList->SetComputeRoot32BitConstants(0, sizeof(ClusterConstants)/4, &mClusterConstants, 0);
+	cmdList->SetComputeRootShaderResourceView(1, mCurrFrameResource->LocalLights->Resource()->GetGPUVirtualAddress());
+	cmdList->SetComputeRootUnorderedAccessView(2, mClusterLightBuffer->GetGPUVirtualAddress());
+	cmdList->Dispatch((clusterCount + 63) / 64, 1, 1);
+
+	// Left readable until the next frame's pass, which records after every
+	// draw of this frame.
+	mClusterLightBufferState = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mClusterLightBuffer.Get(),
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS, mClusterLightBufferState));
+}
+
+void LitColumnsApp::BuildHiZ(ID3D12GraphicsCommandList* cmdList)
+{
+	ID3D12DescriptorHeap* descriptorHeaps[] = { mSrvDescriptorHeap.Get() };
+	cmdList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+
+	D3D12_RESOURCE_BARRIER toBuild[] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(mDepthStencilBuffer.Get(),
+			D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
+		CD3DX12_RESOURCE_BARRIER::Transition(mHiZTexture.Get(),
+			HiZReadState, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+	};
+	cmdList->ResourceBarrier(_countof(toBuild), toBuild);
+
+	cmdList->SetComputeRootSignature(mHiZRootSignature.Get());
+	cmdList->SetPipelineState(mHiZPSO.Get());
+
+	// Each level is reduced from the one below it, level 0 from the depth buffer.
+	CD3DX12_GPU_DESCRIPTOR_HANDLE heapStart(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
+	UINT srcWidth = mClientWidth;
+	UINT srcHeight = mClientHeight;
+	for(UINT level = 0; level < mHiZLevelCount; ++level)
+	{
+		UINT sizes[4] = { srcWidth, srcHeight,
+			HiZBuffer::LevelSize(mClientWidth, level), HiZBuffer::LevelSize(mClientHeight, level) };
+		UINT srcIndex = level == 0 ? HiZDepthSrvIndex : HiZLevelSrvIndex + level - 1;
+
+		cmdList->SetComputeRoot32BitConstants(0, _countof(sizes), sizes, 0);
+		cmdList->SetComputeRootDescriptorTable(1, CD3DX12_GPU_DESCRIPTOR_HANDLE(heapStart, srcIndex, mCbvSrvDescriptorSize));
+		cmdList->SetComputeRootDescriptorTable(2, CD3DX12_GPU_DESCRIPTOR_HANDLE(heapStart, HiZLevelUavIndex + level, mCbvSrvDescriptorSize));
+		cmdList->Dispatch((sizes[2] + 7) / 8, (sizes[3] + 7) / 8, 1);
+
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mHiZTexture.Get(),
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, HiZReadState, level));
+
+		srcWidth = sizes[2];
+		srcHeight = sizes[3];
+	}
+
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mDepthStencilBuffer.Get(),
+		D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_DEPTH_WRITE));
+
+	// Read back by AdvanceFrameResource once the frame has completed.
+	for(UINT level = mHiZ.FirstLevel(); level < mHiZLevelCount; ++level)
+	{
+		CD3DX12_TEXTURE_COPY_LOCATION dst(mCurrFrameResource->HiZReadback.Get(), mHiZFootprints[level - mHiZ.FirstLevel()]);
+		CD3DX12_TEXTURE_COPY_LOCATION src(mHiZTexture.Get(), level);
+		cmdList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+	}
+
+	mCurrFrameResource->HiZView = mLastDepthView;
+	mCurrFrameResource->HiZPending = true;
+}
+
+UINT LitColumnsApp::ScenePsoIndex(bool depthOnly)const
+{
+	if(depthOnly)
+		return ScenePsoDepthOnly;
+
+	if(mDepthPrePass)
+		return mClusteredLighting ? ScenePsoClusteredEqual : ScenePsoShadedEqual;
+
+	return mClusteredLighting ? ScenePsoClustered : ScenePsoShaded;
+}
+
+ID3D12PipelineState* LitColumnsApp::OpaquePSO(bool depthOnly)const
+{
+	return mOpaquePSOs[ScenePsoIndex(depthOnly)].Get();
+}
+
+ID3D12PipelineState* LitColumnsApp::InstancedPSO(bool depthOnly)const
+{
+	return mInstancedPSOs[ScenePsoIndex(depthOnly)].Get();
+}
+
+void LitColumnsApp::DrawOpaqueSlice(ID3D12GraphicsCommandList* cmdList, UINT slice, UINT sliceCount, DrawStats& stats, bool depthOnly)
+{
+	INSTRUMENT_ZONE("RecordSlice");
+
+	// Draw the slice-th of sliceCount contiguous, nearly equal ranges of the
+	// opaque draw list.
+	if(mInstancingEnabled)
+	{
+		size_t count = mInstanceBatches.size();
+		cmdList->SetPipelineState(InstancedPSO(depthOnly));
+		DrawInstanceBatches(cmdList, mInstanceBatches, count*slice/sliceCount, count*(slice + 1)/sliceCount, stats);
+	}
+	else
+	{
+		// The light binning pass may have left its compute PSO bound.
+		size_t count = mVisibleRitems.size();
+		cmdList->SetPipelineState(OpaquePSO(depthOnly));
+		DrawRenderItems(cmdList, mVisibleRitems, count*slice/sliceCount, count*(slice + 1)/sliceCount, stats);
+	}
+}
+
+void LitColumnsApp::RecordOpaquePassParallel(UINT opaqueScope)
+{
+	const UINT workerCount = (UINT)mCurrFrameResource->WorkerCmdLists.size();
+
+	mThreadPool->ParallelFor(workerCount, [this, workerCount, opaqueScope](UINT worker)
+	{
+		auto cmdListAlloc = mCurrFrameResource->WorkerCmdListAllocs[worker].Get();
+		auto cmdList = mCurrFrameResource->WorkerCmdLists[worker].Get();
+
+		// Same rule as the main allocator: the GPU is done with this frame resource.
+		ThrowIfFailed(cmdListAlloc->Reset());
+		ThrowIfFailed(cmdList->Reset(cmdListAlloc, OpaquePSO()));
+
+		mWorkerDrawStats[worker] = DrawStats();
+
+		SetScenePassState(cmdList);
+
+		// Queries cannot span command lists, so each worker has its own slot.
+		mProfiler->BeginPipelineStats(cmdList, worker);
+		DrawOpaqueSlice(cmdList, worker, workerCount, mWorkerDrawStats[worker]);
+		mProfiler->EndPipelineStats(cmdList, worker);
+
+		// The last list in submission order hands the back buffer back to present.
+		if(worker == workerCount - 1)
+		{
+			mProfiler->EndScope(cmdList, opaqueScope);
+			RecordPresent(cmdList);
+		}
+
+		ThrowIfFailed(cmdList->Close());
+	});
+}
+
+void LitColumnsApp::OnMouseDown(WPARAM btnState, int x, int y)
+{
+    mLastMousePos.x = x;
+    mLastMousePos.y = y;
+
+    SetCapture(mhMainWnd);
+}
+
+void LitColumnsApp::OnMouseUp(WPARAM btnState, int x, int y)
+{
+    ReleaseCapture();
+}
+
+void LitColumnsApp::OnMouseMove(WPARAM btnState, int x, int y)
+{
+    if((btnState & MK_LBUTTON) != 0)
+    {
+        // Make each pixel correspond to a quarter of a degree.
+        float dx = XMConvertToRadians(0.25f*static_cast<float>(x - mLastMousePos.x));
+        float dy = XMConvertToRadians(0.25f*static_cast<float>(y - mLastMousePos.y));
+
+
+
+        // Update angles based on input to orbit camera around box.
         mTheta += dx;
         mPhi += dy;
 
@@ -332,81 +1922,615 @@ void LitColumnsApp::OnMouseMove(WPARAM btnState, int x, int y)
     mLastMousePos.y = y;
 }
  
+void LitColumnsApp::OnKeyUp(WPARAM key)
+{
+	if(key == 'I')
+		mInstancingEnabled = !mInstancingEnabled;
+	else if(key == 'P')
+		mParallelRecording = !mParallelRecording;
+	else if(key == 'C')
+		mFrustumCullingEnabled = !mFrustumCullingEnabled;
+	else if(key == 'O')
+		mSortingEnabled = !mSortingEnabled;
+	else if(key == 'L')
+		mLodEnabled = !mLodEnabled;
+	else if(key == 'G')
+		mGpuDrivenEnabled = !mGpuDrivenEnabled;
+	else if(key == 'K')
+		mClusteredLighting = !mClusteredLighting;
+	else if(key == 'Z')
+		mDepthPrePass = !mDepthPrePass;
+	else if(key == 'H')
+	{
+		// Stale levels would otherwise be used when it is turned back on.
+		mOcclusionCullingEnabled = !mOcclusionCullingEnabled;
+		mHiZ.Invalidate();
+	}
+	else if(key == 'T')
+	{
+		if(mProfiler->IsCapturing())
+			WriteProfile();
+		else
+			mProfiler->StartCapture();
+	}
+	else if(key == 'R')
+	{
+		if(Instrumentation::IsTracing())
+			WriteTrace();
+		else
+			Instrumentation::StartTrace();
+	}
+	else if(key == 'S')
+		mShowOverlay = !mShowOverlay;
+}
+
+void LitColumnsApp::WriteProfile()
+{
+	mProfiler->StopCapture();
+	mProfiler->WriteCsv(L"profile.csv");
+	mProfiler->WriteJson(L"profile.json");
+}
+
+void LitColumnsApp::WriteTrace()
+{
+	Instrumentation::StopTrace();
+	Instrumentation::WriteChromeTrace(L"trace.json");
+}
+
+std::wstring LitColumnsApp::FrameStatsText()const
+{
+	size_t visibleCount = mGpuDrivenEnabled ? mGpuVisibleCount : mVisibleRitems.size();
+	return L"   visible: " + std::to_wstring(visibleCount) +
+		L"   culled: " + std::to_wstring(mCulledCount) +
+		L"   occluded: " + std::to_wstring(mOccludedCount) +
+		(mCellStreamer != nullptr ? L"   cells: " + std::to_wstring(mCellStreamer->ResidentCellCount()) + L"/" +
+			std::to_wstring(mCellStreamer->CellCount()) : L"") +
+		L"   frames in flight: " + std::to_wstring(mNumFrameResources) +
+		(DynamicResolutionActive() ? L"   scale: " + std::to_wstring((int)(100.0f*GetRenderScale() + 0.5f)) + L"%" : L"") +
+		L"   draws: " + std::to_wstring(mDrawStats.DrawCalls) +
+		L"   state changes: " + std::to_wstring(mDrawStats.StateChanges) +
+		L"   skipped: " + std::to_wstring(mDrawStats.StateChangesSkipped);
+}
+
+void LitColumnsApp::BuildCameraPath()
+{
+	if(!mCameraPathFile.empty())
+	{
+		if(mCameraPath.Load(mCameraPathFile))
+			return;
+
+		std::wstring msg = L"Could not read camera path " + mCameraPathFile + L"; using the default path.\n";
+		OutputDebugString(msg.c_str());
+	}
+
+	// The default path makes one full orbit over ten seconds, dropping low and
+	// close to the columns on the far side and climbing back out.
+	const CameraKeyframe keys[] =
+	{
+		{  0.0f, 1.5f*XM_PI, 0.20f*XM_PI, 35.0f },
+		{  2.5f, 2.0f*XM_PI, 0.35f*XM_PI, 25.0f },
+		{  5.0f, 2.5f*XM_PI, 0.45f*XM_PI, 15.0f },
+		{  7.5f, 3.0f*XM_PI, 0.30f*XM_PI, 30.0f },
+		{ 10.0f, 3.5f*XM_PI, 0.20f*XM_PI, 35.0f },
+	};
+
+	for(auto& key : keys)
+		mCameraPath.AddKeyframe(key);
+}
+
+void LitColumnsApp::UpdateBenchmark()
+{
+	const UINT64 firstTimedFrame = BenchmarkWarmupFrames + 1;
+	const UINT64 lastTimedFrame = BenchmarkWarmupFrames + mBenchmarkFrameCount;
+
+	// The profiler numbers frames from 1 like mBenchmarkFrame, and reads each
+	// one back a few frames after it was rendered.
+	const ProfiledFrame& frame = mProfiler->LatestFrame();
+	if(frame.FrameIndex != mLastProfiledFrame)
+	{
+		mLastProfiledFrame = frame.FrameIndex;
+		if(frame.FrameIndex >= firstTimedFrame && frame.FrameIndex <= lastTimedFrame)
+			mBenchmark.AddProfiledFrame(frame, BenchmarkCpuScopes, _countof(BenchmarkCpuScopes));
+	}
+
+	// Untimed frames are rendered until the last timed frame has been read back.
+	if(mBenchmarkFrame >= lastTimedFrame && mLastProfiledFrame >= lastTimedFrame)
+		FinishBenchmark();
+}
+
+void LitColumnsApp::FinishBenchmark()
+{
+	std::string report = mBenchmark.Report();
+	OutputDebugStringA(report.c_str());
+	mBenchmark.WriteJson(L"benchmark.json");
+
+	mBenchmarkFrameCount = 0;
+	PostQuitMessage(0);
+}
+
 void LitColumnsApp::OnKeyboardInput(const GameTimer& gt)
 {
 }
  
-void LitColumnsApp::UpdateCamera(const GameTimer& gt)
+void LitColumnsApp::UpdateSimulation(const GameTimer& gt)
+{
+	SimulationInput input;
+	input.TargetTime = gt.TotalTime();
+	input.Theta = mTheta;
+	input.Phi = mPhi;
+	input.Radius = mRadius;
+
+	// Benchmark runs follow the camera path instead of the mouse.
+	input.FollowCameraPath = mBenchmarkFrameCount > 0;
+
+	if(!mPipelinedSimulation)
+	{
+		mProfiler->AddCpuTime("Simulation", RunSimulation(input, mSnapshots[mSnapshotIndex]));
+	}
+	else
+	{
+		// The first frame has no snapshot built ahead of it.  A job's time is
+		// added to the frame that draws its snapshot, this one.
+		if(mSimulationJob.valid())
+		{
+			double ms = 0.0;
+			{
+				ProfileScope scope(mProfiler.get(), "SimulationWait");
+				ms = mSimulationJob.get();
+			}
+			mProfiler->AddCpuTime("Simulation", ms);
+			mSnapshotIndex ^= 1;
+		}
+		else
+		{
+			mProfiler->AddCpuTime("Simulation", RunSimulation(input, mSnapshots[mSnapshotIndex]));
+		}
+
+		// Build the next frame's snapshot while this frame is culled and
+		// recorded.  Errors are rethrown here by the next frame's get.
+		input.TargetTime = gt.TotalTime() + gt.DeltaTime();
+		SceneSnapshot* next = &mSnapshots[mSnapshotIndex ^ 1];
+		auto done = std::make_shared<std::promise<double>>();
+		mSimulationJob = done->get_future();
+		mThreadPool->Enqueue([this, input, next, done]()
+		{
+			try
+			{
+				done->set_value(RunSimulation(input, *next));
+			}
+			catch(...)
+			{
+				done->set_exception(std::current_exception());
+			}
+		});
+	}
+
+	const SceneSnapshot& snapshot = mSnapshots[mSnapshotIndex];
+	mEyePos = snapshot.EyePos;
+	mView = snapshot.View;
+}
+
+double LitColumnsApp::RunSimulation(const SimulationInput& input, SceneSnapshot& snapshot)
 {
+	INSTRUMENT_ZONE("Simulation");
+
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+
+	// Step until the target time lies between the last two steps.
+	UINT steps = 0;
+	while(mSimNext.Time <= input.TargetTime && steps < MaxSimulationSteps)
+	{
+		mSimPrev = mSimNext;
+		StepSimulation(mSimNext, input);
+		++steps;
+	}
+
+	if(mSimNext.Time <= input.TargetTime)
+	{
+		// Too far behind: skip to the target time.
+		mSimPrev = mSimNext;
+		mSimPrev.Time = input.TargetTime;
+		mSimNext = mSimPrev;
+		StepSimulation(mSimNext, input);
+	}
+
+	float s = MathHelper::Clamp((float)((input.TargetTime - mSimPrev.Time) / SimulationStep), 0.0f, 1.0f);
+	float theta = MathHelper::Lerp(mSimPrev.Theta, mSimNext.Theta, s);
+	float phi = MathHelper::Lerp(mSimPrev.Phi, mSimNext.Phi, s);
+	float radius = MathHelper::Lerp(mSimPrev.Radius, mSimNext.Radius, s);
+
+	snapshot.TorchFlicker.resize(mSimNext.TorchFlicker.size());
+	for(size_t i = 0; i < snapshot.TorchFlicker.size(); ++i)
+		snapshot.TorchFlicker[i] = MathHelper::Lerp(mSimPrev.TorchFlicker[i], mSimNext.TorchFlicker[i], s);
+
 	// Convert Spherical to Cartesian coordinates.
-	mEyePos.x = mRadius*sinf(mPhi)*cosf(mTheta);
-	mEyePos.z = mRadius*sinf(mPhi)*sinf(mTheta);
-	mEyePos.y = mRadius*cosf(mPhi);
+	snapshot.EyePos.x = radius*sinf(phi)*cosf(theta);
+	snapshot.EyePos.z = radius*sinf(phi)*sinf(theta);
+	snapshot.EyePos.y = radius*cosf(phi);
 
 	// Build the view matrix.
-	XMVECTOR pos = XMVectorSet(mEyePos.x, mEyePos.y, mEyePos.z, 1.0f);
+	XMVECTOR pos = XMVectorSet(snapshot.EyePos.x, snapshot.EyePos.y, snapshot.EyePos.z, 1.0f);
 	XMVECTOR target = XMVectorZero();
 	XMVECTOR up = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
 
 	XMMATRIX view = XMMatrixLookAtLH(pos, target, up);
-	XMStoreFloat4x4(&mView, view);
+	XMStoreFloat4x4(&snapshot.View, view);
+
+	LARGE_INTEGER end;
+	LARGE_INTEGER frequency;
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	return (double)(end.QuadPart - start.QuadPart)*1000.0 / (double)frequency.QuadPart;
 }
 
-void LitColumnsApp::AnimateMaterials(const GameTimer& gt)
+void LitColumnsApp::StepSimulation(SimulationState& state, const SimulationInput& input)const
 {
-	
+	state.Time += SimulationStep;
+
+	if(input.FollowCameraPath)
+	{
+		CameraKeyframe key = mCameraPath.Sample((float)state.Time);
+		state.Theta = key.Theta;
+		state.Phi = key.Phi;
+		state.Radius = key.Radius;
+	}
+	else
+	{
+		state.Theta = input.Theta;
+		state.Phi = input.Phi;
+		state.Radius = input.Radius;
+	}
+
+	// Torches flicker, each out of step with the others.
+	const float t = (float)state.Time;
+	for(size_t i = 0; i < state.TorchFlicker.size(); ++i)
+		state.TorchFlicker[i] = 0.85f + 0.1f*sinf(7.0f*t + 1.7f*i) + 0.05f*sinf(23.0f*t + 0.9f*i);
+}
+
+void LitColumnsApp::UpdateTransforms(const GameTimer& gt)
+{
+	// Recompute the world matrices below every node moved since the last frame
+	// and queue the render items drawn with them for a constant buffer update.
+	mChangedTransforms.clear();
+	mTransforms.UpdateWorlds(mChangedTransforms);
+
+	for(auto index : mChangedTransforms)
+	{
+		if(mTransformOwners[index] != nullptr)
+			MarkDirty(mTransformOwners[index]);
+	}
+}
+
+void LitColumnsApp::CullRenderItems(const GameTimer& gt)
+{
+	mVisibleRitems.clear();
+
+	// Items hidden behind the depth read back from an earlier frame.
+	mOccludedCount = 0;
+	const bool occlusionCulling = mOcclusionCullingEnabled && mHiZ.IsValid();
+	auto occluded = [this, occlusionCulling](const RenderItem* ri)
+	{
+		if(!occlusionCulling || !mHiZ.IsOccluded(ri->WorldSphere))
+			return false;
+
+		++mOccludedCount;
+		return true;
+	};
+
+	if(mFrustumCullingEnabled)
+	{
+		XMMATRIX view = XMLoadFloat4x4(&mView);
+		XMVECTOR viewDet = XMMatrixDeterminant(view);
+		XMMATRIX invView = XMMatrixInverse(&viewDet, view);
+
+		// Transform the camera frustum from view space to world space.
+		BoundingFrustum worldFrustum;
+		mCamFrustum.Transform(worldFrustum, invView);
+
+		mVisibleIndices.clear();
+		mCuller.Cull(worldFrustum, mVisibleIndices);
+
+		for(auto ri : mOpaqueRitems)
+			ri->Visible = false;
+
+		for(auto i : mVisibleIndices)
+		{
+			RenderItem* ri = mOpaqueRitems[i];
+			if(!ri->Active || !ri->Geo->Resident || occluded(ri))
+				continue;
+
+			ri->Visible = true;
+			mVisibleRitems.push_back(ri);
+		}
+	}
+	else
+	{
+		for(auto ri : mOpaqueRitems)
+		{
+			ri->Visible = ri->Active && ri->Geo->Resident && !occluded(ri);
+			if(ri->Visible)
+				mVisibleRitems.push_back(ri);
+		}
+	}
+
+	mCulledCount = (UINT)(mOpaqueRitems.size() - mVisibleRitems.size());
+}
+
+void LitColumnsApp::SelectLods(const GameTimer& gt)
+{
+	// Radius over distance times the projection's y scale is the fraction of
+	// the viewport height the bounding sphere covers.
+	const float projScale = mProj(1, 1);
+	XMVECTOR eyePos = XMLoadFloat3(&mEyePos);
+
+	for(auto ri : mVisibleRitems)
+	{
+		const SceneSubmesh& sub = mSubmeshes[ri->Submesh];
+
+		UINT lod = 0;
+		if(mLodEnabled && sub.LodCount > 1)
+		{
+			float radius = ri->WorldSphere.Radius;
+			float dist = XMVectorGetX(XMVector3Length(XMLoadFloat3(&ri->WorldSphere.Center) - eyePos));
+			float size = dist > radius ? radius*projScale / dist : 1.0f;
+
+			while(lod + 1 < sub.LodCount && size < LodScreenSizes[lod])
+				++lod;
+		}
+
+		const SubmeshGeometry& args = sub.Lods[lod];
+		ri->Lod = lod;
+		ri->IndexCount = args.IndexCount;
+		ri->StartIndexLocation = args.StartIndexLocation;
+		ri->BaseVertexLocation = args.BaseVertexLocation;
+	}
+}
+
+// Sort key layout, most significant first: 8 bits PSO, 12 bits geometry,
+// 12 bits material, 32 bits view space depth.  Depth is non-negative, so its
+// float bits sort in the same order as its value, giving front to back order
+// within a state group.
+static UINT64 MakeSortKey(UINT psoIndex, UINT geoIndex, UINT matIndex, float depth)
+{
+	if(depth < 0.0f)
+		depth = 0.0f;
+
+	UINT depthBits = 0;
+	std::memcpy(&depthBits, &depth, sizeof(depthBits));
+
+	return ((UINT64)(psoIndex & 0xff) << 56) |
+		((UINT64)(geoIndex & 0xfff) << 44) |
+		((UINT64)(matIndex & 0xfff) << 32) |
+		(UINT64)depthBits;
+}
+
+void LitColumnsApp::SortVisibleRitems(const GameTimer& gt)
+{
+	// The instanced path draws mInstanceBatches, which BuildInstanceBatches
+	// already ordered by PSO, geometry and material; it never reads the
+	// visible list's order.
+	if(!mSortingEnabled || mInstancingEnabled)
+		return;
+
+	XMMATRIX view = XMLoadFloat4x4(&mView);
+
+	for(auto ri : mVisibleRitems)
+	{
+		// View space depth of the item's origin.
+		XMVECTOR posW = mTransforms.Position(ri->TransformIndex);
+		float depth = XMVectorGetZ(XMVector3TransformCoord(posW, view));
+
+		ri->SortKey = MakeSortKey(ri->PsoIndex, ri->GeoIndex, ri->Mat->MatCBIndex, depth);
+	}
+
+	std::sort(mVisibleRitems.begin(), mVisibleRitems.end(),
+		[](const RenderItem* a, const RenderItem* b) { return a->SortKey < b->SortKey; });
 }
 
 void LitColumnsApp::UpdateObjectCBs(const GameTimer& gt)
 {
 	auto currObjectCB = mCurrFrameResource->ObjectCB.get();
-	for(auto& e : mAllRitems)
+	auto currMaterialCB = mCurrFrameResource->MaterialCB.get();
+	auto currIndirectItems = mCurrFrameResource->IndirectItems.get();
+	const UINT frameBit = 1u << mCurrFrameResourceIndex;
+
+	// Only the items queued by MarkDirty since this frame resource was last
+	// used need their constants rewritten.  Their transforms are gathered and
+	// written in SIMD batches straight into the mapped buffer.
+	mWriteTransforms.clear();
+	mWriteSlots.clear();
+	for(auto ri : mCurrFrameResource->DirtyRitems)
 	{
-		// Only update the cbuffer data if the constants have changed.  
-		// This needs to be tracked per frame resource.
-		if(e->NumFramesDirty > 0)
+		// Streamed constants are written by UpdateStreamedCBs, as is the
+		// address in the item's GPU-driven record.
+		if(ri->ObjCBIndex != (UINT)-1)
+		{
+			mWriteTransforms.push_back(ri->TransformIndex);
+			mWriteSlots.push_back(ri->ObjCBIndex);
+		}
+
+		ri->DirtyFrameMask &= ~frameBit;
+
+		// The GPU-driven records of opaque items are kept current whichever
+		// path is in use, so the path can be switched at any frame.  Items of
+		// geometry still uploading, and inactive items, have nothing to draw
+		// and get an empty record; the upload's completion, or the binding of
+		// their cell slot, marks them dirty again.
+		if(ri->CullIndex != (UINT)-1 && (!ri->Active || !ri->Geo->Resident))
+		{
+			IndirectItem empty;
+			empty.LodCount = 0;
+			currIndirectItems->CopyData(ri->CullIndex, empty);
+		}
+		else if(ri->CullIndex != (UINT)-1)
 		{
-			XMMATRIX world = XMLoadFloat4x4(&e->World);
-			XMMATRIX texTransform = XMLoadFloat4x4(&e->TexTransform);
+			const SceneSubmesh& sub = mSubmeshes[ri->Submesh];
+
+			IndirectItem item;
+			item.WorldSphere = XMFLOAT4(ri->WorldSphere.Center.x, ri->WorldSphere.Center.y,
+				ri->WorldSphere.Center.z, ri->WorldSphere.Radius);
+			item.ObjectCB = ri->ObjCBIndex == (UINT)-1 ? 0 : currObjectCB->Resource()->GetGPUVirtualAddress() +
+				(UINT64)ri->ObjCBIndex*currObjectCB->ElementByteSize();
+			item.Material = mBindlessMaterials ? (UINT64)ri->Mat->MatCBIndex :
+				currMaterialCB->Resource()->GetGPUVirtualAddress() + (UINT64)ri->Mat->MatCBIndex*currMaterialCB->ElementByteSize();
+			item.VertexBufferView = ri->Geo->VertexBufferView();
+			item.IndexBufferView = ri->Geo->IndexBufferView();
+			item.LodCount = sub.LodCount;
+			for(UINT lod = 0; lod < sub.LodCount; ++lod)
+			{
+				const SubmeshGeometry& args = sub.Lods[lod];
+				item.Lods[lod] = XMUINT4(args.IndexCount, args.StartIndexLocation, (UINT)args.BaseVertexLocation, 0);
+			}
+
+			currIndirectItems->CopyData(ri->CullIndex, item);
+		}
+	}
 
-			ObjectConstants objConstants;
-			XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
-			XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(texTransform));
+	mTransforms.WriteConstants(mWriteTransforms.data(), mWriteSlots.data(), mWriteTransforms.size(),
+		currObjectCB->MappedData(), currObjectCB->ElementByteSize());
+	INSTRUMENT_COUNT(ConstantBytes, mWriteTransforms.size()*sizeof(ObjectConstants));
 
-			currObjectCB->CopyData(e->ObjCBIndex, objConstants);
+	mCurrFrameResource->DirtyRitems.clear();
+}
 
-			// Next FrameResource need to be updated too.
-			e->NumFramesDirty--;
+void LitColumnsApp::UpdateStreamedCBs(const GameTimer& gt)
+{
+	if(mCellSlots.empty())
+		return;
+
+	// The cell slots' items have no ObjectCB slots, so the constants of those
+	// that may be drawn this frame are written to the upload ring.  The
+	// GPU-driven pass culls every active item itself and the per-item pass
+	// draws the visible ones.  Instanced batches read the instance buffer.
+	mStreamedRitems.clear();
+	if(mGpuDrivenEnabled)
+	{
+		for(auto& slot : mCellSlots)
+		{
+			if(slot.Cell == (UINT)-1)
+				continue;
+
+			const size_t end = slot.FirstRitem + slot.Castles.size()*RitemsPerCastle;
+			for(size_t i = slot.FirstRitem; i < end; ++i)
+			{
+				if(mAllRitems[i]->Active)
+					mStreamedRitems.push_back(mAllRitems[i]);
+			}
+		}
+	}
+	else if(!mInstancingEnabled)
+	{
+		for(auto ri : mVisibleRitems)
+		{
+			if(ri->ObjCBIndex == (UINT)-1)
+				mStreamedRitems.push_back(ri);
 		}
 	}
+
+	if(mStreamedRitems.empty())
+		return;
+
+	// One allocation for the frame, so that recording needs no locking.
+	const UINT objCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
+	auto constants = mUploadRing->Allocate((UINT64)mStreamedRitems.size()*objCBByteSize);
+
+	mWriteTransforms.clear();
+	for(auto ri : mStreamedRitems)
+		mWriteTransforms.push_back(ri->TransformIndex);
+
+	mTransforms.WriteConstants(mWriteTransforms.data(), nullptr, mWriteTransforms.size(),
+		constants.CpuAddress, objCBByteSize);
+	INSTRUMENT_COUNT(ConstantBytes, mWriteTransforms.size()*sizeof(ObjectConstants));
+
+	// Only the address of a GPU-driven record changes from frame to frame;
+	// the rest is kept current by UpdateObjectCBs.
+	IndirectItem* records = mGpuDrivenEnabled ?
+		reinterpret_cast<IndirectItem*>(mCurrFrameResource->IndirectItems->MappedData()) : nullptr;
+	for(size_t i = 0; i < mStreamedRitems.size(); ++i)
+	{
+		RenderItem* ri = mStreamedRitems[i];
+		ri->RingCB = constants.GpuAddress + i*objCBByteSize;
+		if(records != nullptr)
+			records[ri->CullIndex].ObjectCB = ri->RingCB;
+	}
 }
 
 void LitColumnsApp::UpdateMaterialCBs(const GameTimer& gt)
 {
-	auto currMaterialCB = mCurrFrameResource->MaterialCB.get();
-	for(auto& e : mMaterials)
+	// Only the buffer the shaders read in this mode is kept current.
+	auto currMaterialCB = mBindlessMaterials ? mCurrFrameResource->MaterialBuffer.get() : mCurrFrameResource->MaterialCB.get();
+	const UINT frameBit = 1u << mCurrFrameResourceIndex;
+
+	for(auto mat : mCurrFrameResource->DirtyMaterials)
+	{
+		XMMATRIX matTransform = XMLoadFloat4x4(&mat->MatTransform);
+
+		MaterialConstants matConstants;
+		matConstants.DiffuseAlbedo = mat->DiffuseAlbedo;
+		matConstants.FresnelR0 = mat->FresnelR0;
+		matConstants.Roughness = mat->Roughness;
+		XMStoreFloat4x4(&matConstants.MatTransform, XMMatrixTranspose(matTransform));
+
+		currMaterialCB->CopyData(mat->MatCBIndex, matConstants);
+
+		mat->DirtyFrameMask &= ~frameBit;
+	}
+
+	mCurrFrameResource->DirtyMaterials.clear();
+}
+
+void LitColumnsApp::MarkDirty(RenderItem* ri)
+{
+	// Queue the item on each frame resource that does not have it queued yet.
+	for(size_t i = 0; i < mFrameResources.size(); ++i)
 	{
-		// Only update the cbuffer data if the constants have changed.  If the cbuffer
-		// data changes, it needs to be updated for each FrameResource.
-		Material* mat = e.second.get();
-		if(mat->NumFramesDirty > 0)
+		UINT frameBit = 1u << i;
+		if((ri->DirtyFrameMask & frameBit) == 0)
 		{
-			XMMATRIX matTransform = XMLoadFloat4x4(&mat->MatTransform);
+			ri->DirtyFrameMask |= frameBit;
+			mFrameResources[i]->DirtyRitems.push_back(ri);
+		}
+	}
 
-			MaterialConstants matConstants;
-			matConstants.DiffuseAlbedo = mat->DiffuseAlbedo;
-			matConstants.FresnelR0 = mat->FresnelR0;
-			matConstants.Roughness = mat->Roughness;
-			XMStoreFloat4x4(&matConstants.MatTransform, XMMatrixTranspose(matTransform));
+	// Keep the culling and level of detail bounds in step with the world matrix.
+	XMMATRIX world = mTransforms.World(ri->TransformIndex);
+	if(ri->CullIndex != (UINT)-1)
+		mCuller.SetBox(ri->CullIndex, ri->Bounds, world);
 
-			currMaterialCB->CopyData(mat->MatCBIndex, matConstants);
+	BoundingSphere localSphere;
+	BoundingSphere::CreateFromBoundingBox(localSphere, ri->Bounds);
+	localSphere.Transform(ri->WorldSphere, world);
+}
 
-			// Next FrameResource need to be updated too.
-			mat->NumFramesDirty--;
+void LitColumnsApp::MarkDirty(Material* mat)
+{
+	for(size_t i = 0; i < mFrameResources.size(); ++i)
+	{
+		UINT frameBit = 1u << i;
+		if((mat->DirtyFrameMask & frameBit) == 0)
+		{
+			mat->DirtyFrameMask |= frameBit;
+			mFrameResources[i]->DirtyMaterials.push_back(mat);
 		}
 	}
 }
 
+void LitColumnsApp::MarkDirty(const MeshGeometry* geo)
+{
+	// Only the GPU-driven records refer to the buffers.  There are few
+	// geometries, so finding the id is cheap next to the items it queues.
+	auto it = std::find(mGeometries.begin(), mGeometries.end(), geo);
+	if(it == mGeometries.end())
+		return;
+
+	for(auto ri : mGeometryRitems[it - mGeometries.begin()])
+	{
+		if(ri->CullIndex != (UINT)-1)
+			MarkDirty(ri);
+	}
+}
+
 void LitColumnsApp::UpdateMainPassCB(const GameTimer& gt)
 {
 	XMMATRIX view = XMLoadFloat4x4(&mView);
@@ -424,8 +2548,9 @@ void LitColumnsApp::UpdateMainPassCB(const GameTimer& gt)
 	XMStoreFloat4x4(&mMainPassCB.ViewProj, XMMatrixTranspose(viewProj));
 	XMStoreFloat4x4(&mMainPassCB.InvViewProj, XMMatrixTranspose(invViewProj));
 	mMainPassCB.EyePosW = mEyePos;
-	mMainPassCB.RenderTargetSize = XMFLOAT2((float)mClientWidth, (float)mClientHeight);
-	mMainPassCB.InvRenderTargetSize = XMFLOAT2(1.0f / mClientWidth, 1.0f / mClientHeight);
+	// The size the scene is drawn at, which dynamic resolution scales.
+	mMainPassCB.RenderTargetSize = XMFLOAT2((float)RenderWidth(), (float)RenderHeight());
+	mMainPassCB.InvRenderTargetSize = XMFLOAT2(1.0f / RenderWidth(), 1.0f / RenderHeight());
 	mMainPassCB.NearZ = 1.0f;
 	mMainPassCB.FarZ = 1000.0f;
 	mMainPassCB.TotalTime = gt.TotalTime();
@@ -442,23 +2567,235 @@ void LitColumnsApp::UpdateMainPassCB(const GameTimer& gt)
 	currPassCB->CopyData(0, mMainPassCB);
 }
 
+void LitColumnsApp::UpdateInstanceBuffer(const GameTimer& gt)
+{
+	if(!mInstancingEnabled || mGpuDrivenEnabled)
+		return;
+
+	// Pack the instances of each batch at each level of detail into a
+	// contiguous range of this frame's instance buffer.
+	auto currInstanceBuffer = mCurrFrameResource->InstanceBuffer.get();
+	mWriteTransforms.clear();
+	for(auto& batch : mInstanceBatches)
+	{
+		for(UINT lod = 0; lod < batch.Submesh->LodCount; ++lod)
+		{
+			batch.StartInstance[lod] = (UINT)mWriteTransforms.size();
+
+			for(auto ri : batch.Instances)
+			{
+				if(ri->Visible && ri->Lod == lod)
+					mWriteTransforms.push_back(ri->TransformIndex);
+			}
+
+			batch.InstanceCount[lod] = (UINT)mWriteTransforms.size() - batch.StartInstance[lod];
+		}
+	}
+
+	mTransforms.WriteConstants(mWriteTransforms.data(), nullptr, mWriteTransforms.size(),
+		currInstanceBuffer->MappedData(), currInstanceBuffer->ElementByteSize());
+}
+
+void LitColumnsApp::UpdateLightBuffer(const GameTimer& gt)
+{
+	if(!mClusteredLighting)
+		return;
+
+	// The torches flicker as simulated for this frame.  Lights that are off,
+	// those with no range, are skipped, and lights past the buffer's capacity
+	// are dropped, spot lights first.
+	auto currLights = mCurrFrameResource->LocalLights.get();
+	UINT pointCount = 0;
+	UINT spotCount = 0;
+
+	const std::vector<float>& torchFlicker = mSnapshots[mSnapshotIndex].TorchFlicker;
+	for(size_t i = 0; i < mPointLights.size() && pointCount < MaxLocalLights; ++i)
+	{
+		if(mPointLights[i].FalloffEnd <= 0.0f)
+			continue;
+
+		Light light = mPointLights[i];
+		float flicker = torchFlicker[i];
+		light.Strength = XMFLOAT3(light.Strength.x*flicker, light.Strength.y*flicker, light.Strength.z*flicker);
+		currLights->CopyData(pointCount++, light);
+	}
+
+	for(size_t i = 0; i < mSpotLights.size() && pointCount + spotCount < MaxLocalLights; ++i)
+	{
+		if(mSpotLights[i].FalloffEnd > 0.0f)
+			currLights->CopyData(pointCount + spotCount++, mSpotLights[i]);
+	}
+
+	XMMATRIX view = XMLoadFloat4x4(&mView);
+	XMMATRIX proj = XMLoadFloat4x4(&mProj);
+	XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
+
+	XMStoreFloat4x4(&mClusterConstants.View, XMMatrixTranspose(view));
+	XMStoreFloat4x4(&mClusterConstants.InvProj, XMMatrixTranspose(invProj));
+	mClusterConstants.NearZ = mMainPassCB.NearZ;
+	mClusterConstants.FarZ = mMainPassCB.FarZ;
+	mClusterConstants.NumPointLights = pointCount;
+	mClusterConstants.NumSpotLights = spotCount;
+}
+
 void LitColumnsApp::BuildRootSignature()
 {
 	// Root parameter can be a table, root descriptor or root constants.
-	CD3DX12_ROOT_PARAMETER slotRootParameter[3];
+	CD3DX12_ROOT_PARAMETER slotRootParameter[6];
 
 	// Create root CBV.
 	slotRootParameter[0].InitAsConstantBufferView(0);
 	slotRootParameter[1].InitAsConstantBufferView(1);
 	slotRootParameter[2].InitAsConstantBufferView(2);
 
-	// A root signature is an array of root parameters.
-	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(3, slotRootParameter, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+	// Root SRV for the instance buffer used by the instanced vertex shader.
+	slotRootParameter[3].InitAsShaderResourceView(0, 1);
+
+	// Root SRVs for the local lights and cluster buffer of the clustered
+	// lighting pixel shader.
+	slotRootParameter[4].InitAsShaderResourceView(1, 1);
+	slotRootParameter[5].InitAsShaderResourceView(2, 1);
+
+	if(mBindlessMaterials)
+	{
+		//
+		// The same layout, except that root parameter 1 is the material index
+		// and the material buffer is added as root parameter 6.  Version 1.1
+		// lets the driver assume the data behind the root descriptors does not
+		// change while a draw can read it; only the cluster lists are written by
+		// the GPU in the frame itself.
+		//
+		D3D12_ROOT_PARAMETER1 bindlessRootParameter[7] = {};
+		for(int i = 0; i < 7; ++i)
+		{
+			bindlessRootParameter[i].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+			bindlessRootParameter[i].Descriptor.Flags = D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC_WHILE_SET_AT_EXECUTE;
+		}
+
+		bindlessRootParameter[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
+		bindlessRootParameter[0].Descriptor.ShaderRegister = 0;
+
+		// The index and a pad, so an ExecuteIndirect command sets both from
+		// the 8 bytes that hold the material CBV address otherwise.
+		bindlessRootParameter[1].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+		bindlessRootParameter[1].Constants.ShaderRegister = 1;
+		bindlessRootParameter[1].Constants.Num32BitValues = 2;
+
+		bindlessRootParameter[2].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
+		bindlessRootParameter[2].Descriptor.ShaderRegister = 2;
+
+		bindlessRootParameter[3].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+		bindlessRootParameter[3].Descriptor.ShaderRegister = 0;
+		bindlessRootParameter[3].Descriptor.RegisterSpace = 1;
+
+		bindlessRootParameter[4].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+		bindlessRootParameter[4].Descriptor.ShaderRegister = 1;
+		bindlessRootParameter[4].Descriptor.RegisterSpace = 1;
+
+		bindlessRootParameter[5].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+		bindlessRootParameter[5].Descriptor.ShaderRegister = 2;
+		bindlessRootParameter[5].Descriptor.RegisterSpace = 1;
+		bindlessRootParameter[5].Descriptor.Flags = D3D12_ROOT_DESCRIPTOR_FLAG_DATA_VOLATILE;
+
+		bindlessRootParameter[6].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+		bindlessRootParameter[6].Descriptor.ShaderRegister = 3;
+		bindlessRootParameter[6].Descriptor.RegisterSpace = 1;
+
+		D3D12_ROOT_SIGNATURE_DESC1 bindlessRootSigDesc = {};
+		bindlessRootSigDesc.NumParameters = 7;
+		bindlessRootSigDesc.pParameters = bindlessRootParameter;
+		bindlessRootSigDesc.Flags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT;
+		CreateRootSignature(bindlessRootSigDesc, mRootSignature);
+	}
+	else
+	{
+		// A root signature is an array of root parameters.
+		CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(6, slotRootParameter, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+		CreateRootSignature(rootSigDesc, mRootSignature);
+	}
+
+	//
+	// Root signature of the culling compute shader: the cull constants, the
+	// frame's item records, and the command buffer and count it writes.
+	//
+	// The occlusion test adds its constants and the depth pyramid.
+	CD3DX12_DESCRIPTOR_RANGE hiZPyramidTable;
+	hiZPyramidTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 1);
+
+	CD3DX12_ROOT_PARAMETER cullRootParameter[6];
+	cullRootParameter[0].InitAsConstants(sizeof(CullConstants)/4, 0);
+	cullRootParameter[1].InitAsShaderResourceView(0);
+	cullRootParameter[2].InitAsUnorderedAccessView(0);
+	cullRootParameter[3].InitAsUnorderedAccessView(1);
+	cullRootParameter[4].InitAsConstantBufferView(1);
+	cullRootParameter[5].InitAsDescriptorTable(1, &hiZPyramidTable);
+
+	CD3DX12_ROOT_SIGNATURE_DESC cullRootSigDesc(6, cullRootParameter, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+	CreateRootSignature(cullRootSigDesc, mCullRootSignature);
+
+	//
+	// Root signature of the light binning compute shader: the cluster
+	// constants, the frame's lights, and the cluster buffer it writes.
+	//
+	CD3DX12_ROOT_PARAMETER clusterRootParameter[3];
+	clusterRootParameter[0].InitAsConstants(sizeof(ClusterConstants)/4, 0);
+	clusterRootParameter[1].InitAsShaderResourceView(0);
+	clusterRootParameter[2].InitAsUnorderedAccessView(0);
+
+	CD3DX12_ROOT_SIGNATURE_DESC clusterRootSigDesc(3, clusterRootParameter, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+	CreateRootSignature(clusterRootSigDesc, mClusterRootSignature);
+
+	//
+	// Root signature of the depth pyramid shader: the source and destination
+	// sizes, and tables with the source level SRV and destination level UAV.
+	//
+	CD3DX12_DESCRIPTOR_RANGE hiZSrcTable;
+	hiZSrcTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+	CD3DX12_DESCRIPTOR_RANGE hiZDstTable;
+	hiZDstTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
+
+	CD3DX12_ROOT_PARAMETER hiZRootParameter[3];
+	hiZRootParameter[0].InitAsConstants(4, 0);
+	hiZRootParameter[1].InitAsDescriptorTable(1, &hiZSrcTable);
+	hiZRootParameter[2].InitAsDescriptorTable(1, &hiZDstTable);
+
+	CD3DX12_ROOT_SIGNATURE_DESC hiZRootSigDesc(3, hiZRootParameter, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+	CreateRootSignature(hiZRootSigDesc, mHiZRootSignature);
+
+	//
+	// Root signature of the upscale pass: the texture coordinate constants
+	// and a table with the scene buffer SRV, sampled bilinearly.
+	//
+	CD3DX12_DESCRIPTOR_RANGE sceneTable;
+	sceneTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+
+	CD3DX12_ROOT_PARAMETER upscaleRootParameter[2];
+	upscaleRootParameter[0].InitAsConstants(4, 0, 0, D3D12_SHADER_VISIBILITY_PIXEL);
+	upscaleRootParameter[1].InitAsDescriptorTable(1, &sceneTable, D3D12_SHADER_VISIBILITY_PIXEL);
+
+	CD3DX12_STATIC_SAMPLER_DESC linearClamp(0, D3D12_FILTER_MIN_MAG_MIP_LINEAR,
+		D3D12_TEXTURE_ADDRESS_MODE_CLAMP, D3D12_TEXTURE_ADDRESS_MODE_CLAMP, D3D12_TEXTURE_ADDRESS_MODE_CLAMP);
+
+	CD3DX12_ROOT_SIGNATURE_DESC upscaleRootSigDesc(2, upscaleRootParameter, 1, &linearClamp, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+	CreateRootSignature(upscaleRootSigDesc, mUpscaleRootSignature);
+
+	//
+	// Root signature of the stats overlay: the panel constants, read by both
+	// stages, and the packed text as a root SRV.
+	//
+	CD3DX12_ROOT_PARAMETER overlayRootParameter[2];
+	overlayRootParameter[0].InitAsConstants(8, 0);
+	overlayRootParameter[1].InitAsShaderResourceView(0, 0, D3D12_SHADER_VISIBILITY_PIXEL);
+
+	CD3DX12_ROOT_SIGNATURE_DESC overlayRootSigDesc(2, overlayRootParameter, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+	CreateRootSignature(overlayRootSigDesc, mOverlayRootSignature);
+}
 
-	// create a root signature with a single slot which points to a descriptor range consisting of a single constant buffer
+void LitColumnsApp::CreateRootSignature(const CD3DX12_ROOT_SIGNATURE_DESC& desc, ComPtr<ID3D12RootSignature>& rootSig)
+{
 	ComPtr<ID3DBlob> serializedRootSig = nullptr;
 	ComPtr<ID3DBlob> errorBlob = nullptr;
-	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+	HRESULT hr = D3D12SerializeRootSignature(&desc, D3D_ROOT_SIGNATURE_VERSION_1,
 		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
 
 	if(errorBlob != nullptr)
@@ -471,314 +2808,730 @@ void LitColumnsApp::BuildRootSignature()
 		0,
 		serializedRootSig->GetBufferPointer(),
 		serializedRootSig->GetBufferSize(),
-		IID_PPV_ARGS(mRootSignature.GetAddressOf())));
+		IID_PPV_ARGS(rootSig.GetAddressOf())));
 }
 
-void LitColumnsApp::BuildShadersAndInputLayout()
+void LitColumnsApp::CreateRootSignature(const D3D12_ROOT_SIGNATURE_DESC1& desc, ComPtr<ID3D12RootSignature>& rootSig)
 {
-	const D3D_SHADER_MACRO alphaTestDefines[] =
+	D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
+	featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
+	if(FAILED(md3dDevice->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &featureData, sizeof(featureData))))
+		featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+
+	if(featureData.HighestVersion == D3D_ROOT_SIGNATURE_VERSION_1_0)
+	{
+		// Runtimes without version 1.1 get the same parameters without the
+		// flags.  Only root constants and descriptors are converted.
+		std::vector<CD3DX12_ROOT_PARAMETER> parameters(desc.NumParameters);
+		for(UINT i = 0; i < desc.NumParameters; ++i)
+		{
+			const D3D12_ROOT_PARAMETER1& p = desc.pParameters[i];
+			assert(p.ParameterType != D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE);
+
+			parameters[i].ParameterType = p.ParameterType;
+			parameters[i].ShaderVisibility = p.ShaderVisibility;
+			if(p.ParameterType == D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS)
+				parameters[i].Constants = p.Constants;
+			else
+			{
+				parameters[i].Descriptor.ShaderRegister = p.Descriptor.ShaderRegister;
+				parameters[i].Descriptor.RegisterSpace = p.Descriptor.RegisterSpace;
+			}
+		}
+
+		CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(desc.NumParameters, parameters.data(),
+			desc.NumStaticSamplers, desc.pStaticSamplers, desc.Flags);
+		CreateRootSignature(rootSigDesc, rootSig);
+		return;
+	}
+
+	D3D12_VERSIONED_ROOT_SIGNATURE_DESC versionedDesc = {};
+	versionedDesc.Version = D3D_ROOT_SIGNATURE_VERSION_1_1;
+	versionedDesc.Desc_1_1 = desc;
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeVersionedRootSignature(&versionedDesc,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if(errorBlob != nullptr)
 	{
-		"ALPHA_TEST", "1",
-		NULL, NULL
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(rootSig.GetAddressOf())));
+}
+
+std::vector<ShaderPermutation> LitColumnsApp::ShaderPermutations(bool packedVertices, bool bindlessMaterials)
+{
+	const std::vector<D3D_SHADER_MACRO> noDefines;
+
+	const std::vector<D3D_SHADER_MACRO> instancingDefines =
+	{
+		{ "INSTANCING", "1" },
+		{ NULL, NULL }
 	};
 
-	mShaders["standardVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "VS", "vs_5_1");
-	mShaders["opaquePS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "PS", "ps_5_1");
-	
-    mInputLayout =
-    {
-        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-        { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-    };
+	// The vertex shaders decode PackedVertex when PACKED_VERTEX is defined.
+	const std::vector<D3D_SHADER_MACRO> packedDefines =
+	{
+		{ "PACKED_VERTEX", "1" },
+		{ NULL, NULL }
+	};
+
+	const std::vector<D3D_SHADER_MACRO> packedInstancingDefines =
+	{
+		{ "PACKED_VERTEX", "1" },
+		{ "INSTANCING", "1" },
+		{ NULL, NULL }
+	};
+
+	// The pixel shader adds the lights of its cluster to the directional lights.
+	const std::vector<D3D_SHADER_MACRO> clusteredDefines =
+	{
+		{ "CLUSTERED_LIGHTING", "1" },
+		{ NULL, NULL }
+	};
+
+	// The pixel shaders read the material from gMaterialData with -bindless.
+	const std::vector<D3D_SHADER_MACRO> bindlessDefines =
+	{
+		{ "BINDLESS_MATERIALS", "1" },
+		{ NULL, NULL }
+	};
+
+	const std::vector<D3D_SHADER_MACRO> bindlessClusteredDefines =
+	{
+		{ "BINDLESS_MATERIALS", "1" },
+		{ "CLUSTERED_LIGHTING", "1" },
+		{ NULL, NULL }
+	};
+
+	return
+	{
+		{ "standardVS", L"Shaders\\Default.hlsl", packedVertices ? packedDefines : noDefines, "VS", "vs_5_1" },
+		{ "instancedVS", L"Shaders\\Default.hlsl", packedVertices ? packedInstancingDefines : instancingDefines, "VS", "vs_5_1" },
+		{ "opaquePS", L"Shaders\\Default.hlsl", bindlessMaterials ? bindlessDefines : noDefines, "PS", "ps_5_1" },
+		{ "clusteredPS", L"Shaders\\Default.hlsl", bindlessMaterials ? bindlessClusteredDefines : clusteredDefines, "PS", "ps_5_1" },
+		{ "cullCS", L"Shaders\\Cull.hlsl", noDefines, "CS", "cs_5_1" },
+		{ "clusterLightsCS", L"Shaders\\ClusterLights.hlsl", noDefines, "CS", "cs_5_1" },
+		{ "hiZCS", L"Shaders\\HiZ.hlsl", noDefines, "CS", "cs_5_1" },
+		{ "upscaleVS", L"Shaders\\Upscale.hlsl", noDefines, "VS", "vs_5_1" },
+		{ "upscalePS", L"Shaders\\Upscale.hlsl", noDefines, "PS", "ps_5_1" },
+		{ "overlayVS", L"Shaders\\TextOverlay.hlsl", noDefines, "VS", "vs_5_1" },
+		{ "overlayPS", L"Shaders\\TextOverlay.hlsl", noDefines, "PS", "ps_5_1" },
+	};
 }
 
+void LitColumnsApp::BuildShadersAndInputLayout()
+{
+	// Only permutations missing from the cache are compiled.
+	ShaderCache cache(ShaderCacheDirectory);
+	for(auto& p : ShaderPermutations(mPackedVertices, mBindlessMaterials))
+		mShaders[p.Name] = cache.Load(p.Filename, p.Defines.empty() ? nullptr : p.Defines.data(), p.EntryPoint, p.Target);
+
+	if(mPackedVertices)
+	{
+		mInputLayout =
+		{
+			{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 8, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		};
+	}
+	else
+	{
+		mInputLayout =
+		{
+			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		};
+	}
+}
+
+static_assert(sizeof(PackedVertex) == 12, "PackedVertex must match the packed input layout.");
+
+// FNV-1a, continuing from hash.
+static UINT64 HashBytes(const void* data, size_t byteSize, UINT64 hash = 14695981039346656037ull)
+{
+	const BYTE* bytes = static_cast<const BYTE*>(data);
+	for(size_t i = 0; i < byteSize; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Packs a position and unit normal into the -packedvertices layout.  Half
+// precision keeps about three significant digits, plenty for the demo's meshes.
+static PackedVertex PackVertex(const XMFLOAT3& pos, const XMFLOAT3& normal)
+{
+	XMFLOAT2 oct = MathHelper::EncodeOctahedral(normal);
+
+	PackedVertex v;
+	v.Pos = PackedVector::XMHALF4(pos.x, pos.y, pos.z, 1.0f);
+	v.Normal = PackedVector::XMSHORTN2(oct.x, oct.y);
+	return v;
+}
+
+// The shapes the castles are built from and the arguments of the generator
+// call for each, in the order of the call's parameters.  Hexagon and Octagon
+// build level of detail chains starting from Counts[0] subdivisions.
+enum class ShapeKind
+{
+	Box,
+	Grid,
+	Sphere,
+	Cylinder,
+	Diamond,
+	Wedge,
+	Octahedron,
+	TriangularPrism,
+	Hexagon,
+	Octagon,
+	Cone,
+	Pyramid,
+	Container,
+	Candy
+};
+
+struct ShapeArgs
+{
+	const char* Name;
+	ShapeKind Kind;
+	float Sizes[5];
+	UINT Counts[2];
+};
+
+static const ShapeArgs CastleShapes[] =
+{
+	{ "box", ShapeKind::Box, { 1.5f, 0.5f, 1.5f }, { 3 } },
+	{ "grid", ShapeKind::Grid, { 20.0f, 30.0f }, { 60, 40 } },
+	{ "sphere", ShapeKind::Sphere, { 0.5f }, { 20, 20 } },
+	{ "cylinder", ShapeKind::Cylinder, { 0.5f, 0.5f, 3.0f }, { 20, 20 } },
+	{ "diamond", ShapeKind::Diamond, { 1.0f, 1.0f } },
+	{ "wedge", ShapeKind::Wedge, { 1.5f, 1.5f, 1.5f }, { 3 } },
+	{ "octahedron", ShapeKind::Octahedron, { 0.5f } },
+	{ "triangularPrism", ShapeKind::TriangularPrism, { 1.0f, 1.0f, 1.0f }, { 3 } },
+	{ "hexagon", ShapeKind::Hexagon, { 1.5f, 1.5f }, { 3 } },
+	{ "octagon", ShapeKind::Octagon, { 1.5f, 1.5f }, { 3 } },
+	{ "cone", ShapeKind::Cone, { 1.0f, 1.0f }, { 20, 20 } },
+	{ "pyramid", ShapeKind::Pyramid, { 1.0f, 1.0f, 0.0f, 0.0f, 1.0f }, { 3 } },
+	{ "container", ShapeKind::Container, { 1.0f, 1.0f }, { 3 } },
+	{ "star", ShapeKind::Candy, { 1.0f, 1.0f }, { 3 } },
+};
+
 void LitColumnsApp::BuildShapeGeometry()
 {
-    GeometryGenerator geoGen;
-	GeometryGenerator::MeshData box = geoGen.CreateBox(1.5f, 0.5f, 1.5f, 3);
-	GeometryGenerator::MeshData grid = geoGen.CreateGrid(20.0f, 30.0f, 60, 40);
-	GeometryGenerator::MeshData sphere = geoGen.CreateSphere(0.5f, 20, 20);
-	GeometryGenerator::MeshData cylinder = geoGen.CreateCylinder(0.5f, 0.5f, 3.0f, 20, 20);
-	GeometryGenerator::MeshData diamond = geoGen.CreateDiamond(1.f, 1.f);
-	GeometryGenerator::MeshData wedge = geoGen.CreateWedge(1.5f, 1.5f, 1.5f, 3);
-	GeometryGenerator::MeshData octahedron = geoGen.CreateOctahedron(0.5f);
-	GeometryGenerator::MeshData triangularPrism = geoGen.CreateTriangularPrism(1.f, 1.f, 1.f, 3);
-	GeometryGenerator::MeshData hexagon = geoGen.CreateHexagon(1.5f, 1.5f, 3);
-	GeometryGenerator::MeshData octagon = geoGen.CreateOctagon(1.5f, 1.5f, 3);
-	GeometryGenerator::MeshData cone = geoGen.CreateCone(1.0f, 1.0f, 20, 20);
-	GeometryGenerator::MeshData pyramid = geoGen.CreatePyramid(1.f, 1.f, 0.f, 0.f, 1.f, 3);
-	GeometryGenerator::MeshData container = geoGen.CreateHexagonContainer(1.f, 1.f, 3);
-	GeometryGenerator::MeshData star = geoGen.CreateCandy(1.f, 1.f, 3);
-	
+	MeshBatchBuilder batch;
+	BuildShapeBatch(batch);
+
+	AddGeometry(BuildBatchGeometry("shapeGeo", batch));
+}
+
+void LitColumnsApp::BuildShapeBatch(MeshBatchBuilder& batch)
+{
+    GeometryGenerator geoGen(mParallelGeometryBuild ? mThreadPool.get() : nullptr);
 
 	//
-	// We are concatenating all the geometry into one big vertex/index buffer.  So
-	// define the regions in the buffer each submesh covers.
+	// We are concatenating all the geometry into one big vertex/index buffer.
+	// The builder records the region of the buffers each submesh covers.
+	// The finely tessellated shapes get level of detail chains.
 	//
 
-	// Cache the vertex offsets to each object in the concatenated vertex buffer.
-	UINT boxVertexOffset = 0;
-	UINT gridVertexOffset = (UINT)box.Vertices.size();
-	UINT sphereVertexOffset = gridVertexOffset + (UINT)grid.Vertices.size();
-	UINT cylinderVertexOffset = sphereVertexOffset + (UINT)sphere.Vertices.size();
-	UINT diamondVertexOffset = cylinderVertexOffset + (UINT)cylinder.Vertices.size();
-	UINT wedgeVertexOffset = diamondVertexOffset + (UINT)diamond.Vertices.size();
-	UINT octahedronVertexOffset = wedgeVertexOffset + (UINT)wedge.Vertices.size();
-	UINT triPrismVertexOffset = octahedronVertexOffset + (UINT)octahedron.Vertices.size();
-	UINT hexagonVertexOffset = triPrismVertexOffset + (UINT)triangularPrism.Vertices.size();
-	UINT octagonVertexOffset = hexagonVertexOffset + (UINT)hexagon.Vertices.size();
-	UINT coneVertexOffset = octagonVertexOffset + (UINT)octagon.Vertices.size();
-	UINT pyramidVertexOffset = coneVertexOffset + (UINT)cone.Vertices.size();
-	UINT containerVertexOffset = pyramidVertexOffset + (UINT)pyramid.Vertices.size();
-	UINT starVertexOffset = containerVertexOffset + (UINT)container.Vertices.size();
-
-	// Cache the starting index for each object in the concatenated index buffer.
-	UINT boxIndexOffset = 0;
-	UINT gridIndexOffset = (UINT)box.Indices32.size();
-	UINT sphereIndexOffset = gridIndexOffset + (UINT)grid.Indices32.size();
-	UINT cylinderIndexOffset = sphereIndexOffset + (UINT)sphere.Indices32.size();
-	UINT diamondIndexOffset = cylinderIndexOffset + (UINT)cylinder.Indices32.size();
-	UINT wedgeIndexOffset = diamondIndexOffset + (UINT)diamond.Indices32.size();
-	UINT octahedronIndexOffset = wedgeIndexOffset + (UINT)wedge.Indices32.size();
-	UINT triPrismIndexOffset = octahedronIndexOffset + (UINT)octahedron.Indices32.size();
-	UINT hexagonIndexOffset = triPrismIndexOffset + (UINT)triangularPrism.Indices32.size();
-	UINT octagonIndexOffset = hexagonIndexOffset + (UINT)hexagon.Indices32.size();
-	UINT coneIndexOffset = octagonIndexOffset + (UINT)octagon.Indices32.size();
-	UINT pyramidIndexOffset = coneIndexOffset + (UINT)cone.Indices32.size();
-	UINT containerIndexOffset = pyramidIndexOffset + (UINT)pyramid.Indices32.size();
-	UINT starIndexOffset = containerIndexOffset + (UINT)container.Indices32.size();
-
-
-
-	SubmeshGeometry boxSubmesh;
-	boxSubmesh.IndexCount = (UINT)box.Indices32.size();
-	boxSubmesh.StartIndexLocation = boxIndexOffset;
-	boxSubmesh.BaseVertexLocation = boxVertexOffset;
-
-	SubmeshGeometry gridSubmesh;
-	gridSubmesh.IndexCount = (UINT)grid.Indices32.size();
-	gridSubmesh.StartIndexLocation = gridIndexOffset;
-	gridSubmesh.BaseVertexLocation = gridVertexOffset;
-
-	SubmeshGeometry sphereSubmesh;
-	sphereSubmesh.IndexCount = (UINT)sphere.Indices32.size();
-	sphereSubmesh.StartIndexLocation = sphereIndexOffset;
-	sphereSubmesh.BaseVertexLocation = sphereVertexOffset;
-
-	SubmeshGeometry cylinderSubmesh;
-	cylinderSubmesh.IndexCount = (UINT)cylinder.Indices32.size();
-	cylinderSubmesh.StartIndexLocation = cylinderIndexOffset;
-	cylinderSubmesh.BaseVertexLocation = cylinderVertexOffset;
-
-	SubmeshGeometry diamondSubmesh;
-	diamondSubmesh.IndexCount = (UINT)diamond.Indices32.size();
-	diamondSubmesh.StartIndexLocation = diamondIndexOffset;
-	diamondSubmesh.BaseVertexLocation = diamondVertexOffset;
-
-	SubmeshGeometry wedgeSubmesh;
-	wedgeSubmesh.IndexCount = (UINT)wedge.Indices32.size();
-	wedgeSubmesh.StartIndexLocation = wedgeIndexOffset;
-	wedgeSubmesh.BaseVertexLocation = wedgeVertexOffset;
-
-	SubmeshGeometry octahedronSubmesh;
-	octahedronSubmesh.IndexCount = (UINT)octahedron.Indices32.size();
-	octahedronSubmesh.StartIndexLocation = octahedronIndexOffset;
-	octahedronSubmesh.BaseVertexLocation = octahedronVertexOffset;
-
-	SubmeshGeometry triPrismSubmesh;
-	triPrismSubmesh.IndexCount = (UINT)triangularPrism.Indices32.size();
-	triPrismSubmesh.StartIndexLocation = triPrismIndexOffset;
-	triPrismSubmesh.BaseVertexLocation = triPrismVertexOffset;
-
-	SubmeshGeometry hexagonSubmesh;
-	hexagonSubmesh.IndexCount = (UINT)hexagon.Indices32.size();
-	hexagonSubmesh.StartIndexLocation = hexagonIndexOffset;
-	hexagonSubmesh.BaseVertexLocation = hexagonVertexOffset;
-
-	SubmeshGeometry octagonSubmesh;
-	octagonSubmesh.IndexCount = (UINT)octagon.Indices32.size();
-	octagonSubmesh.StartIndexLocation = octagonIndexOffset;
-	octagonSubmesh.BaseVertexLocation = octagonVertexOffset;
-
-	SubmeshGeometry coneSubmesh;
-	coneSubmesh.IndexCount = (UINT)cone.Indices32.size();
-	coneSubmesh.StartIndexLocation = coneIndexOffset;
-	coneSubmesh.BaseVertexLocation = coneVertexOffset;
-
-	SubmeshGeometry pyramidSubmesh;
-	pyramidSubmesh.IndexCount = (UINT)pyramid.Indices32.size();
-	pyramidSubmesh.StartIndexLocation = pyramidIndexOffset;
-	pyramidSubmesh.BaseVertexLocation = pyramidVertexOffset;
-
-	SubmeshGeometry containerSubmesh;
-	containerSubmesh.IndexCount = (UINT)container.Indices32.size();
-	containerSubmesh.StartIndexLocation = containerIndexOffset;
-	containerSubmesh.BaseVertexLocation = containerVertexOffset;
-
-	SubmeshGeometry starSubmesh;
-	starSubmesh.IndexCount = (UINT)star.Indices32.size();
-	starSubmesh.StartIndexLocation = starIndexOffset;
-	starSubmesh.BaseVertexLocation = starVertexOffset;
+	// Each shape of CastleShapes, or level of detail chain, is generated and
+	// optimized as an independent job on the thread pool.  The results are
+	// appended in the table's order so the buffer layout does not depend on
+	// job timing.
+	using MeshList = std::vector<GeometryGenerator::MeshData>;
+	auto create = [&geoGen](const ShapeArgs& s)
+	{
+		const float* f = s.Sizes;
+		const UINT* n = s.Counts;
+
+		MeshList lods;
+		switch(s.Kind)
+		{
+		case ShapeKind::Box: lods.push_back(geoGen.CreateBox(f[0], f[1], f[2], n[0])); break;
+		case ShapeKind::Grid: lods.push_back(geoGen.CreateGrid(f[0], f[1], n[0], n[1])); break;
+		case ShapeKind::Sphere: lods = geoGen.CreateSphereLods(f[0], n[0], n[1], MaxLodLevels); break;
+		case ShapeKind::Cylinder: lods = geoGen.CreateCylinderLods(f[0], f[1], f[2], n[0], n[1], MaxLodLevels); break;
+		case ShapeKind::Diamond: lods.push_back(geoGen.CreateDiamond(f[0], f[1])); break;
+		case ShapeKind::Wedge: lods.push_back(geoGen.CreateWedge(f[0], f[1], f[2], n[0])); break;
+		case ShapeKind::Octahedron: lods.push_back(geoGen.CreateOctahedron(f[0])); break;
+		case ShapeKind::TriangularPrism: lods.push_back(geoGen.CreateTriangularPrism(f[0], f[1], f[2], n[0])); break;
+		case ShapeKind::Cone: lods = geoGen.CreateConeLods(f[0], f[1], n[0], n[1], MaxLodLevels); break;
+		case ShapeKind::Pyramid: lods.push_back(geoGen.CreatePyramid(f[0], f[1], f[2], f[3], f[4], n[0])); break;
+		case ShapeKind::Container: lods.push_back(geoGen.CreateHexagonContainer(f[0], f[1], n[0])); break;
+		case ShapeKind::Candy: lods.push_back(geoGen.CreateCandy(f[0], f[1], n[0])); break;
+
+		case ShapeKind::Hexagon:
+		case ShapeKind::Octagon:
+			for(UINT subdivisions = n[0]; lods.size() < MaxLodLevels - 1; --subdivisions)
+			{
+				lods.push_back(s.Kind == ShapeKind::Octagon ? geoGen.CreateOctagon(f[0], f[1], subdivisions) :
+					geoGen.CreateHexagon(f[0], f[1], subdivisions));
+			}
+			break;
+		}
+		return lods;
+	};
+
+	const unsigned int shapeCount = _countof(CastleShapes);
+	std::vector<MeshList> shapes(shapeCount);
+	auto runJob = [this, &create, &shapes](unsigned int i)
+	{
+		shapes[i] = create(CastleShapes[i]);
+
+		if(mOptimizeMeshes)
+		{
+			for(auto& mesh : shapes[i])
+				MeshOptimizer::Optimize(mesh);
+		}
+	};
+
+	if(mParallelGeometryBuild)
+	{
+		mThreadPool->ParallelFor(shapeCount, runJob);
+	}
+	else
+	{
+		for(unsigned int i = 0; i < shapeCount; ++i)
+			runJob(i);
+	}
+
+	for(unsigned int i = 0; i < shapeCount; ++i)
+		batch.AddLods(CastleShapes[i].Name, std::move(shapes[i]));
+}
+
+MeshGeometry* LitColumnsApp::BuildBatchGeometry(const std::string& name, const MeshBatchBuilder& batch)
+{
+	MeshGeometry* geo = mGeometryPool.Allocate();
+	geo->Name = name;
+
+	// Extract the vertex elements we are interested in straight into the
+	// vertex buffer blob, one submesh per job.
+	ThreadPool* pool = mParallelGeometryBuild ? mThreadPool.get() : nullptr;
+	if(mPackedVertices)
+	{
+		batch.Build<PackedVertex>(geo, [](const GeometryGenerator::Vertex& v)
+		{
+			return PackVertex(v.Position, v.Normal);
+		}, pool);
+	}
+	else
+	{
+		batch.Build<Vertex>(geo, [](const GeometryGenerator::Vertex& v)
+		{
+			Vertex out;
+			out.Pos = v.Position;
+			out.Normal = v.Normal;
+			return out;
+		}, pool);
+	}
+
+	UploadGeometry(geo, geo->VertexBufferCPU->GetBufferPointer(), geo->IndexBufferCPU->GetBufferPointer());
+	return geo;
+}
+
+void LitColumnsApp::UploadGeometry(MeshGeometry* geo, const void* vertices, const void* indices)
+{
+	// Upload on the copy queue; the geometry is drawn once the copies complete.
+	geo->VertexBufferGPU = mUploadQueue->CreateDefaultBuffer(vertices, geo->VertexBufferByteSize);
+	geo->IndexBufferGPU = mUploadQueue->CreateDefaultBuffer(indices, geo->IndexBufferByteSize);
+	geo->Resident = false;
+
+	// Items made dirty while the upload was in flight skipped their
+	// GPU-driven records, so they are queued again for the new buffers.
+	mUploadQueue->Submit([this, geo]()
+	{
+		geo->Resident = true;
+		MarkDirty(geo);
+	});
+}
+
+void LitColumnsApp::BuildSkullGeometry()
+{
+	// The first run parses the text file and writes Models/skull.txt.mesh; later
+	// runs map that cache instead of parsing the text.
+	MeshFile file;
+	if(!file.Load(L"Models/skull.txt"))
+	{
+		MessageBox(0, L"Models/skull.txt not found.", 0, 0);
+		return;
+	}
+
+	GeometryGenerator::MeshData skull;
+	skull.Vertices.resize(file.VertexCount());
+	for(UINT i = 0; i < file.VertexCount(); ++i)
+	{
+		skull.Vertices[i].Position = file.Vertices()[i].Pos;
+		skull.Vertices[i].Normal = file.Vertices()[i].Normal;
+	}
+
+	skull.Indices32.resize(file.IndexCount());
+	if(file.IndexFormat() == DXGI_FORMAT_R16_UINT)
+	{
+		const std::uint16_t* indices = reinterpret_cast<const std::uint16_t*>(file.Indices());
+		for(UINT i = 0; i < file.IndexCount(); ++i)
+			skull.Indices32[i] = indices[i];
+	}
+	else
+	{
+		CopyMemory(skull.Indices32.data(), file.Indices(), file.IndexCount()*sizeof(std::uint32_t));
+	}
+
+	// A loaded model has no tessellation to lower, so its coarser levels are
+	// made by vertex clustering on successively coarser grids.  The levels only
+	// read the full mesh, so they are simplified in parallel.
+	std::vector<GeometryGenerator::MeshData> lods(MaxLodLevels);
+	auto simplify = [&lods, &skull](unsigned int i)
+	{
+		lods[i + 1] = MeshOptimizer::Simplify(skull, 64u >> i);
+	};
+
+	if(mParallelGeometryBuild)
+	{
+		mThreadPool->ParallelFor(MaxLodLevels - 1, simplify);
+	}
+	else
+	{
+		for(unsigned int i = 0; i < MaxLodLevels - 1; ++i)
+			simplify(i);
+	}
+	lods[0] = std::move(skull);
+
+	MeshBatchBuilder batch;
+	batch.AddLods("skull", std::move(lods));
+
+	AddGeometry(BuildBatchGeometry("skullGeo", batch));
+}
+
+std::wstring LitColumnsApp::CellMeshFile()const
+{
+	// Reordering changes the file; the vertex layout is converted on load.
+	return std::wstring(CellMeshDirectory) + (mOptimizeMeshes ? L"\\castle_optimized.mesh" : L"\\castle.mesh");
+}
+
+bool LitColumnsApp::LoadCellMeshFile(const std::wstring& filename, MeshFile& file)
+{
+	// The stamp is a hash of everything the shapes are generated from, so a
+	// current file is loaded without generating anything.
+	const UINT settings[] = { CellMeshBakeVersion, MaxLodLevels, MeshOptimizer::CacheSize, mOptimizeMeshes ? 1u : 0u };
+	UINT64 stamp = HashBytes(settings, sizeof(settings));
+	for(auto& s : CastleShapes)
+	{
+		stamp = HashBytes(s.Name, std::strlen(s.Name) + 1, stamp);
+		stamp = HashBytes(&s.Kind, sizeof(s.Kind), stamp);
+		stamp = HashBytes(s.Sizes, sizeof(s.Sizes), stamp);
+		stamp = HashBytes(s.Counts, sizeof(s.Counts), stamp);
+	}
 
-	//
-	// Extract the vertex elements we are interested in and pack the
-	// vertices of all the meshes into one vertex buffer.
-	//
+	// A stamp of 0 would not be checked.
+	stamp = stamp != 0 ? stamp : 1;
 
-	auto totalVertexCount =
-		box.Vertices.size() +
-		grid.Vertices.size() +
-		sphere.Vertices.size() +
-		cylinder.Vertices.size() +
-		diamond.Vertices.size() +
-		wedge.Vertices.size() +
-		octahedron.Vertices.size() +
-		triangularPrism.Vertices.size() +
-		hexagon.Vertices.size() +
-		octagon.Vertices.size() +
-		cone.Vertices.size() +
-		pyramid.Vertices.size() +
-		container.Vertices.size() +
-		star.Vertices.size();
+	if(file.LoadBinary(filename, stamp))
+		return true;
 
-	std::vector<Vertex> vertices(totalVertexCount);
+	// Missing, or baked from other inputs.
+	MeshBatchBuilder batch;
+	BuildShapeBatch(batch);
 
-	UINT k = 0;
-	for(size_t i = 0; i < box.Vertices.size(); ++i, ++k)
+	MeshGeometry geo;
+	batch.Build<MeshFileVertex>(&geo, [](const GeometryGenerator::Vertex& v)
 	{
-		vertices[k].Pos = box.Vertices[i].Position;
-		vertices[k].Normal = box.Vertices[i].Normal;
-	}
-
-	for(size_t i = 0; i < grid.Vertices.size(); ++i, ++k)
+		MeshFileVertex out;
+		out.Pos = v.Position;
+		out.Normal = v.Normal;
+		return out;
+	}, mParallelGeometryBuild ? mThreadPool.get() : nullptr);
+
+	std::vector<SubmeshGeometry> submeshes;
+	std::vector<std::string> names;
+	for(auto& e : geo.DrawArgs)
 	{
-		vertices[k].Pos = grid.Vertices[i].Position;
-		vertices[k].Normal = grid.Vertices[i].Normal;
+		names.push_back(e.first);
+		submeshes.push_back(e.second);
 	}
 
-	for(size_t i = 0; i < sphere.Vertices.size(); ++i, ++k)
+	CreateDirectoryW(CellMeshDirectory, nullptr);
+	return MeshFile::Write(filename, reinterpret_cast<const MeshFileVertex*>(geo.VertexBufferCPU->GetBufferPointer()),
+		batch.VertexCount(), geo.IndexBufferCPU->GetBufferPointer(), batch.IndexCount(),
+		geo.IndexFormat == DXGI_FORMAT_R16_UINT ? sizeof(std::uint16_t) : sizeof(std::uint32_t), submeshes, names,
+		stamp) && file.LoadBinary(filename, stamp);
+}
+
+void LitColumnsApp::BuildCellGeometry()
+{
+	// Every cell draws from the one shape geometry, read from the mesh file so
+	// that nothing is generated while the file is current.  Without the file
+	// streaming is turned off rather than failing.
+	std::wstring filename = CellMeshFile();
+	MeshFile file;
+	if(!LoadCellMeshFile(filename, file))
 	{
-		vertices[k].Pos = sphere.Vertices[i].Position;
-		vertices[k].Normal = sphere.Vertices[i].Normal;
+		MessageBox(0, (filename + L" could not be written; streaming is off.").c_str(), 0, 0);
+		mStreamingEnabled = false;
+		BuildShapeGeometry();
+		return;
 	}
 
-	for(size_t i = 0; i < cylinder.Vertices.size(); ++i, ++k)
+	MeshGeometry* geo = mGeometryPool.Allocate();
+	geo->Name = "shapeGeo";
+	for(size_t i = 0; i < file.Submeshes().size(); ++i)
+		geo->DrawArgs[file.SubmeshNames()[i]] = file.Submeshes()[i];
+
+	// Vertex has the layout of MeshFileVertex, so only -packedvertices converts.
+	static_assert(sizeof(Vertex) == sizeof(MeshFileVertex), "Vertex layout");
+	const void* vertices = file.Vertices();
+	std::vector<PackedVertex> packed;
+	if(mPackedVertices)
 	{
-		vertices[k].Pos = cylinder.Vertices[i].Position;
-		vertices[k].Normal = cylinder.Vertices[i].Normal;
+		packed.resize(file.VertexCount());
+		for(UINT i = 0; i < file.VertexCount(); ++i)
+			packed[i] = PackVertex(file.Vertices()[i].Pos, file.Vertices()[i].Normal);
+		vertices = packed.data();
 	}
 
-	for (size_t i = 0; i < diamond.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = diamond.Vertices[i].Position;
-		vertices[k].Normal = diamond.Vertices[i].Normal;
-	}
+	geo->VertexByteStride = mPackedVertices ? (UINT)sizeof(PackedVertex) : (UINT)sizeof(Vertex);
+	geo->VertexBufferByteSize = file.VertexCount()*geo->VertexByteStride;
+	geo->IndexFormat = file.IndexFormat();
+	geo->IndexBufferByteSize = file.IndexCount()*file.IndexByteSize();
+	UploadGeometry(geo, vertices, file.Indices());
 
-	for (size_t i = 0; i < wedge.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = wedge.Vertices[i].Position;
-		vertices[k].Normal = wedge.Vertices[i].Normal;
-	}
+	AddGeometry(geo);
+}
 
-	for (size_t i = 0; i < octahedron.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = octahedron.Vertices[i].Position;
-		vertices[k].Normal = octahedron.Vertices[i].Normal;
-	}
+void LitColumnsApp::BuildCells()
+{
+	const UINT cellRows = (mCastleRows + StreamingCellSize - 1) / StreamingCellSize;
+	const UINT cellColumns = (mCastleColumns + StreamingCellSize - 1) / StreamingCellSize;
+	mCells.resize(cellRows*cellColumns);
 
-	for (size_t i = 0; i < triangularPrism.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = triangularPrism.Vertices[i].Position;
-		vertices[k].Normal = triangularPrism.Vertices[i].Normal;
-	}
+	mCellStreamer = std::make_unique<CellStreamer>();
+	mCellStreamer->SetDistances(StreamLoadDistance, StreamUnloadDistance);
 
-	for (size_t i = 0; i < hexagon.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = hexagon.Vertices[i].Position;
-		vertices[k].Normal = hexagon.Vertices[i].Normal;
+	for(UINT row = 0; row < cellRows; ++row)
+	{
+		for(UINT col = 0; col < cellColumns; ++col)
+		{
+			// The last cells of a row or column may hold fewer castles.
+			UINT lastRow = MathHelper::Min((row + 1)*StreamingCellSize, mCastleRows) - 1;
+			UINT lastCol = MathHelper::Min((col + 1)*StreamingCellSize, mCastleColumns) - 1;
+			XMFLOAT3 first = CastleCenter(row*StreamingCellSize, col*StreamingCellSize);
+			XMFLOAT3 last = CastleCenter(lastRow, lastCol);
+
+			BoundingBox box;
+			box.Center = XMFLOAT3(0.5f*(first.x + last.x), 0.5f*CastleHeight, 0.5f*(first.z + last.z));
+			box.Extents = XMFLOAT3(0.5f*(last.x - first.x + CastleSpacingX), 0.5f*CastleHeight,
+				0.5f*(last.z - first.z + CastleSpacingZ));
+
+			BoundingSphere bounds;
+			BoundingSphere::CreateFromBoundingBox(bounds, box);
+			mCellStreamer->AddCell(bounds);
+		}
 	}
 
-	for (size_t i = 0; i < octagon.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = octagon.Vertices[i].Position;
-		vertices[k].Normal = octagon.Vertices[i].Normal;
-	}
+	// A resident cell holds a slot, so no more cells are resident than there
+	// are slots.
+	mCellSlots.resize(MathHelper::Min((UINT)mCells.size(), mMaxResidentCells));
+	mCellStreamer->SetResidentLimit((UINT)mCellSlots.size());
+}
 
-	for (size_t i = 0; i < cone.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = cone.Vertices[i].Position;
-		vertices[k].Normal = cone.Vertices[i].Normal;
-	}
+void LitColumnsApp::BuildCellSlots(const CastlePalette& ids)
+{
+	// The castles are built at the origin, inactive and with their lights
+	// off, until UpdateStreaming binds their slot to a cell.
+	const UINT castlesPerSlot = StreamingCellSize*StreamingCellSize;
+	for(UINT i = 0; i < (UINT)mCellSlots.size(); ++i)
+	{
+		CellSlot& slot = mCellSlots[i];
+		slot.FirstRitem = mAllRitems.size();
+		slot.FirstPointLight = (UINT)mPointLights.size();
+		slot.FirstSpotLight = (UINT)mSpotLights.size();
+
+		for(UINT castle = 0; castle < castlesPerSlot; ++castle)
+		{
+			slot.Castles.push_back(BuildCastle(ids, XMMatrixIdentity()));
+			PlaceCastleLights(slot.FirstPointLight + castle*PointLightsPerCastle,
+				slot.FirstSpotLight + castle*SpotLightsPerCastle, XMMatrixIdentity(), false);
+		}
 
-	for (size_t i = 0; i < pyramid.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = pyramid.Vertices[i].Position;
-		vertices[k].Normal = pyramid.Vertices[i].Normal;
+		assert(mAllRitems.size() - slot.FirstRitem == castlesPerSlot*RitemsPerCastle);
+		for(size_t ri = slot.FirstRitem; ri < mAllRitems.size(); ++ri)
+			mAllRitems[ri]->Active = false;
+
+		mFreeCellSlots.push_back(i);
 	}
+}
 
-	for (size_t i = 0; i < container.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = container.Vertices[i].Position;
-		vertices[k].Normal = container.Vertices[i].Normal;
+void LitColumnsApp::BindCellSlot(UINT slotIndex, UINT cell)
+{
+	CellSlot& slot = mCellSlots[slotIndex];
+	slot.Cell = cell;
+	mCells[cell].Slot = slotIndex;
+
+	// Each of the slot's castles takes the place of one of the cell's.  The
+	// last cells of a row or column have fewer places, and the castles left
+	// over stay inactive.
+	const UINT cellColumns = (mCastleColumns + StreamingCellSize - 1) / StreamingCellSize;
+	const UINT firstRow = (cell / cellColumns)*StreamingCellSize;
+	const UINT firstCol = (cell % cellColumns)*StreamingCellSize;
+	for(UINT castle = 0; castle < (UINT)slot.Castles.size(); ++castle)
+	{
+		UINT row = firstRow + castle / StreamingCellSize;
+		UINT col = firstCol + castle % StreamingCellSize;
+		if(row < mCastleRows && col < mCastleColumns)
+		{
+			XMFLOAT3 center = CastleCenter(row, col);
+			PlaceSlotCastle(slot, castle, true, XMMatrixTranslation(center.x, center.y, center.z));
+		}
+		else
+		{
+			PlaceSlotCastle(slot, castle, false, XMMatrixIdentity());
+		}
 	}
+}
+
+void LitColumnsApp::UnbindCellSlot(UINT slotIndex)
+{
+	CellSlot& slot = mCellSlots[slotIndex];
+	for(UINT castle = 0; castle < (UINT)slot.Castles.size(); ++castle)
+		PlaceSlotCastle(slot, castle, false, XMMatrixIdentity());
+
+	mCells[slot.Cell].Slot = -1;
+	slot.Cell = -1;
+	mFreeCellSlots.push_back(slotIndex);
+}
 
-	for (size_t i = 0; i < star.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = star.Vertices[i].Position;
-		vertices[k].Normal = star.Vertices[i].Normal;
+void LitColumnsApp::PlaceSlotCastle(const CellSlot& slot, UINT castle, bool active, FXMMATRIX castleWorld)
+{
+	// UpdateTransforms queues the items of a moved castle, which updates their
+	// bounds, constants and GPU-driven records.  An inactive castle stays
+	// where it is, and only its items' records need emptying.
+	size_t first = slot.FirstRitem + castle*RitemsPerCastle;
+	for(size_t i = first; i < first + RitemsPerCastle; ++i)
+	{
+		mAllRitems[i]->Active = active;
+		if(!active)
+			MarkDirty(mAllRitems[i]);
 	}
 
+	if(active)
+		mTransforms.SetLocal(slot.Castles[castle], castleWorld);
 
-	std::vector<std::uint16_t> indices;
-	indices.insert(indices.end(), std::begin(box.GetIndices16()), std::end(box.GetIndices16()));
-	indices.insert(indices.end(), std::begin(grid.GetIndices16()), std::end(grid.GetIndices16()));
-	indices.insert(indices.end(), std::begin(sphere.GetIndices16()), std::end(sphere.GetIndices16()));
-	indices.insert(indices.end(), std::begin(cylinder.GetIndices16()), std::end(cylinder.GetIndices16()));
-	indices.insert(indices.end(), std::begin(diamond.GetIndices16()), std::end(diamond.GetIndices16()));
-	indices.insert(indices.end(), std::begin(wedge.GetIndices16()), std::end(wedge.GetIndices16()));
-	indices.insert(indices.end(), std::begin(octahedron.GetIndices16()), std::end(octahedron.GetIndices16()));
-	indices.insert(indices.end(), std::begin(triangularPrism.GetIndices16()), std::end(triangularPrism.GetIndices16()));
-	indices.insert(indices.end(), std::begin(hexagon.GetIndices16()), std::end(hexagon.GetIndices16()));
-	indices.insert(indices.end(), std::begin(octagon.GetIndices16()), std::end(octagon.GetIndices16()));
-	indices.insert(indices.end(), std::begin(cone.GetIndices16()), std::end(cone.GetIndices16()));
-	indices.insert(indices.end(), std::begin(pyramid.GetIndices16()), std::end(pyramid.GetIndices16()));
-	indices.insert(indices.end(), std::begin(container.GetIndices16()), std::end(container.GetIndices16()));
-	indices.insert(indices.end(), std::begin(star.GetIndices16()), std::end(star.GetIndices16()));
+	PlaceCastleLights(slot.FirstPointLight + castle*PointLightsPerCastle,
+		slot.FirstSpotLight + castle*SpotLightsPerCastle, castleWorld, active);
+}
 
-    const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-    const UINT ibByteSize = (UINT)indices.size()  * sizeof(std::uint16_t);
+void LitColumnsApp::UpdateStreaming()
+{
+	// The camera of the last frame; this frame's has not been simulated yet.
+	mCellStreamer->Update(XMLoadFloat3(&mEyePos));
 
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "shapeGeo";
+	// A loaded cell may take the slot of one unloaded now.  The GPU still
+	// reads a rebound slot's items from the frame resources of earlier frames,
+	// not from the one updated next, so a slot can be reused at once.
+	for(UINT cell : mCellStreamer->UnloadedCells())
+		UnbindCellSlot(mCells[cell].Slot);
 
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+	for(UINT cell : mCellStreamer->LoadedCells())
+	{
+		UINT slot = mFreeCellSlots.back();
+		mFreeCellSlots.pop_back();
+		BindCellSlot(slot, cell);
+	}
+}
 
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+void LitColumnsApp::BuildPSOs()
+{
+	// The sample count in use now, then the other one in the background.
+	BuildScenePSOs(m4xMsaaState, false);
+	BuildScenePSOs(!m4xMsaaState, true);
+	mPsoMsaaState = m4xMsaaState;
 
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+	//
+	// PSO for the GPU-driven culling pass.
+	//
+	D3D12_COMPUTE_PIPELINE_STATE_DESC cullPsoDesc = {};
+	cullPsoDesc.pRootSignature = mCullRootSignature.Get();
+	cullPsoDesc.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["cullCS"]->GetBufferPointer()),
+		mShaders["cullCS"]->GetBufferSize()
+	};
+	cullPsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	mCullPSO = mPsoCache->Compute(L"cull", cullPsoDesc);
 
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
+	//
+	// PSO for the light binning pass.
+	//
+	D3D12_COMPUTE_PIPELINE_STATE_DESC clusterPsoDesc = {};
+	clusterPsoDesc.pRootSignature = mClusterRootSignature.Get();
+	clusterPsoDesc.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["clusterLightsCS"]->GetBufferPointer()),
+		mShaders["clusterLightsCS"]->GetBufferSize()
+	};
+	clusterPsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	mClusterPSO = mPsoCache->Compute(L"clusterLights", clusterPsoDesc);
 
-	geo->DrawArgs["box"] = boxSubmesh;
-	geo->DrawArgs["grid"] = gridSubmesh;
-	geo->DrawArgs["sphere"] = sphereSubmesh;
-	geo->DrawArgs["cylinder"] = cylinderSubmesh;
-	geo->DrawArgs["diamond"] = diamondSubmesh;
-	geo->DrawArgs["wedge"] = wedgeSubmesh;
-	geo->DrawArgs["octahedron"] = octahedronSubmesh;
-	geo->DrawArgs["triangularPrism"] = triPrismSubmesh;
-	geo->DrawArgs["hexagon"] = hexagonSubmesh;
-	geo->DrawArgs["octagon"] = octagonSubmesh;
-	geo->DrawArgs["cone"] = coneSubmesh;
-	geo->DrawArgs["pyramid"] = pyramidSubmesh;
-	geo->DrawArgs["container"] = containerSubmesh;
-	geo->DrawArgs["star"] = starSubmesh;
+	//
+	// PSO for the depth pyramid reduction.
+	//
+	D3D12_COMPUTE_PIPELINE_STATE_DESC hiZPsoDesc = {};
+	hiZPsoDesc.pRootSignature = mHiZRootSignature.Get();
+	hiZPsoDesc.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["hiZCS"]->GetBufferPointer()),
+		mShaders["hiZCS"]->GetBufferSize()
+	};
+	hiZPsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	mHiZPSO = mPsoCache->Compute(L"hiZ", hiZPsoDesc);
 
-	mGeometries[geo->Name] = std::move(geo);
+	//
+	// PSO for the dynamic resolution upscale: one full screen triangle, no
+	// depth.  The scene buffer is never multisampled.
+	//
+	if(mDynamicResolution)
+	{
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC upscalePsoDesc;
+		ZeroMemory(&upscalePsoDesc, sizeof(D3D12_GRAPHICS_PIPELINE_STATE_DESC));
+		upscalePsoDesc.pRootSignature = mUpscaleRootSignature.Get();
+		upscalePsoDesc.VS =
+		{
+			reinterpret_cast<BYTE*>(mShaders["upscaleVS"]->GetBufferPointer()),
+			mShaders["upscaleVS"]->GetBufferSize()
+		};
+		upscalePsoDesc.PS =
+		{
+			reinterpret_cast<BYTE*>(mShaders["upscalePS"]->GetBufferPointer()),
+			mShaders["upscalePS"]->GetBufferSize()
+		};
+		upscalePsoDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
+		upscalePsoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
+		upscalePsoDesc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
+		upscalePsoDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
+		upscalePsoDesc.DepthStencilState.DepthEnable = FALSE;
+		upscalePsoDesc.SampleMask = UINT_MAX;
+		upscalePsoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+		upscalePsoDesc.NumRenderTargets = 1;
+		upscalePsoDesc.RTVFormats[0] = mBackBufferFormat;
+		upscalePsoDesc.SampleDesc.Count = 1;
+		upscalePsoDesc.SampleDesc.Quality = 0;
+		upscalePsoDesc.DSVFormat = DXGI_FORMAT_UNKNOWN;
+		mUpscalePSO = mPsoCache->Graphics(L"upscale", upscalePsoDesc);
+	}
 }
 
-
-void LitColumnsApp::BuildPSOs()
+void LitColumnsApp::BuildScenePSOs(bool msaa, bool background)
 {
     D3D12_GRAPHICS_PIPELINE_STATE_DESC opaquePsoDesc;
 
@@ -805,622 +3558,780 @@ void LitColumnsApp::BuildPSOs()
 	opaquePsoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
 	opaquePsoDesc.NumRenderTargets = 1;
 	opaquePsoDesc.RTVFormats[0] = mBackBufferFormat;
-	opaquePsoDesc.SampleDesc.Count = m4xMsaaState ? 4 : 1;
-	opaquePsoDesc.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
+	opaquePsoDesc.SampleDesc.Count = msaa ? 4 : 1;
+	opaquePsoDesc.SampleDesc.Quality = msaa ? (m4xMsaaQuality - 1) : 0;
 	opaquePsoDesc.DSVFormat = mDepthStencilFormat;
-    ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&opaquePsoDesc, IID_PPV_ARGS(&mOpaquePSO)));
+
+	//
+	// The scene pass PSOs, see ScenePso, for plain and instanced drawing.  The
+	// Equal PSOs keep the depth the pre-pass wrote, and the pre-pass has no
+	// pixel shader and writes no color.
+	//
+	D3D12_SHADER_BYTECODE opaquePS = opaquePsoDesc.PS;
+	D3D12_SHADER_BYTECODE clusteredPS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["clusteredPS"]->GetBufferPointer()),
+		mShaders["clusteredPS"]->GetBufferSize()
+	};
+	D3D12_SHADER_BYTECODE vertexShaders[2] =
+	{
+		opaquePsoDesc.VS,
+		{
+			reinterpret_cast<BYTE*>(mShaders["instancedVS"]->GetBufferPointer()),
+			mShaders["instancedVS"]->GetBufferSize()
+		}
+	};
+
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDescs[ScenePsoCount];
+	const wchar_t* psoNames[ScenePsoCount] = { L"shaded", L"clustered", L"shadedEqual", L"clusteredEqual", L"depthOnly" };
+
+	// The name must change with anything that changes the description.
+	std::wstring suffix = std::wstring(mPackedVertices ? L"_packed" : L"") + (mBindlessMaterials ? L"_bindless" : L"") +
+		(msaa ? L"_msaa4" : L"");
+	const wchar_t* prefixes[2] = { L"opaque_", L"instanced_" };
+	ComPtr<ID3D12PipelineState>* scenePSOs[2] = { mOpaquePSOs, mInstancedPSOs };
+
+	for(int i = 0; i < 2; ++i)
+	{
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc = opaquePsoDesc;
+		psoDesc.VS = vertexShaders[i];
+		psoDescs[ScenePsoShaded] = psoDesc;
+
+		psoDesc.PS = clusteredPS;
+		psoDescs[ScenePsoClustered] = psoDesc;
+
+		psoDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_EQUAL;
+		psoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+		psoDescs[ScenePsoClusteredEqual] = psoDesc;
+
+		psoDesc.PS = opaquePS;
+		psoDescs[ScenePsoShadedEqual] = psoDesc;
+
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC depthOnlyPsoDesc = opaquePsoDesc;
+		depthOnlyPsoDesc.VS = vertexShaders[i];
+		depthOnlyPsoDesc.PS = { nullptr, 0 };
+		depthOnlyPsoDesc.BlendState.RenderTarget[0].RenderTargetWriteMask = 0;
+		psoDescs[ScenePsoDepthOnly] = depthOnlyPsoDesc;
+
+		for(int pso = 0; pso < ScenePsoCount; ++pso)
+		{
+			std::wstring name = prefixes[i] + std::wstring(psoNames[pso]) + suffix;
+			if(background)
+				mPsoCache->RequestGraphics(name, psoDescs[pso]);
+			else
+				scenePSOs[i][pso] = mPsoCache->Graphics(name, psoDescs[pso]);
+		}
+	}
+
+	//
+	// PSO for the stats overlay, blended over the back buffer with no depth.
+	// It draws to the back buffer, so it follows the MSAA state too.
+	//
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC overlayPsoDesc = opaquePsoDesc;
+	overlayPsoDesc.InputLayout = { nullptr, 0 };
+	overlayPsoDesc.pRootSignature = mOverlayRootSignature.Get();
+	overlayPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["overlayVS"]->GetBufferPointer()),
+		mShaders["overlayVS"]->GetBufferSize()
+	};
+	overlayPsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["overlayPS"]->GetBufferPointer()),
+		mShaders["overlayPS"]->GetBufferSize()
+	};
+	overlayPsoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
+	overlayPsoDesc.DepthStencilState.DepthEnable = FALSE;
+	overlayPsoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+	overlayPsoDesc.DSVFormat = DXGI_FORMAT_UNKNOWN;
+
+	D3D12_RENDER_TARGET_BLEND_DESC& overlayBlend = overlayPsoDesc.BlendState.RenderTarget[0];
+	overlayBlend.BlendEnable = TRUE;
+	overlayBlend.SrcBlend = D3D12_BLEND_SRC_ALPHA;
+	overlayBlend.DestBlend = D3D12_BLEND_INV_SRC_ALPHA;
+	overlayBlend.BlendOp = D3D12_BLEND_OP_ADD;
+
+	std::wstring overlayName = std::wstring(L"overlay") + (msaa ? L"_msaa4" : L"");
+	if(background)
+		mPsoCache->RequestGraphics(overlayName, overlayPsoDesc);
+	else
+		mOverlayPSO = mPsoCache->Graphics(overlayName, overlayPsoDesc);
 }
 
 void LitColumnsApp::BuildFrameResources()
 {
-    for(int i = 0; i < gNumFrameResources; ++i)
+	// Only the items with slots have object constants in the frame resources.
+	// The buffer is never empty, so that it can be created.
+	const UINT objectCount = MathHelper::Max(mObjectCBCount, 1u);
+    for(int i = 0; i < mNumFrameResources; ++i)
     {
         mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
-            1, (UINT)mAllRitems.size(), (UINT)mMaterials.size()));
+            1, objectCount, (UINT)mMaterials.size(), (UINT)mOpaqueRitems.size(),
+            (UINT)mOpaqueRitems.size(), MaxLocalLights, mNumRecordingThreads));
+
+		mFrameResources.back()->OverlayText = std::make_unique<UploadBuffer<UINT>>(md3dDevice.Get(),
+			TextOverlay::PackedSize, false);
     }
 }
 
+void LitColumnsApp::BuildUploadRing()
+{
+	// Each frame in flight, and the one being written, may stream the
+	// constants of every item without a slot.
+	const UINT objCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
+	const UINT64 streamedCount = mAllRitems.size() - mObjectCBCount;
+	const UINT64 frameByteSize = UploadRingFrameByteSize + streamedCount*objCBByteSize;
+	mUploadRing = std::make_unique<UploadRingBuffer>(md3dDevice.Get(), mFence.Get(),
+		frameByteSize*(mNumFrameResources + 1));
+}
+
+void LitColumnsApp::BuildIndirectResources()
+{
+	// Each command sets the object and material root CBVs and the geometry,
+	// then draws, so one ExecuteIndirect covers items of every geometry and
+	// material.  Commands that change root arguments need the root signature.
+	// With -bindless the material is the two material root constants.
+	D3D12_INDIRECT_ARGUMENT_DESC args[5] = {};
+	args[0].Type = D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT_BUFFER_VIEW;
+	args[0].ConstantBufferView.RootParameterIndex = 0;
+	if(mBindlessMaterials)
+	{
+		args[1].Type = D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT;
+		args[1].Constant.RootParameterIndex = 1;
+		args[1].Constant.DestOffsetIn32BitValues = 0;
+		args[1].Constant.Num32BitValuesToSet = 2;
+	}
+	else
+	{
+		args[1].Type = D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT_BUFFER_VIEW;
+		args[1].ConstantBufferView.RootParameterIndex = 1;
+	}
+	args[2].Type = D3D12_INDIRECT_ARGUMENT_TYPE_VERTEX_BUFFER_VIEW;
+	args[2].VertexBuffer.Slot = 0;
+	args[3].Type = D3D12_INDIRECT_ARGUMENT_TYPE_INDEX_BUFFER_VIEW;
+	args[4].Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW_INDEXED;
+
+	D3D12_COMMAND_SIGNATURE_DESC sigDesc = {};
+	sigDesc.ByteStride = sizeof(IndirectCommand);
+	sigDesc.NumArgumentDescs = _countof(args);
+	sigDesc.pArgumentDescs = args;
+	ThrowIfFailed(md3dDevice->CreateCommandSignature(&sigDesc, mRootSignature.Get(),
+		IID_PPV_ARGS(mCommandSignature.GetAddressOf())));
+
+	// Room for every opaque item to be visible.  The buffers are only used
+	// within a frame, so the frame resources share them.
+	const UINT64 commandBufferByteSize = (UINT64)MathHelper::Max((UINT)mOpaqueRitems.size(), 1u)*sizeof(IndirectCommand);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(commandBufferByteSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+		D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT,
+		nullptr,
+		IID_PPV_ARGS(mIndirectCommandBuffer.GetAddressOf())));
+
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		nullptr,
+		IID_PPV_ARGS(mIndirectCountBuffer.GetAddressOf())));
+
+	mIndirectCountReset = std::make_unique<UploadBuffer<UINT>>(md3dDevice.Get(), 1, false);
+	mIndirectCountReset->CopyData(0, 0);
+}
+
+void LitColumnsApp::BuildDescriptorHeaps()
+{
+	D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
+	srvHeapDesc.NumDescriptors = SrvHeapDescriptorCount;
+	srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+	srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&srvHeapDesc, IID_PPV_ARGS(&mSrvDescriptorHeap)));
+}
+
+void LitColumnsApp::BuildSceneBufferSrv()
+{
+	// D3DApp::OnResize recreates the scene buffer, so this follows every resize.
+	if(!DynamicResolutionActive())
+		return;
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = mBackBufferFormat;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MipLevels = 1;
+	md3dDevice->CreateShaderResourceView(mSceneBuffer.Get(), &srvDesc, CD3DX12_CPU_DESCRIPTOR_HANDLE(
+		mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), SceneSrvIndex, mCbvSrvDescriptorSize));
+}
+
+void LitColumnsApp::BuildHiZResources()
+{
+	// Called again after every resize, once the GPU is idle, so the old
+	// resources can be released and the depth is no longer valid.
+	mLastDepthValid = false;
+	mHiZLevelCount = HiZBuffer::LevelCount(mClientWidth, mClientHeight);
+
+	UINT readbackLevel = 0;
+	while(readbackLevel + 1 < mHiZLevelCount && HiZBuffer::LevelSize(mClientWidth, readbackLevel) > HiZReadbackMaxWidth)
+		++readbackLevel;
+	mHiZ.Resize(mClientWidth, mClientHeight, readbackLevel);
+
+	D3D12_RESOURCE_DESC texDesc;
+	ZeroMemory(&texDesc, sizeof(D3D12_RESOURCE_DESC));
+	texDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+	texDesc.Alignment = 0;
+	texDesc.Width = HiZBuffer::LevelSize(mClientWidth, 0);
+	texDesc.Height = HiZBuffer::LevelSize(mClientHeight, 0);
+	texDesc.DepthOrArraySize = 1;
+	texDesc.MipLevels = (UINT16)mHiZLevelCount;
+	texDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	texDesc.SampleDesc.Count = 1;
+	texDesc.SampleDesc.Quality = 0;
+	texDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+	texDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+
+	mHiZTexture.Reset();
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		HiZReadState,
+		nullptr,
+		IID_PPV_ARGS(mHiZTexture.GetAddressOf())));
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE heapStart(mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart());
+
+	// The depth buffer is only read without MSAA.
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	if(!m4xMsaaState)
+	{
+		srvDesc.Format = DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
+		srvDesc.Texture2D.MostDetailedMip = 0;
+		srvDesc.Texture2D.MipLevels = 1;
+		md3dDevice->CreateShaderResourceView(mDepthStencilBuffer.Get(), &srvDesc,
+			CD3DX12_CPU_DESCRIPTOR_HANDLE(heapStart, HiZDepthSrvIndex, mCbvSrvDescriptorSize));
+	}
+
+	srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	uavDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+	for(UINT level = 0; level < mHiZLevelCount; ++level)
+	{
+		srvDesc.Texture2D.MostDetailedMip = level;
+		srvDesc.Texture2D.MipLevels = 1;
+		md3dDevice->CreateShaderResourceView(mHiZTexture.Get(), &srvDesc,
+			CD3DX12_CPU_DESCRIPTOR_HANDLE(heapStart, HiZLevelSrvIndex + level, mCbvSrvDescriptorSize));
+
+		uavDesc.Texture2D.MipSlice = level;
+		md3dDevice->CreateUnorderedAccessView(mHiZTexture.Get(), nullptr, &uavDesc,
+			CD3DX12_CPU_DESCRIPTOR_HANDLE(heapStart, HiZLevelUavIndex + level, mCbvSrvDescriptorSize));
+	}
+
+	srvDesc.Texture2D.MostDetailedMip = 0;
+	srvDesc.Texture2D.MipLevels = mHiZLevelCount;
+	md3dDevice->CreateShaderResourceView(mHiZTexture.Get(), &srvDesc,
+		CD3DX12_CPU_DESCRIPTOR_HANDLE(heapStart, HiZPyramidSrvIndex, mCbvSrvDescriptorSize));
+
+	// Each frame resource reads back the levels the CPU test uses.
+	const UINT readbackLevelCount = mHiZLevelCount - readbackLevel;
+	UINT64 readbackByteSize = 0;
+	mHiZFootprints.resize(readbackLevelCount);
+	md3dDevice->GetCopyableFootprints(&texDesc, readbackLevel, readbackLevelCount, 0,
+		mHiZFootprints.data(), nullptr, nullptr, &readbackByteSize);
+
+	for(auto& frameResource : mFrameResources)
+	{
+		frameResource->HiZReadback.Reset();
+		frameResource->HiZPending = false;
+		ThrowIfFailed(md3dDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(readbackByteSize),
+			D3D12_RESOURCE_STATE_COPY_DEST,
+			nullptr,
+			IID_PPV_ARGS(frameResource->HiZReadback.GetAddressOf())));
+	}
+}
+
+void LitColumnsApp::BuildClusterResources()
+{
+	// Rebuilt from scratch by every light binning pass, so the frame resources
+	// share one buffer.
+	const UINT64 clusterBufferByteSize = (UINT64)ClusterCountX*ClusterCountY*ClusterCountZ*ClusterStride*sizeof(UINT);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(clusterBufferByteSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+		mClusterLightBufferState,
+		nullptr,
+		IID_PPV_ARGS(mClusterLightBuffer.GetAddressOf())));
+}
+
 void LitColumnsApp::BuildMaterials()
 {
-	auto bricks0 = std::make_unique<Material>();
-	bricks0->Name = "bricks0";
-	bricks0->MatCBIndex = 0;
-	bricks0->DiffuseSrvHeapIndex = 0;
-	bricks0->DiffuseAlbedo = XMFLOAT4(Colors::ForestGreen);
-	bricks0->FresnelR0 = XMFLOAT3(0.02f, 0.02f, 0.02f);
-	bricks0->Roughness = 0.1f;
-
-	auto stone0 = std::make_unique<Material>();
-	stone0->Name = "stone0";
-	stone0->MatCBIndex = 1;
-	stone0->DiffuseSrvHeapIndex = 1;
-	stone0->DiffuseAlbedo = XMFLOAT4(Colors::LightSteelBlue);
-	stone0->FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
-	stone0->Roughness = 0.3f;
+	Material bricks0;
+	bricks0.Name = "bricks0";
+	bricks0.MatCBIndex = 0;
+	bricks0.DiffuseSrvHeapIndex = 0;
+	bricks0.DiffuseAlbedo = XMFLOAT4(Colors::ForestGreen);
+	bricks0.FresnelR0 = XMFLOAT3(0.02f, 0.02f, 0.02f);
+	bricks0.Roughness = 0.1f;
+
+	Material stone0;
+	stone0.Name = "stone0";
+	stone0.MatCBIndex = 1;
+	stone0.DiffuseSrvHeapIndex = 1;
+	stone0.DiffuseAlbedo = XMFLOAT4(Colors::LightSteelBlue);
+	stone0.FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
+	stone0.Roughness = 0.3f;
  
-	auto tile0 = std::make_unique<Material>();
-	tile0->Name = "tile0";
-	tile0->MatCBIndex = 2;
-	tile0->DiffuseSrvHeapIndex = 2;
-	tile0->DiffuseAlbedo = XMFLOAT4(Colors::DimGray);
-	tile0->FresnelR0 = XMFLOAT3(0.02f, 0.02f, 0.02f);
-	tile0->Roughness = 0.2f;
-
-	auto wedgeMat = std::make_unique<Material>();
-	wedgeMat->Name = "wedgeMat";
-	wedgeMat->MatCBIndex = 3;
-	wedgeMat->DiffuseSrvHeapIndex = 3;
-	wedgeMat->DiffuseAlbedo = XMFLOAT4(.98f, 0.55f, 0.94f, 1.f);
-	wedgeMat->FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
-	wedgeMat->Roughness = 0.3f;
-
-	auto diamondMat = std::make_unique<Material>();
-	diamondMat->Name = "diaMat";
-	diamondMat->MatCBIndex = 4;
-	diamondMat->DiffuseSrvHeapIndex = 4;
-	diamondMat->DiffuseAlbedo = XMFLOAT4(0.f, 0.f, 1.f, 1.f);
-	diamondMat->FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
-	diamondMat->Roughness = 0.3f;
-
-	auto octahedronMat = std::make_unique<Material>();
-	octahedronMat->Name = "octahedronMat";
-	octahedronMat->MatCBIndex = 5;
-	octahedronMat->DiffuseSrvHeapIndex = 5;
-	octahedronMat->DiffuseAlbedo = XMFLOAT4(.98f, 1.f, 0.f, 1.f);
-	octahedronMat->FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
-	octahedronMat->Roughness = 0.3f;
-
-	auto sky = std::make_unique<Material>();
-	sky->Name = "sky";
-	sky->MatCBIndex = 6;
-	sky->DiffuseSrvHeapIndex = 6;
-	sky->DiffuseAlbedo = XMFLOAT4(Colors::SkyBlue);
-	sky->FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
-	sky->Roughness = 0.3f;
-
-	auto gold = std::make_unique<Material>();
-	gold->Name = "gold";
-	gold->MatCBIndex = 7;
-	gold->DiffuseSrvHeapIndex = 7;
-	gold->DiffuseAlbedo = XMFLOAT4(Colors::Goldenrod);
-	gold->FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
-	gold->Roughness = 0.2f;
-
-	auto shineBlue = std::make_unique<Material>();
-	shineBlue->Name = "shineBlue";
-	shineBlue->MatCBIndex = 8;
-	shineBlue->DiffuseSrvHeapIndex = 8;
-	shineBlue->DiffuseAlbedo = XMFLOAT4(Colors::DeepSkyBlue);
-	shineBlue->FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
-	shineBlue->Roughness = 0.05f;
-
-	auto shineRed = std::make_unique<Material>();
-	shineRed->Name = "shineRed";
-	shineRed->MatCBIndex = 9;
-	shineRed->DiffuseSrvHeapIndex = 9;
-	shineRed->DiffuseAlbedo = XMFLOAT4(.85f, .2f, .2f, 1.0f);
-	shineRed->FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
-	shineRed->Roughness = 0.05f;
-
-	auto wallPurple = std::make_unique<Material>();
-	wallPurple->Name = "wallPurple";
-	wallPurple->MatCBIndex = 10;
-	wallPurple->DiffuseSrvHeapIndex = 9;
-	wallPurple->DiffuseAlbedo = XMFLOAT4(.52f, .14f, .72f, 1.0f);
-	wallPurple->FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
-	wallPurple->Roughness = 0.05f;
+	Material tile0;
+	tile0.Name = "tile0";
+	tile0.MatCBIndex = 2;
+	tile0.DiffuseSrvHeapIndex = 2;
+	tile0.DiffuseAlbedo = XMFLOAT4(Colors::DimGray);
+	tile0.FresnelR0 = XMFLOAT3(0.02f, 0.02f, 0.02f);
+	tile0.Roughness = 0.2f;
+
+	Material wedgeMat;
+	wedgeMat.Name = "wedgeMat";
+	wedgeMat.MatCBIndex = 3;
+	wedgeMat.DiffuseSrvHeapIndex = 3;
+	wedgeMat.DiffuseAlbedo = XMFLOAT4(.98f, 0.55f, 0.94f, 1.f);
+	wedgeMat.FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
+	wedgeMat.Roughness = 0.3f;
+
+	Material diamondMat;
+	diamondMat.Name = "diaMat";
+	diamondMat.MatCBIndex = 4;
+	diamondMat.DiffuseSrvHeapIndex = 4;
+	diamondMat.DiffuseAlbedo = XMFLOAT4(0.f, 0.f, 1.f, 1.f);
+	diamondMat.FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
+	diamondMat.Roughness = 0.3f;
+
+	Material octahedronMat;
+	octahedronMat.Name = "octahedronMat";
+	octahedronMat.MatCBIndex = 5;
+	octahedronMat.DiffuseSrvHeapIndex = 5;
+	octahedronMat.DiffuseAlbedo = XMFLOAT4(.98f, 1.f, 0.f, 1.f);
+	octahedronMat.FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
+	octahedronMat.Roughness = 0.3f;
+
+	Material sky;
+	sky.Name = "sky";
+	sky.MatCBIndex = 6;
+	sky.DiffuseSrvHeapIndex = 6;
+	sky.DiffuseAlbedo = XMFLOAT4(Colors::SkyBlue);
+	sky.FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
+	sky.Roughness = 0.3f;
+
+	Material gold;
+	gold.Name = "gold";
+	gold.MatCBIndex = 7;
+	gold.DiffuseSrvHeapIndex = 7;
+	gold.DiffuseAlbedo = XMFLOAT4(Colors::Goldenrod);
+	gold.FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
+	gold.Roughness = 0.2f;
+
+	Material shineBlue;
+	shineBlue.Name = "shineBlue";
+	shineBlue.MatCBIndex = 8;
+	shineBlue.DiffuseSrvHeapIndex = 8;
+	shineBlue.DiffuseAlbedo = XMFLOAT4(Colors::DeepSkyBlue);
+	shineBlue.FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
+	shineBlue.Roughness = 0.05f;
+
+	Material shineRed;
+	shineRed.Name = "shineRed";
+	shineRed.MatCBIndex = 9;
+	shineRed.DiffuseSrvHeapIndex = 9;
+	shineRed.DiffuseAlbedo = XMFLOAT4(.85f, .2f, .2f, 1.0f);
+	shineRed.FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
+	shineRed.Roughness = 0.05f;
+
+	Material wallPurple;
+	wallPurple.Name = "wallPurple";
+	wallPurple.MatCBIndex = 10;
+	wallPurple.DiffuseSrvHeapIndex = 9;
+	wallPurple.DiffuseAlbedo = XMFLOAT4(.52f, .14f, .72f, 1.0f);
+	wallPurple.FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
+	wallPurple.Roughness = 0.05f;
 	
-	mMaterials["bricks0"] = std::move(bricks0);
-	mMaterials["stone0"] = std::move(stone0);
-	mMaterials["tile0"] = std::move(tile0);
-	//mMaterials["skullMat"] = std::move(skullMat);
-	mMaterials["wedgeMat"] = std::move(wedgeMat);
-	mMaterials["diaMat"] = std::move(diamondMat);
-	mMaterials["octahedronMat"] = std::move(octahedronMat);
-	mMaterials["sky"] = std::move(sky);
-	mMaterials["gold"] = std::move(gold);
-	mMaterials["shineBlue"] = std::move(shineBlue);
-	mMaterials["shineRed"] = std::move(shineRed);
-	mMaterials["wallPurple"] = std::move(wallPurple);
+	AddMaterial(bricks0);
+	AddMaterial(stone0);
+	AddMaterial(tile0);
+	//AddMaterial(skullMat);
+	AddMaterial(wedgeMat);
+	AddMaterial(diamondMat);
+	AddMaterial(octahedronMat);
+	AddMaterial(sky);
+	AddMaterial(gold);
+	AddMaterial(shineBlue);
+	AddMaterial(shineRed);
+	AddMaterial(wallPurple);
+}
+
+void LitColumnsApp::AddMaterial(const Material& mat)
+{
+	mMaterialIndices[mat.Name] = (UINT)mMaterials.size();
+	mMaterials.push_back(mat);
+}
+
+UINT LitColumnsApp::FindMaterial(const std::string& name)const
+{
+	return mMaterialIndices.at(name);
+}
+
+UINT LitColumnsApp::AddGeometry(MeshGeometry* geo)
+{
+	UINT geoIndex = (UINT)mGeometries.size();
+	mGeometries.push_back(geo);
+
+	// Submesh names are unique across the geometries.  Levels of detail are
+	// stored in the entry of the submesh they belong to.
+	for(auto& e : geo->DrawArgs)
+	{
+		if(MeshBatchBuilder::IsLodName(e.first))
+			continue;
+
+		SceneSubmesh submesh;
+		submesh.GeoIndex = geoIndex;
+		submesh.Lods[0] = e.second;
+
+		for(UINT lod = 1; lod < MaxLodLevels; ++lod)
+		{
+			auto it = geo->DrawArgs.find(MeshBatchBuilder::LodName(e.first, lod));
+			if(it == geo->DrawArgs.end())
+				break;
+
+			submesh.Lods[lod] = it->second;
+			submesh.LodCount = lod + 1;
+		}
+
+		bool added = mSubmeshIndices.emplace(e.first, (UINT)mSubmeshes.size()).second;
+		assert(added);
+		mSubmeshes.push_back(submesh);
+	}
+
+	return geoIndex;
+}
+
+UINT LitColumnsApp::FindSubmesh(const std::string& name)const
+{
+	return mSubmeshIndices.at(name);
 }
 
 void LitColumnsApp::BuildRenderItems()
 {
+	// With streaming only the cell slots' castles are built.
+	if(mStreamingEnabled)
+		BuildCells();
+
+	const UINT castleCount = mStreamingEnabled ? (UINT)mCellSlots.size()*StreamingCellSize*StreamingCellSize :
+		mCastleRows*mCastleColumns;
+	mRitemPool.Reserve(castleCount*RitemsPerCastle);
+	mAllRitems.reserve(castleCount*RitemsPerCastle);
+	mOpaqueRitems.reserve(castleCount*RitemsPerCastle);
+	mTransforms.Reserve(castleCount*TransformNodesPerCastle);
+	mTransformOwners.reserve(castleCount*TransformNodesPerCastle);
+	mPointLights.reserve(castleCount*PointLightsPerCastle);
+	mSpotLights.reserve(castleCount*SpotLightsPerCastle);
+
+	CastlePalette ids = BuildCastlePalette();
+
+	if(mStreamingEnabled)
+	{
+		BuildCellSlots(ids);
+	}
+	else
+	{
+		for(UINT row = 0; row < mCastleRows; ++row)
+		{
+			for(UINT col = 0; col < mCastleColumns; ++col)
+			{
+				XMFLOAT3 center = CastleCenter(row, col);
+				BuildCastle(ids, XMMatrixTranslation(center.x, center.y, center.z));
+			}
+		}
+	}
+
+	// All the render items are opaque.
+	mGeometryRitems.resize(mGeometries.size());
+	for(auto ri : mAllRitems)
+	{
+		mOpaqueRitems.push_back(ri);
+		mGeometryRitems[ri->GeoIndex].push_back(ri);
+	}
+
+	// Compute the initial world matrices.  Initialize queues every item for
+	// its first constant buffer upload.
+	mTransforms.UpdateWorlds(mChangedTransforms);
+	mChangedTransforms.clear();
+
+	// Compute the world space bounds once; MarkDirty updates them if an item moves.
+	for(auto ri : mOpaqueRitems)
+		ri->CullIndex = mCuller.AddBox(ri->Bounds, mTransforms.World(ri->TransformIndex));
+}
+
+XMFLOAT3 LitColumnsApp::CastleCenter(UINT row, UINT col)const
+{
+	// Lay the castles out in a grid centred on the origin.  The default 1x1
+	// grid is the original scene.
+	return XMFLOAT3((col - 0.5f*(mCastleColumns - 1))*CastleSpacingX, 0.0f,
+		(row - 0.5f*(mCastleRows - 1))*CastleSpacingZ);
+}
 
-	auto FountainBaseCylinderRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&FountainBaseCylinderRitem->World, XMMatrixScaling(4.3f, .3f, 4.3f)*XMMatrixTranslation(0.f, 0.3f, -8.f));
-	XMStoreFloat4x4(&FountainBaseCylinderRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	FountainBaseCylinderRitem->ObjCBIndex = 0;
-	FountainBaseCylinderRitem->Mat = mMaterials["diaMat"].get();
-	FountainBaseCylinderRitem->Geo = mGeometries["shapeGeo"].get();
-	FountainBaseCylinderRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	FountainBaseCylinderRitem->IndexCount = FountainBaseCylinderRitem->Geo->DrawArgs["cylinder"].IndexCount;
-	FountainBaseCylinderRitem->StartIndexLocation = FountainBaseCylinderRitem->Geo->DrawArgs["cylinder"].StartIndexLocation;
-	FountainBaseCylinderRitem->BaseVertexLocation = FountainBaseCylinderRitem->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(FountainBaseCylinderRitem));
-
-	auto containerRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&containerRitem->World, XMMatrixScaling(1.3f, 1.f, 1.3f)*XMMatrixTranslation( 0.f, 1.3f, -8.f));
-	XMStoreFloat4x4(&containerRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	containerRitem->ObjCBIndex = 1;
-	containerRitem->Mat = mMaterials["stone0"].get();
-	containerRitem->Geo = mGeometries["shapeGeo"].get();
-	containerRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	containerRitem->IndexCount = containerRitem->Geo->DrawArgs["container"].IndexCount;
-	containerRitem->StartIndexLocation = containerRitem->Geo->DrawArgs["container"].StartIndexLocation;
-	containerRitem->BaseVertexLocation = containerRitem->Geo->DrawArgs["container"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(containerRitem));
-
-	auto pyramidRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&pyramidRitem->World, XMMatrixScaling(1.f, 1.5f, 1.f)*XMMatrixTranslation(-3.5f, .5f, -8.f));
-	XMStoreFloat4x4(&pyramidRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	pyramidRitem->ObjCBIndex = 2;
-	pyramidRitem->Mat = mMaterials["wedgeMat"].get();
-	pyramidRitem->Geo = mGeometries["shapeGeo"].get();
-	pyramidRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	pyramidRitem->IndexCount = pyramidRitem->Geo->DrawArgs["pyramid"].IndexCount;
-	pyramidRitem->StartIndexLocation = pyramidRitem->Geo->DrawArgs["pyramid"].StartIndexLocation;
-	pyramidRitem->BaseVertexLocation = pyramidRitem->Geo->DrawArgs["pyramid"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(pyramidRitem));
-
-	auto pyramidRitem2 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&pyramidRitem2->World, XMMatrixScaling(1.f, 1.5f, 1.f)*XMMatrixTranslation(3.5f, .5f, -8.f));
-	XMStoreFloat4x4(&pyramidRitem2->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	pyramidRitem2->ObjCBIndex = 3;
-	pyramidRitem2->Mat = mMaterials["wedgeMat"].get();
-	pyramidRitem2->Geo = mGeometries["shapeGeo"].get();
-	pyramidRitem2->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	pyramidRitem2->IndexCount = pyramidRitem2->Geo->DrawArgs["pyramid"].IndexCount;
-	pyramidRitem2->StartIndexLocation = pyramidRitem2->Geo->DrawArgs["pyramid"].StartIndexLocation;
-	pyramidRitem2->BaseVertexLocation = pyramidRitem2->Geo->DrawArgs["pyramid"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(pyramidRitem2));
-
-	auto coneRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&coneRitem->World, XMMatrixScaling(3.f, 2.f, 3.f)*XMMatrixTranslation(0.0f, 7.5f, 6.0f));
-	XMStoreFloat4x4(&coneRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	coneRitem->ObjCBIndex = 4;
-	coneRitem->Mat = mMaterials["sky"].get();
-	coneRitem->Geo = mGeometries["shapeGeo"].get();
-	coneRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	coneRitem->IndexCount = coneRitem->Geo->DrawArgs["cone"].IndexCount;
-	coneRitem->StartIndexLocation = coneRitem->Geo->DrawArgs["cone"].StartIndexLocation;
-	coneRitem->BaseVertexLocation = coneRitem->Geo->DrawArgs["cone"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(coneRitem));
-
-	auto cylinderRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&cylinderRitem->World, XMMatrixScaling(5.f, 1.f, 5.f)*XMMatrixTranslation(0.0f, 5.f, 6.0f));
-	XMStoreFloat4x4(&cylinderRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	cylinderRitem->ObjCBIndex = 5;
-	cylinderRitem->Mat = mMaterials["diaMat"].get();
-	cylinderRitem->Geo = mGeometries["shapeGeo"].get();
-	cylinderRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	cylinderRitem->IndexCount = cylinderRitem->Geo->DrawArgs["cylinder"].IndexCount;
-	cylinderRitem->StartIndexLocation = cylinderRitem->Geo->DrawArgs["cylinder"].StartIndexLocation;
-	cylinderRitem->BaseVertexLocation = cylinderRitem->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(cylinderRitem));
-
-	auto HexagonRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&HexagonRitem->World, XMMatrixScaling(4.5f, 2.0f, 4.5f)*XMMatrixTranslation(0.0f, 2.0f, 6.0f));
-	XMStoreFloat4x4(&HexagonRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	HexagonRitem->ObjCBIndex = 6;
-	HexagonRitem->Mat = mMaterials["gold"].get();
-	HexagonRitem->Geo = mGeometries["shapeGeo"].get();
-	HexagonRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	HexagonRitem->IndexCount = HexagonRitem->Geo->DrawArgs["hexagon"].IndexCount;
-	HexagonRitem->StartIndexLocation = HexagonRitem->Geo->DrawArgs["hexagon"].StartIndexLocation;
-	HexagonRitem->BaseVertexLocation = HexagonRitem->Geo->DrawArgs["hexagon"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(HexagonRitem));
-
-	auto triPrismRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&triPrismRitem->World, XMMatrixScaling(1.5f, 1.5f, 2.5f)*XMMatrixTranslation(0.0f, 0.5f, -2.5f));
-	XMStoreFloat4x4(&triPrismRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	triPrismRitem->ObjCBIndex = 7;
-	triPrismRitem->Mat = mMaterials["sky"].get();
-	triPrismRitem->Geo = mGeometries["shapeGeo"].get();
-	triPrismRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	triPrismRitem->IndexCount = triPrismRitem->Geo->DrawArgs["triangularPrism"].IndexCount;
-	triPrismRitem->StartIndexLocation = triPrismRitem->Geo->DrawArgs["triangularPrism"].StartIndexLocation;
-	triPrismRitem->BaseVertexLocation = triPrismRitem->Geo->DrawArgs["triangularPrism"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(triPrismRitem));
-
-	auto leftDoorRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&leftDoorRitem->World, XMMatrixScaling(.5f, 2.0f, .7f)*XMMatrixRotationX(XMConvertToRadians(-90))*XMMatrixRotationY(XMConvertToRadians(-30))*XMMatrixTranslation(-1.7f, 0.25f, -12.0f));
-	XMStoreFloat4x4(&leftDoorRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	leftDoorRitem->ObjCBIndex = 8;
-	leftDoorRitem->Mat = mMaterials["bricks0"].get();
-	leftDoorRitem->Geo = mGeometries["shapeGeo"].get();
-	leftDoorRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	leftDoorRitem->IndexCount = leftDoorRitem->Geo->DrawArgs["triangularPrism"].IndexCount;
-	leftDoorRitem->StartIndexLocation = leftDoorRitem->Geo->DrawArgs["triangularPrism"].StartIndexLocation;
-	leftDoorRitem->BaseVertexLocation = leftDoorRitem->Geo->DrawArgs["triangularPrism"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(leftDoorRitem));
-
-	auto rightDoorRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&rightDoorRitem->World, XMMatrixScaling(.5f, 2.0f, .7f)*XMMatrixRotationX(XMConvertToRadians(-90))*XMMatrixRotationY(XMConvertToRadians(60))*XMMatrixTranslation(1.5f, 0.25f, -12.0f));
-	XMStoreFloat4x4(&rightDoorRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	rightDoorRitem->ObjCBIndex = 9;
-	rightDoorRitem->Mat = mMaterials["bricks0"].get();
-	rightDoorRitem->Geo = mGeometries["shapeGeo"].get();
-	rightDoorRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	rightDoorRitem->IndexCount = rightDoorRitem->Geo->DrawArgs["triangularPrism"].IndexCount;
-	rightDoorRitem->StartIndexLocation = rightDoorRitem->Geo->DrawArgs["triangularPrism"].StartIndexLocation;
-	rightDoorRitem->BaseVertexLocation = rightDoorRitem->Geo->DrawArgs["triangularPrism"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(rightDoorRitem));
-
-	auto diamondRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&diamondRitem->World, XMMatrixScaling(.7f, .5f, .7f)*XMMatrixTranslation(0.0f, 2.f, -8.0f));
-	XMStoreFloat4x4(&diamondRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	diamondRitem->ObjCBIndex = 10;
-	diamondRitem->Mat = mMaterials["shineBlue"].get();
-	diamondRitem->Geo = mGeometries["shapeGeo"].get();
-	diamondRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	diamondRitem->IndexCount = diamondRitem->Geo->DrawArgs["diamond"].IndexCount;
-	diamondRitem->StartIndexLocation = diamondRitem->Geo->DrawArgs["diamond"].StartIndexLocation;
-	diamondRitem->BaseVertexLocation = diamondRitem->Geo->DrawArgs["diamond"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(diamondRitem));
-
-	auto boxRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&boxRitem->World, XMMatrixScaling(4.5f, 2.0f, 4.5f)*XMMatrixTranslation(0.0f, 0.5f, 6.0f));
-	XMStoreFloat4x4(&boxRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	boxRitem->ObjCBIndex = 11;
-	boxRitem->Mat = mMaterials["shineRed"].get();
-	boxRitem->Geo = mGeometries["shapeGeo"].get();
-	boxRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	boxRitem->IndexCount = boxRitem->Geo->DrawArgs["box"].IndexCount;
-	boxRitem->StartIndexLocation = boxRitem->Geo->DrawArgs["box"].StartIndexLocation;
-	boxRitem->BaseVertexLocation = boxRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(boxRitem));
-
-    auto gridRitem = std::make_unique<RenderItem>();
-    gridRitem->World = MathHelper::Identity4x4();
-	XMStoreFloat4x4(&gridRitem->TexTransform, XMMatrixScaling(8.0f, 8.0f, 1.0f));
-	gridRitem->ObjCBIndex = 12;
-	gridRitem->Mat = mMaterials["tile0"].get();
-	gridRitem->Geo = mGeometries["shapeGeo"].get();
-	gridRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-    gridRitem->IndexCount = gridRitem->Geo->DrawArgs["grid"].IndexCount;
-    gridRitem->StartIndexLocation = gridRitem->Geo->DrawArgs["grid"].StartIndexLocation;
-    gridRitem->BaseVertexLocation = gridRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(gridRitem));
-
-	auto WedgeRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&WedgeRitem->World, XMMatrixScaling(.3f, .4f, 2.5f)*XMMatrixRotationY(XMConvertToRadians(-90))*XMMatrixTranslation(0.0f, .35f, 2.5f));
-	XMStoreFloat4x4(&WedgeRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	WedgeRitem->ObjCBIndex = 13;
-	WedgeRitem->Mat = mMaterials["wedgeMat"].get();
-	WedgeRitem->Geo = mGeometries["shapeGeo"].get();
-	WedgeRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	WedgeRitem->IndexCount = WedgeRitem->Geo->DrawArgs["wedge"].IndexCount;
-	WedgeRitem->StartIndexLocation = WedgeRitem->Geo->DrawArgs["wedge"].StartIndexLocation;
-	WedgeRitem->BaseVertexLocation = WedgeRitem->Geo->DrawArgs["wedge"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(WedgeRitem));
-
-	auto octahedronRitem1 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&octahedronRitem1->World, XMMatrixScaling(1.f, 1.f, 1.f)* XMMatrixTranslation(3.5f, 2.f, -8.f));
-	octahedronRitem1->TexTransform = MathHelper::Identity4x4();
-	octahedronRitem1->ObjCBIndex = 14;
-	octahedronRitem1->Mat = mMaterials["octahedronMat"].get();
-	octahedronRitem1->Geo = mGeometries["shapeGeo"].get();
-	octahedronRitem1->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	octahedronRitem1->IndexCount = octahedronRitem1->Geo->DrawArgs["octahedron"].IndexCount;
-	octahedronRitem1->StartIndexLocation = octahedronRitem1->Geo->DrawArgs["octahedron"].StartIndexLocation;
-	octahedronRitem1->BaseVertexLocation = octahedronRitem1->Geo->DrawArgs["octahedron"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(octahedronRitem1));
-
-	auto octahedronRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&octahedronRitem->World, XMMatrixScaling(1.f, 1.f, 1.f)* XMMatrixTranslation(-3.5f, 2.f, -8.f));
-	octahedronRitem->TexTransform = MathHelper::Identity4x4();
-	octahedronRitem->ObjCBIndex = 15;
-	octahedronRitem->Mat = mMaterials["octahedronMat"].get();
-	octahedronRitem->Geo = mGeometries["shapeGeo"].get();
-	octahedronRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	octahedronRitem->IndexCount = octahedronRitem->Geo->DrawArgs["octahedron"].IndexCount;
-	octahedronRitem->StartIndexLocation = octahedronRitem->Geo->DrawArgs["octahedron"].StartIndexLocation;
-	octahedronRitem->BaseVertexLocation = octahedronRitem->Geo->DrawArgs["octahedron"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(octahedronRitem));
+CastlePalette LitColumnsApp::BuildCastlePalette()const
+{
+	CastlePalette ids;
+	ids.Box = FindSubmesh("box");
+	ids.Grid = FindSubmesh("grid");
+	ids.Sphere = FindSubmesh("sphere");
+	ids.Cylinder = FindSubmesh("cylinder");
+	ids.Diamond = FindSubmesh("diamond");
+	ids.Wedge = FindSubmesh("wedge");
+	ids.Octahedron = FindSubmesh("octahedron");
+	ids.TriPrism = FindSubmesh("triangularPrism");
+	ids.Hexagon = FindSubmesh("hexagon");
+	ids.Octagon = FindSubmesh("octagon");
+	ids.Cone = FindSubmesh("cone");
+	ids.Pyramid = FindSubmesh("pyramid");
+	ids.Container = FindSubmesh("container");
+	ids.Star = FindSubmesh("star");
+
+	ids.BricksMat = FindMaterial("bricks0");
+	ids.StoneMat = FindMaterial("stone0");
+	ids.TileMat = FindMaterial("tile0");
+	ids.WedgeMat = FindMaterial("wedgeMat");
+	ids.DiaMat = FindMaterial("diaMat");
+	ids.OctahedronMat = FindMaterial("octahedronMat");
+	ids.SkyMat = FindMaterial("sky");
+	ids.GoldMat = FindMaterial("gold");
+	ids.ShineBlueMat = FindMaterial("shineBlue");
+	ids.ShineRedMat = FindMaterial("shineRed");
+	ids.WallMat = FindMaterial("wallPurple");
+	return ids;
+}
 
+UINT LitColumnsApp::BuildCastle(const CastlePalette& ids, FXMMATRIX castleWorld)
+{
+	XMMATRIX identity = XMMatrixIdentity();
+
+	// Every piece is placed relative to the castle, and the composite props
+	// relative to their own group node, so moving a node moves everything below it.
+	UINT castle = AddTransformNode(TransformStore::NoParent, castleWorld);
+
+	// Fountain in the front courtyard.
+	UINT fountain = AddTransformNode(castle, XMMatrixTranslation(0.f, 0.f, -8.f));
+	AddRenderItem(ids.Cylinder, ids.DiaMat, fountain, XMMatrixScaling(4.3f, .3f, 4.3f)*XMMatrixTranslation(0.f, 0.3f, 0.f), identity);
+	AddRenderItem(ids.Container, ids.StoneMat, fountain, XMMatrixScaling(1.3f, 1.f, 1.3f)*XMMatrixTranslation(0.f, 1.3f, 0.f), identity);
+	AddRenderItem(ids.Pyramid, ids.WedgeMat, castle, XMMatrixScaling(1.f, 1.5f, 1.f)*XMMatrixTranslation(-3.5f, .5f, -8.f), identity);
+	AddRenderItem(ids.Pyramid, ids.WedgeMat, castle, XMMatrixScaling(1.f, 1.5f, 1.f)*XMMatrixTranslation(3.5f, .5f, -8.f), identity);
+
+	// Keep.
+	UINT keep = AddTransformNode(castle, XMMatrixTranslation(0.0f, 0.0f, 6.0f));
+	AddRenderItem(ids.Cone, ids.SkyMat, keep, XMMatrixScaling(3.f, 2.f, 3.f)*XMMatrixTranslation(0.0f, 7.5f, 0.0f), identity);
+	AddRenderItem(ids.Cylinder, ids.DiaMat, keep, XMMatrixScaling(5.f, 1.f, 5.f)*XMMatrixTranslation(0.0f, 5.f, 0.0f), identity);
+	AddRenderItem(ids.Hexagon, ids.GoldMat, keep, XMMatrixScaling(4.5f, 2.0f, 4.5f)*XMMatrixTranslation(0.0f, 2.0f, 0.0f), identity);
+	AddRenderItem(ids.TriPrism, ids.SkyMat, castle, XMMatrixScaling(1.5f, 1.5f, 2.5f)*XMMatrixTranslation(0.0f, 0.5f, -2.5f), identity);
+
+	// Gate doors.
+	AddRenderItem(ids.TriPrism, ids.BricksMat, castle, XMMatrixScaling(.5f, 2.0f, .7f)*XMMatrixRotationX(XMConvertToRadians(-90))*XMMatrixRotationY(XMConvertToRadians(-30))*XMMatrixTranslation(-1.7f, 0.25f, -12.0f), identity);
+	AddRenderItem(ids.TriPrism, ids.BricksMat, castle, XMMatrixScaling(.5f, 2.0f, .7f)*XMMatrixRotationX(XMConvertToRadians(-90))*XMMatrixRotationY(XMConvertToRadians(60))*XMMatrixTranslation(1.5f, 0.25f, -12.0f), identity);
+
+	AddRenderItem(ids.Diamond, ids.ShineBlueMat, fountain, XMMatrixScaling(.7f, .5f, .7f)*XMMatrixTranslation(0.0f, 2.f, 0.0f), identity);
+	AddRenderItem(ids.Box, ids.ShineRedMat, keep, XMMatrixScaling(4.5f, 2.0f, 4.5f)*XMMatrixTranslation(0.0f, 0.5f, 0.0f), identity);
+	AddRenderItem(ids.Grid, ids.TileMat, castle, identity, XMMatrixScaling(8.0f, 8.0f, 1.0f));
+	AddRenderItem(ids.Wedge, ids.WedgeMat, castle, XMMatrixScaling(.3f, .4f, 2.5f)*XMMatrixRotationY(XMConvertToRadians(-90))*XMMatrixTranslation(0.0f, .35f, 2.5f), identity);
+	AddRenderItem(ids.Octahedron, ids.OctahedronMat, castle, XMMatrixTranslation(3.5f, 2.f, -8.f), identity);
+	AddRenderItem(ids.Octahedron, ids.OctahedronMat, castle, XMMatrixTranslation(-3.5f, 2.f, -8.f), identity);
+
+	// Columns with spheres on top.
 	XMMATRIX brickTexTransform = XMMatrixScaling(1.0f, 3.0f, 1.0f);
 	XMMATRIX sphereTransform = XMMatrixScaling(1.4f, 1.4f, 1.4f);
-	UINT objCBIndex = 16;
 	for(int i = 0; i < 2; ++i)
 	{
-		auto leftCylRitem = std::make_unique<RenderItem>();
-		auto rightCylRitem = std::make_unique<RenderItem>();
-		auto leftSphereRitem = std::make_unique<RenderItem>();
-		auto rightSphereRitem = std::make_unique<RenderItem>();
-
-		XMMATRIX leftCylWorld = XMMatrixTranslation(-3.0f, 2.f, 1.5f + i*8.9f);
-		XMMATRIX rightCylWorld = XMMatrixTranslation(+3.0f, 2.f, 1.5f + i*8.9f);
-
-		XMMATRIX leftSphereWorld = XMMatrixTranslation(-3.0f, 5.f, 1.5f + i*8.9f);
-		XMMATRIX rightSphereWorld = XMMatrixTranslation(+3.0f, 5.f, 1.5f + i*8.9f);
-
-		XMStoreFloat4x4(&leftCylRitem->World, brickTexTransform * rightCylWorld);
-		XMStoreFloat4x4(&leftCylRitem->TexTransform, brickTexTransform);
-		leftCylRitem->ObjCBIndex = objCBIndex++;
-		leftCylRitem->Mat = mMaterials["bricks0"].get();
-		leftCylRitem->Geo = mGeometries["shapeGeo"].get();
-		leftCylRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		leftCylRitem->IndexCount = leftCylRitem->Geo->DrawArgs["octagon"].IndexCount;
-		leftCylRitem->StartIndexLocation = leftCylRitem->Geo->DrawArgs["octagon"].StartIndexLocation;
-		leftCylRitem->BaseVertexLocation = leftCylRitem->Geo->DrawArgs["octagon"].BaseVertexLocation;
-
-		XMStoreFloat4x4(&rightCylRitem->World, brickTexTransform * leftCylWorld);
-		XMStoreFloat4x4(&rightCylRitem->TexTransform, brickTexTransform);
-		rightCylRitem->ObjCBIndex = objCBIndex++;
-		rightCylRitem->Mat = mMaterials["bricks0"].get();
-		rightCylRitem->Geo = mGeometries["shapeGeo"].get();
-		rightCylRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		rightCylRitem->IndexCount = rightCylRitem->Geo->DrawArgs["octagon"].IndexCount;
-		rightCylRitem->StartIndexLocation = rightCylRitem->Geo->DrawArgs["octagon"].StartIndexLocation;
-		rightCylRitem->BaseVertexLocation = rightCylRitem->Geo->DrawArgs["octagon"].BaseVertexLocation;
-
-		XMStoreFloat4x4(&leftSphereRitem->World, sphereTransform*leftSphereWorld);
-		leftSphereRitem->ObjCBIndex = objCBIndex++;
-		leftSphereRitem->Mat = mMaterials["gold"].get();
-		leftSphereRitem->Geo = mGeometries["shapeGeo"].get();
-		leftSphereRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		leftSphereRitem->IndexCount = leftSphereRitem->Geo->DrawArgs["sphere"].IndexCount;
-		leftSphereRitem->StartIndexLocation = leftSphereRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
-		leftSphereRitem->BaseVertexLocation = leftSphereRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
-
-		XMStoreFloat4x4(&rightSphereRitem->World, sphereTransform*rightSphereWorld);
-		rightSphereRitem->TexTransform = MathHelper::Identity4x4();
-		rightSphereRitem->ObjCBIndex = objCBIndex++;
-		rightSphereRitem->Mat = mMaterials["gold"].get();
-		rightSphereRitem->Geo = mGeometries["shapeGeo"].get();
-		rightSphereRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		rightSphereRitem->IndexCount = rightSphereRitem->Geo->DrawArgs["sphere"].IndexCount;
-		rightSphereRitem->StartIndexLocation = rightSphereRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
-		rightSphereRitem->BaseVertexLocation = rightSphereRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
-
-		mAllRitems.push_back(std::move(leftCylRitem));
-		mAllRitems.push_back(std::move(rightCylRitem));
-		mAllRitems.push_back(std::move(leftSphereRitem));
-		mAllRitems.push_back(std::move(rightSphereRitem));
+		UINT leftColumn = AddTransformNode(castle, XMMatrixTranslation(-3.0f, 0.f, 1.5f + i*8.9f));
+		UINT rightColumn = AddTransformNode(castle, XMMatrixTranslation(+3.0f, 0.f, 1.5f + i*8.9f));
+
+		XMMATRIX cylWorld = XMMatrixTranslation(0.0f, 2.f, 0.0f);
+		XMMATRIX sphereWorld = XMMatrixTranslation(0.0f, 5.f, 0.0f);
+
+		AddRenderItem(ids.Octagon, ids.BricksMat, rightColumn, brickTexTransform*cylWorld, brickTexTransform);
+		AddRenderItem(ids.Octagon, ids.BricksMat, leftColumn, brickTexTransform*cylWorld, brickTexTransform);
+		AddRenderItem(ids.Sphere, ids.GoldMat, leftColumn, sphereTransform*sphereWorld, identity);
+		AddRenderItem(ids.Sphere, ids.GoldMat, rightColumn, sphereTransform*sphereWorld, identity);
 	}
 
+	// Towers with cones on top.
 	XMMATRIX hexTransform = XMMatrixScaling(.5f, 1.2f, .5f);
 	XMMATRIX coneTransform = XMMatrixScaling(.7f, .7f, .7f);
-	objCBIndex = 24;
-	for (int i = 0; i < 2; ++i)
-	{
-		auto leftHexRitem = std::make_unique<RenderItem>();
-		auto righHexRitem = std::make_unique<RenderItem>();
-		auto leftSphereRitem = std::make_unique<RenderItem>();
-		auto rightSphereRitem = std::make_unique<RenderItem>();
-
-		XMMATRIX leftHexWorld = XMMatrixTranslation(-7.0f, .6f, .5f + i * 12.f);
-		XMMATRIX rightHexWorld = XMMatrixTranslation(+7.0f, .6f, .5f + i * 12.f);
-
-		XMMATRIX leftSphereWorld = XMMatrixTranslation(-7.0f, 1.6f, .5f + i * 12.f);
-		XMMATRIX rightSphereWorld = XMMatrixTranslation(+7.0f, 1.6f, .5f + i * 12.f);
-
-		XMStoreFloat4x4(&leftHexRitem->World, hexTransform*leftHexWorld);
-		XMStoreFloat4x4(&leftHexRitem->TexTransform, brickTexTransform);
-		leftHexRitem->ObjCBIndex = objCBIndex++;
-		leftHexRitem->Mat = mMaterials["diaMat"].get();
-		leftHexRitem->Geo = mGeometries["shapeGeo"].get();
-		leftHexRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		leftHexRitem->IndexCount = leftHexRitem->Geo->DrawArgs["hexagon"].IndexCount;
-		leftHexRitem->StartIndexLocation = leftHexRitem->Geo->DrawArgs["hexagon"].StartIndexLocation;
-		leftHexRitem->BaseVertexLocation = leftHexRitem->Geo->DrawArgs["hexagon"].BaseVertexLocation;
-
-		XMStoreFloat4x4(&righHexRitem->World, hexTransform*rightHexWorld);
-		XMStoreFloat4x4(&righHexRitem->TexTransform, brickTexTransform);
-		righHexRitem->ObjCBIndex = objCBIndex++;
-		righHexRitem->Mat = mMaterials["diaMat"].get();
-		righHexRitem->Geo = mGeometries["shapeGeo"].get();
-		righHexRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		righHexRitem->IndexCount = righHexRitem->Geo->DrawArgs["hexagon"].IndexCount;
-		righHexRitem->StartIndexLocation = righHexRitem->Geo->DrawArgs["hexagon"].StartIndexLocation;
-		righHexRitem->BaseVertexLocation = righHexRitem->Geo->DrawArgs["hexagon"].BaseVertexLocation;
-
-		XMStoreFloat4x4(&leftSphereRitem->World, coneTransform*leftSphereWorld);
-		leftSphereRitem->ObjCBIndex = objCBIndex++;
-		leftSphereRitem->Mat = mMaterials["gold"].get();
-		leftSphereRitem->Geo = mGeometries["shapeGeo"].get();
-		leftSphereRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		leftSphereRitem->IndexCount = leftSphereRitem->Geo->DrawArgs["cone"].IndexCount;
-		leftSphereRitem->StartIndexLocation = leftSphereRitem->Geo->DrawArgs["cone"].StartIndexLocation;
-		leftSphereRitem->BaseVertexLocation = leftSphereRitem->Geo->DrawArgs["cone"].BaseVertexLocation;
-
-		XMStoreFloat4x4(&rightSphereRitem->World, coneTransform*rightSphereWorld);
-		rightSphereRitem->TexTransform = MathHelper::Identity4x4();
-		rightSphereRitem->ObjCBIndex = objCBIndex++;
-		rightSphereRitem->Mat = mMaterials["gold"].get();
-		rightSphereRitem->Geo = mGeometries["shapeGeo"].get();
-		rightSphereRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		rightSphereRitem->IndexCount = rightSphereRitem->Geo->DrawArgs["cone"].IndexCount;
-		rightSphereRitem->StartIndexLocation = rightSphereRitem->Geo->DrawArgs["cone"].StartIndexLocation;
-		rightSphereRitem->BaseVertexLocation = rightSphereRitem->Geo->DrawArgs["cone"].BaseVertexLocation;
-
-		mAllRitems.push_back(std::move(leftHexRitem));
-		mAllRitems.push_back(std::move(righHexRitem));
-		mAllRitems.push_back(std::move(leftSphereRitem));
-		mAllRitems.push_back(std::move(rightSphereRitem));
-	}
-
-	auto leftMainWedgeRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&leftMainWedgeRitem->World, XMMatrixScaling(.3f, .4f, 4.f)*XMMatrixTranslation(-3.65f, .35f, 6.f));
-	XMStoreFloat4x4(&leftMainWedgeRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	leftMainWedgeRitem->ObjCBIndex = 32;
-	leftMainWedgeRitem->Mat = mMaterials["wedgeMat"].get();
-	leftMainWedgeRitem->Geo = mGeometries["shapeGeo"].get();
-	leftMainWedgeRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	leftMainWedgeRitem->IndexCount = leftMainWedgeRitem->Geo->DrawArgs["wedge"].IndexCount;
-	leftMainWedgeRitem->StartIndexLocation = leftMainWedgeRitem->Geo->DrawArgs["wedge"].StartIndexLocation;
-	leftMainWedgeRitem->BaseVertexLocation = leftMainWedgeRitem->Geo->DrawArgs["wedge"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(leftMainWedgeRitem));
-
-	auto rightMainWedgeRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&rightMainWedgeRitem->World, XMMatrixScaling(.3f, .4f, 4.f)*XMMatrixRotationY(XMConvertToRadians(180))*XMMatrixTranslation(3.65f, .35f, 6.f));
-	XMStoreFloat4x4(&rightMainWedgeRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	rightMainWedgeRitem->ObjCBIndex = 33;
-	rightMainWedgeRitem->Mat = mMaterials["wedgeMat"].get();
-	rightMainWedgeRitem->Geo = mGeometries["shapeGeo"].get();
-	rightMainWedgeRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	rightMainWedgeRitem->IndexCount = rightMainWedgeRitem->Geo->DrawArgs["wedge"].IndexCount;
-	rightMainWedgeRitem->StartIndexLocation = rightMainWedgeRitem->Geo->DrawArgs["wedge"].StartIndexLocation;
-	rightMainWedgeRitem->BaseVertexLocation = rightMainWedgeRitem->Geo->DrawArgs["wedge"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(rightMainWedgeRitem));
-
-	auto backMainWedgeRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&backMainWedgeRitem->World, XMMatrixScaling(.3f, .4f, 2.5f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(0.0f, .35f, 9.6f));
-	XMStoreFloat4x4(&backMainWedgeRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	backMainWedgeRitem->ObjCBIndex = 34;
-	backMainWedgeRitem->Mat = mMaterials["wedgeMat"].get();
-	backMainWedgeRitem->Geo = mGeometries["shapeGeo"].get();
-	backMainWedgeRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	backMainWedgeRitem->IndexCount = backMainWedgeRitem->Geo->DrawArgs["wedge"].IndexCount;
-	backMainWedgeRitem->StartIndexLocation = backMainWedgeRitem->Geo->DrawArgs["wedge"].StartIndexLocation;
-	backMainWedgeRitem->BaseVertexLocation = backMainWedgeRitem->Geo->DrawArgs["wedge"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(backMainWedgeRitem));
-
-	auto stickRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&stickRitem->World, XMMatrixScaling(.2f, 1.f, .2f)*XMMatrixTranslation(0.f, 8.3f, 6.f));
-	XMStoreFloat4x4(&stickRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	stickRitem->ObjCBIndex = 35;
-	stickRitem->Mat = mMaterials["diaMat"].get();
-	stickRitem->Geo = mGeometries["shapeGeo"].get();
-	stickRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	stickRitem->IndexCount = stickRitem->Geo->DrawArgs["cylinder"].IndexCount;
-	stickRitem->StartIndexLocation = stickRitem->Geo->DrawArgs["cylinder"].StartIndexLocation;
-	stickRitem->BaseVertexLocation = stickRitem->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(stickRitem));
-
-	auto starRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&starRitem->World, XMMatrixScaling(.6f, 1.f, .6f)*XMMatrixTranslation(0.f, 9.5f, 6.f));
-	XMStoreFloat4x4(&starRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	starRitem->ObjCBIndex = 36;
-	starRitem->Mat = mMaterials["shineRed"].get();
-	starRitem->Geo = mGeometries["shapeGeo"].get();
-	starRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	starRitem->IndexCount = starRitem->Geo->DrawArgs["star"].IndexCount;
-	starRitem->StartIndexLocation = starRitem->Geo->DrawArgs["star"].StartIndexLocation;
-	starRitem->BaseVertexLocation = starRitem->Geo->DrawArgs["star"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(starRitem));
-
-	auto wallsInBackRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallsInBackRitem->World, XMMatrixScaling(.2f, 2.6f, 8.f)*XMMatrixTranslation(-7.0f, 0.5f, 6.5f));
-	XMStoreFloat4x4(&wallsInBackRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallsInBackRitem->ObjCBIndex = 37;
-	wallsInBackRitem->Mat = mMaterials["wallPurple"].get();
-	wallsInBackRitem->Geo = mGeometries["shapeGeo"].get();
-	wallsInBackRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallsInBackRitem->IndexCount = wallsInBackRitem->Geo->DrawArgs["box"].IndexCount;
-	wallsInBackRitem->StartIndexLocation = wallsInBackRitem->Geo->DrawArgs["box"].StartIndexLocation;
-	wallsInBackRitem->BaseVertexLocation = wallsInBackRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(wallsInBackRitem));
-
-	auto wallsInBackRitem2 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallsInBackRitem2->World, XMMatrixScaling(.2f, 2.6f, 9.f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation( 0.0f, 0.5f, 12.5f));
-	XMStoreFloat4x4(&wallsInBackRitem2->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallsInBackRitem2->ObjCBIndex = 38;
-	wallsInBackRitem2->Mat = mMaterials["wallPurple"].get();
-	wallsInBackRitem2->Geo = mGeometries["shapeGeo"].get();
-	wallsInBackRitem2->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallsInBackRitem2->IndexCount = wallsInBackRitem2->Geo->DrawArgs["box"].IndexCount;
-	wallsInBackRitem2->StartIndexLocation = wallsInBackRitem2->Geo->DrawArgs["box"].StartIndexLocation;
-	wallsInBackRitem2->BaseVertexLocation = wallsInBackRitem2->Geo->DrawArgs["box"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(wallsInBackRitem2));
-
-	auto wallsInBackRitem3 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallsInBackRitem3->World, XMMatrixScaling(.2f, 2.6f, 8.f)*XMMatrixTranslation(7.0f, 0.5f, 6.5f));
-	XMStoreFloat4x4(&wallsInBackRitem3->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallsInBackRitem3->ObjCBIndex = 39;
-	wallsInBackRitem3->Mat = mMaterials["wallPurple"].get();
-	wallsInBackRitem3->Geo = mGeometries["shapeGeo"].get();
-	wallsInBackRitem3->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallsInBackRitem3->IndexCount = wallsInBackRitem3->Geo->DrawArgs["box"].IndexCount;
-	wallsInBackRitem3->StartIndexLocation = wallsInBackRitem3->Geo->DrawArgs["box"].StartIndexLocation;
-	wallsInBackRitem3->BaseVertexLocation = wallsInBackRitem3->Geo->DrawArgs["box"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(wallsInBackRitem3));
-
-	objCBIndex = 40;
-	for (int i = 0; i < 2; ++i) {
-		auto wallsInMidRitem = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&wallsInMidRitem->World, XMMatrixScaling(.2f, 2.6f, 3.f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(-5.f + 10.f*i, 0.5f, .5f));
-		XMStoreFloat4x4(&wallsInMidRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		wallsInMidRitem->ObjCBIndex = objCBIndex++;
-		wallsInMidRitem->Mat = mMaterials["wallPurple"].get();
-		wallsInMidRitem->Geo = mGeometries["shapeGeo"].get();
-		wallsInMidRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		wallsInMidRitem->IndexCount = wallsInMidRitem->Geo->DrawArgs["box"].IndexCount;
-		wallsInMidRitem->StartIndexLocation = wallsInMidRitem->Geo->DrawArgs["box"].StartIndexLocation;
-		wallsInMidRitem->BaseVertexLocation = wallsInMidRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-		mAllRitems.push_back(std::move(wallsInMidRitem));
-	}
-
-	objCBIndex = 42;
-	for (int i = 0; i < 2; ++i) {
-		auto wallsInMidRitem = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&wallsInMidRitem->World, XMMatrixScaling(.2f, 2.6f, 2.f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(-4.f + 8.f*i, 0.5f, -5.5f));
-		XMStoreFloat4x4(&wallsInMidRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		wallsInMidRitem->ObjCBIndex = objCBIndex++;
-		wallsInMidRitem->Mat = mMaterials["wallPurple"].get();
-		wallsInMidRitem->Geo = mGeometries["shapeGeo"].get();
-		wallsInMidRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		wallsInMidRitem->IndexCount = wallsInMidRitem->Geo->DrawArgs["box"].IndexCount;
-		wallsInMidRitem->StartIndexLocation = wallsInMidRitem->Geo->DrawArgs["box"].StartIndexLocation;
-		wallsInMidRitem->BaseVertexLocation = wallsInMidRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-		mAllRitems.push_back(std::move(wallsInMidRitem));
-	}
-
-	objCBIndex = 44;
-	for (int i = 0; i < 2; ++i) {
-		auto wallsInMidRitem2 = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&wallsInMidRitem2->World, XMMatrixScaling(.2f, 2.6f, 4.f)*XMMatrixTranslation(-5.35f + 10.7f*i, 0.5f, -8.5f));
-		XMStoreFloat4x4(&wallsInMidRitem2->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		wallsInMidRitem2->ObjCBIndex = objCBIndex++;
-		wallsInMidRitem2->Mat = mMaterials["wallPurple"].get();
-		wallsInMidRitem2->Geo = mGeometries["shapeGeo"].get();
-		wallsInMidRitem2->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		wallsInMidRitem2->IndexCount = wallsInMidRitem2->Geo->DrawArgs["box"].IndexCount;
-		wallsInMidRitem2->StartIndexLocation = wallsInMidRitem2->Geo->DrawArgs["box"].StartIndexLocation;
-		wallsInMidRitem2->BaseVertexLocation = wallsInMidRitem2->Geo->DrawArgs["box"].BaseVertexLocation;
-		mAllRitems.push_back(std::move(wallsInMidRitem2));
-	}
-
-	objCBIndex = 46;
-	for (int i = 0; i < 2; ++i) {
-		auto frontWallsRitem = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&frontWallsRitem->World, XMMatrixScaling(.2f, 2.6f, 2.f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(-4.f + 8.f*i, 0.5f, -11.5f));
-		XMStoreFloat4x4(&frontWallsRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		frontWallsRitem->ObjCBIndex = objCBIndex++;
-		frontWallsRitem->Mat = mMaterials["wallPurple"].get();
-		frontWallsRitem->Geo = mGeometries["shapeGeo"].get();
-		frontWallsRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		frontWallsRitem->IndexCount = frontWallsRitem->Geo->DrawArgs["box"].IndexCount;
-		frontWallsRitem->StartIndexLocation = frontWallsRitem->Geo->DrawArgs["box"].StartIndexLocation;
-		frontWallsRitem->BaseVertexLocation = frontWallsRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-		mAllRitems.push_back(std::move(frontWallsRitem));
-	}
-
-	objCBIndex = 48;
-	for (int i = 0; i < 2; ++i) {
-		auto CorridorWallsRitem = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&CorridorWallsRitem->World, XMMatrixScaling(.2f, 2.6f, 4.2f)*XMMatrixTranslation(-2.7f + 5.4f*i, 0.5f, -2.5f));
-		XMStoreFloat4x4(&CorridorWallsRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		CorridorWallsRitem->ObjCBIndex = objCBIndex++;
-		CorridorWallsRitem->Mat = mMaterials["wallPurple"].get();
-		CorridorWallsRitem->Geo = mGeometries["shapeGeo"].get();
-		CorridorWallsRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		CorridorWallsRitem->IndexCount = CorridorWallsRitem->Geo->DrawArgs["box"].IndexCount;
-		CorridorWallsRitem->StartIndexLocation = CorridorWallsRitem->Geo->DrawArgs["box"].StartIndexLocation;
-		CorridorWallsRitem->BaseVertexLocation = CorridorWallsRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-		mAllRitems.push_back(std::move(CorridorWallsRitem));
+	for(int i = 0; i < 2; ++i)
+	{
+		UINT leftTower = AddTransformNode(castle, XMMatrixTranslation(-7.0f, 0.f, .5f + i*12.f));
+		UINT rightTower = AddTransformNode(castle, XMMatrixTranslation(+7.0f, 0.f, .5f + i*12.f));
+
+		XMMATRIX hexWorld = XMMatrixTranslation(0.0f, .6f, 0.0f);
+		XMMATRIX coneWorld = XMMatrixTranslation(0.0f, 1.6f, 0.0f);
+
+		AddRenderItem(ids.Hexagon, ids.DiaMat, leftTower, hexTransform*hexWorld, brickTexTransform);
+		AddRenderItem(ids.Hexagon, ids.DiaMat, rightTower, hexTransform*hexWorld, brickTexTransform);
+		AddRenderItem(ids.Cone, ids.GoldMat, leftTower, coneTransform*coneWorld, identity);
+		AddRenderItem(ids.Cone, ids.GoldMat, rightTower, coneTransform*coneWorld, identity);
 	}
 
+	AddRenderItem(ids.Wedge, ids.WedgeMat, castle, XMMatrixScaling(.3f, .4f, 4.f)*XMMatrixTranslation(-3.65f, .35f, 6.f), identity);
+	AddRenderItem(ids.Wedge, ids.WedgeMat, castle, XMMatrixScaling(.3f, .4f, 4.f)*XMMatrixRotationY(XMConvertToRadians(180))*XMMatrixTranslation(3.65f, .35f, 6.f), identity);
+	AddRenderItem(ids.Wedge, ids.WedgeMat, castle, XMMatrixScaling(.3f, .4f, 2.5f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(0.0f, .35f, 9.6f), identity);
 
-	// All the render items are opaque.
-	for(auto& e : mAllRitems)
-		mOpaqueRitems.push_back(e.get());
+	// Flag pole and star on top of the keep.
+	AddRenderItem(ids.Cylinder, ids.DiaMat, keep, XMMatrixScaling(.2f, 1.f, .2f)*XMMatrixTranslation(0.f, 8.3f, 0.f), identity);
+	AddRenderItem(ids.Star, ids.ShineRedMat, keep, XMMatrixScaling(.6f, 1.f, .6f)*XMMatrixTranslation(0.f, 9.5f, 0.f), identity);
+
+	// Walls.
+	AddRenderItem(ids.Box, ids.WallMat, castle, XMMatrixScaling(.2f, 2.6f, 8.f)*XMMatrixTranslation(-7.0f, 0.5f, 6.5f), identity);
+	AddRenderItem(ids.Box, ids.WallMat, castle, XMMatrixScaling(.2f, 2.6f, 9.f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(0.0f, 0.5f, 12.5f), identity);
+	AddRenderItem(ids.Box, ids.WallMat, castle, XMMatrixScaling(.2f, 2.6f, 8.f)*XMMatrixTranslation(7.0f, 0.5f, 6.5f), identity);
+
+	for(int i = 0; i < 2; ++i)
+		AddRenderItem(ids.Box, ids.WallMat, castle, XMMatrixScaling(.2f, 2.6f, 3.f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(-5.f + 10.f*i, 0.5f, .5f), identity);
+
+	for(int i = 0; i < 2; ++i)
+		AddRenderItem(ids.Box, ids.WallMat, castle, XMMatrixScaling(.2f, 2.6f, 2.f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(-4.f + 8.f*i, 0.5f, -5.5f), identity);
+
+	for(int i = 0; i < 2; ++i)
+		AddRenderItem(ids.Box, ids.WallMat, castle, XMMatrixScaling(.2f, 2.6f, 4.f)*XMMatrixTranslation(-5.35f + 10.7f*i, 0.5f, -8.5f), identity);
+
+	for(int i = 0; i < 2; ++i)
+		AddRenderItem(ids.Box, ids.WallMat, castle, XMMatrixScaling(.2f, 2.6f, 2.f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(-4.f + 8.f*i, 0.5f, -11.5f), identity);
+
+	// Corridor from the gate to the keep.
+	for(int i = 0; i < 2; ++i)
+		AddRenderItem(ids.Box, ids.WallMat, castle, XMMatrixScaling(.2f, 2.6f, 4.2f)*XMMatrixTranslation(-2.7f + 5.4f*i, 0.5f, -2.5f), identity);
+
+	BuildCastleLights(castleWorld);
+	return castle;
+}
+
+void LitColumnsApp::BuildCastleLights(FXMMATRIX castleWorld)
+{
+	UINT firstPoint = (UINT)mPointLights.size();
+	UINT firstSpot = (UINT)mSpotLights.size();
+	mPointLights.resize(firstPoint + PointLightsPerCastle);
+	mSpotLights.resize(firstSpot + SpotLightsPerCastle);
+	PlaceCastleLights(firstPoint, firstSpot, castleWorld, true);
+}
+
+void LitColumnsApp::PlaceCastleLights(UINT firstPoint, UINT firstSpot, FXMMATRIX castleWorld, bool lit)
+{
+	// Torches above the four towers and either side of the gate.  A light
+	// that is not lit gets no range, and UpdateLightBuffer skips it.
+	const XMFLOAT3 torchPositions[PointLightsPerCastle] =
+	{
+		{ -7.0f, 3.0f, 0.5f }, { 7.0f, 3.0f, 0.5f }, { -7.0f, 3.0f, 12.5f }, { 7.0f, 3.0f, 12.5f },
+		{ -2.5f, 2.0f, -12.5f }, { 2.5f, 2.0f, -12.5f },
+	};
+
+	for(UINT i = 0; i < PointLightsPerCastle; ++i)
+	{
+		Light& torch = mPointLights[firstPoint + i];
+		XMStoreFloat3(&torch.Position, XMVector3TransformCoord(XMLoadFloat3(&torchPositions[i]), castleWorld));
+		torch.Strength = { 1.0f, 0.55f, 0.2f };
+		torch.FalloffStart = 1.0f;
+		torch.FalloffEnd = lit ? 7.0f : 0.0f;
+	}
+
+	// Spotlights on the keep pointing down at the fountain and the gate.
+	const XMFLOAT3 spotTargets[SpotLightsPerCastle] = { { 0.0f, 0.0f, -8.0f }, { 0.0f, 0.0f, -12.0f } };
+	for(UINT i = 0; i < SpotLightsPerCastle; ++i)
+	{
+		XMVECTOR pos = XMVector3TransformCoord(XMVectorSet(0.0f, 9.0f, 3.0f, 1.0f), castleWorld);
+		XMVECTOR dir = XMVector3Normalize(XMVector3TransformCoord(XMLoadFloat3(&spotTargets[i]), castleWorld) - pos);
+
+		Light& spot = mSpotLights[firstSpot + i];
+		XMStoreFloat3(&spot.Position, pos);
+		XMStoreFloat3(&spot.Direction, dir);
+		spot.Strength = { 0.9f, 0.9f, 1.0f };
+		spot.FalloffStart = 10.0f;
+		spot.FalloffEnd = lit ? 25.0f : 0.0f;
+		spot.SpotPower = 32.0f;
+	}
+}
+
+UINT LitColumnsApp::AddTransformNode(UINT parent, FXMMATRIX local)
+{
+	mTransformOwners.push_back(nullptr);
+	return mTransforms.Add(parent, local, XMMatrixIdentity());
+}
+
+void LitColumnsApp::AddRenderItem(UINT submesh, UINT mat, UINT parent, FXMMATRIX local, CXMMATRIX texTransform)
+{
+	const SceneSubmesh& sub = mSubmeshes[submesh];
+	const SubmeshGeometry& args = sub.Lods[0];
+
+	RenderItem* ritem = mRitemPool.Allocate();
+	ritem->TransformIndex = mTransforms.Add(parent, local, texTransform);
+	mTransformOwners.push_back(ritem);
+
+	// Object constant buffer slots are handed out in creation order.  With
+	// streaming every item belongs to a cell slot and has its constants
+	// streamed instead.
+	ritem->ObjCBIndex = mStreamingEnabled ? (UINT)-1 : mObjectCBCount++;
+	ritem->Mat = &mMaterials[mat];
+	ritem->Geo = mGeometries[sub.GeoIndex];
+	ritem->GeoIndex = sub.GeoIndex;
+	ritem->Submesh = submesh;
+	ritem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	ritem->IndexCount = args.IndexCount;
+	ritem->StartIndexLocation = args.StartIndexLocation;
+	ritem->BaseVertexLocation = args.BaseVertexLocation;
+	ritem->Bounds = args.Bounds;
+	mAllRitems.push_back(ritem);
+}
+
+void LitColumnsApp::BuildInstanceBatches()
+{
+	// Batches are found by their state.
+	typedef std::tuple<const MeshGeometry*, const Material*, D3D12_PRIMITIVE_TOPOLOGY, UINT> BatchKey;
+	std::map<BatchKey, size_t> batchIndices;
+
+	for(auto ri : mOpaqueRitems)
+	{
+		BatchKey key(ri->Geo, ri->Mat, ri->PrimitiveType, ri->Submesh);
+		auto it = batchIndices.find(key);
+
+		if(it == batchIndices.end())
+		{
+			InstanceBatch batch;
+			batch.Mat = ri->Mat;
+			batch.Geo = ri->Geo;
+			batch.PrimitiveType = ri->PrimitiveType;
+			batch.Submesh = &mSubmeshes[ri->Submesh];
+			mInstanceBatches.push_back(batch);
+			it = batchIndices.emplace(key, mInstanceBatches.size() - 1).first;
+		}
+
+		mInstanceBatches[it->second].Instances.push_back(ri);
+	}
+
+	// Order the batches by state so that consecutive batches can share bindings.
+	std::sort(mInstanceBatches.begin(), mInstanceBatches.end(),
+		[](const InstanceBatch& a, const InstanceBatch& b)
+		{
+			const RenderItem* ra = a.Instances.front();
+			const RenderItem* rb = b.Instances.front();
+			return MakeSortKey(ra->PsoIndex, ra->GeoIndex, ra->Mat->MatCBIndex, 0.0f) <
+				MakeSortKey(rb->PsoIndex, rb->GeoIndex, rb->Mat->MatCBIndex, 0.0f);
+		});
 }
 
 
 
-void LitColumnsApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
+void LitColumnsApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems, size_t begin, size_t end, DrawStats& stats)
 {
     UINT objCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
     UINT matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(MaterialConstants));
@@ -1428,21 +4339,135 @@ void LitColumnsApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const st
 	auto objectCB = mCurrFrameResource->ObjectCB->Resource();
 	auto matCB = mCurrFrameResource->MaterialCB->Resource();
 
+	// State bound by the previous item.  The list is sorted by state, so only
+	// the bindings that differ from it need to be set.
+	MeshGeometry* boundGeo = nullptr;
+	D3D12_PRIMITIVE_TOPOLOGY boundTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+	Material* boundMat = nullptr;
+
     // For each render item...
-    for(size_t i = 0; i < ritems.size(); ++i)
+    for(size_t i = begin; i < end; ++i)
     {
         auto ri = ritems[i];
 
-        cmdList->IASetVertexBuffers(0, 1, &ri->Geo->VertexBufferView());
-        cmdList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
-        cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
+		if(ri->Geo != boundGeo)
+		{
+			cmdList->IASetVertexBuffers(0, 1, &ri->Geo->VertexBufferView());
+			cmdList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
+			boundGeo = ri->Geo;
+			stats.StateChanges += 2;
+		}
+		else
+			stats.StateChangesSkipped += 2;
+
+		if(ri->PrimitiveType != boundTopology)
+		{
+			cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
+			boundTopology = ri->PrimitiveType;
+			stats.StateChanges++;
+		}
+		else
+			stats.StateChangesSkipped++;
 
-        D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB->GetGPUVirtualAddress() + ri->ObjCBIndex*objCBByteSize;
-		D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB->GetGPUVirtualAddress() + ri->Mat->MatCBIndex*matCBByteSize;
+		if(ri->Mat != boundMat)
+		{
+			if(mBindlessMaterials)
+				cmdList->SetGraphicsRoot32BitConstant(1, ri->Mat->MatCBIndex, 0);
+			else
+			{
+				D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB->GetGPUVirtualAddress() + ri->Mat->MatCBIndex*matCBByteSize;
+				cmdList->SetGraphicsRootConstantBufferView(1, matCBAddress);
+			}
+			boundMat = ri->Mat;
+			stats.StateChanges++;
+		}
+		else
+			stats.StateChangesSkipped++;
 
+		D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = ri->ObjCBIndex == (UINT)-1 ? ri->RingCB :
+			objectCB->GetGPUVirtualAddress() + ri->ObjCBIndex*objCBByteSize;
         cmdList->SetGraphicsRootConstantBufferView(0, objCBAddress);
-		cmdList->SetGraphicsRootConstantBufferView(1, matCBAddress);
 
         cmdList->DrawIndexedInstanced(ri->IndexCount, 1, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
+        stats.DrawCalls++;
+		INSTRUMENT_COUNT(DrawCalls, 1);
+		INSTRUMENT_COUNT(Triangles, ri->IndexCount/3);
     }
 }
+
+void LitColumnsApp::DrawInstanceBatches(ID3D12GraphicsCommandList* cmdList, const std::vector<InstanceBatch>& batches, size_t begin, size_t end, DrawStats& stats)
+{
+	UINT matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(MaterialConstants));
+
+	auto instanceBuffer = mCurrFrameResource->InstanceBuffer->Resource();
+	auto matCB = mCurrFrameResource->MaterialCB->Resource();
+
+	// Batches are sorted by state, see BuildInstanceBatches.
+	MeshGeometry* boundGeo = nullptr;
+	D3D12_PRIMITIVE_TOPOLOGY boundTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+	Material* boundMat = nullptr;
+
+	// For each batch...
+	for(size_t i = begin; i < end; ++i)
+	{
+		auto& batch = batches[i];
+
+		UINT instanceCount = 0;
+		for(UINT lod = 0; lod < batch.Submesh->LodCount; ++lod)
+			instanceCount += batch.InstanceCount[lod];
+
+		if(instanceCount == 0)
+			continue;
+
+		if(batch.Geo != boundGeo)
+		{
+			cmdList->IASetVertexBuffers(0, 1, &batch.Geo->VertexBufferView());
+			cmdList->IASetIndexBuffer(&batch.Geo->IndexBufferView());
+			boundGeo = batch.Geo;
+			stats.StateChanges += 2;
+		}
+		else
+			stats.StateChangesSkipped += 2;
+
+		if(batch.PrimitiveType != boundTopology)
+		{
+			cmdList->IASetPrimitiveTopology(batch.PrimitiveType);
+			boundTopology = batch.PrimitiveType;
+			stats.StateChanges++;
+		}
+		else
+			stats.StateChangesSkipped++;
+
+		if(batch.Mat != boundMat)
+		{
+			if(mBindlessMaterials)
+				cmdList->SetGraphicsRoot32BitConstant(1, batch.Mat->MatCBIndex, 0);
+			else
+			{
+				D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB->GetGPUVirtualAddress() + batch.Mat->MatCBIndex*matCBByteSize;
+				cmdList->SetGraphicsRootConstantBufferView(1, matCBAddress);
+			}
+			boundMat = batch.Mat;
+			stats.StateChanges++;
+		}
+		else
+			stats.StateChangesSkipped++;
+
+		for(UINT lod = 0; lod < batch.Submesh->LodCount; ++lod)
+		{
+			if(batch.InstanceCount[lod] == 0)
+				continue;
+
+			// Offset the root SRV to the first instance so SV_InstanceID starts at 0.
+			D3D12_GPU_VIRTUAL_ADDRESS instanceAddress = instanceBuffer->GetGPUVirtualAddress() +
+				batch.StartInstance[lod]*sizeof(InstanceData);
+			cmdList->SetGraphicsRootShaderResourceView(3, instanceAddress);
+
+			const SubmeshGeometry& args = batch.Submesh->Lods[lod];
+			cmdList->DrawIndexedInstanced(args.IndexCount, batch.InstanceCount[lod], args.StartIndexLocation, args.BaseVertexLocation, 0);
+			stats.DrawCalls++;
+			INSTRUMENT_COUNT(DrawCalls, 1);
+			INSTRUMENT_COUNT(Triangles, (UINT64)(args.IndexCount/3)*batch.InstanceCount[lod]);
+		}
+	}
+}
@@ -0,0 +1,107 @@
+//***************************************************************************************
+// ClusterLights.hlsl
+//
+// Bins the point and spot lights into the view space clusters of
+// LightingUtil.hlsl.  One thread per cluster builds the cluster's bounding box
+// and tests it against every light's sphere of influence.  The lights are
+// loaded into groupshared memory a group at a time, so each light is read and
+// transformed to view space once per thread group rather than once per cluster.
+//***************************************************************************************
+
+#include "LightingUtil.hlsl"
+
+#define GROUP_SIZE 64
+
+// Mirrors ClusterConstants in FrameResource.h.
+cbuffer cbCluster : register(b0)
+{
+    float4x4 gView;
+    float4x4 gInvProj;
+    float gNearZ;
+    float gFarZ;
+    uint gNumPointLights;
+    uint gNumSpotLights;
+};
+
+// Point lights followed by spot lights.
+StructuredBuffer<Light> gLocalLights : register(t0);
+
+RWStructuredBuffer<uint> gClusterLights : register(u0);
+
+// View space centre and radius of the lights being tested.
+groupshared float4 gLightSpheres[GROUP_SIZE];
+
+// Point on the near plane with the given NDC x and y, in view space.
+float3 NdcToView(float2 ndc)
+{
+    float4 p = mul(float4(ndc, 0.0f, 1.0f), gInvProj);
+    return p.xyz / p.w;
+}
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void CS(uint3 dispatchThreadID : SV_DispatchThreadID, uint groupIndex : SV_GroupIndex)
+{
+    const uint clusterCount = CLUSTER_COUNT_X*CLUSTER_COUNT_Y*CLUSTER_COUNT_Z;
+    const uint lightCount = gNumPointLights + gNumSpotLights;
+
+    uint cluster = dispatchThreadID.x;
+    bool valid = cluster < clusterCount;
+
+    uint x = cluster % CLUSTER_COUNT_X;
+    uint y = (cluster / CLUSTER_COUNT_X) % CLUSTER_COUNT_Y;
+    uint z = cluster / (CLUSTER_COUNT_X*CLUSTER_COUNT_Y);
+
+    // Corners of the tile, with tile rows counted down from the top of the
+    // screen like ClusterIndex, and the depths bounding the slice, the inverse
+    // of ClusterSlice.
+    float2 ndcMin = float2(2.0f*x / CLUSTER_COUNT_X - 1.0f, 1.0f - 2.0f*(y + 1) / CLUSTER_COUNT_Y);
+    float2 ndcMax = float2(2.0f*(x + 1) / CLUSTER_COUNT_X - 1.0f, 1.0f - 2.0f*y / CLUSTER_COUNT_Y);
+    float sliceNear = gNearZ*pow(gFarZ / gNearZ, (float)z / CLUSTER_COUNT_Z);
+    float sliceFar = gNearZ*pow(gFarZ / gNearZ, (float)(z + 1) / CLUSTER_COUNT_Z);
+
+    // The cluster is bounded by the rays through the corners, cut at the slice
+    // depths.  x and y scale with depth independently, so the two diagonal
+    // corners give the extremes.
+    float3 cornerMin = NdcToView(ndcMin);
+    float3 cornerMax = NdcToView(ndcMax);
+    float3 a = cornerMin*(sliceNear / cornerMin.z);
+    float3 b = cornerMin*(sliceFar / cornerMin.z);
+    float3 c = cornerMax*(sliceNear / cornerMax.z);
+    float3 d = cornerMax*(sliceFar / cornerMax.z);
+    float3 boxMin = min(min(a, b), min(c, d));
+    float3 boxMax = max(max(a, b), max(c, d));
+
+    uint base = cluster*CLUSTER_STRIDE;
+    uint count = 0;
+
+    // Every thread takes part in the loads and barriers, including those past
+    // the last cluster.
+    for(uint first = 0; first < lightCount; first += GROUP_SIZE)
+    {
+        uint i = first + groupIndex;
+        if(i < lightCount)
+        {
+            Light L = gLocalLights[i];
+            gLightSpheres[groupIndex] = float4(mul(float4(L.Position, 1.0f), gView).xyz, L.FalloffEnd);
+        }
+        GroupMemoryBarrierWithGroupSync();
+
+        uint groupLightCount = min(GROUP_SIZE, lightCount - first);
+        for(uint j = 0; j < groupLightCount && valid; ++j)
+        {
+            float4 sphere = gLightSpheres[j];
+            float3 delta = sphere.xyz - clamp(sphere.xyz, boxMin, boxMax);
+
+            if(dot(delta, delta) <= sphere.w*sphere.w && count < MAX_LIGHTS_PER_CLUSTER)
+            {
+                uint index = first + j;
+                gClusterLights[base + 1 + count] = index < gNumPointLights ? index : (index | CLUSTER_SPOT_LIGHT_BIT);
+                ++count;
+            }
+        }
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    if(valid)
+        gClusterLights[base] = count;
+}
@@ -0,0 +1,188 @@
+//***************************************************************************************
+// Cull.hlsl
+//
+// GPU-driven culling.  One thread per opaque render item tests the item's world
+// bounding sphere against the camera frustum, picks its level of detail from
+// its projected size, and appends an ExecuteIndirect command for it.  Items
+// hidden behind the previous frame's depth, by the hierarchical depth buffer
+// test of Common/HiZBuffer.cpp, are dropped as well, as are the empty records
+// (LodCount 0) of inactive items and of items whose geometry is not
+// resident.  The layouts mirror IndirectItem, IndirectCommand, CullConstants
+// and HiZConstants in FrameResource.h.
+//***************************************************************************************
+
+#define MAX_LODS 4
+
+struct IndirectItem
+{
+    float4 WorldSphere;
+    uint2  ObjectCB;
+    uint2  Material;
+    uint2  VertexBufferLocation;
+    uint   VertexBufferSize;
+    uint   VertexBufferStride;
+    uint2  IndexBufferLocation;
+    uint   IndexBufferSize;
+    uint   IndexBufferFormat;
+    uint   LodCount;
+    uint3  Pad;
+
+    // IndexCount, StartIndexLocation, BaseVertexLocation, unused.
+    uint4  Lods[MAX_LODS];
+};
+
+struct IndirectCommand
+{
+    uint2  ObjectCB;
+    uint2  Material;
+    uint2  VertexBufferLocation;
+    uint   VertexBufferSize;
+    uint   VertexBufferStride;
+    uint2  IndexBufferLocation;
+    uint   IndexBufferSize;
+    uint   IndexBufferFormat;
+    uint   IndexCountPerInstance;
+    uint   InstanceCount;
+    uint   StartIndexLocation;
+    int    BaseVertexLocation;
+    uint   StartInstanceLocation;
+    uint   Pad;
+};
+
+cbuffer cbCull : register(b0)
+{
+    // World space, pointing inwards.
+    float4 gFrustumPlanes[6];
+    float3 gEyePosW;
+    float  gProjScale;
+    float4 gLodScreenSizes;
+    uint   gItemCount;
+    uint   gFrustumCullingEnabled;
+    uint   gLodEnabled;
+    uint   gCullPad;
+};
+
+// Camera the depth pyramid was rendered with; see HiZBuffer::SetCamera.
+cbuffer cbHiZ : register(b1)
+{
+    float4x4 gHiZView;
+    float  gHiZProjScaleX;
+    float  gHiZProjScaleY;
+    float  gHiZDepthA;
+    float  gHiZDepthB;
+    uint2  gHiZDepthSize;
+    uint   gHiZLevelCount;
+    uint   gHiZEnabled;
+};
+
+StructuredBuffer<IndirectItem> gItems : register(t0);
+
+// Every level of the depth pyramid.
+Texture2D<float> gHiZ : register(t1);
+
+RWStructuredBuffer<IndirectCommand> gCommands : register(u0);
+
+// Number of commands written; read by ExecuteIndirect as the draw count.
+RWByteAddressBuffer gCommandCount : register(u1);
+
+// Same test as HiZBuffer::IsOccluded.
+bool IsOccluded(float3 centerW, float radius)
+{
+    float3 c = mul(float4(centerW, 1.0f), gHiZView).xyz;
+    float z0 = c.z - radius;
+    float z1 = c.z + radius;
+    if(z0*gHiZDepthA + gHiZDepthB <= 0.0f)
+        return false;
+
+    float2 boundsMin = c.xy - radius;
+    float2 boundsMax = c.xy + radius;
+    float2 scale = float2(gHiZProjScaleX, gHiZProjScaleY);
+    float2 ndcMin = scale*boundsMin / float2(boundsMin.x < 0.0f ? z0 : z1, boundsMin.y < 0.0f ? z0 : z1);
+    float2 ndcMax = scale*boundsMax / float2(boundsMax.x > 0.0f ? z0 : z1, boundsMax.y > 0.0f ? z0 : z1);
+    if(any(ndcMin < -1.0f) || any(ndcMax > 1.0f))
+        return false;
+
+    float2 p0 = float2(0.5f*ndcMin.x + 0.5f, 0.5f - 0.5f*ndcMax.y)*gHiZDepthSize;
+    float2 p1 = float2(0.5f*ndcMax.x + 0.5f, 0.5f - 0.5f*ndcMin.y)*gHiZDepthSize;
+
+    float extent = max(p1.x - p0.x, p1.y - p0.y);
+    uint level = 0;
+    while(level + 1 < gHiZLevelCount && (float)(2u << level) < extent)
+        ++level;
+
+    uint width, height, levels;
+    gHiZ.GetDimensions(level, width, height, levels);
+    uint2 levelMax = uint2(width, height) - 1;
+    uint2 t0 = min((uint2)p0 >> (level + 1), levelMax);
+    uint2 t1 = min((uint2)p1 >> (level + 1), levelMax);
+
+    float farthest = 0.0f;
+    for(uint y = t0.y; y <= t1.y; ++y)
+    {
+        for(uint x = t0.x; x <= t1.x; ++x)
+            farthest = max(farthest, gHiZ.Load(int3(x, y, level)));
+    }
+
+    return gHiZDepthA + gHiZDepthB / z0 > farthest;
+}
+
+[numthreads(64, 1, 1)]
+void CS(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    uint i = dispatchThreadID.x;
+    if(i >= gItemCount)
+        return;
+
+    IndirectItem item = gItems[i];
+    if(item.LodCount == 0)
+        return;
+
+    float3 center = item.WorldSphere.xyz;
+    float radius = item.WorldSphere.w;
+
+    if(gFrustumCullingEnabled)
+    {
+        [unroll]
+        for(int p = 0; p < 6; ++p)
+        {
+            if(dot(gFrustumPlanes[p].xyz, center) + gFrustumPlanes[p].w < -radius)
+                return;
+        }
+    }
+
+    if(gHiZEnabled && IsOccluded(center, radius))
+        return;
+
+    // Same rule as LitColumnsApp::SelectLods: radius over distance times the
+    // projection's y scale is the fraction of the viewport height covered.
+    uint lod = 0;
+    if(gLodEnabled)
+    {
+        float dist = distance(center, gEyePosW);
+        float size = dist > radius ? radius*gProjScale / dist : 1.0f;
+
+        while(lod + 1 < item.LodCount && size < gLodScreenSizes[lod])
+            ++lod;
+    }
+
+    uint slot;
+    gCommandCount.InterlockedAdd(0, 1, slot);
+
+    IndirectCommand cmd;
+    cmd.ObjectCB = item.ObjectCB;
+    cmd.Material = item.Material;
+    cmd.VertexBufferLocation = item.VertexBufferLocation;
+    cmd.VertexBufferSize = item.VertexBufferSize;
+    cmd.VertexBufferStride = item.VertexBufferStride;
+    cmd.IndexBufferLocation = item.IndexBufferLocation;
+    cmd.IndexBufferSize = item.IndexBufferSize;
+    cmd.IndexBufferFormat = item.IndexBufferFormat;
+    cmd.IndexCountPerInstance = item.Lods[lod].x;
+    cmd.InstanceCount = 1;
+    cmd.StartIndexLocation = item.Lods[lod].y;
+    cmd.BaseVertexLocation = asint(item.Lods[lod].z);
+    cmd.StartInstanceLocation = 0;
+    cmd.Pad = 0;
+
+    gCommands[slot] = cmd;
+}
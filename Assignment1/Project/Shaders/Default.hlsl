@@ -27,6 +27,44 @@ cbuffer cbPerObject : register(b0)
     float4x4 gWorld;
 };
 
+struct InstanceData
+{
+    float4x4 World;
+    float4x4 TexTransform;
+};
+
+#ifdef INSTANCING
+// Instances of the batch being drawn.  The root SRV is offset to the first
+// instance of the batch, so SV_InstanceID indexes it directly.
+StructuredBuffer<InstanceData> gInstanceData : register(t0, space1);
+#endif
+
+#ifdef CLUSTERED_LIGHTING
+// Point and spot lights, and the lights binned into each cluster by
+// ClusterLights.hlsl.
+StructuredBuffer<Light> gLocalLights : register(t1, space1);
+StructuredBuffer<uint> gClusterLights : register(t2, space1);
+#endif
+
+#ifdef BINDLESS_MATERIALS
+// MaterialConstants of every material of the frame.  The draw selects its
+// material with a root constant.
+struct MaterialData
+{
+    float4   DiffuseAlbedo;
+    float3   FresnelR0;
+    float    Roughness;
+    float4x4 MatTransform;
+};
+
+StructuredBuffer<MaterialData> gMaterialData : register(t3, space1);
+
+cbuffer cbMaterialIndex : register(b1)
+{
+    uint gMaterialIndex;
+    uint gMaterialIndexPad;
+};
+#else
 cbuffer cbMaterial : register(b1)
 {
 	float4 gDiffuseAlbedo;
@@ -34,6 +72,7 @@ cbuffer cbMaterial : register(b1)
     float  gRoughness;
 	float4x4 gMatTransform;
 };
+#endif
 
 // Constant data that varies per material.
 cbuffer cbPass : register(b2)
@@ -61,11 +100,32 @@ cbuffer cbPass : register(b2)
     Light gLights[MaxLights];
 };
  
+#ifdef PACKED_VERTEX
+// PackedVertex: half precision position and an octahedral encoded normal.
+struct VertexIn
+{
+	float4 PosL      : POSITION;
+    float2 NormalOct : NORMAL;
+};
+
+// Inverse of MathHelper::EncodeOctahedral.
+float3 DecodeOctahedral(float2 e)
+{
+    float3 n = float3(e, 1.0f - abs(e.x) - abs(e.y));
+
+    // Unfold the lower half of the octahedron.
+    float t = saturate(-n.z);
+    n.xy += n.xy >= 0.0f ? -t : t;
+
+    return normalize(n);
+}
+#else
 struct VertexIn
 {
 	float3 PosL    : POSITION;
     float3 NormalL : NORMAL;
 };
+#endif
 
 struct VertexOut
 {
@@ -74,16 +134,30 @@ struct VertexOut
     float3 NormalW : NORMAL;
 };
 
-VertexOut VS(VertexIn vin)
+VertexOut VS(VertexIn vin, uint instanceID : SV_InstanceID)
 {
 	VertexOut vout = (VertexOut)0.0f;
+
+#ifdef INSTANCING
+    float4x4 world = gInstanceData[instanceID].World;
+#else
+    float4x4 world = gWorld;
+#endif
 	
+#ifdef PACKED_VERTEX
+    float3 posL = vin.PosL.xyz;
+    float3 normalL = DecodeOctahedral(vin.NormalOct);
+#else
+    float3 posL = vin.PosL;
+    float3 normalL = vin.NormalL;
+#endif
+
     // Transform to world space.
-    float4 posW = mul(float4(vin.PosL, 1.0f), gWorld);
+    float4 posW = mul(float4(posL, 1.0f), world);
     vout.PosW = posW.xyz;
 
     // Assumes nonuniform scaling; otherwise, need to use inverse-transpose of world matrix.
-    vout.NormalW = mul(vin.NormalL, (float3x3)gWorld);
+    vout.NormalW = mul(normalL, (float3x3)world);
 
     // Transform to homogeneous clip space.
     vout.PosH = mul(posW, gViewProj);
@@ -93,6 +167,17 @@ VertexOut VS(VertexIn vin)
 
 float4 PS(VertexOut pin) : SV_Target
 {
+#ifdef BINDLESS_MATERIALS
+    MaterialData matData = gMaterialData[gMaterialIndex];
+    float4 diffuseAlbedo = matData.DiffuseAlbedo;
+    float3 fresnelR0 = matData.FresnelR0;
+    float  roughness = matData.Roughness;
+#else
+    float4 diffuseAlbedo = gDiffuseAlbedo;
+    float3 fresnelR0 = gFresnelR0;
+    float  roughness = gRoughness;
+#endif
+
     // Interpolating normal can unnormalize it, so renormalize it.
     pin.NormalW = normalize(pin.NormalW);
 
@@ -100,18 +185,25 @@ float4 PS(VertexOut pin) : SV_Target
     float3 toEyeW = normalize(gEyePosW - pin.PosW);
 
 	// Indirect lighting.
-    float4 ambient = gAmbientLight*gDiffuseAlbedo;
+    float4 ambient = gAmbientLight*diffuseAlbedo;
 
-    const float shininess = 1.0f - gRoughness;
-    Material mat = { gDiffuseAlbedo, gFresnelR0, shininess };
+    const float shininess = 1.0f - roughness;
+    Material mat = { diffuseAlbedo, fresnelR0, shininess };
     float3 shadowFactor = 1.0f;
     float4 directLight = ComputeLighting(gLights, mat, pin.PosW, 
         pin.NormalW, toEyeW, shadowFactor);
 
+#ifdef CLUSTERED_LIGHTING
+    float viewZ = mul(float4(pin.PosW, 1.0f), gView).z;
+    uint cluster = ClusterIndex(pin.PosH.xy*gInvRenderTargetSize, viewZ, gNearZ, gFarZ);
+    directLight.rgb += ComputeClusterLighting(gLocalLights, gClusterLights, cluster,
+        mat, pin.PosW, pin.NormalW, toEyeW);
+#endif
+
     float4 litColor = ambient + directLight;
 
     // Common convention to take alpha from diffuse material.
-    litColor.a = gDiffuseAlbedo.a;
+    litColor.a = diffuseAlbedo.a;
 
     return litColor;
 }
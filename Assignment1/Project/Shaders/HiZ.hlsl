@@ -0,0 +1,42 @@
+//***************************************************************************************
+// HiZ.hlsl
+//
+// Builds one level of the hierarchical depth buffer (see Common/HiZBuffer.h).
+// Each texel is the farthest depth of its 2 x 2 texels of the level below, or
+// of the depth buffer itself for level 0.  A level is rounded down in size, so
+// when the level below has an odd width or height its last row or column is
+// folded into the last texel of this level.
+//***************************************************************************************
+
+cbuffer cbHiZ : register(b0)
+{
+    uint2 gSrcSize;
+    uint2 gDstSize;
+};
+
+Texture2D<float> gSrc : register(t0);
+RWTexture2D<float> gDst : register(u0);
+
+[numthreads(8, 8, 1)]
+void CS(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    uint2 dst = dispatchThreadID.xy;
+    if(any(dst >= gDstSize))
+        return;
+
+    uint2 first = min(2*dst, gSrcSize - 1);
+    uint2 last = min(2*dst + 1, gSrcSize - 1);
+    if(dst.x == gDstSize.x - 1)
+        last.x = gSrcSize.x - 1;
+    if(dst.y == gDstSize.y - 1)
+        last.y = gSrcSize.y - 1;
+
+    float farthest = 0.0f;
+    for(uint y = first.y; y <= last.y; ++y)
+    {
+        for(uint x = first.x; x <= last.x; ++x)
+            farthest = max(farthest, gSrc.Load(int3(x, y, 0)));
+    }
+
+    gDst[dst] = farthest;
+}
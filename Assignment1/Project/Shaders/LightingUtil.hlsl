@@ -167,4 +167,56 @@ float4 ComputeLighting(Light gLights[MaxLights], Material mat,
     return float4(result, 0.0f);
 }
 
+//---------------------------------------------------------------------------------------
+// Clustered lighting.  The view frustum is split into CLUSTER_COUNT_X by
+// CLUSTER_COUNT_Y screen tiles and CLUSTER_COUNT_Z depth slices, spaced
+// exponentially between the near and far planes.  Each cluster owns
+// CLUSTER_STRIDE entries of the cluster buffer: a light count followed by the
+// indices of the point and spot lights that reach it, with spot lights marked
+// by CLUSTER_SPOT_LIGHT_BIT.  Mirrors the cluster constants in FrameResource.h.
+//---------------------------------------------------------------------------------------
+#define CLUSTER_COUNT_X 16
+#define CLUSTER_COUNT_Y 9
+#define CLUSTER_COUNT_Z 24
+#define CLUSTER_STRIDE 64
+#define MAX_LIGHTS_PER_CLUSTER (CLUSTER_STRIDE - 1)
+#define CLUSTER_SPOT_LIGHT_BIT 0x80000000
+
+uint ClusterSlice(float viewZ, float nearZ, float farZ)
+{
+    float slice = log(viewZ / nearZ) * CLUSTER_COUNT_Z / log(farZ / nearZ);
+    return (uint)clamp(slice, 0.0f, CLUSTER_COUNT_Z - 1.0f);
+}
+
+// uv is the position on the render target in [0, 1], with v pointing down.
+uint ClusterIndex(float2 uv, float viewZ, float nearZ, float farZ)
+{
+    uint2 tile = (uint2)clamp(uv * float2(CLUSTER_COUNT_X, CLUSTER_COUNT_Y),
+        0.0f, float2(CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1));
+    uint slice = ClusterSlice(viewZ, nearZ, farZ);
+
+    return (slice*CLUSTER_COUNT_Y + tile.y)*CLUSTER_COUNT_X + tile.x;
+}
+
+// Evaluates only the point and spot lights binned into the cluster.
+float3 ComputeClusterLighting(StructuredBuffer<Light> lights, StructuredBuffer<uint> clusterLights,
+                              uint cluster, Material mat, float3 pos, float3 normal, float3 toEye)
+{
+    float3 result = 0.0f;
+
+    uint base = cluster*CLUSTER_STRIDE;
+    uint count = clusterLights[base];
+    for(uint i = 0; i < count; ++i)
+    {
+        uint index = clusterLights[base + 1 + i];
+        Light L = lights[index & ~CLUSTER_SPOT_LIGHT_BIT];
+
+        if(index & CLUSTER_SPOT_LIGHT_BIT)
+            result += ComputeSpotLight(L, mat, pos, normal, toEye);
+        else
+            result += ComputePointLight(L, mat, pos, normal, toEye);
+    }
+
+    return result;
+}
 
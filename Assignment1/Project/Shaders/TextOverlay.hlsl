@@ -0,0 +1,105 @@
+//***************************************************************************************
+// TextOverlay.hlsl
+//
+// Draws the character grid of a TextOverlay (see Common/TextOverlay.h) over
+// the frame on a translucent panel.  There is no font texture: each cell is
+// 6 x 9 font pixels holding a 5 x 7 glyph from gFont, and the pixel shader
+// works out which cell and glyph bit a pixel falls on.  Characters are one
+// byte each, four to a uint.
+//***************************************************************************************
+
+cbuffer cbOverlay : register(b0)
+{
+    // Top left corner of the panel and the render target size, in pixels.
+    float2 gOrigin;
+    float2 gTargetSize;
+
+    // Cells drawn, screen pixels per font pixel and characters per row of gText.
+    uint gColumns;
+    uint gRows;
+    uint gScale;
+    uint gStride;
+};
+
+StructuredBuffer<uint> gText : register(t0);
+
+static const uint CellWidth = 6;
+static const uint CellHeight = 9;
+
+// Border around the text, in font pixels.
+static const uint Padding = 2;
+
+// Glyphs of ASCII 32 to 95; lower case letters are drawn with the upper case
+// ones.  Rows 0 to 5 of a glyph are packed 5 bits each into x, row 6 into y,
+// with the leftmost pixel in the highest bit of its row.
+static const uint2 gFont[64] =
+{
+    uint2(0x00000000, 0x00), uint2(0x00421084, 0x04), uint2(0x0000294a, 0x00), uint2(0x15f57d4a, 0x0a),  //   ! " #
+    uint2(0x3c5751e4, 0x04), uint2(0x26820b38, 0x03), uint2(0x2554524c, 0x0d), uint2(0x00002084, 0x00),  // $ % & '
+    uint2(0x08842082, 0x02), uint2(0x08210888, 0x08), uint2(0x09575480, 0x00), uint2(0x084f9080, 0x00),  // ( ) * +
+    uint2(0x08c00000, 0x08), uint2(0x000f8000, 0x00), uint2(0x18000000, 0x0c), uint2(0x20820820, 0x00),  // , - . /
+    uint2(0x239ace2e, 0x0e), uint2(0x08421184, 0x0e), uint2(0x1041062e, 0x1f), uint2(0x2211105f, 0x0e),  // 0 1 2 3
+    uint2(0x05f928c2, 0x02), uint2(0x2210fa1f, 0x0e), uint2(0x231f4106, 0x0e), uint2(0x1082083f, 0x08),  // 4 5 6 7
+    uint2(0x2317462e, 0x0e), uint2(0x0417c62e, 0x0c), uint2(0x18c03180, 0x00), uint2(0x08c03180, 0x08),  // 8 9 : ;
+    uint2(0x08882082, 0x02), uint2(0x01f07c00, 0x00), uint2(0x08208888, 0x08), uint2(0x0041062e, 0x04),  // < = > ?
+    uint2(0x2b56862e, 0x0e), uint2(0x231fc62e, 0x11), uint2(0x231f463e, 0x1e), uint2(0x2308422e, 0x0e),  // @ A B C
+    uint2(0x2518c65c, 0x1c), uint2(0x210f421f, 0x1f), uint2(0x210f421f, 0x10), uint2(0x231bc22e, 0x0f),  // D E F G
+    uint2(0x231fc631, 0x11), uint2(0x0842108e, 0x0e), uint2(0x24210847, 0x0c), uint2(0x254c5251, 0x11),  // H I J K
+    uint2(0x21084210, 0x1f), uint2(0x231ad771, 0x11), uint2(0x233ae631, 0x11), uint2(0x2318c62e, 0x0e),  // L M N O
+    uint2(0x210f463e, 0x10), uint2(0x2558c62e, 0x0d), uint2(0x254f463e, 0x11), uint2(0x0217420f, 0x1e),  // P Q R S
+    uint2(0x0842109f, 0x04), uint2(0x2318c631, 0x0e), uint2(0x1518c631, 0x04), uint2(0x2b5ac631, 0x0a),  // T U V W
+    uint2(0x22a22a31, 0x11), uint2(0x08422a31, 0x04), uint2(0x2082083f, 0x1f), uint2(0x1084210e, 0x0e),  // X Y Z [
+    uint2(0x02222200, 0x00), uint2(0x0421084e, 0x0e), uint2(0x00004544, 0x00), uint2(0x00000000, 0x1f)   // \ ] ^ _
+};
+
+struct VertexOut
+{
+    float4 PosH : SV_POSITION;
+
+    // Position in font pixels from the top left corner of the first cell.
+    float2 FontPos : TEXCOORD;
+};
+
+VertexOut VS(uint vertexID : SV_VertexID)
+{
+    VertexOut vout;
+
+    // A triangle strip over the panel.
+    float2 corner = float2(vertexID & 1, vertexID >> 1);
+    float2 panelSize = float2(gColumns*CellWidth, gRows*CellHeight) + 2.0f*Padding;
+    float2 posPixels = gOrigin + corner*panelSize*gScale;
+
+    vout.FontPos = corner*panelSize - Padding;
+    vout.PosH = float4(posPixels.x/gTargetSize.x*2.0f - 1.0f, 1.0f - posPixels.y/gTargetSize.y*2.0f, 0.0f, 1.0f);
+
+    return vout;
+}
+
+float4 PS(VertexOut pin) : SV_Target
+{
+    const float4 background = float4(0.0f, 0.0f, 0.0f, 0.6f);
+    const float4 foreground = float4(1.0f, 1.0f, 1.0f, 1.0f);
+
+    int2 p = (int2)floor(pin.FontPos);
+    if(any(p < 0))
+        return background;
+
+    uint2 cell = uint2(p) / uint2(CellWidth, CellHeight);
+    uint2 texel = uint2(p) % uint2(CellWidth, CellHeight);
+    if(cell.x >= gColumns || cell.y >= gRows || texel.x >= 5 || texel.y >= 7)
+        return background;
+
+    uint index = cell.y*gStride + cell.x;
+    uint c = (gText[index / 4] >> (8*(index % 4))) & 0xff;
+
+    // 'a' to 'z'.
+    if(c >= 97 && c <= 122)
+        c -= 32;
+    if(c < 32 || c > 95)
+        return background;
+
+    uint2 glyph = gFont[c - 32];
+    uint row = texel.y < 6 ? (glyph.x >> (5*texel.y)) & 0x1f : glyph.y;
+
+    return ((row >> (4 - texel.x)) & 1) != 0 ? foreground : background;
+}
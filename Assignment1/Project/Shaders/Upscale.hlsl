@@ -0,0 +1,42 @@
+//***************************************************************************************
+// Upscale.hlsl
+//
+// Stretches the part of the scene buffer the scene was drawn to, with dynamic
+// resolution, over the back buffer.  A single triangle covers the screen.
+// Bilinear taps are kept within the drawn part so the texels beyond it,
+// left from frames drawn at a larger scale, do not bleed in at the edges.
+//***************************************************************************************
+
+cbuffer cbUpscale : register(b0)
+{
+    // Drawn size over scene buffer size, and the largest texture coordinate
+    // whose bilinear footprint stays in the drawn part.
+    float2 gUvScale;
+    float2 gUvMax;
+};
+
+Texture2D gScene : register(t0);
+SamplerState gsamLinearClamp : register(s0);
+
+struct VertexOut
+{
+    float4 PosH : SV_POSITION;
+    float2 TexC : TEXCOORD;
+};
+
+VertexOut VS(uint vertexID : SV_VertexID)
+{
+    VertexOut vout;
+
+    // (0, 0), (2, 0) and (0, 2) in texture space cover the [0, 1] square.
+    vout.TexC = float2((vertexID << 1) & 2, vertexID & 2);
+    vout.PosH = float4(vout.TexC.x*2.0f - 1.0f, 1.0f - vout.TexC.y*2.0f, 0.0f, 1.0f);
+
+    return vout;
+}
+
+float4 PS(VertexOut pin) : SV_Target
+{
+    float2 uv = min(pin.TexC*gUvScale, gUvMax);
+    return gScene.SampleLevel(gsamLinearClamp, uv, 0.0f);
+}
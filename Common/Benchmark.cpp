@@ -0,0 +1,191 @@
+//***************************************************************************************
+// Benchmark.cpp
+//***************************************************************************************
+
+#include "Benchmark.h"
+
+bool CameraPath::Load(const std::wstring& filename)
+{
+	std::ifstream fin(filename);
+	if(!fin)
+		return false;
+
+	mKeys.clear();
+
+	std::string line;
+	while(std::getline(fin, line))
+	{
+		if(line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream ss(line);
+		CameraKeyframe key;
+		if(ss >> key.Time >> key.Theta >> key.Phi >> key.Radius)
+			AddKeyframe(key);
+	}
+
+	return !mKeys.empty();
+}
+
+void CameraPath::AddKeyframe(const CameraKeyframe& key)
+{
+	assert(mKeys.empty() || key.Time >= mKeys.back().Time);
+	mKeys.push_back(key);
+}
+
+CameraKeyframe CameraPath::Sample(float t)const
+{
+	assert(!mKeys.empty());
+
+	const float start = mKeys.front().Time;
+	const float duration = Duration();
+	if(mKeys.size() == 1 || duration <= 0.0f)
+		return mKeys.front();
+
+	// Wrap t into [start, start + duration).
+	float u = fmodf(t - start, duration);
+	if(u < 0.0f)
+		u += duration;
+	u += start;
+
+	// Find the first keyframe after u; the segment ends there.
+	size_t next = 1;
+	while(next < mKeys.size() - 1 && mKeys[next].Time <= u)
+		++next;
+
+	const CameraKeyframe& k0 = mKeys[next - 1];
+	const CameraKeyframe& k1 = mKeys[next];
+
+	float span = k1.Time - k0.Time;
+	float s = span > 0.0f ? MathHelper::Clamp((u - k0.Time) / span, 0.0f, 1.0f) : 1.0f;
+
+	CameraKeyframe result;
+	result.Time = t;
+	result.Theta = k0.Theta + s*(k1.Theta - k0.Theta);
+	result.Phi = k0.Phi + s*(k1.Phi - k0.Phi);
+	result.Radius = k0.Radius + s*(k1.Radius - k0.Radius);
+	return result;
+}
+
+bool CameraPath::Empty()const
+{
+	return mKeys.empty();
+}
+
+float CameraPath::Duration()const
+{
+	return mKeys.empty() ? 0.0f : mKeys.back().Time - mKeys.front().Time;
+}
+
+BenchmarkRecorder::BenchmarkRecorder()
+{
+	__int64 countsPerSec;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
+	mSecondsPerCount = 1.0 / (double)countsPerSec;
+}
+
+void BenchmarkRecorder::FrameCompleted(UINT drawCalls)
+{
+	__int64 currTime;
+	QueryPerformanceCounter((LARGE_INTEGER*)&currTime);
+
+	if(mPrevTime != 0)
+	{
+		mFrameTimes.push_back((currTime - mPrevTime)*mSecondsPerCount*1000.0);
+		mDrawCalls.push_back((double)drawCalls);
+	}
+
+	mPrevTime = currTime;
+}
+
+void BenchmarkRecorder::AddProfiledFrame(const ProfiledFrame& frame, const char* cpuScopes[], UINT cpuScopeCount)
+{
+	double cpuMs = 0.0;
+	for(auto& t : frame.CpuTimes)
+		for(UINT i = 0; i < cpuScopeCount; ++i)
+			if(t.first == cpuScopes[i])
+				cpuMs += t.second;
+
+	double gpuMs = 0.0;
+	for(auto& t : frame.GpuTimes)
+		gpuMs += t.second;
+
+	mCpuTimes.push_back(cpuMs);
+	mGpuTimes.push_back(gpuMs);
+}
+
+size_t BenchmarkRecorder::FrameCount()const
+{
+	return mFrameTimes.size();
+}
+
+BenchmarkStat BenchmarkRecorder::Summarize(std::vector<double> samples)
+{
+	BenchmarkStat stat;
+	if(samples.empty())
+		return stat;
+
+	std::sort(samples.begin(), samples.end());
+
+	// Nearest rank percentile.
+	auto percentile = [&samples](double p)
+	{
+		size_t rank = (size_t)ceil(p*samples.size());
+		return samples[rank > 0 ? rank - 1 : 0];
+	};
+
+	double sum = 0.0;
+	for(double s : samples)
+		sum += s;
+
+	stat.Min = samples.front();
+	stat.Mean = sum / samples.size();
+	stat.P50 = percentile(0.50);
+	stat.P95 = percentile(0.95);
+	stat.P99 = percentile(0.99);
+	stat.Max = samples.back();
+	return stat;
+}
+
+std::string BenchmarkRecorder::Report()const
+{
+	auto writeStat = [](std::ostringstream& out, const char* name, const std::vector<double>& samples)
+	{
+		BenchmarkStat s = Summarize(samples);
+		out << name << ": mean " << s.Mean << "  p50 " << s.P50 << "  p95 " << s.P95 <<
+			"  p99 " << s.P99 << "  min " << s.Min << "  max " << s.Max << "\n";
+	};
+
+	std::ostringstream out;
+	out << "Benchmark: " << mFrameTimes.size() << " frames\n";
+	writeStat(out, "  frame ms", mFrameTimes);
+	writeStat(out, "  cpu ms  ", mCpuTimes);
+	writeStat(out, "  gpu ms  ", mGpuTimes);
+	writeStat(out, "  draws   ", mDrawCalls);
+	return out.str();
+}
+
+bool BenchmarkRecorder::WriteJson(const std::wstring& filename)const
+{
+	std::ofstream fout(filename);
+	if(!fout)
+		return false;
+
+	auto writeStat = [&fout](const char* name, const std::vector<double>& samples, bool last)
+	{
+		BenchmarkStat s = Summarize(samples);
+		fout << "  \"" << name << "\": { \"samples\": " << samples.size() <<
+			", \"mean\": " << s.Mean << ", \"p50\": " << s.P50 << ", \"p95\": " << s.P95 <<
+			", \"p99\": " << s.P99 << ", \"min\": " << s.Min << ", \"max\": " << s.Max << " }" <<
+			(last ? "\n" : ",\n");
+	};
+
+	fout << "{\n  \"frames\": " << mFrameTimes.size() << ",\n";
+	writeStat("frame_ms", mFrameTimes, false);
+	writeStat("cpu_ms", mCpuTimes, false);
+	writeStat("gpu_ms", mGpuTimes, false);
+	writeStat("draw_calls", mDrawCalls, true);
+	fout << "}\n";
+
+	return true;
+}
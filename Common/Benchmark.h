@@ -0,0 +1,88 @@
+//***************************************************************************************
+// Benchmark.h
+//
+// Support for deterministic benchmark runs: an orbit camera path interpolated
+// from keyframes, and a recorder that collects frame, CPU and GPU times and
+// draw counts and reports their percentiles.
+//***************************************************************************************
+
+#pragma once
+
+#include "FrameProfiler.h"
+
+// Orbit camera position at a point in time, in the spherical coordinates the
+// demos use (theta around the y axis, phi from the y axis, radius from the origin).
+struct CameraKeyframe
+{
+	float Time = 0.0f;
+	float Theta = 0.0f;
+	float Phi = 0.0f;
+	float Radius = 0.0f;
+};
+
+class CameraPath
+{
+public:
+	// Reads one keyframe per line as "time theta phi radius", with angles in
+	// radians.  Blank lines and lines starting with '#' are ignored.  Keyframes
+	// must be in increasing time order.  Returns false if the file cannot be
+	// read or holds no keyframes.
+	bool Load(const std::wstring& filename);
+
+	void AddKeyframe(const CameraKeyframe& key);
+
+	// Linearly interpolates between the keyframes around t.  The path loops,
+	// so t past the last keyframe wraps back to the first.
+	CameraKeyframe Sample(float t)const;
+
+	bool Empty()const;
+	float Duration()const;
+
+private:
+	std::vector<CameraKeyframe> mKeys;
+};
+
+// Percentiles of one measured quantity, in milliseconds.
+struct BenchmarkStat
+{
+	double Min = 0.0;
+	double Mean = 0.0;
+	double P50 = 0.0;
+	double P95 = 0.0;
+	double P99 = 0.0;
+	double Max = 0.0;
+};
+
+class BenchmarkRecorder
+{
+public:
+	BenchmarkRecorder();
+
+	// Call once per frame after the frame has been submitted.  The frame time
+	// is the wall-clock interval since the previous call, so the first call
+	// only starts the clock.
+	void FrameCompleted(UINT drawCalls);
+
+	// Adds the CPU and GPU timings of a frame read back by the profiler.  The
+	// CPU time is the sum of the cpuScope timings; the GPU time is the sum of
+	// every GPU scope.
+	void AddProfiledFrame(const ProfiledFrame& frame, const char* cpuScopes[], UINT cpuScopeCount);
+
+	size_t FrameCount()const;
+
+	// Summary of every quantity, as text for OutputDebugString or as JSON.
+	std::string Report()const;
+	bool WriteJson(const std::wstring& filename)const;
+
+private:
+	static BenchmarkStat Summarize(std::vector<double> samples);
+
+private:
+	double mSecondsPerCount = 0.0;
+	__int64 mPrevTime = 0;
+
+	std::vector<double> mFrameTimes;
+	std::vector<double> mDrawCalls;
+	std::vector<double> mCpuTimes;
+	std::vector<double> mGpuTimes;
+};
@@ -0,0 +1,129 @@
+//***************************************************************************************
+// CellStreamer.cpp
+//***************************************************************************************
+
+#include "CellStreamer.h"
+#include <algorithm>
+
+using namespace DirectX;
+
+UINT CellStreamer::AddCell(const BoundingSphere& bounds)
+{
+	Cell cell;
+	cell.Bounds = bounds;
+
+	mCells.push_back(cell);
+	return (UINT)mCells.size() - 1;
+}
+
+void CellStreamer::SetDistances(float loadDistance, float unloadDistance)
+{
+	mLoadDistance = loadDistance;
+	mUnloadDistance = unloadDistance;
+}
+
+void CellStreamer::SetResidentLimit(UINT cellCount)
+{
+	mResidentLimit = cellCount;
+}
+
+void CellStreamer::Update(FXMVECTOR eyePos)
+{
+	mLoadedCells.clear();
+	mUnloadedCells.clear();
+
+	for(auto& cell : mCells)
+	{
+		float distance = XMVectorGetX(XMVector3Length(XMLoadFloat3(&cell.Bounds.Center) - eyePos)) - cell.Bounds.Radius;
+		cell.Distance = distance > 0.0f ? distance : 0.0f;
+	}
+
+	for(UINT i = 0; i < (UINT)mCells.size(); ++i)
+	{
+		if(mCells[i].Resident && mCells[i].Distance > mUnloadDistance)
+			Unload(i);
+	}
+
+	// SetResidentLimit may have lowered the limit since the last frame.
+	while(mResidentLimit != 0 && mResidentCount > mResidentLimit)
+		Unload(FarthestResidentCell(-1.0f));
+
+	mLoadOrder.clear();
+	for(UINT i = 0; i < (UINT)mCells.size(); ++i)
+	{
+		if(!mCells[i].Resident && mCells[i].Distance <= mLoadDistance)
+			mLoadOrder.push_back(i);
+	}
+
+	std::sort(mLoadOrder.begin(), mLoadOrder.end(),
+		[this](UINT a, UINT b) { return mCells[a].Distance < mCells[b].Distance; });
+
+	for(UINT i : mLoadOrder)
+	{
+		// Make room by giving up a cell farther away than this one.  The rest
+		// are farther still, so if there is none they do not fit either.
+		if(mResidentLimit != 0 && mResidentCount >= mResidentLimit)
+		{
+			UINT farthest = FarthestResidentCell(mCells[i].Distance);
+			if(farthest == (UINT)-1)
+				break;
+			Unload(farthest);
+		}
+
+		Load(i);
+	}
+}
+
+const std::vector<UINT>& CellStreamer::LoadedCells()const
+{
+	return mLoadedCells;
+}
+
+const std::vector<UINT>& CellStreamer::UnloadedCells()const
+{
+	return mUnloadedCells;
+}
+
+UINT CellStreamer::CellCount()const
+{
+	return (UINT)mCells.size();
+}
+
+bool CellStreamer::IsResident(UINT cell)const
+{
+	return mCells[cell].Resident;
+}
+
+UINT CellStreamer::ResidentCellCount()const
+{
+	return mResidentCount;
+}
+
+void CellStreamer::Load(UINT cell)
+{
+	mCells[cell].Resident = true;
+	++mResidentCount;
+	mLoadedCells.push_back(cell);
+}
+
+void CellStreamer::Unload(UINT cell)
+{
+	mCells[cell].Resident = false;
+	--mResidentCount;
+	mUnloadedCells.push_back(cell);
+}
+
+UINT CellStreamer::FarthestResidentCell(float minDistance)const
+{
+	UINT farthest = (UINT)-1;
+	float farthestDistance = minDistance;
+	for(UINT i = 0; i < (UINT)mCells.size(); ++i)
+	{
+		if(mCells[i].Resident && mCells[i].Distance > farthestDistance)
+		{
+			farthest = i;
+			farthestDistance = mCells[i].Distance;
+		}
+	}
+	return farthest;
+}
@@ -0,0 +1,75 @@
+//***************************************************************************************
+// CellStreamer.h
+//
+// Decides which cells of a world divided into cells are resident.  Once a frame
+// Update makes the cells within the load distance of the camera resident,
+// nearest first, and unloads the cells past the unload distance.  While the
+// resident limit is reached, a cell waiting to load takes the place of the
+// farthest resident cell if that one is farther away.
+//
+// What a resident cell holds is up to the caller, which binds and unbinds its
+// cells' data from the cells loaded and unloaded by each Update.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+
+class CellStreamer
+{
+public:
+	CellStreamer() = default;
+	CellStreamer(const CellStreamer& rhs) = delete;
+	CellStreamer& operator=(const CellStreamer& rhs) = delete;
+
+	// Adds an unloaded cell and returns its index.
+	UINT AddCell(const DirectX::BoundingSphere& bounds);
+
+	// Distances are from the camera to the nearest point of a cell's bounds.
+	// unloadDistance should be larger than loadDistance so a cell on the edge
+	// is not loaded and unloaded on alternate frames.
+	void SetDistances(float loadDistance, float unloadDistance);
+
+	// Most cells resident at once, or 0 for no limit.
+	void SetResidentLimit(UINT cellCount);
+
+	// Once a frame, before the cells are culled.
+	void Update(DirectX::FXMVECTOR eyePos);
+
+	// Cells that became resident, or were unloaded, in the last Update.  A
+	// loaded cell may take the place of an unloaded one, so the caller should
+	// release what the unloaded cells hold before binding the loaded ones.
+	const std::vector<UINT>& LoadedCells()const;
+	const std::vector<UINT>& UnloadedCells()const;
+
+	UINT CellCount()const;
+	bool IsResident(UINT cell)const;
+	UINT ResidentCellCount()const;
+
+private:
+	struct Cell
+	{
+		DirectX::BoundingSphere Bounds;
+		bool Resident = false;
+
+		// Distance from the camera in the current Update.
+		float Distance = 0.0f;
+	};
+
+	void Load(UINT cell);
+	void Unload(UINT cell);
+
+	// The resident cell farthest from the camera, or -1 if none is farther
+	// than minDistance.
+	UINT FarthestResidentCell(float minDistance)const;
+
+	std::vector<Cell> mCells;
+	std::vector<UINT> mLoadOrder;
+	std::vector<UINT> mLoadedCells;
+	std::vector<UINT> mUnloadedCells;
+
+	float mLoadDistance = 100.0f;
+	float mUnloadDistance = 150.0f;
+	UINT mResidentLimit = 0;
+	UINT mResidentCount = 0;
+};
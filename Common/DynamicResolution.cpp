@@ -0,0 +1,68 @@
+//***************************************************************************************
+// DynamicResolution.cpp
+//***************************************************************************************
+
+#include "DynamicResolution.h"
+#include "MathHelper.h"
+#include <cmath>
+
+DynamicResolution::DynamicResolution(double targetMs, float minScale, float maxScale)
+	: mTargetMs(targetMs), mMinScale(minScale), mMaxScale(maxScale), mScale(maxScale)
+{
+}
+
+float DynamicResolution::Update(double gpuMs)
+{
+	if(mSettleCount > 0)
+	{
+		// Frames queued before the last change are still coming back.
+		--mSettleCount;
+		return mScale;
+	}
+
+	mSmoothedMs = mHasTime ? mSmoothedMs + Smoothing*(gpuMs - mSmoothedMs) : gpuMs;
+	mHasTime = true;
+
+	if(mSmoothedMs <= 0.0 || (mSmoothedMs <= mTargetMs && mSmoothedMs >= Headroom*mTargetMs))
+		return mScale;
+
+	// Aim at the middle of the band so the next step is not straight back.
+	double goalMs = 0.5*(1.0 + Headroom)*mTargetMs;
+	float ideal = mScale*(float)std::sqrt(goalMs / mSmoothedMs);
+	float next = MathHelper::Clamp(ideal, mScale - MaxStep, mScale + MaxStep);
+	next = MathHelper::Clamp(next, mMinScale, mMaxScale);
+
+	if(next != mScale)
+	{
+		mScale = next;
+		mSettleCount = SettleFrames;
+
+		// Times measured at the old scale say nothing about the new one.
+		mHasTime = false;
+	}
+
+	return mScale;
+}
+
+float DynamicResolution::Scale()const
+{
+	return mScale;
+}
+
+double DynamicResolution::SmoothedMs()const
+{
+	return mSmoothedMs;
+}
+
+double DynamicResolution::TargetMs()const
+{
+	return mTargetMs;
+}
+
+void DynamicResolution::Reset()
+{
+	mScale = mMaxScale;
+	mSmoothedMs = 0.0;
+	mHasTime = false;
+	mSettleCount = SettleFrames;
+}
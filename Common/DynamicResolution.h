@@ -0,0 +1,56 @@
+//***************************************************************************************
+// DynamicResolution.h
+//
+// Picks the render scale, see D3DApp::SetRenderScale, that keeps the GPU
+// frame time near a target.  The GPU time is smoothed and the cost of a frame
+// taken to grow with its pixel count, the square of the scale, so the scale
+// moves by the square root of the ratio of the target to the smoothed time.
+// Between the target and a lower bound the scale is left alone, so it does not
+// flip between two values.  GPU times are read back a few frames late, so
+// after every change the controller waits for the times of frames drawn at
+// the new scale before it changes the scale again.
+//***************************************************************************************
+
+#pragma once
+
+class DynamicResolution
+{
+public:
+	explicit DynamicResolution(double targetMs, float minScale = 0.5f, float maxScale = 1.0f);
+	DynamicResolution(const DynamicResolution& rhs) = delete;
+	DynamicResolution& operator=(const DynamicResolution& rhs) = delete;
+
+	// Feeds the GPU time of one completed frame and returns the scale for
+	// the next frame.
+	float Update(double gpuMs);
+
+	float Scale()const;
+	double SmoothedMs()const;
+	double TargetMs()const;
+
+	// Forgets the measured times, after a resize say, and starts again at
+	// the largest scale.
+	void Reset();
+
+private:
+	// The scale is only raised while the frame time is below this fraction of
+	// the target.
+	static constexpr double Headroom = 0.85;
+
+	// Weight of the newest time in the smoothed time.
+	static constexpr double Smoothing = 0.25;
+
+	// Largest change of the scale in one step, and the frames ignored after
+	// a step: the profiler's read back latency and a few frames of smoothing.
+	static constexpr float MaxStep = 0.1f;
+	static const unsigned SettleFrames = 8;
+
+	double mTargetMs = 0.0;
+	float mMinScale = 0.5f;
+	float mMaxScale = 1.0f;
+
+	float mScale = 1.0f;
+	double mSmoothedMs = 0.0;
+	bool mHasTime = false;
+	unsigned mSettleCount = 0;
+};
@@ -0,0 +1,385 @@
+//***************************************************************************************
+// FrameProfiler.cpp
+//***************************************************************************************
+
+#include "FrameProfiler.h"
+
+using Microsoft::WRL::ComPtr;
+
+FrameProfiler::FrameProfiler(ID3D12Device* device, ID3D12CommandQueue* queue,
+	UINT maxScopesPerFrame, UINT maxStatsSlots) :
+	mQueue(queue),
+	mMaxScopes(maxScopesPerFrame),
+	mMaxStatsSlots(maxStatsSlots)
+{
+	// Two timestamps per scope, for every frame slot.
+	D3D12_QUERY_HEAP_DESC timestampHeapDesc = {};
+	timestampHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+	timestampHeapDesc.Count = FrameSlotCount*mMaxScopes*2;
+	ThrowIfFailed(device->CreateQueryHeap(&timestampHeapDesc, IID_PPV_ARGS(&mTimestampHeap)));
+
+	D3D12_QUERY_HEAP_DESC statsHeapDesc = {};
+	statsHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_PIPELINE_STATISTICS;
+	statsHeapDesc.Count = FrameSlotCount*mMaxStatsSlots;
+	ThrowIfFailed(device->CreateQueryHeap(&statsHeapDesc, IID_PPV_ARGS(&mStatsHeap)));
+
+	UINT64 frequency = 0;
+	ThrowIfFailed(mQueue->GetTimestampFrequency(&frequency));
+	mTimestampPeriodMs = 1000.0 / (double)frequency;
+
+	const UINT64 readbackByteSize = mMaxScopes*2*sizeof(UINT64) +
+		mMaxStatsSlots*sizeof(D3D12_QUERY_DATA_PIPELINE_STATISTICS);
+
+	for(auto& slot : mSlots)
+	{
+		ThrowIfFailed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT,
+			IID_PPV_ARGS(slot.CmdListAlloc.GetAddressOf())));
+
+		ThrowIfFailed(device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(readbackByteSize),
+			D3D12_RESOURCE_STATE_COPY_DEST,
+			nullptr,
+			IID_PPV_ARGS(slot.Readback.GetAddressOf())));
+
+		slot.StatsUsed.resize(mMaxStatsSlots, 0);
+	}
+
+	ThrowIfFailed(device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT,
+		mSlots[0].CmdListAlloc.Get(), nullptr, IID_PPV_ARGS(mResolveCmdList.GetAddressOf())));
+	ThrowIfFailed(mResolveCmdList->Close());
+
+	ThrowIfFailed(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mFence)));
+
+	mFenceEvent = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
+	if(mFenceEvent == nullptr)
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+}
+
+FrameProfiler::~FrameProfiler()
+{
+	// The resolve lists must finish before their allocators are released.
+	if(mFence->GetCompletedValue() < mCurrentFence)
+	{
+		mFence->SetEventOnCompletion(mCurrentFence, mFenceEvent);
+		WaitForSingleObject(mFenceEvent, INFINITE);
+	}
+
+	if(mFenceEvent != nullptr)
+		CloseHandle(mFenceEvent);
+}
+
+void FrameProfiler::BeginFrame()
+{
+	++mFrameIndex;
+
+	// Read every finished frame, oldest first.  The slot about to be reused is
+	// waited for if the GPU has not got to it yet.
+	while(mOldestPendingFrame < mFrameIndex)
+	{
+		FrameSlot& slot = mSlots[mOldestPendingFrame % FrameSlotCount];
+
+		bool reused = (mOldestPendingFrame % FrameSlotCount) == (mFrameIndex % FrameSlotCount);
+		if(mFence->GetCompletedValue() < slot.Fence)
+		{
+			if(!reused)
+				break;
+
+			ThrowIfFailed(mFence->SetEventOnCompletion(slot.Fence, mFenceEvent));
+			WaitForSingleObject(mFenceEvent, INFINITE);
+		}
+
+		if(slot.Pending)
+			CollectFrame(slot);
+
+		++mOldestPendingFrame;
+	}
+
+	FrameSlot& slot = mSlots[mFrameIndex % FrameSlotCount];
+	slot.Pending = false;
+	slot.Frame = ProfiledFrame();
+	slot.Frame.FrameIndex = mFrameIndex;
+	slot.ScopeNames.clear();
+	std::fill(slot.StatsUsed.begin(), slot.StatsUsed.end(), (BYTE)0);
+}
+
+void FrameProfiler::EndFrame()
+{
+	FrameSlot& slot = mSlots[mFrameIndex % FrameSlotCount];
+	const UINT scopeCount = (UINT)slot.ScopeNames.size();
+
+	// The slot's previous resolve list finished before BeginFrame reused it.
+	ThrowIfFailed(slot.CmdListAlloc->Reset());
+	ThrowIfFailed(mResolveCmdList->Reset(slot.CmdListAlloc.Get(), nullptr));
+
+	if(scopeCount > 0)
+	{
+		mResolveCmdList->ResolveQueryData(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP,
+			TimestampIndex(0, false), scopeCount*2, slot.Readback.Get(), 0);
+	}
+
+	const UINT64 statsOffset = mMaxScopes*2*sizeof(UINT64);
+	for(UINT i = 0; i < mMaxStatsSlots; ++i)
+	{
+		if(!slot.StatsUsed[i])
+			continue;
+
+		UINT queryIndex = (UINT)(mFrameIndex % FrameSlotCount)*mMaxStatsSlots + i;
+		mResolveCmdList->ResolveQueryData(mStatsHeap.Get(), D3D12_QUERY_TYPE_PIPELINE_STATISTICS,
+			queryIndex, 1, slot.Readback.Get(), statsOffset + i*sizeof(D3D12_QUERY_DATA_PIPELINE_STATISTICS));
+	}
+
+	ThrowIfFailed(mResolveCmdList->Close());
+
+	ID3D12CommandList* cmdsLists[] = { mResolveCmdList.Get() };
+	mQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
+
+	slot.Fence = ++mCurrentFence;
+	ThrowIfFailed(mQueue->Signal(mFence.Get(), mCurrentFence));
+
+	slot.Pending = true;
+}
+
+UINT FrameProfiler::BeginScope(ID3D12GraphicsCommandList* cmdList, const char* name)
+{
+	FrameSlot& slot = mSlots[mFrameIndex % FrameSlotCount];
+
+	UINT scope = 0;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		// Scopes past the limit are dropped rather than overwriting others.
+		if(slot.ScopeNames.size() >= mMaxScopes)
+			return (UINT)-1;
+
+		scope = (UINT)slot.ScopeNames.size();
+		slot.ScopeNames.push_back(name);
+	}
+
+	cmdList->EndQuery(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, TimestampIndex(scope, false));
+
+	return scope;
+}
+
+void FrameProfiler::EndScope(ID3D12GraphicsCommandList* cmdList, UINT scope)
+{
+	if(scope == (UINT)-1)
+		return;
+
+	cmdList->EndQuery(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, TimestampIndex(scope, true));
+}
+
+void FrameProfiler::BeginPipelineStats(ID3D12GraphicsCommandList* cmdList, UINT slot)
+{
+	assert(slot < mMaxStatsSlots);
+
+	UINT queryIndex = (UINT)(mFrameIndex % FrameSlotCount)*mMaxStatsSlots + slot;
+	cmdList->BeginQuery(mStatsHeap.Get(), D3D12_QUERY_TYPE_PIPELINE_STATISTICS, queryIndex);
+}
+
+void FrameProfiler::EndPipelineStats(ID3D12GraphicsCommandList* cmdList, UINT slot)
+{
+	assert(slot < mMaxStatsSlots);
+
+	UINT queryIndex = (UINT)(mFrameIndex % FrameSlotCount)*mMaxStatsSlots + slot;
+	cmdList->EndQuery(mStatsHeap.Get(), D3D12_QUERY_TYPE_PIPELINE_STATISTICS, queryIndex);
+
+	// Each thread writes only its own slot's flag.
+	mSlots[mFrameIndex % FrameSlotCount].StatsUsed[slot] = 1;
+}
+
+void FrameProfiler::AddCpuTime(const char* name, double ms)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mSlots[mFrameIndex % FrameSlotCount].Frame.CpuTimes.push_back(std::make_pair(std::string(name), ms));
+}
+
+const ProfiledFrame& FrameProfiler::LatestFrame()const
+{
+	return mLatestFrame;
+}
+
+void FrameProfiler::StartCapture()
+{
+	mCapturedFrames.clear();
+	mCapturing = true;
+}
+
+void FrameProfiler::StopCapture()
+{
+	mCapturing = false;
+}
+
+bool FrameProfiler::IsCapturing()const
+{
+	return mCapturing;
+}
+
+size_t FrameProfiler::CapturedFrameCount()const
+{
+	return mCapturedFrames.size();
+}
+
+bool FrameProfiler::WriteCsv(const std::wstring& filename)const
+{
+	std::ofstream fout(filename);
+	if(!fout)
+		return false;
+
+	// One column per scope name seen in the capture, in first-seen order.
+	std::vector<std::string> cpuColumns;
+	std::vector<std::string> gpuColumns;
+	for(auto& frame : mCapturedFrames)
+	{
+		for(auto& t : frame.CpuTimes)
+			if(std::find(cpuColumns.begin(), cpuColumns.end(), t.first) == cpuColumns.end())
+				cpuColumns.push_back(t.first);
+		for(auto& t : frame.GpuTimes)
+			if(std::find(gpuColumns.begin(), gpuColumns.end(), t.first) == gpuColumns.end())
+				gpuColumns.push_back(t.first);
+	}
+
+	fout << "frame";
+	for(auto& name : cpuColumns)
+		fout << ",cpu_" << name << "_ms";
+	for(auto& name : gpuColumns)
+		fout << ",gpu_" << name << "_ms";
+	fout << ",ia_primitives,vs_invocations,ps_invocations\n";
+
+	for(auto& frame : mCapturedFrames)
+	{
+		fout << frame.FrameIndex;
+
+		for(auto& name : cpuColumns)
+		{
+			double ms = 0.0;
+			for(auto& t : frame.CpuTimes)
+				if(t.first == name)
+					ms += t.second;
+			fout << "," << ms;
+		}
+
+		for(auto& name : gpuColumns)
+		{
+			double ms = 0.0;
+			for(auto& t : frame.GpuTimes)
+				if(t.first == name)
+					ms += t.second;
+			fout << "," << ms;
+		}
+
+		fout << "," << frame.PipelineStats.IAPrimitives <<
+			"," << frame.PipelineStats.VSInvocations <<
+			"," << frame.PipelineStats.PSInvocations << "\n";
+	}
+
+	return true;
+}
+
+bool FrameProfiler::WriteJson(const std::wstring& filename)const
+{
+	std::ofstream fout(filename);
+	if(!fout)
+		return false;
+
+	auto writeTimes = [&fout](const std::vector<std::pair<std::string, double>>& times)
+	{
+		fout << "{";
+		for(size_t i = 0; i < times.size(); ++i)
+			fout << (i > 0 ? ", " : "") << "\"" << times[i].first << "\": " << times[i].second;
+		fout << "}";
+	};
+
+	fout << "{\n  \"frames\": [\n";
+	for(size_t i = 0; i < mCapturedFrames.size(); ++i)
+	{
+		const ProfiledFrame& frame = mCapturedFrames[i];
+
+		fout << "    { \"frame\": " << frame.FrameIndex << ", \"cpu_ms\": ";
+		writeTimes(frame.CpuTimes);
+		fout << ", \"gpu_ms\": ";
+		writeTimes(frame.GpuTimes);
+		fout << ", \"ia_primitives\": " << frame.PipelineStats.IAPrimitives <<
+			", \"vs_invocations\": " << frame.PipelineStats.VSInvocations <<
+			", \"ps_invocations\": " << frame.PipelineStats.PSInvocations << " }";
+		fout << (i + 1 < mCapturedFrames.size() ? ",\n" : "\n");
+	}
+	fout << "  ]\n}\n";
+
+	return true;
+}
+
+void FrameProfiler::CollectFrame(FrameSlot& slot)
+{
+	const UINT scopeCount = (UINT)slot.ScopeNames.size();
+	const UINT64 statsOffset = mMaxScopes*2*sizeof(UINT64);
+
+	BYTE* data = nullptr;
+	D3D12_RANGE readRange = { 0, (SIZE_T)(statsOffset + mMaxStatsSlots*sizeof(D3D12_QUERY_DATA_PIPELINE_STATISTICS)) };
+	ThrowIfFailed(slot.Readback->Map(0, &readRange, reinterpret_cast<void**>(&data)));
+
+	const UINT64* timestamps = reinterpret_cast<const UINT64*>(data);
+	for(UINT i = 0; i < scopeCount; ++i)
+	{
+		double ms = (double)(timestamps[2*i + 1] - timestamps[2*i])*mTimestampPeriodMs;
+		slot.Frame.GpuTimes.push_back(std::make_pair(slot.ScopeNames[i], ms));
+	}
+
+	const D3D12_QUERY_DATA_PIPELINE_STATISTICS* stats =
+		reinterpret_cast<const D3D12_QUERY_DATA_PIPELINE_STATISTICS*>(data + statsOffset);
+	for(UINT i = 0; i < mMaxStatsSlots; ++i)
+	{
+		if(!slot.StatsUsed[i])
+			continue;
+
+		slot.Frame.PipelineStats.IAVertices += stats[i].IAVertices;
+		slot.Frame.PipelineStats.IAPrimitives += stats[i].IAPrimitives;
+		slot.Frame.PipelineStats.VSInvocations += stats[i].VSInvocations;
+		slot.Frame.PipelineStats.GSInvocations += stats[i].GSInvocations;
+		slot.Frame.PipelineStats.GSPrimitives += stats[i].GSPrimitives;
+		slot.Frame.PipelineStats.CInvocations += stats[i].CInvocations;
+		slot.Frame.PipelineStats.CPrimitives += stats[i].CPrimitives;
+		slot.Frame.PipelineStats.PSInvocations += stats[i].PSInvocations;
+		slot.Frame.PipelineStats.HSInvocations += stats[i].HSInvocations;
+		slot.Frame.PipelineStats.DSInvocations += stats[i].DSInvocations;
+		slot.Frame.PipelineStats.CSInvocations += stats[i].CSInvocations;
+	}
+
+	// Nothing was written by the CPU.
+	D3D12_RANGE writeRange = { 0, 0 };
+	slot.Readback->Unmap(0, &writeRange);
+
+	slot.Pending = false;
+
+	mLatestFrame = slot.Frame;
+	if(mCapturing)
+		mCapturedFrames.push_back(slot.Frame);
+}
+
+UINT FrameProfiler::TimestampIndex(UINT scope, bool end)const
+{
+	UINT slotBase = (UINT)(mFrameIndex % FrameSlotCount)*mMaxScopes*2;
+	return slotBase + scope*2 + (end ? 1 : 0);
+}
+
+ProfileScope::ProfileScope(FrameProfiler* profiler, const char* name) :
+	mProfiler(profiler),
+	mName(name)
+{
+	QueryPerformanceCounter(&mStart);
+}
+
+ProfileScope::~ProfileScope()
+{
+	if(mProfiler == nullptr)
+		return;
+
+	LARGE_INTEGER end;
+	LARGE_INTEGER frequency;
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+
+	double ms = (double)(end.QuadPart - mStart.QuadPart)*1000.0 / (double)frequency.QuadPart;
+	mProfiler->AddCpuTime(mName, ms);
+}
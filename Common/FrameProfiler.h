@@ -0,0 +1,132 @@
+//***************************************************************************************
+// FrameProfiler.h
+//
+// Per-frame CPU and GPU timings.  GPU scopes are timestamp query pairs around
+// ranges of command list work; pipeline statistics queries count primitives
+// and shader invocations.  Queries are resolved into a readback buffer on a
+// small command list at the end of each frame and read back a few frames
+// later, once the profiler's fence shows the GPU is done with them.  Captured
+// frames can be written out as CSV or JSON.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include <mutex>
+
+// Results of one frame.
+struct ProfiledFrame
+{
+	UINT64 FrameIndex = 0;
+
+	// Milliseconds per named scope, in the order the scopes were begun.
+	std::vector<std::pair<std::string, double>> CpuTimes;
+	std::vector<std::pair<std::string, double>> GpuTimes;
+
+	// Sum of every pipeline statistics slot used in the frame.
+	D3D12_QUERY_DATA_PIPELINE_STATISTICS PipelineStats = {};
+};
+
+class FrameProfiler
+{
+public:
+	FrameProfiler(ID3D12Device* device, ID3D12CommandQueue* queue,
+		UINT maxScopesPerFrame = 32, UINT maxStatsSlots = 8);
+	FrameProfiler(const FrameProfiler& rhs) = delete;
+	FrameProfiler& operator=(const FrameProfiler& rhs) = delete;
+	~FrameProfiler();
+
+	// Frame boundaries.  BeginFrame collects the results of earlier frames the
+	// GPU has finished.  EndFrame resolves this frame's queries on the queue.
+	void BeginFrame();
+	void EndFrame();
+
+	// Timestamps around a range of GPU work.  Begin and End may be recorded on
+	// different command lists of the frame as long as those lists execute in
+	// that order on the profiler's queue.  Safe to call from several threads.
+	UINT BeginScope(ID3D12GraphicsCommandList* cmdList, const char* name);
+	void EndScope(ID3D12GraphicsCommandList* cmdList, UINT scope);
+
+	// Pipeline statistics must begin and end on the same command list, so each
+	// recording thread uses its own slot.  The slots are summed per frame.
+	void BeginPipelineStats(ID3D12GraphicsCommandList* cmdList, UINT slot);
+	void EndPipelineStats(ID3D12GraphicsCommandList* cmdList, UINT slot);
+
+	// Adds a CPU timing to the current frame.  Safe to call from several
+	// threads between BeginFrame and EndFrame, but not while BeginFrame runs,
+	// so work that may overlap a frame boundary reports its time to the
+	// thread that begins the frames instead.
+	void AddCpuTime(const char* name, double ms);
+
+	// Most recent frame whose GPU results have been read back.
+	const ProfiledFrame& LatestFrame()const;
+
+	// While capturing, every completed frame is kept for WriteCsv/WriteJson.
+	void StartCapture();
+	void StopCapture();
+	bool IsCapturing()const;
+	size_t CapturedFrameCount()const;
+
+	bool WriteCsv(const std::wstring& filename)const;
+	bool WriteJson(const std::wstring& filename)const;
+
+private:
+	struct FrameSlot
+	{
+		Microsoft::WRL::ComPtr<ID3D12CommandAllocator> CmdListAlloc;
+		Microsoft::WRL::ComPtr<ID3D12Resource> Readback;
+
+		UINT64 Fence = 0;
+		bool Pending = false;
+
+		ProfiledFrame Frame;
+		std::vector<std::string> ScopeNames;
+		std::vector<BYTE> StatsUsed;
+	};
+
+	void CollectFrame(FrameSlot& slot);
+	UINT TimestampIndex(UINT scope, bool end)const;
+
+private:
+	// Enough slots that a slot is normally finished on the GPU well before it
+	// is reused; BeginFrame waits otherwise.
+	static const UINT FrameSlotCount = 8;
+
+	Microsoft::WRL::ComPtr<ID3D12CommandQueue> mQueue;
+	Microsoft::WRL::ComPtr<ID3D12QueryHeap> mTimestampHeap;
+	Microsoft::WRL::ComPtr<ID3D12QueryHeap> mStatsHeap;
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> mResolveCmdList;
+
+	Microsoft::WRL::ComPtr<ID3D12Fence> mFence;
+	UINT64 mCurrentFence = 0;
+	HANDLE mFenceEvent = nullptr;
+
+	UINT mMaxScopes = 0;
+	UINT mMaxStatsSlots = 0;
+	double mTimestampPeriodMs = 0.0;
+
+	FrameSlot mSlots[FrameSlotCount];
+	UINT64 mFrameIndex = 0;
+	UINT64 mOldestPendingFrame = 1;
+
+	ProfiledFrame mLatestFrame;
+	std::vector<ProfiledFrame> mCapturedFrames;
+	bool mCapturing = false;
+
+	std::mutex mMutex;
+};
+
+// Adds the CPU time between construction and destruction to the current frame.
+class ProfileScope
+{
+public:
+	ProfileScope(FrameProfiler* profiler, const char* name);
+	ProfileScope(const ProfileScope& rhs) = delete;
+	ProfileScope& operator=(const ProfileScope& rhs) = delete;
+	~ProfileScope();
+
+private:
+	FrameProfiler* mProfiler = nullptr;
+	const char* mName = nullptr;
+	LARGE_INTEGER mStart;
+};
@@ -0,0 +1,110 @@
+//***************************************************************************************
+// FrustumCuller.cpp
+//***************************************************************************************
+
+#include "FrustumCuller.h"
+
+using namespace DirectX;
+
+std::uint32_t FrustumCuller::AddBox(const BoundingBox& localBounds, FXMMATRIX world)
+{
+	std::uint32_t index = mBoxCount++;
+
+	// Grow the arrays four entries at a time to keep them padded.
+	if(mCenterX.size() < mBoxCount)
+	{
+		size_t paddedSize = mCenterX.size() + 4;
+		mCenterX.resize(paddedSize, 0.0f);
+		mCenterY.resize(paddedSize, 0.0f);
+		mCenterZ.resize(paddedSize, 0.0f);
+		mExtentX.resize(paddedSize, 0.0f);
+		mExtentY.resize(paddedSize, 0.0f);
+		mExtentZ.resize(paddedSize, 0.0f);
+	}
+
+	SetBox(index, localBounds, world);
+
+	return index;
+}
+
+void FrustumCuller::SetBox(std::uint32_t index, const BoundingBox& localBounds, FXMMATRIX world)
+{
+	BoundingBox worldBounds;
+	localBounds.Transform(worldBounds, world);
+
+	mCenterX[index] = worldBounds.Center.x;
+	mCenterY[index] = worldBounds.Center.y;
+	mCenterZ[index] = worldBounds.Center.z;
+	mExtentX[index] = worldBounds.Extents.x;
+	mExtentY[index] = worldBounds.Extents.y;
+	mExtentZ[index] = worldBounds.Extents.z;
+}
+
+std::uint32_t FrustumCuller::BoxCount()const
+{
+	return mBoxCount;
+}
+
+void FrustumCuller::Clear()
+{
+	mCenterX.clear();
+	mCenterY.clear();
+	mCenterZ.clear();
+	mExtentX.clear();
+	mExtentY.clear();
+	mExtentZ.clear();
+	mBoxCount = 0;
+}
+
+void FrustumCuller::Cull(const BoundingFrustum& frustumW, std::vector<std::uint32_t>& visible)const
+{
+	// The frustum planes have outward facing normals, so a point p is inside
+	// when dot(n, p) + d <= 0 for all six planes.
+	XMVECTOR planes[6];
+	frustumW.GetPlanes(&planes[0], &planes[1], &planes[2], &planes[3], &planes[4], &planes[5]);
+
+	// Splat each plane component across a register so one plane can be tested
+	// against four boxes at once.  |n| projects a box's extents onto the normal.
+	XMVECTOR nx[6], ny[6], nz[6], nd[6];
+	XMVECTOR absNx[6], absNy[6], absNz[6];
+	for(int p = 0; p < 6; ++p)
+	{
+		nx[p] = XMVectorSplatX(planes[p]);
+		ny[p] = XMVectorSplatY(planes[p]);
+		nz[p] = XMVectorSplatZ(planes[p]);
+		nd[p] = XMVectorSplatW(planes[p]);
+		absNx[p] = XMVectorAbs(nx[p]);
+		absNy[p] = XMVectorAbs(ny[p]);
+		absNz[p] = XMVectorAbs(nz[p]);
+	}
+
+	for(std::uint32_t i = 0; i < mBoxCount; i += 4)
+	{
+		XMVECTOR cx = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&mCenterX[i]));
+		XMVECTOR cy = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&mCenterY[i]));
+		XMVECTOR cz = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&mCenterZ[i]));
+		XMVECTOR ex = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&mExtentX[i]));
+		XMVECTOR ey = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&mExtentY[i]));
+		XMVECTOR ez = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&mExtentZ[i]));
+
+		// A box is culled when it lies entirely on the outside of any plane,
+		// i.e. the plane distance of its center exceeds its projected radius.
+		XMVECTOR outside = XMVectorFalseInt();
+		for(int p = 0; p < 6; ++p)
+		{
+			XMVECTOR dist = XMVectorMultiplyAdd(cx, nx[p], XMVectorMultiplyAdd(cy, ny[p], XMVectorMultiplyAdd(cz, nz[p], nd[p])));
+			XMVECTOR radius = XMVectorMultiplyAdd(ex, absNx[p], XMVectorMultiplyAdd(ey, absNy[p], XMVectorMultiply(ez, absNz[p])));
+			outside = XMVectorOrInt(outside, XMVectorGreater(dist, radius));
+		}
+
+		XMUINT4 mask;
+		XMStoreUInt4(&mask, outside);
+
+		const std::uint32_t lanes[4] = { mask.x, mask.y, mask.z, mask.w };
+		for(std::uint32_t lane = 0; lane < 4 && i + lane < mBoxCount; ++lane)
+		{
+			if(lanes[lane] == 0)
+				visible.push_back(i + lane);
+		}
+	}
+}
@@ -0,0 +1,48 @@
+//***************************************************************************************
+// FrustumCuller.h
+//
+// Keeps a set of world-space axis-aligned bounding boxes in structure-of-arrays
+// form so they can be tested against the view frustum four at a time with
+// DirectXMath SIMD operations.
+//***************************************************************************************
+
+#pragma once
+
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <cstdint>
+#include <vector>
+
+class FrustumCuller
+{
+public:
+	FrustumCuller() = default;
+	FrustumCuller(const FrustumCuller& rhs) = delete;
+	FrustumCuller& operator=(const FrustumCuller& rhs) = delete;
+
+	// Adds the world-space bounds of localBounds transformed by world and
+	// returns the index used to refer to the box.
+	std::uint32_t AddBox(const DirectX::BoundingBox& localBounds, DirectX::FXMMATRIX world);
+
+	// Updates a box after the object it bounds has moved.
+	void SetBox(std::uint32_t index, const DirectX::BoundingBox& localBounds, DirectX::FXMMATRIX world);
+
+	std::uint32_t BoxCount()const;
+	void Clear();
+
+	// Appends the index of every box that is at least partially inside the
+	// frustum.  The frustum must be in world space.
+	void Cull(const DirectX::BoundingFrustum& frustumW, std::vector<std::uint32_t>& visible)const;
+
+private:
+	std::vector<float> mCenterX;
+	std::vector<float> mCenterY;
+	std::vector<float> mCenterZ;
+	std::vector<float> mExtentX;
+	std::vector<float> mExtentY;
+	std::vector<float> mExtentZ;
+
+	// Number of real boxes.  The arrays are padded to a multiple of four with
+	// empty boxes so the SIMD loop never reads past the end.
+	std::uint32_t mBoxCount = 0;
+};
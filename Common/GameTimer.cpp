@@ -6,7 +6,7 @@
 #include "GameTimer.h"
 
 GameTimer::GameTimer()
-: mSecondsPerCount(0.0), mDeltaTime(-1.0), mBaseTime(0), 
+: mSecondsPerCount(0.0), mDeltaTime(-1.0), mFixedTimeStep(0.0), mBaseTime(0), 
   mPausedTime(0), mPrevTime(0), mCurrTime(0), mStopped(false)
 {
 	__int64 countsPerSec;
@@ -53,6 +53,16 @@ float GameTimer::DeltaTime()const
 	return (float)mDeltaTime;
 }
 
+void GameTimer::SetFixedTimeStep(double seconds)
+{
+	mFixedTimeStep = seconds > 0.0 ? seconds : 0.0;
+}
+
+bool GameTimer::IsFixedTimeStep()const
+{
+	return mFixedTimeStep > 0.0;
+}
+
 void GameTimer::Reset()
 {
 	__int64 currTime;
@@ -106,6 +116,16 @@ void GameTimer::Tick()
 		return;
 	}
 
+	// In fixed step mode the clock is driven entirely by the frame count, so
+	// TotalTime() and DeltaTime() are identical from run to run.
+	if( mFixedTimeStep > 0.0 )
+	{
+		mCurrTime = mPrevTime + (__int64)(mFixedTimeStep / mSecondsPerCount);
+		mDeltaTime = mFixedTimeStep;
+		mPrevTime = mCurrTime;
+		return;
+	}
+
 	__int64 currTime;
 	QueryPerformanceCounter((LARGE_INTEGER*)&currTime);
 	mCurrTime = currTime;
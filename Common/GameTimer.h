@@ -18,9 +18,16 @@ public:
 	void Stop();  // Call when paused.
 	void Tick();  // Call every frame.
 
+	// When seconds > 0, Tick() advances the clock by exactly that amount each
+	// frame instead of reading the performance counter.  Used for deterministic
+	// benchmark runs.  Pass 0 to return to real time.
+	void SetFixedTimeStep(double seconds);
+	bool IsFixedTimeStep()const;
+
 private:
 	double mSecondsPerCount;
 	double mDeltaTime;
+	double mFixedTimeStep;
 
 	__int64 mBaseTime;
 	__int64 mPausedTime;
@@ -3,7 +3,10 @@
 //***************************************************************************************
 
 #include "GeometryGenerator.h"
+#include "ThreadPool.h"
 #include <algorithm>
+#include <cstring>
+#include <limits>
 
 using namespace DirectX;
 
@@ -306,9 +309,21 @@ GeometryGenerator::MeshData GeometryGenerator::CreateWedge(float width, float he
 	return meshData;
 }
 
-GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32 sliceCount, uint32 stackCount)
+GeometryGenerator::MeshSize GeometryGenerator::SphereSize(uint32 sliceCount, uint32 stackCount)
 {
-    MeshData meshData;
+	// A ring of sliceCount+1 vertices between each pair of stacks plus the two
+	// poles, and two triangles per slice of each stack but the two at the poles.
+	MeshSize size;
+	size.VertexCount = (stackCount-1)*(sliceCount+1) + 2;
+	size.IndexCount = 6*sliceCount*(stackCount-1);
+	return size;
+}
+
+template<typename Index>
+void GeometryGenerator::BuildSphere(float radius, uint32 sliceCount, uint32 stackCount, Vertex* vertices, Index* indices)
+{
+	uint32 vertexCount = 0;
+	auto addIndex = [&indices](uint32 i) { *indices++ = static_cast<Index>(i); };
 
 	//
 	// Compute the vertices stating at the top pole and moving down the stacks.
@@ -320,7 +335,7 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 	Vertex topVertex(0.0f, +radius, 0.0f, 0.0f, +1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
 	Vertex bottomVertex(0.0f, -radius, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
 
-	meshData.Vertices.push_back( topVertex );
+	vertices[vertexCount++] = topVertex;
 
 	float phiStep   = XM_PI/stackCount;
 	float thetaStep = 2.0f*XM_PI/sliceCount;
@@ -356,11 +371,11 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 			v.TexC.x = theta / XM_2PI;
 			v.TexC.y = phi / XM_PI;
 
-			meshData.Vertices.push_back( v );
+			vertices[vertexCount++] = v;
 		}
 	}
 
-	meshData.Vertices.push_back( bottomVertex );
+	vertices[vertexCount++] = bottomVertex;
 
 	//
 	// Compute indices for top stack.  The top stack was written first to the vertex buffer
@@ -369,9 +384,9 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 
     for(uint32 i = 1; i <= sliceCount; ++i)
 	{
-		meshData.Indices32.push_back(0);
-		meshData.Indices32.push_back(i+1);
-		meshData.Indices32.push_back(i);
+		addIndex(0);
+		addIndex(i+1);
+		addIndex(i);
 	}
 	
 	//
@@ -386,13 +401,13 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 	{
 		for(uint32 j = 0; j < sliceCount; ++j)
 		{
-			meshData.Indices32.push_back(baseIndex + i*ringVertexCount + j);
-			meshData.Indices32.push_back(baseIndex + i*ringVertexCount + j+1);
-			meshData.Indices32.push_back(baseIndex + (i+1)*ringVertexCount + j);
+			addIndex(baseIndex + i*ringVertexCount + j);
+			addIndex(baseIndex + i*ringVertexCount + j+1);
+			addIndex(baseIndex + (i+1)*ringVertexCount + j);
 
-			meshData.Indices32.push_back(baseIndex + (i+1)*ringVertexCount + j);
-			meshData.Indices32.push_back(baseIndex + i*ringVertexCount + j+1);
-			meshData.Indices32.push_back(baseIndex + (i+1)*ringVertexCount + j+1);
+			addIndex(baseIndex + (i+1)*ringVertexCount + j);
+			addIndex(baseIndex + i*ringVertexCount + j+1);
+			addIndex(baseIndex + (i+1)*ringVertexCount + j+1);
 		}
 	}
 
@@ -402,21 +417,37 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 	//
 
 	// South pole vertex was added last.
-	uint32 southPoleIndex = (uint32)meshData.Vertices.size()-1;
+	uint32 southPoleIndex = vertexCount-1;
 
 	// Offset the indices to the index of the first vertex in the last ring.
 	baseIndex = southPoleIndex - ringVertexCount;
 	
 	for(uint32 i = 0; i < sliceCount; ++i)
 	{
-		meshData.Indices32.push_back(southPoleIndex);
-		meshData.Indices32.push_back(baseIndex+i);
-		meshData.Indices32.push_back(baseIndex+i+1);
+		addIndex(southPoleIndex);
+		addIndex(baseIndex+i);
+		addIndex(baseIndex+i+1);
 	}
+}
 
+GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32 sliceCount, uint32 stackCount)
+{
+    MeshData meshData;
+	meshData.Resize(SphereSize(sliceCount, stackCount));
+	BuildSphere(radius, sliceCount, stackCount, meshData.Vertices.data(), meshData.Indices32.data());
     return meshData;
 }
 
+void GeometryGenerator::CreateSphere(float radius, uint32 sliceCount, uint32 stackCount, Vertex* vertices, uint32* indices)
+{
+	BuildSphere(radius, sliceCount, stackCount, vertices, indices);
+}
+
+void GeometryGenerator::CreateSphere(float radius, uint32 sliceCount, uint32 stackCount, Vertex* vertices, uint16* indices)
+{
+	BuildSphere(radius, sliceCount, stackCount, vertices, indices);
+}
+
 GeometryGenerator::MeshData GeometryGenerator::CreateDiamond(float radius, float height)
 {
 	MeshData meshData;
@@ -810,15 +841,10 @@ GeometryGenerator::MeshData GeometryGenerator::CreateHexagon(float width, float
 
 
 
-void GeometryGenerator::Subdivide(MeshData& meshData)
+template<typename Index>
+void GeometryGenerator::Subdivide(const Vertex* inVertices, const Index* inIndices, uint32 numTris,
+	Vertex* outVertices, Index* outIndices)
 {
-	// Save a copy of the input geometry.
-	MeshData inputCopy = meshData;
-
-
-	meshData.Vertices.resize(0);
-	meshData.Indices32.resize(0);
-
 	//       v1
 	//       *
 	//      / \
@@ -829,48 +855,95 @@ void GeometryGenerator::Subdivide(MeshData& meshData)
 	// *-----*-----*
 	// v0    m2     v2
 
-	uint32 numTris = (uint32)inputCopy.Indices32.size()/3;
-	for(uint32 i = 0; i < numTris; ++i)
+	// Each input triangle becomes 6 vertices and 4 triangles at a fixed offset,
+	// so ranges of triangles can be filled in independently.
+	auto subdivideRange = [&](uint32 first, uint32 last)
 	{
-		Vertex v0 = inputCopy.Vertices[ inputCopy.Indices32[i*3+0] ];
-		Vertex v1 = inputCopy.Vertices[ inputCopy.Indices32[i*3+1] ];
-		Vertex v2 = inputCopy.Vertices[ inputCopy.Indices32[i*3+2] ];
-
-		//
-		// Generate the midpoints.
-		//
-
-        Vertex m0 = MidPoint(v0, v1);
-        Vertex m1 = MidPoint(v1, v2);
-        Vertex m2 = MidPoint(v0, v2);
-
-		//
-		// Add new geometry.
-		//
-
-		meshData.Vertices.push_back(v0); // 0
-		meshData.Vertices.push_back(v1); // 1
-		meshData.Vertices.push_back(v2); // 2
-		meshData.Vertices.push_back(m0); // 3
-		meshData.Vertices.push_back(m1); // 4
-		meshData.Vertices.push_back(m2); // 5
- 
-		meshData.Indices32.push_back(i*6+0);
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+5);
+		for(uint32 i = first; i < last; ++i)
+		{
+			Vertex v0 = inVertices[ inIndices[i*3+0] ];
+			Vertex v1 = inVertices[ inIndices[i*3+1] ];
+			Vertex v2 = inVertices[ inIndices[i*3+2] ];
 
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+4);
-		meshData.Indices32.push_back(i*6+5);
+			//
+			// Generate the midpoints.
+			//
+
+			Vertex m0 = MidPoint(v0, v1);
+			Vertex m1 = MidPoint(v1, v2);
+			Vertex m2 = MidPoint(v0, v2);
 
-		meshData.Indices32.push_back(i*6+5);
-		meshData.Indices32.push_back(i*6+4);
-		meshData.Indices32.push_back(i*6+2);
+			//
+			// Add new geometry.
+			//
 
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+1);
-		meshData.Indices32.push_back(i*6+4);
+			Vertex* v = &outVertices[i*6];
+			v[0] = v0;
+			v[1] = v1;
+			v[2] = v2;
+			v[3] = m0;
+			v[4] = m1;
+			v[5] = m2;
+
+			const uint32 tris[12] = { 0, 3, 5,  3, 4, 5,  5, 4, 2,  3, 1, 4 };
+			Index* indices = &outIndices[i*12];
+			for(uint32 k = 0; k < 12; ++k)
+				indices[k] = static_cast<Index>(i*6 + tris[k]);
+		}
+	};
+
+	// Small meshes are not worth the cost of queuing jobs.
+	const uint32 trisPerJob = 4096;
+	if(mThreadPool == nullptr || numTris < 2*trisPerJob)
+	{
+		subdivideRange(0, numTris);
+		return;
 	}
+
+	uint32 jobCount = (numTris + trisPerJob - 1) / trisPerJob;
+	mThreadPool->ParallelFor(jobCount, [&](unsigned int job)
+	{
+		uint32 first = job*trisPerJob;
+		uint32 last = first + trisPerJob < numTris ? first + trisPerJob : numTris;
+		subdivideRange(first, last);
+	});
+}
+
+void GeometryGenerator::Subdivide(MeshData& meshData)
+{
+	// Save a copy of the input geometry, in scratch space kept from earlier
+	// calls rather than a new MeshData.
+	std::unique_ptr<Scratch> input = AcquireScratch();
+	input->Vertices.assign(meshData.Vertices.begin(), meshData.Vertices.end());
+	input->Indices32.assign(meshData.Indices32.begin(), meshData.Indices32.end());
+
+	uint32 numTris = (uint32)input->Indices32.size()/3;
+
+	MeshSize size;
+	size.VertexCount = numTris*6;
+	size.IndexCount = numTris*12;
+	meshData.Resize(size);
+
+	Subdivide(input->Vertices.data(), input->Indices32.data(), numTris, meshData.Vertices.data(), meshData.Indices32.data());
+
+	ReleaseScratch(std::move(input));
+}
+
+std::unique_ptr<GeometryGenerator::Scratch> GeometryGenerator::AcquireScratch()
+{
+	std::lock_guard<std::mutex> lock(mScratchMutex);
+	if(mScratch.empty())
+		return std::make_unique<Scratch>();
+
+	std::unique_ptr<Scratch> scratch = std::move(mScratch.back());
+	mScratch.pop_back();
+	return scratch;
+}
+
+void GeometryGenerator::ReleaseScratch(std::unique_ptr<Scratch> scratch)
+{
+	std::lock_guard<std::mutex> lock(mScratchMutex);
+	mScratch.push_back(std::move(scratch));
 }
 
 GeometryGenerator::MeshData GeometryGenerator::CreateCandy(float width, float height, uint32 numSubdivisions)
@@ -1013,12 +1086,28 @@ GeometryGenerator::Vertex GeometryGenerator::MidPoint(const Vertex& v0, const Ve
     return v;
 }
 
-GeometryGenerator::MeshData GeometryGenerator::CreateGeosphere(float radius, uint32 numSubdivisions)
+// Put a cap on the number of subdivisions.
+static const GeometryGenerator::uint32 MaxGeosphereSubdivisions = 6;
+
+GeometryGenerator::MeshSize GeometryGenerator::GeosphereSize(uint32 numSubdivisions)
 {
-    MeshData meshData;
+	numSubdivisions = std::min<uint32>(numSubdivisions, MaxGeosphereSubdivisions);
 
-	// Put a cap on the number of subdivisions.
-    numSubdivisions = std::min<uint32>(numSubdivisions, 6u);
+	// Each subdivision turns a triangle into 4 with 6 vertices of their own.
+	uint32 numTris = 20;
+	for(uint32 i = 0; i < numSubdivisions; ++i)
+		numTris *= 4;
+
+	MeshSize size;
+	size.VertexCount = numSubdivisions == 0 ? 12 : numTris/4*6;
+	size.IndexCount = numTris*3;
+	return size;
+}
+
+template<typename Index>
+void GeometryGenerator::BuildGeosphere(float radius, uint32 numSubdivisions, Vertex* vertices, Index* indices)
+{
+    numSubdivisions = std::min<uint32>(numSubdivisions, MaxGeosphereSubdivisions);
 
 	// Approximate a sphere by tessellating an icosahedron.
 
@@ -1043,54 +1132,114 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGeosphere(float radius, uin
 		10,1,6, 11,0,9, 2,11,9, 5,2,9,  11,2,7 
 	};
 
-    meshData.Vertices.resize(12);
-    meshData.Indices32.assign(&k[0], &k[60]);
+	// Each subdivision reads one buffer and writes the other, so the levels
+	// alternate between the output and a scratch buffer the size of the next
+	// to last level, starting wherever makes the last level land in the output.
+	std::unique_ptr<Scratch> scratch;
+	Vertex* levelVertices[2] = { vertices, nullptr };
+	Index* levelIndices[2] = { indices, nullptr };
+	if(numSubdivisions > 0)
+	{
+		MeshSize scratchSize = GeosphereSize(numSubdivisions - 1);
+
+		scratch = AcquireScratch();
+		std::vector<Index>& scratchIndices = scratch->IndicesFor(indices);
+		scratch->Vertices.resize(scratchSize.VertexCount);
+		scratchIndices.resize(scratchSize.IndexCount);
 
+		levelVertices[1] = scratch->Vertices.data();
+		levelIndices[1] = scratchIndices.data();
+	}
+
+	uint32 level = numSubdivisions % 2;
 	for(uint32 i = 0; i < 12; ++i)
-		meshData.Vertices[i].Position = pos[i];
+		levelVertices[level][i] = Vertex(pos[i], XMFLOAT3(), XMFLOAT3(), XMFLOAT2());
+	for(uint32 i = 0; i < 60; ++i)
+		levelIndices[level][i] = static_cast<Index>(k[i]);
 
+	uint32 numTris = 20;
 	for(uint32 i = 0; i < numSubdivisions; ++i)
-		Subdivide(meshData);
+	{
+		Subdivide(levelVertices[level], levelIndices[level], numTris,
+			levelVertices[level ^ 1], levelIndices[level ^ 1]);
+
+		numTris *= 4;
+		level ^= 1;
+	}
+
+	if(scratch != nullptr)
+		ReleaseScratch(std::move(scratch));
 
 	// Project vertices onto sphere and scale.
-	for(uint32 i = 0; i < meshData.Vertices.size(); ++i)
+	uint32 vertexCount = GeosphereSize(numSubdivisions).VertexCount;
+	for(uint32 i = 0; i < vertexCount; ++i)
 	{
 		// Project onto unit sphere.
-		XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&meshData.Vertices[i].Position));
+		XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&vertices[i].Position));
 
 		// Project onto sphere.
 		XMVECTOR p = radius*n;
 
-		XMStoreFloat3(&meshData.Vertices[i].Position, p);
-		XMStoreFloat3(&meshData.Vertices[i].Normal, n);
+		XMStoreFloat3(&vertices[i].Position, p);
+		XMStoreFloat3(&vertices[i].Normal, n);
 
 		// Derive texture coordinates from spherical coordinates.
-        float theta = atan2f(meshData.Vertices[i].Position.z, meshData.Vertices[i].Position.x);
+        float theta = atan2f(vertices[i].Position.z, vertices[i].Position.x);
 
         // Put in [0, 2pi].
         if(theta < 0.0f)
             theta += XM_2PI;
 
-		float phi = acosf(meshData.Vertices[i].Position.y / radius);
+		float phi = acosf(vertices[i].Position.y / radius);
 
-		meshData.Vertices[i].TexC.x = theta/XM_2PI;
-		meshData.Vertices[i].TexC.y = phi/XM_PI;
+		vertices[i].TexC.x = theta/XM_2PI;
+		vertices[i].TexC.y = phi/XM_PI;
 
 		// Partial derivative of P with respect to theta
-		meshData.Vertices[i].TangentU.x = -radius*sinf(phi)*sinf(theta);
-		meshData.Vertices[i].TangentU.y = 0.0f;
-		meshData.Vertices[i].TangentU.z = +radius*sinf(phi)*cosf(theta);
+		vertices[i].TangentU.x = -radius*sinf(phi)*sinf(theta);
+		vertices[i].TangentU.y = 0.0f;
+		vertices[i].TangentU.z = +radius*sinf(phi)*cosf(theta);
 
-		XMVECTOR T = XMLoadFloat3(&meshData.Vertices[i].TangentU);
-		XMStoreFloat3(&meshData.Vertices[i].TangentU, XMVector3Normalize(T));
+		XMVECTOR T = XMLoadFloat3(&vertices[i].TangentU);
+		XMStoreFloat3(&vertices[i].TangentU, XMVector3Normalize(T));
 	}
+}
 
+GeometryGenerator::MeshData GeometryGenerator::CreateGeosphere(float radius, uint32 numSubdivisions)
+{
+    MeshData meshData;
+	meshData.Resize(GeosphereSize(numSubdivisions));
+	BuildGeosphere(radius, numSubdivisions, meshData.Vertices.data(), meshData.Indices32.data());
     return meshData;
 }
 
-GeometryGenerator::MeshData GeometryGenerator::CreateCylinder(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount)
+void GeometryGenerator::CreateGeosphere(float radius, uint32 numSubdivisions, Vertex* vertices, uint32* indices)
 {
-    MeshData meshData;
+	BuildGeosphere(radius, numSubdivisions, vertices, indices);
+}
+
+void GeometryGenerator::CreateGeosphere(float radius, uint32 numSubdivisions, Vertex* vertices, uint16* indices)
+{
+	BuildGeosphere(radius, numSubdivisions, vertices, indices);
+}
+
+GeometryGenerator::MeshSize GeometryGenerator::CylinderSize(uint32 sliceCount, uint32 stackCount)
+{
+	// stackCount+1 rings of sliceCount+1 vertices, and each cap has a ring of
+	// its own plus a center vertex.
+	MeshSize size;
+	size.VertexCount = (stackCount+1)*(sliceCount+1) + 2*(sliceCount+2);
+	size.IndexCount = 6*sliceCount*stackCount + 2*3*sliceCount;
+	return size;
+}
+
+template<typename Index>
+void GeometryGenerator::BuildCylinder(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount,
+	Vertex* vertices, Index* indices)
+{
+	uint32 vertexCount = 0;
+	uint32 indexCount = 0;
+	auto addIndex = [&](uint32 i) { indices[indexCount++] = static_cast<Index>(i); };
 
 	//
 	// Build Stacks.
@@ -1153,7 +1302,7 @@ GeometryGenerator::MeshData GeometryGenerator::CreateCylinder(float bottomRadius
 			XMVECTOR N = XMVector3Normalize(XMVector3Cross(T, B));
 			XMStoreFloat3(&vertex.Normal, N);
 
-			meshData.Vertices.push_back(vertex);
+			vertices[vertexCount++] = vertex;
 		}
 	}
 
@@ -1166,26 +1315,51 @@ GeometryGenerator::MeshData GeometryGenerator::CreateCylinder(float bottomRadius
 	{
 		for(uint32 j = 0; j < sliceCount; ++j)
 		{
-			meshData.Indices32.push_back(i*ringVertexCount + j);
-			meshData.Indices32.push_back((i+1)*ringVertexCount + j);
-			meshData.Indices32.push_back((i+1)*ringVertexCount + j+1);
+			addIndex(i*ringVertexCount + j);
+			addIndex((i+1)*ringVertexCount + j);
+			addIndex((i+1)*ringVertexCount + j+1);
 
-			meshData.Indices32.push_back(i*ringVertexCount + j);
-			meshData.Indices32.push_back((i+1)*ringVertexCount + j+1);
-			meshData.Indices32.push_back(i*ringVertexCount + j+1);
+			addIndex(i*ringVertexCount + j);
+			addIndex((i+1)*ringVertexCount + j+1);
+			addIndex(i*ringVertexCount + j+1);
 		}
 	}
 
-	BuildCylinderTopCap(bottomRadius, topRadius, height, sliceCount, stackCount, meshData);
-	BuildCylinderBottomCap(bottomRadius, topRadius, height, sliceCount, stackCount, meshData);
+	// Each cap has sliceCount+2 vertices and sliceCount triangles.
+	BuildCylinderTopCap(bottomRadius, topRadius, height, sliceCount, vertices, indices, vertexCount, indexCount);
+	vertexCount += sliceCount+2;
+	indexCount += 3*sliceCount;
 
+	BuildCylinderBottomCap(bottomRadius, topRadius, height, sliceCount, vertices, indices, vertexCount, indexCount);
+}
+
+GeometryGenerator::MeshData GeometryGenerator::CreateCylinder(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount)
+{
+    MeshData meshData;
+	meshData.Resize(CylinderSize(sliceCount, stackCount));
+	BuildCylinder(bottomRadius, topRadius, height, sliceCount, stackCount, meshData.Vertices.data(), meshData.Indices32.data());
     return meshData;
 }
 
-void GeometryGenerator::BuildCylinderTopCap(float bottomRadius, float topRadius, float height,
-											uint32 sliceCount, uint32 stackCount, MeshData& meshData)
+void GeometryGenerator::CreateCylinder(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount,
+	Vertex* vertices, uint32* indices)
+{
+	BuildCylinder(bottomRadius, topRadius, height, sliceCount, stackCount, vertices, indices);
+}
+
+void GeometryGenerator::CreateCylinder(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount,
+	Vertex* vertices, uint16* indices)
 {
-	uint32 baseIndex = (uint32)meshData.Vertices.size();
+	BuildCylinder(bottomRadius, topRadius, height, sliceCount, stackCount, vertices, indices);
+}
+
+template<typename Index>
+void GeometryGenerator::BuildCylinderTopCap(float bottomRadius, float topRadius, float height, uint32 sliceCount,
+											Vertex* vertices, Index* indices, uint32 baseVertex, uint32 baseIndex)
+{
+	uint32 vertexCount = baseVertex;
+	uint32 indexCount = baseIndex;
+	auto addIndex = [&](uint32 i) { indices[indexCount++] = static_cast<Index>(i); };
 
 	float y = 0.5f*height;
 	float dTheta = 2.0f*XM_PI/sliceCount;
@@ -1201,31 +1375,35 @@ void GeometryGenerator::BuildCylinderTopCap(float bottomRadius, float topRadius,
 		float u = x/height + 0.5f;
 		float v = z/height + 0.5f;
 
-		meshData.Vertices.push_back( Vertex(x, y, z, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, u, v) );
+		vertices[vertexCount++] = Vertex(x, y, z, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, u, v);
 	}
 
 	// Cap center vertex.
-	meshData.Vertices.push_back( Vertex(0.0f, y, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.5f, 0.5f) );
+	vertices[vertexCount++] = Vertex(0.0f, y, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.5f, 0.5f);
 
 	// Index of center vertex.
-	uint32 centerIndex = (uint32)meshData.Vertices.size()-1;
+	uint32 centerIndex = vertexCount-1;
 
 	for(uint32 i = 0; i < sliceCount; ++i)
 	{
-		meshData.Indices32.push_back(centerIndex);
-		meshData.Indices32.push_back(baseIndex + i+1);
-		meshData.Indices32.push_back(baseIndex + i);
+		addIndex(centerIndex);
+		addIndex(baseVertex + i+1);
+		addIndex(baseVertex + i);
 	}
 }
 
-void GeometryGenerator::BuildCylinderBottomCap(float bottomRadius, float topRadius, float height,
-											   uint32 sliceCount, uint32 stackCount, MeshData& meshData)
+template<typename Index>
+void GeometryGenerator::BuildCylinderBottomCap(float bottomRadius, float topRadius, float height, uint32 sliceCount,
+											   Vertex* vertices, Index* indices, uint32 baseVertex, uint32 baseIndex)
 {
 	// 
 	// Build bottom cap.
 	//
 
-	uint32 baseIndex = (uint32)meshData.Vertices.size();
+	uint32 vertexCount = baseVertex;
+	uint32 indexCount = baseIndex;
+	auto addIndex = [&](uint32 i) { indices[indexCount++] = static_cast<Index>(i); };
+
 	float y = -0.5f*height;
 
 	// vertices of ring
@@ -1240,30 +1418,34 @@ void GeometryGenerator::BuildCylinderBottomCap(float bottomRadius, float topRadi
 		float u = x/height + 0.5f;
 		float v = z/height + 0.5f;
 
-		meshData.Vertices.push_back( Vertex(x, y, z, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, u, v) );
+		vertices[vertexCount++] = Vertex(x, y, z, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, u, v);
 	}
 
 	// Cap center vertex.
-	meshData.Vertices.push_back( Vertex(0.0f, y, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.5f, 0.5f) );
+	vertices[vertexCount++] = Vertex(0.0f, y, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.5f, 0.5f);
 
 	// Cache the index of center vertex.
-	uint32 centerIndex = (uint32)meshData.Vertices.size()-1;
+	uint32 centerIndex = vertexCount-1;
 
 	for(uint32 i = 0; i < sliceCount; ++i)
 	{
-		meshData.Indices32.push_back(centerIndex);
-		meshData.Indices32.push_back(baseIndex + i);
-		meshData.Indices32.push_back(baseIndex + i+1);
+		addIndex(centerIndex);
+		addIndex(baseVertex + i);
+		addIndex(baseVertex + i+1);
 	}
 }
 
-GeometryGenerator::MeshData GeometryGenerator::CreateGrid(float width, float depth, uint32 m, uint32 n)
+GeometryGenerator::MeshSize GeometryGenerator::GridSize(uint32 m, uint32 n)
 {
-    MeshData meshData;
-
-	uint32 vertexCount = m*n;
-	uint32 faceCount   = (m-1)*(n-1)*2;
+	MeshSize size;
+	size.VertexCount = m*n;
+	size.IndexCount = (m-1)*(n-1)*2*3; // 3 indices per face
+	return size;
+}
 
+template<typename Index>
+void GeometryGenerator::BuildGrid(float width, float depth, uint32 m, uint32 n, Vertex* vertices, Index* indices)
+{
 	//
 	// Create the vertices.
 	//
@@ -1277,7 +1459,6 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGrid(float width, float dep
 	float du = 1.0f / (n-1);
 	float dv = 1.0f / (m-1);
 
-	meshData.Vertices.resize(vertexCount);
 	for(uint32 i = 0; i < m; ++i)
 	{
 		float z = halfDepth - i*dz;
@@ -1285,13 +1466,13 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGrid(float width, float dep
 		{
 			float x = -halfWidth + j*dx;
 
-			meshData.Vertices[i*n+j].Position = XMFLOAT3(x, 0.0f, z);
-			meshData.Vertices[i*n+j].Normal   = XMFLOAT3(0.0f, 1.0f, 0.0f);
-			meshData.Vertices[i*n+j].TangentU = XMFLOAT3(1.0f, 0.0f, 0.0f);
+			vertices[i*n+j].Position = XMFLOAT3(x, 0.0f, z);
+			vertices[i*n+j].Normal   = XMFLOAT3(0.0f, 1.0f, 0.0f);
+			vertices[i*n+j].TangentU = XMFLOAT3(1.0f, 0.0f, 0.0f);
 
 			// Stretch texture over grid.
-			meshData.Vertices[i*n+j].TexC.x = j*du;
-			meshData.Vertices[i*n+j].TexC.y = i*dv;
+			vertices[i*n+j].TexC.x = j*du;
+			vertices[i*n+j].TexC.y = i*dv;
 		}
 	}
  
@@ -1299,29 +1480,43 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGrid(float width, float dep
 	// Create the indices.
 	//
 
-	meshData.Indices32.resize(faceCount*3); // 3 indices per face
-
 	// Iterate over each quad and compute indices.
 	uint32 k = 0;
 	for(uint32 i = 0; i < m-1; ++i)
 	{
 		for(uint32 j = 0; j < n-1; ++j)
 		{
-			meshData.Indices32[k]   = i*n+j;
-			meshData.Indices32[k+1] = i*n+j+1;
-			meshData.Indices32[k+2] = (i+1)*n+j;
+			indices[k]   = static_cast<Index>(i*n+j);
+			indices[k+1] = static_cast<Index>(i*n+j+1);
+			indices[k+2] = static_cast<Index>((i+1)*n+j);
 
-			meshData.Indices32[k+3] = (i+1)*n+j;
-			meshData.Indices32[k+4] = i*n+j+1;
-			meshData.Indices32[k+5] = (i+1)*n+j+1;
+			indices[k+3] = static_cast<Index>((i+1)*n+j);
+			indices[k+4] = static_cast<Index>(i*n+j+1);
+			indices[k+5] = static_cast<Index>((i+1)*n+j+1);
 
 			k += 6; // next quad
 		}
 	}
+}
 
+GeometryGenerator::MeshData GeometryGenerator::CreateGrid(float width, float depth, uint32 m, uint32 n)
+{
+    MeshData meshData;
+	meshData.Resize(GridSize(m, n));
+	BuildGrid(width, depth, m, n, meshData.Vertices.data(), meshData.Indices32.data());
     return meshData;
 }
 
+void GeometryGenerator::CreateGrid(float width, float depth, uint32 m, uint32 n, Vertex* vertices, uint32* indices)
+{
+	BuildGrid(width, depth, m, n, vertices, indices);
+}
+
+void GeometryGenerator::CreateGrid(float width, float depth, uint32 m, uint32 n, Vertex* vertices, uint16* indices)
+{
+	BuildGrid(width, depth, m, n, vertices, indices);
+}
+
 GeometryGenerator::MeshData GeometryGenerator::CreateQuad(float x, float y, float w, float h, float depth)
 {
     MeshData meshData;
@@ -1364,3 +1559,186 @@ GeometryGenerator::MeshData GeometryGenerator::CreateQuad(float x, float y, floa
 
     return meshData;
 }
+
+// Level of detail chains are built through the pointer overloads, so that
+// every chain exercises the *Size functions and the overloads the callers
+// building into their own memory rely on.
+
+// Halves a tessellation parameter without going below low.
+static GeometryGenerator::uint32 HalveTessellation(GeometryGenerator::uint32 count, GeometryGenerator::uint32 low)
+{
+	GeometryGenerator::uint32 half = count / 2;
+	return half > low ? half : (count > low ? low : count);
+}
+
+std::vector<GeometryGenerator::MeshData> GeometryGenerator::CreateSphereLods(float radius, uint32 sliceCount, uint32 stackCount, uint32 lodCount)
+{
+	std::vector<MeshData> lods;
+	for(uint32 i = 0; i < lodCount; ++i)
+	{
+		lods.emplace_back();
+		lods.back().Resize(SphereSize(sliceCount, stackCount));
+		CreateSphere(radius, sliceCount, stackCount, lods.back().Vertices.data(), lods.back().Indices32.data());
+
+		uint32 slices = HalveTessellation(sliceCount, 6);
+		uint32 stacks = HalveTessellation(stackCount, 4);
+		if(slices == sliceCount && stacks == stackCount)
+			break;
+
+		sliceCount = slices;
+		stackCount = stacks;
+	}
+
+	return lods;
+}
+
+std::vector<GeometryGenerator::MeshData> GeometryGenerator::CreateGeosphereLods(float radius, uint32 numSubdivisions, uint32 lodCount)
+{
+	std::vector<MeshData> lods;
+	for(uint32 i = 0; i < lodCount; ++i)
+	{
+		lods.emplace_back();
+		lods.back().Resize(GeosphereSize(numSubdivisions));
+		CreateGeosphere(radius, numSubdivisions, lods.back().Vertices.data(), lods.back().Indices32.data());
+
+		if(numSubdivisions == 0)
+			break;
+
+		--numSubdivisions;
+	}
+
+	return lods;
+}
+
+std::vector<GeometryGenerator::MeshData> GeometryGenerator::CreateCylinderLods(float bottomRadius, float topRadius, float height,
+	uint32 sliceCount, uint32 stackCount, uint32 lodCount)
+{
+	std::vector<MeshData> lods;
+	for(uint32 i = 0; i < lodCount; ++i)
+	{
+		lods.emplace_back();
+		lods.back().Resize(CylinderSize(sliceCount, stackCount));
+		CreateCylinder(bottomRadius, topRadius, height, sliceCount, stackCount,
+			lods.back().Vertices.data(), lods.back().Indices32.data());
+
+		// Stacks only split the sides along the axis, so one is enough.
+		uint32 slices = HalveTessellation(sliceCount, 6);
+		uint32 stacks = HalveTessellation(stackCount, 1);
+		if(slices == sliceCount && stacks == stackCount)
+			break;
+
+		sliceCount = slices;
+		stackCount = stacks;
+	}
+
+	return lods;
+}
+
+std::vector<GeometryGenerator::MeshData> GeometryGenerator::CreateConeLods(float radius, float height, uint32 sliceCount, uint32 stackCount, uint32 lodCount)
+{
+	return CreateCylinderLods(radius, 0.f, height, sliceCount, stackCount, lodCount);
+}
+
+namespace
+{
+	// Fill values for the buffers CheckPointerOverloads hands out.  A vertex
+	// still made of FillByte, or an index not below the vertex count, was
+	// never written; a changed guard element was written past the end.
+	const unsigned char FillByte = 0xcd;
+	const GeometryGenerator::uint32 GuardCount = 4;
+
+	bool IsFill(const GeometryGenerator::Vertex& v)
+	{
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&v);
+		for(size_t i = 0; i < sizeof(v); ++i)
+		{
+			if(bytes[i] != FillByte)
+				return false;
+		}
+		return true;
+	}
+
+	template<typename Index, typename Build>
+	bool CheckBuild(const GeometryGenerator::MeshSize& size, const GeometryGenerator::MeshData& expected, Build build)
+	{
+		if(size.VertexCount != expected.Vertices.size() || size.IndexCount != expected.Indices32.size())
+			return false;
+
+		std::vector<GeometryGenerator::Vertex> vertices(size.VertexCount + GuardCount);
+		std::vector<Index> indices(size.IndexCount + GuardCount);
+		std::memset(vertices.data(), FillByte, vertices.size()*sizeof(GeometryGenerator::Vertex));
+		std::fill(indices.begin(), indices.end(), std::numeric_limits<Index>::max());
+
+		build(vertices.data(), indices.data());
+
+		for(GeometryGenerator::uint32 i = 0; i < size.VertexCount + GuardCount; ++i)
+		{
+			bool inMesh = i < size.VertexCount;
+			if(IsFill(vertices[i]) == inMesh)
+				return false;
+			if(inMesh && std::memcmp(&vertices[i], &expected.Vertices[i], sizeof(GeometryGenerator::Vertex)) != 0)
+				return false;
+		}
+
+		for(GeometryGenerator::uint32 i = 0; i < size.IndexCount; ++i)
+		{
+			if(indices[i] >= size.VertexCount || indices[i] != static_cast<Index>(expected.Indices32[i]))
+				return false;
+		}
+
+		for(GeometryGenerator::uint32 i = size.IndexCount; i < size.IndexCount + GuardCount; ++i)
+		{
+			if(indices[i] != std::numeric_limits<Index>::max())
+				return false;
+		}
+
+		return true;
+	}
+
+	// Both index widths of one shape.
+	template<typename Build>
+	bool CheckShape(const GeometryGenerator::MeshSize& size, const GeometryGenerator::MeshData& expected, Build build)
+	{
+		return CheckBuild<GeometryGenerator::uint32>(size, expected, build) &&
+			(!size.FitsIndices16() || CheckBuild<GeometryGenerator::uint16>(size, expected, build));
+	}
+}
+
+bool GeometryGenerator::CheckPointerOverloads()
+{
+	// Odd and even subdivision counts place the geosphere's first level in
+	// different buffers, and the smallest tessellations are the edge cases
+	// of the size arithmetic.
+	const uint32 sphereTessellations[][2] = { { 20, 20 }, { 7, 5 }, { 3, 2 } };
+	for(auto& t : sphereTessellations)
+	{
+		if(!CheckShape(SphereSize(t[0], t[1]), CreateSphere(0.5f, t[0], t[1]),
+			[&](Vertex* v, auto* i) { CreateSphere(0.5f, t[0], t[1], v, i); }))
+			return false;
+	}
+
+	for(uint32 subdivisions = 0; subdivisions <= 4; ++subdivisions)
+	{
+		if(!CheckShape(GeosphereSize(subdivisions), CreateGeosphere(0.5f, subdivisions),
+			[&](Vertex* v, auto* i) { CreateGeosphere(0.5f, subdivisions, v, i); }))
+			return false;
+	}
+
+	const uint32 cylinderTessellations[][2] = { { 20, 20 }, { 7, 5 }, { 3, 1 } };
+	for(auto& t : cylinderTessellations)
+	{
+		if(!CheckShape(CylinderSize(t[0], t[1]), CreateCylinder(0.5f, 0.25f, 3.0f, t[0], t[1]),
+			[&](Vertex* v, auto* i) { CreateCylinder(0.5f, 0.25f, 3.0f, t[0], t[1], v, i); }))
+			return false;
+	}
+
+	const uint32 gridTessellations[][2] = { { 60, 40 }, { 5, 7 }, { 2, 2 } };
+	for(auto& t : gridTessellations)
+	{
+		if(!CheckShape(GridSize(t[0], t[1]), CreateGrid(20.0f, 30.0f, t[0], t[1]),
+			[&](Vertex* v, auto* i) { CreateGrid(20.0f, 30.0f, t[0], t[1], v, i); }))
+			return false;
+	}
+
+	return true;
+}
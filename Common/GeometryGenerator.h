@@ -16,11 +16,24 @@
 
 #include <cstdint>
 #include <DirectXMath.h>
+#include <memory>
+#include <mutex>
 #include <vector>
 
+class ThreadPool;
+
 class GeometryGenerator
 {
 public:
+	GeometryGenerator() = default;
+
+	///<summary>
+	/// Splits the work of Subdivide on large meshes into jobs on pool.  Apart
+	/// from its scratch buffers, which are handed out under a lock, the
+	/// generator keeps no state, so one instance may be shared by jobs running
+	/// on the same pool.
+	///</summary>
+	explicit GeometryGenerator(ThreadPool* pool) : mThreadPool(pool) {}
 
     using uint16 = std::uint16_t;
     using uint32 = std::uint32_t;
@@ -53,11 +66,45 @@ public:
         DirectX::XMFLOAT2 TexC;
 	};
 
+	///<summary>
+	/// The exact vertex and index counts of a mesh, known before it is built.
+	///</summary>
+	struct MeshSize
+	{
+		uint32 VertexCount = 0;
+		uint32 IndexCount = 0;
+
+		// Whether every index fits in 16 bits.
+		bool FitsIndices16()const { return VertexCount <= 0x10000u; }
+	};
+
 	struct MeshData
 	{
 		std::vector<Vertex> Vertices;
         std::vector<uint32> Indices32;
 
+		///<summary>
+		/// Sizes the mesh for one of the Create* overloads that write through
+		/// pointers.  The vectors keep their capacity, so a MeshData that is
+		/// reused stops allocating once it has held its largest mesh.
+		///</summary>
+		void Resize(const MeshSize& size)
+		{
+			Vertices.resize(size.VertexCount);
+			Indices32.resize(size.IndexCount);
+			mIndices16.clear();
+		}
+
+		///<summary>
+		/// Writes the indices, narrowed to 16 bits, to dest, which must hold
+		/// Indices32.size() of them.  Nothing is allocated or kept.
+		///</summary>
+		void GetIndices16(uint16* dest)const
+		{
+			for(size_t i = 0; i < Indices32.size(); ++i)
+				dest[i] = static_cast<uint16>(Indices32[i]);
+		}
+
         std::vector<uint16>& GetIndices16()
         {
 			if(mIndices16.empty())
@@ -160,11 +207,102 @@ public:
 
 	MeshData CreateCandy(float width, float height, uint32 numSubdivisions);
 
+	///<summary>
+	/// Sizes of the meshes made by CreateSphere, CreateGeosphere, CreateCylinder
+	/// and CreateGrid with the same tessellation.
+	///</summary>
+	static MeshSize SphereSize(uint32 sliceCount, uint32 stackCount);
+	static MeshSize GeosphereSize(uint32 numSubdivisions);
+	static MeshSize CylinderSize(uint32 sliceCount, uint32 stackCount);
+	static MeshSize GridSize(uint32 m, uint32 n);
+
+	///<summary>
+	/// Build the same meshes straight into caller memory, a reused MeshData or
+	/// a mapped upload buffer say, sized with the matching *Size function.
+	/// Nothing is allocated except, for a geosphere, scratch space the
+	/// generator keeps for later calls.  The 16-bit overloads need a size
+	/// that FitsIndices16.
+	///</summary>
+	void CreateSphere(float radius, uint32 sliceCount, uint32 stackCount, Vertex* vertices, uint32* indices);
+	void CreateSphere(float radius, uint32 sliceCount, uint32 stackCount, Vertex* vertices, uint16* indices);
+	void CreateGeosphere(float radius, uint32 numSubdivisions, Vertex* vertices, uint32* indices);
+	void CreateGeosphere(float radius, uint32 numSubdivisions, Vertex* vertices, uint16* indices);
+	void CreateCylinder(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount,
+		Vertex* vertices, uint32* indices);
+	void CreateCylinder(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount,
+		Vertex* vertices, uint16* indices);
+	void CreateGrid(float width, float depth, uint32 m, uint32 n, Vertex* vertices, uint32* indices);
+	void CreateGrid(float width, float depth, uint32 m, uint32 n, Vertex* vertices, uint16* indices);
+
+	///<summary>
+	/// Level of detail chains.  Level 0 has the given tessellation and each
+	/// further level halves the slices and stacks, or drops one subdivision,
+	/// down to the coarsest mesh that still has the shape.  The chain stops
+	/// early once a level can get no coarser, so it can be shorter than lodCount.
+	///</summary>
+	std::vector<MeshData> CreateSphereLods(float radius, uint32 sliceCount, uint32 stackCount, uint32 lodCount);
+	std::vector<MeshData> CreateGeosphereLods(float radius, uint32 numSubdivisions, uint32 lodCount);
+	std::vector<MeshData> CreateCylinderLods(float bottomRadius, float topRadius, float height,
+		uint32 sliceCount, uint32 stackCount, uint32 lodCount);
+	std::vector<MeshData> CreateConeLods(float radius, float height, uint32 sliceCount, uint32 stackCount, uint32 lodCount);
+
+	///<summary>
+	/// Builds each shape that has a *Size function with both pointer overloads,
+	/// over a range of tessellations, and compares the results with the
+	/// MeshData versions.  Also fails if a build writes fewer or more elements
+	/// than its *Size gives.  Run by the app's -checkgeometry option.
+	///</summary>
+	bool CheckPointerOverloads();
+
 
 private:
+	// Space for the levels of a subdivision that are not the output.
+	struct Scratch
+	{
+		std::vector<Vertex> Vertices;
+		std::vector<uint32> Indices32;
+		std::vector<uint16> Indices16;
+
+		std::vector<uint32>& IndicesFor(const uint32*) { return Indices32; }
+		std::vector<uint16>& IndicesFor(const uint16*) { return Indices16; }
+	};
+
 	void Subdivide(MeshData& meshData);
+
+	// Writes the 4 triangles each of numTris input triangles becomes, as 6
+	// vertices and 12 indices per input triangle.  The input and output must
+	// not overlap.
+	template<typename Index>
+	void Subdivide(const Vertex* inVertices, const Index* inIndices, uint32 numTris, Vertex* outVertices, Index* outIndices);
+
     Vertex MidPoint(const Vertex& v0, const Vertex& v1);
-    void BuildCylinderTopCap(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount, MeshData& meshData);
-    void BuildCylinderBottomCap(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount, MeshData& meshData);
+
+	template<typename Index>
+	void BuildSphere(float radius, uint32 sliceCount, uint32 stackCount, Vertex* vertices, Index* indices);
+	template<typename Index>
+	void BuildGeosphere(float radius, uint32 numSubdivisions, Vertex* vertices, Index* indices);
+	template<typename Index>
+	void BuildCylinder(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount,
+		Vertex* vertices, Index* indices);
+	template<typename Index>
+	void BuildGrid(float width, float depth, uint32 m, uint32 n, Vertex* vertices, Index* indices);
+
+	// The caps are written from the given first vertex and first index on.
+	template<typename Index>
+	void BuildCylinderTopCap(float bottomRadius, float topRadius, float height, uint32 sliceCount,
+		Vertex* vertices, Index* indices, uint32 baseVertex, uint32 baseIndex);
+	template<typename Index>
+	void BuildCylinderBottomCap(float bottomRadius, float topRadius, float height, uint32 sliceCount,
+		Vertex* vertices, Index* indices, uint32 baseVertex, uint32 baseIndex);
+
+	// Scratch buffers are reused rather than freed, one per concurrent user.
+	std::unique_ptr<Scratch> AcquireScratch();
+	void ReleaseScratch(std::unique_ptr<Scratch> scratch);
+
+private:
+	ThreadPool* mThreadPool = nullptr;
+
+	std::vector<std::unique_ptr<Scratch>> mScratch;
+	std::mutex mScratchMutex;
 };
 
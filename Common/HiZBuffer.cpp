@@ -0,0 +1,156 @@
+//***************************************************************************************
+// HiZBuffer.cpp
+//***************************************************************************************
+
+#include "HiZBuffer.h"
+
+using namespace DirectX;
+
+std::uint32_t HiZBuffer::LevelCount(std::uint32_t depthWidth, std::uint32_t depthHeight)
+{
+	std::uint32_t count = 1;
+	while(LevelSize(depthWidth, count - 1) > 1 || LevelSize(depthHeight, count - 1) > 1)
+		++count;
+
+	return count;
+}
+
+std::uint32_t HiZBuffer::LevelSize(std::uint32_t depthSize, std::uint32_t level)
+{
+	std::uint32_t size = depthSize >> (level + 1);
+	return size > 0 ? size : 1;
+}
+
+void HiZBuffer::Resize(std::uint32_t depthWidth, std::uint32_t depthHeight, std::uint32_t firstLevel)
+{
+	mDepthWidth = depthWidth;
+	mDepthHeight = depthHeight;
+	mLevelCount = LevelCount(depthWidth, depthHeight);
+	mFirstLevel = firstLevel < mLevelCount ? firstLevel : mLevelCount - 1;
+
+	size_t size = 0;
+	mLevelOffsets.clear();
+	for(std::uint32_t level = mFirstLevel; level < mLevelCount; ++level)
+	{
+		mLevelOffsets.push_back(size);
+		size += (size_t)LevelWidth(level)*LevelHeight(level);
+	}
+
+	mDepths.assign(size, 1.0f);
+	mValid = false;
+}
+
+std::uint32_t HiZBuffer::FirstLevel()const
+{
+	return mFirstLevel;
+}
+
+std::uint32_t HiZBuffer::LevelCount()const
+{
+	return mLevelCount;
+}
+
+std::uint32_t HiZBuffer::LevelWidth(std::uint32_t level)const
+{
+	return LevelSize(mDepthWidth, level);
+}
+
+std::uint32_t HiZBuffer::LevelHeight(std::uint32_t level)const
+{
+	return LevelSize(mDepthHeight, level);
+}
+
+float* HiZBuffer::LevelData(std::uint32_t level)
+{
+	return mDepths.data() + mLevelOffsets[level - mFirstLevel];
+}
+
+void HiZBuffer::SetCamera(FXMMATRIX view, CXMMATRIX proj)
+{
+	XMStoreFloat4x4(&mView, view);
+
+	XMFLOAT4X4 p;
+	XMStoreFloat4x4(&p, proj);
+	mProjScaleX = p(0, 0);
+	mProjScaleY = p(1, 1);
+	mDepthA = p(2, 2);
+	mDepthB = p(3, 2);
+
+	mValid = !mDepths.empty();
+}
+
+void HiZBuffer::Invalidate()
+{
+	mValid = false;
+}
+
+bool HiZBuffer::IsValid()const
+{
+	return mValid;
+}
+
+bool HiZBuffer::IsOccluded(const BoundingSphere& sphereW)const
+{
+	XMFLOAT3 c;
+	XMStoreFloat3(&c, XMVector3TransformCoord(XMLoadFloat3(&sphereW.Center), XMLoadFloat4x4(&mView)));
+	const float r = sphereW.Radius;
+
+	// The near plane is where the projected depth is 0.
+	const float z0 = c.z - r;
+	const float z1 = c.z + r;
+	if(z0*mDepthA + mDepthB <= 0.0f)
+		return false;
+
+	// Screen bounds of the sphere's view space box.  x / z is largest at the
+	// near face for positive x and at the far face for negative x.
+	const float xMin = c.x - r;
+	const float xMax = c.x + r;
+	const float yMin = c.y - r;
+	const float yMax = c.y + r;
+	const float ndcMinX = mProjScaleX*xMin / (xMin < 0.0f ? z0 : z1);
+	const float ndcMaxX = mProjScaleX*xMax / (xMax > 0.0f ? z0 : z1);
+	const float ndcMinY = mProjScaleY*yMin / (yMin < 0.0f ? z0 : z1);
+	const float ndcMaxY = mProjScaleY*yMax / (yMax > 0.0f ? z0 : z1);
+
+	if(ndcMinX < -1.0f || ndcMaxX > 1.0f || ndcMinY < -1.0f || ndcMaxY > 1.0f)
+		return false;
+
+	// Pixels of the depth buffer, with rows counted down from the top.
+	const float px0 = (0.5f*ndcMinX + 0.5f)*mDepthWidth;
+	const float px1 = (0.5f*ndcMaxX + 0.5f)*mDepthWidth;
+	const float py0 = (0.5f - 0.5f*ndcMaxY)*mDepthHeight;
+	const float py1 = (0.5f - 0.5f*ndcMinY)*mDepthHeight;
+
+	// The finest level whose texels are at least as large as the bounds, so
+	// they cover at most 2 x 2 texels.  A texel of level n is 2^(n+1) pixels.
+	const float extent = px1 - px0 > py1 - py0 ? px1 - px0 : py1 - py0;
+	std::uint32_t level = mFirstLevel;
+	while(level + 1 < mLevelCount && (float)(2u << level) < extent)
+		++level;
+
+	const std::uint32_t width = LevelWidth(level);
+	const std::uint32_t height = LevelHeight(level);
+	const std::uint32_t shift = level + 1;
+	std::uint32_t x0 = (std::uint32_t)px0 >> shift;
+	std::uint32_t x1 = (std::uint32_t)px1 >> shift;
+	std::uint32_t y0 = (std::uint32_t)py0 >> shift;
+	std::uint32_t y1 = (std::uint32_t)py1 >> shift;
+	x0 = x0 < width ? x0 : width - 1;
+	x1 = x1 < width ? x1 : width - 1;
+	y0 = y0 < height ? y0 : height - 1;
+	y1 = y1 < height ? y1 : height - 1;
+
+	const float* depths = mDepths.data() + mLevelOffsets[level - mFirstLevel];
+	float farthest = 0.0f;
+	for(std::uint32_t y = y0; y <= y1; ++y)
+	{
+		for(std::uint32_t x = x0; x <= x1; ++x)
+		{
+			float d = depths[(size_t)y*width + x];
+			farthest = d > farthest ? d : farthest;
+		}
+	}
+
+	const float nearest = mDepthA + mDepthB / z0;
+	return nearest > farthest;
+}
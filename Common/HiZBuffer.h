@@ -0,0 +1,74 @@
+//***************************************************************************************
+// HiZBuffer.h
+//
+// CPU copy of a hierarchical depth buffer for occlusion culling.  Level 0 is
+// half the size of the depth buffer, and each texel of a level holds the
+// farthest depth of the texels below it, so a sphere whose nearest point is
+// behind every texel its projection covers is hidden.  The pyramid is built
+// on the GPU and read back from some level down, which the coarser tests of
+// the CPU need anyway; the depth is from an earlier frame, so IsOccluded
+// projects with the camera the depth was rendered with.  Levels are rounded
+// down in size, with the last row and column of a level also covering the
+// odd row or column of the level below.  Shaders/Cull.hlsl has the same test.
+//***************************************************************************************
+
+#pragma once
+
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <cstdint>
+#include <vector>
+
+class HiZBuffer
+{
+public:
+	HiZBuffer() = default;
+	HiZBuffer(const HiZBuffer& rhs) = delete;
+	HiZBuffer& operator=(const HiZBuffer& rhs) = delete;
+
+	// Size of the pyramid of a depthWidth x depthHeight depth buffer.
+	static std::uint32_t LevelCount(std::uint32_t depthWidth, std::uint32_t depthHeight);
+	static std::uint32_t LevelSize(std::uint32_t depthSize, std::uint32_t level);
+
+	// Sizes the levels from firstLevel down to 1 x 1 for a depth buffer of the
+	// given size and marks the buffer invalid until the levels are filled.
+	void Resize(std::uint32_t depthWidth, std::uint32_t depthHeight, std::uint32_t firstLevel);
+
+	std::uint32_t FirstLevel()const;
+	std::uint32_t LevelCount()const;
+	std::uint32_t LevelWidth(std::uint32_t level)const;
+	std::uint32_t LevelHeight(std::uint32_t level)const;
+
+	// Rows of LevelWidth(level) depths, for level >= FirstLevel().
+	float* LevelData(std::uint32_t level);
+
+	// Stores the view and projection the depth was rendered with and marks the
+	// buffer valid.  The projection must be a left-handed perspective one.
+	void SetCamera(DirectX::FXMMATRIX view, DirectX::CXMMATRIX proj);
+	void Invalidate();
+	bool IsValid()const;
+
+	// True if the world space sphere is hidden behind the depth.  Spheres that
+	// reach the near plane or leave the screen of the depth are never hidden.
+	bool IsOccluded(const DirectX::BoundingSphere& sphereW)const;
+
+private:
+	std::uint32_t mDepthWidth = 0;
+	std::uint32_t mDepthHeight = 0;
+	std::uint32_t mFirstLevel = 0;
+	std::uint32_t mLevelCount = 0;
+
+	// Levels mFirstLevel and above, one after another.
+	std::vector<float> mDepths;
+	std::vector<size_t> mLevelOffsets;
+
+	DirectX::XMFLOAT4X4 mView;
+	float mProjScaleX = 0.0f;
+	float mProjScaleY = 0.0f;
+
+	// The projection maps view space depth z to depth DepthA + DepthB / z.
+	float mDepthA = 0.0f;
+	float mDepthB = 0.0f;
+
+	bool mValid = false;
+};
@@ -0,0 +1,385 @@
+//***************************************************************************************
+// Instrumentation.cpp
+//***************************************************************************************
+
+#include "Instrumentation.h"
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	// Threads past this many record nothing.
+	const UINT MaxThreads = 64;
+
+	// Zones a thread can finish between two EndFrames before it drops some.
+	const UINT ZoneRingSize = 4096;
+
+	// Keeps a long trace from growing without bound; about 24 MB.
+	const size_t MaxTraceZones = 1 << 20;
+
+	const char* const CounterNames[InstrumentCounterCount] =
+	{
+		"DrawCalls",
+		"Triangles",
+		"ConstantBytes"
+	};
+
+	struct ZoneRecord
+	{
+		const char* Name;
+		LONGLONG Start;
+		LONGLONG End;
+	};
+
+	// Written by its own thread and read by the main thread.  A counter is
+	// updated with a plain load and store, atomic only so the reader sees
+	// whole values.  The ring is single producer, single consumer: the owner
+	// publishes a record by moving Head and EndFrame frees it by moving Tail.
+	struct ThreadData
+	{
+		std::atomic<UINT64> Counters[InstrumentCounterCount];
+		ZoneRecord Zones[ZoneRingSize];
+		std::atomic<UINT> Head{ 0 };
+		std::atomic<UINT> Tail{ 0 };
+		DWORD ThreadId = 0;
+
+		ThreadData()
+		{
+			for(auto& c : Counters)
+				c.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	struct TraceZone
+	{
+		const char* Name;
+		UINT Thread;
+		LONGLONG Start;
+		LONGLONG End;
+	};
+
+	struct TraceCounters
+	{
+		LONGLONG Time;
+		UINT64 Counters[InstrumentCounterCount];
+	};
+
+	std::unique_ptr<ThreadData> gThreads[MaxThreads];
+	std::atomic<UINT> gThreadCount{ 0 };
+	std::mutex gRegisterMutex;
+
+	thread_local ThreadData* tThread = nullptr;
+	thread_local bool tUnregistered = false;
+
+	// Everything below is only touched by the main thread.
+	InstrumentedFrame gHistory[Instrumentation::HistoryLength];
+	UINT64 gFrameIndex = 0;
+	UINT gHistoryCount = 0;
+	LONGLONG gLastFrameEnd = 0;
+	UINT64 gCounterTotals[InstrumentCounterCount] = {};
+
+	bool gTracing = false;
+	LONGLONG gTraceStart = 0;
+	DWORD gMainThreadId = 0;
+	std::vector<TraceZone> gTraceZones;
+	std::vector<TraceCounters> gTraceCounters;
+
+	double gTicksToMs = 0.0;
+
+	double TicksToMs(LONGLONG ticks)
+	{
+		if(gTicksToMs == 0.0)
+		{
+			LARGE_INTEGER frequency;
+			QueryPerformanceFrequency(&frequency);
+			gTicksToMs = 1000.0 / (double)frequency.QuadPart;
+		}
+		return (double)ticks*gTicksToMs;
+	}
+
+	// The calling thread's block, registered on first use.  Null once the
+	// blocks have run out.
+	ThreadData* CurrentThread()
+	{
+		if(tThread != nullptr || tUnregistered)
+			return tThread;
+
+		std::lock_guard<std::mutex> lock(gRegisterMutex);
+
+		UINT index = gThreadCount.load(std::memory_order_relaxed);
+		if(index >= MaxThreads)
+		{
+			tUnregistered = true;
+			return nullptr;
+		}
+
+		gThreads[index] = std::make_unique<ThreadData>();
+		gThreads[index]->ThreadId = GetCurrentThreadId();
+		tThread = gThreads[index].get();
+
+		// Publishes the block to EndFrame.
+		gThreadCount.store(index + 1, std::memory_order_release);
+		return tThread;
+	}
+
+	void AddZoneTime(InstrumentedFrame& frame, const ZoneRecord& record)
+	{
+		InstrumentedFrame::Zone* zone = nullptr;
+		for(UINT i = 0; i < frame.ZoneCount && zone == nullptr; ++i)
+		{
+			const char* name = frame.Zones[i].Name;
+			if(name == record.Name || std::strcmp(name, record.Name) == 0)
+				zone = &frame.Zones[i];
+		}
+
+		if(zone == nullptr)
+		{
+			if(frame.ZoneCount == InstrumentedFrame::MaxZones)
+				return;
+
+			zone = &frame.Zones[frame.ZoneCount++];
+			zone->Name = record.Name;
+		}
+
+		zone->Ms += TicksToMs(record.End - record.Start);
+		++zone->Calls;
+	}
+
+	// JSON string contents; zone names are identifiers in practice.
+	void WriteJsonString(std::ofstream& fout, const char* s)
+	{
+		fout << '"';
+		for(; *s != '\0'; ++s)
+		{
+			if(*s == '"' || *s == '\\')
+				fout << '\\';
+			fout << *s;
+		}
+		fout << '"';
+	}
+}
+
+UINT64 InstrumentedFrame::Counter(InstrumentCounter counter)const
+{
+	return Counters[(UINT)counter];
+}
+
+double InstrumentedFrame::ZoneMs(const char* name)const
+{
+	for(UINT i = 0; i < ZoneCount; ++i)
+	{
+		if(std::strcmp(Zones[i].Name, name) == 0)
+			return Zones[i].Ms;
+	}
+	return 0.0;
+}
+
+bool Instrumentation::Enabled()
+{
+#ifdef INSTRUMENTATION_ENABLED
+	return true;
+#else
+	return false;
+#endif
+}
+
+const char* Instrumentation::CounterName(InstrumentCounter counter)
+{
+	return CounterNames[(UINT)counter];
+}
+
+void Instrumentation::AddCount(InstrumentCounter counter, UINT64 amount)
+{
+	ThreadData* thread = CurrentThread();
+	if(thread == nullptr)
+		return;
+
+	// Only this thread writes the counter, so no read-modify-write is needed.
+	std::atomic<UINT64>& c = thread->Counters[(UINT)counter];
+	c.store(c.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+void Instrumentation::AddZone(const char* name, const LARGE_INTEGER& start, const LARGE_INTEGER& end)
+{
+	ThreadData* thread = CurrentThread();
+	if(thread == nullptr)
+		return;
+
+	// A full ring drops the zone rather than waiting for the main thread.
+	UINT head = thread->Head.load(std::memory_order_relaxed);
+	if(head - thread->Tail.load(std::memory_order_acquire) >= ZoneRingSize)
+		return;
+
+	ZoneRecord& record = thread->Zones[head % ZoneRingSize];
+	record.Name = name;
+	record.Start = start.QuadPart;
+	record.End = end.QuadPart;
+
+	thread->Head.store(head + 1, std::memory_order_release);
+}
+
+void Instrumentation::EndFrame()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	InstrumentedFrame& frame = gHistory[gFrameIndex % HistoryLength];
+	frame = InstrumentedFrame();
+	frame.FrameIndex = ++gFrameIndex;
+	frame.FrameMs = gLastFrameEnd == 0 ? 0.0 : TicksToMs(now.QuadPart - gLastFrameEnd);
+	gLastFrameEnd = now.QuadPart;
+
+	if(gHistoryCount < HistoryLength)
+		++gHistoryCount;
+
+	UINT64 totals[InstrumentCounterCount] = {};
+
+	const UINT threadCount = gThreadCount.load(std::memory_order_acquire);
+	for(UINT t = 0; t < threadCount; ++t)
+	{
+		ThreadData& thread = *gThreads[t];
+
+		for(UINT c = 0; c < InstrumentCounterCount; ++c)
+			totals[c] += thread.Counters[c].load(std::memory_order_relaxed);
+
+		UINT tail = thread.Tail.load(std::memory_order_relaxed);
+		const UINT head = thread.Head.load(std::memory_order_acquire);
+		for(; tail != head; ++tail)
+		{
+			const ZoneRecord& record = thread.Zones[tail % ZoneRingSize];
+			AddZoneTime(frame, record);
+
+			if(gTracing && gTraceZones.size() < MaxTraceZones)
+				gTraceZones.push_back({ record.Name, t, record.Start, record.End });
+		}
+		thread.Tail.store(tail, std::memory_order_release);
+	}
+
+	// The counters only grow, so a frame's counts are the growth since the last.
+	for(UINT c = 0; c < InstrumentCounterCount; ++c)
+	{
+		frame.Counters[c] = totals[c] - gCounterTotals[c];
+		gCounterTotals[c] = totals[c];
+	}
+
+	if(gTracing)
+	{
+		TraceCounters counters;
+		counters.Time = now.QuadPart;
+		for(UINT c = 0; c < InstrumentCounterCount; ++c)
+			counters.Counters[c] = frame.Counters[c];
+		gTraceCounters.push_back(counters);
+	}
+}
+
+const InstrumentedFrame& Instrumentation::History(UINT framesAgo)
+{
+	return gHistory[(gFrameIndex - 1 - framesAgo) % HistoryLength];
+}
+
+UINT Instrumentation::HistoryCount()
+{
+	return gHistoryCount;
+}
+
+void Instrumentation::FrameTimes(double& averageMs, double& maxMs)
+{
+	averageMs = 0.0;
+	maxMs = 0.0;
+
+	// The first frame has no start to time from.
+	UINT count = 0;
+	for(UINT i = 0; i < gHistoryCount; ++i)
+	{
+		const InstrumentedFrame& frame = History(i);
+		if(frame.FrameIndex == 1)
+			continue;
+
+		averageMs += frame.FrameMs;
+		maxMs = frame.FrameMs > maxMs ? frame.FrameMs : maxMs;
+		++count;
+	}
+
+	if(count > 0)
+		averageMs /= count;
+}
+
+void Instrumentation::StartTrace()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	gTraceZones.clear();
+	gTraceCounters.clear();
+	gTraceStart = now.QuadPart;
+	gMainThreadId = GetCurrentThreadId();
+	gTracing = true;
+}
+
+void Instrumentation::StopTrace()
+{
+	gTracing = false;
+}
+
+bool Instrumentation::IsTracing()
+{
+	return gTracing;
+}
+
+size_t Instrumentation::TracedFrameCount()
+{
+	return gTraceCounters.size();
+}
+
+bool Instrumentation::WriteChromeTrace(const std::wstring& filename)
+{
+	std::ofstream fout(filename);
+	if(!fout)
+		return false;
+
+	// Trace event timestamps are microseconds.
+	auto micros = [](LONGLONG ticks) { return 1000.0*TicksToMs(ticks); };
+
+	fout << "{\n  \"displayTimeUnit\": \"ms\",\n  \"traceEvents\": [\n";
+
+	const UINT threadCount = gThreadCount.load(std::memory_order_acquire);
+	for(UINT t = 0; t < threadCount; ++t)
+	{
+		fout << "    { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t <<
+			", \"args\": { \"name\": \"" << (gThreads[t]->ThreadId == gMainThreadId ? "Main" : "Worker") <<
+			" " << gThreads[t]->ThreadId << "\" } },\n";
+	}
+
+	for(auto& zone : gTraceZones)
+	{
+		fout << "    { \"name\": ";
+		WriteJsonString(fout, zone.Name);
+		fout << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << zone.Thread <<
+			", \"ts\": " << micros(zone.Start - gTraceStart) <<
+			", \"dur\": " << micros(zone.End - zone.Start) << " },\n";
+	}
+
+	for(size_t i = 0; i < gTraceCounters.size(); ++i)
+	{
+		const TraceCounters& counters = gTraceCounters[i];
+		for(UINT c = 0; c < InstrumentCounterCount; ++c)
+		{
+			fout << "    { \"name\": \"" << CounterNames[c] << "\", \"ph\": \"C\", \"pid\": 1" <<
+				", \"ts\": " << micros(counters.Time - gTraceStart) <<
+				", \"args\": { \"value\": " << counters.Counters[c] << " } }";
+			fout << (i + 1 < gTraceCounters.size() || c + 1 < InstrumentCounterCount ? ",\n" : "\n");
+		}
+	}
+
+	// Every event above ends in a comma, so a capture of no frames needs a last one.
+	if(gTraceCounters.empty())
+		fout << "    { \"name\": \"trace_end\", \"ph\": \"i\", \"pid\": 1, \"tid\": 0, \"ts\": 0, \"s\": \"g\" }\n";
+
+	fout << "  ]\n}\n";
+
+	return true;
+}
@@ -0,0 +1,133 @@
+//***************************************************************************************
+// Instrumentation.h
+//
+// Counters and timed zones cheap enough for hot paths.  Every thread that
+// records gets a block of its own: counters that only its thread writes and a
+// ring of finished zones that its thread fills and the main thread drains, so
+// recording takes no lock and no interlocked instruction.  Once a frame,
+// EndFrame sums the counters and drains the rings into a ring buffer of recent
+// frames, which the app shows in its stats overlay.  While a trace is being
+// captured the zones and counters are also kept, to be written as Chrome trace
+// JSON for chrome://tracing or ui.perfetto.dev.
+//
+// Hot code records through the INSTRUMENT_* macros, which compile to nothing,
+// arguments included, unless INSTRUMENTATION_ENABLED is defined.  The rest of
+// the interface is always there so callers need no #ifs; in a build without
+// the define only the frame times are recorded.
+//***************************************************************************************
+
+#pragma once
+
+#include <windows.h>
+#include <string>
+
+enum class InstrumentCounter
+{
+	DrawCalls,      // draws and ExecuteIndirect calls recorded
+	Triangles,      // triangles of the CPU recorded draws, from their IndexCount
+	ConstantBytes,  // bytes written to constant buffers by UploadBuffer::CopyData
+	Count
+};
+
+const UINT InstrumentCounterCount = (UINT)InstrumentCounter::Count;
+
+// One frame of the history.
+struct InstrumentedFrame
+{
+	// Zone names past this many in a frame are dropped from the history,
+	// though not from a trace.
+	static const UINT MaxZones = 16;
+
+	struct Zone
+	{
+		const char* Name = nullptr;
+		double Ms = 0.0;
+		UINT Calls = 0;
+	};
+
+	UINT64 FrameIndex = 0;
+
+	// From the previous EndFrame to this one.
+	double FrameMs = 0.0;
+
+	UINT64 Counters[InstrumentCounterCount] = {};
+
+	// Total time per zone name, on every thread, in the order the names were
+	// first seen.
+	Zone Zones[MaxZones];
+	UINT ZoneCount = 0;
+
+	UINT64 Counter(InstrumentCounter counter)const;
+
+	// Total time of the named zone, or 0 if it did not run.
+	double ZoneMs(const char* name)const;
+};
+
+class Instrumentation
+{
+public:
+	static const UINT HistoryLength = 240;
+
+	// Whether the build records counters and zones.
+	static bool Enabled();
+
+	static const char* CounterName(InstrumentCounter counter);
+
+	// Hot path recording; call through the macros.  Zone names must be string
+	// literals or otherwise outlive the trace, since only the pointer is kept.
+	static void AddCount(InstrumentCounter counter, UINT64 amount);
+	static void AddZone(const char* name, const LARGE_INTEGER& start, const LARGE_INTEGER& end);
+
+	// Closes the frame.  Call once a frame, on the main thread, after the
+	// frame's work; the frame's zones are the ones finished since the last call.
+	static void EndFrame();
+
+	// The frame framesAgo frames before the latest, for framesAgo < HistoryCount().
+	static const InstrumentedFrame& History(UINT framesAgo);
+	static UINT HistoryCount();
+
+	// Mean and longest frame time over the history.
+	static void FrameTimes(double& averageMs, double& maxMs);
+
+	// While tracing, EndFrame keeps every zone and each frame's counters, up to
+	// a limit, for WriteChromeTrace.
+	static void StartTrace();
+	static void StopTrace();
+	static bool IsTracing();
+	static size_t TracedFrameCount();
+	static bool WriteChromeTrace(const std::wstring& filename);
+};
+
+// Adds the time between construction and destruction as a zone of the
+// calling thread.
+class InstrumentZone
+{
+public:
+	explicit InstrumentZone(const char* name) : mName(name)
+	{
+		QueryPerformanceCounter(&mStart);
+	}
+	InstrumentZone(const InstrumentZone& rhs) = delete;
+	InstrumentZone& operator=(const InstrumentZone& rhs) = delete;
+	~InstrumentZone()
+	{
+		LARGE_INTEGER end;
+		QueryPerformanceCounter(&end);
+		Instrumentation::AddZone(mName, mStart, end);
+	}
+
+private:
+	const char* mName = nullptr;
+	LARGE_INTEGER mStart;
+};
+
+#define INSTRUMENT_CONCAT_(a, b) a##b
+#define INSTRUMENT_CONCAT(a, b) INSTRUMENT_CONCAT_(a, b)
+
+#ifdef INSTRUMENTATION_ENABLED
+#define INSTRUMENT_COUNT(counter, amount) Instrumentation::AddCount(InstrumentCounter::counter, (amount))
+#define INSTRUMENT_ZONE(name) InstrumentZone INSTRUMENT_CONCAT(instrumentZone, __LINE__)(name)
+#else
+#define INSTRUMENT_COUNT(counter, amount) ((void)0)
+#define INSTRUMENT_ZONE(name) ((void)0)
+#endif
@@ -79,4 +79,23 @@ XMVECTOR MathHelper::RandHemisphereUnitVec3(XMVECTOR n)
 
 		return XMVector3Normalize(v);
 	}
-}
\ No newline at end of file
+}
+
+XMFLOAT2 MathHelper::EncodeOctahedral(const XMFLOAT3& n)
+{
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if(l1 == 0.0f)
+		return XMFLOAT2(0.0f, 0.0f);
+
+	float x = n.x / l1;
+	float y = n.y / l1;
+	if(n.z < 0.0f)
+	{
+		float fx = (1.0f - fabsf(y))*(x >= 0.0f ? 1.0f : -1.0f);
+		float fy = (1.0f - fabsf(x))*(y >= 0.0f ? 1.0f : -1.0f);
+		x = fx;
+		y = fy;
+	}
+
+	return XMFLOAT2(x, y);
+}
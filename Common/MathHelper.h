@@ -92,6 +92,11 @@ public:
     static DirectX::XMVECTOR RandUnitVec3();
     static DirectX::XMVECTOR RandHemisphereUnitVec3(DirectX::XMVECTOR n);
 
+	// Maps a unit vector to a point in [-1,1]^2 by projecting it onto the
+	// octahedron |x|+|y|+|z| = 1 and folding the lower half over the upper.
+	// The shaders decode it with DecodeOctahedral.
+	static DirectX::XMFLOAT2 EncodeOctahedral(const DirectX::XMFLOAT3& n);
+
 	static const float Infinity;
 	static const float Pi;
 
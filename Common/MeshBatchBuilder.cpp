@@ -0,0 +1,98 @@
+//***************************************************************************************
+// MeshBatchBuilder.cpp
+//***************************************************************************************
+
+#include "MeshBatchBuilder.h"
+
+using namespace DirectX;
+
+void MeshBatchBuilder::Add(const std::string& name, GeometryGenerator::MeshData&& mesh)
+{
+	Entry e;
+	e.Name = name;
+	e.Mesh = std::move(mesh);
+
+	// Indices are relative to the submesh's base vertex.
+	e.Submesh.IndexCount = (UINT)e.Mesh.Indices32.size();
+	e.Submesh.StartIndexLocation = mIndexCount;
+	e.Submesh.BaseVertexLocation = (INT)mVertexCount;
+
+	if(!e.Mesh.Vertices.empty())
+	{
+		BoundingBox::CreateFromPoints(e.Submesh.Bounds, e.Mesh.Vertices.size(),
+			&e.Mesh.Vertices[0].Position, sizeof(GeometryGenerator::Vertex));
+	}
+
+	for(auto i : e.Mesh.Indices32)
+		mMaxIndex = i > mMaxIndex ? i : mMaxIndex;
+
+	mVertexCount += (UINT)e.Mesh.Vertices.size();
+	mIndexCount += e.Submesh.IndexCount;
+
+	mMeshes.push_back(std::move(e));
+}
+
+void MeshBatchBuilder::AddLods(const std::string& name, std::vector<GeometryGenerator::MeshData>&& lods)
+{
+	for(size_t i = 0; i < lods.size(); ++i)
+		Add(i == 0 ? name : LodName(name, (UINT)i), std::move(lods[i]));
+
+	lods.clear();
+}
+
+std::string MeshBatchBuilder::LodName(const std::string& name, UINT level)
+{
+	return name + "_lod" + std::to_string(level);
+}
+
+bool MeshBatchBuilder::IsLodName(const std::string& submeshName)
+{
+	return submeshName.find("_lod") != std::string::npos;
+}
+
+UINT MeshBatchBuilder::VertexCount()const
+{
+	return mVertexCount;
+}
+
+UINT MeshBatchBuilder::IndexCount()const
+{
+	return mIndexCount;
+}
+
+DXGI_FORMAT MeshBatchBuilder::IndexFormat()const
+{
+	return mMaxIndex > 0xffff ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+}
+
+void MeshBatchBuilder::BuildIndices(MeshGeometry* geo, ThreadPool* pool)const
+{
+	const bool use32 = IndexFormat() == DXGI_FORMAT_R32_UINT;
+	const UINT indexByteSize = use32 ? sizeof(std::uint32_t) : sizeof(std::uint16_t);
+	const UINT ibByteSize = mIndexCount*indexByteSize;
+
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+	BYTE* indexBuffer = reinterpret_cast<BYTE*>(geo->IndexBufferCPU->GetBufferPointer());
+
+	ForEachMesh(pool, [&](const Entry& e)
+	{
+		const auto& indices = e.Mesh.Indices32;
+		BYTE* dest = indexBuffer + (size_t)e.Submesh.StartIndexLocation*indexByteSize;
+		if(use32)
+		{
+			CopyMemory(dest, indices.data(), indices.size()*sizeof(std::uint32_t));
+		}
+		else
+		{
+			std::uint16_t* dest16 = reinterpret_cast<std::uint16_t*>(dest);
+			for(size_t i = 0; i < indices.size(); ++i)
+				dest16[i] = static_cast<std::uint16_t>(indices[i]);
+		}
+	});
+
+	for(auto& e : mMeshes)
+		geo->DrawArgs[e.Name] = e.Submesh;
+
+	geo->IndexFormat = IndexFormat();
+	geo->IndexBufferByteSize = ibByteSize;
+}
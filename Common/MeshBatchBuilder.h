@@ -0,0 +1,97 @@
+//***************************************************************************************
+// MeshBatchBuilder.h
+//
+// Concatenates GeometryGenerator meshes into one vertex and index buffer.  Each
+// added mesh becomes a submesh, with its offsets and bounds filled in.  Build
+// sizes the CPU blobs of a MeshGeometry once for the whole batch and writes the
+// vertices and indices straight into them.  The index buffer is 16-bit unless a
+// mesh has more vertices than 16-bit indices can address.  Levels of detail
+// of a submesh are stored as extra submeshes of the same geometry.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "GeometryGenerator.h"
+#include "ThreadPool.h"
+
+class MeshBatchBuilder
+{
+public:
+	MeshBatchBuilder() = default;
+	MeshBatchBuilder(const MeshBatchBuilder& rhs) = delete;
+	MeshBatchBuilder& operator=(const MeshBatchBuilder& rhs) = delete;
+
+	// Appends mesh as the submesh name.  The mesh data is moved into the
+	// builder, so no copy is made.
+	void Add(const std::string& name, GeometryGenerator::MeshData&& mesh);
+
+	// Appends a level of detail chain, finest first.  Level 0 is the submesh
+	// name and level i > 0 the submesh LodName(name, i).
+	void AddLods(const std::string& name, std::vector<GeometryGenerator::MeshData>&& lods);
+
+	static std::string LodName(const std::string& name, UINT level);
+	static bool IsLodName(const std::string& submeshName);
+
+	UINT VertexCount()const;
+	UINT IndexCount()const;
+	DXGI_FORMAT IndexFormat()const;
+
+	// Fills in the CPU blobs, buffer sizes, index format and DrawArgs of geo.
+	// Each vertex is converted with makeVertex, which takes a
+	// GeometryGenerator::Vertex and returns a VertexT.  Every submesh has a
+	// precomputed region of the blobs, so given a pool the submeshes are
+	// copied in parallel, one job each, and makeVertex must be safe to call
+	// from several threads.  The GPU buffers are left to the caller.
+	template<typename VertexT, typename MakeVertex>
+	void Build(MeshGeometry* geo, MakeVertex makeVertex, ThreadPool* pool = nullptr)const
+	{
+		const UINT vbByteSize = mVertexCount*sizeof(VertexT);
+		ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+
+		VertexT* vertices = reinterpret_cast<VertexT*>(geo->VertexBufferCPU->GetBufferPointer());
+		ForEachMesh(pool, [&](const Entry& e)
+		{
+			VertexT* dest = vertices + e.Submesh.BaseVertexLocation;
+			for(auto& v : e.Mesh.Vertices)
+				*dest++ = makeVertex(v);
+		});
+
+		geo->VertexByteStride = sizeof(VertexT);
+		geo->VertexBufferByteSize = vbByteSize;
+
+		BuildIndices(geo, pool);
+	}
+
+private:
+	struct Entry
+	{
+		std::string Name;
+		GeometryGenerator::MeshData Mesh;
+		SubmeshGeometry Submesh;
+	};
+
+	void BuildIndices(MeshGeometry* geo, ThreadPool* pool)const;
+
+	// Runs func on every entry, in parallel on pool if there is one.
+	template<typename Func>
+	void ForEachMesh(ThreadPool* pool, Func func)const
+	{
+		if(pool == nullptr)
+		{
+			for(auto& e : mMeshes)
+				func(e);
+			return;
+		}
+
+		pool->ParallelFor((unsigned int)mMeshes.size(), [&](unsigned int i) { func(mMeshes[i]); });
+	}
+
+	std::vector<Entry> mMeshes;
+
+	UINT mVertexCount = 0;
+	UINT mIndexCount = 0;
+
+	// Largest index of any mesh, relative to its own first vertex.
+	GeometryGenerator::uint32 mMaxIndex = 0;
+};
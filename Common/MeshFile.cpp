@@ -0,0 +1,364 @@
+//***************************************************************************************
+// MeshFile.cpp
+//***************************************************************************************
+
+#include "MeshFile.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Cache layout: MeshCacheHeader, SubmeshCount MeshCacheSubmesh records,
+	// VertexCount MeshFileVertex, then IndexCount indices of IndexByteSize bytes.
+	// Version 2 added the submesh names.
+	const UINT32 MeshCacheMagic = 0x4853454D; // "MESH"
+	const UINT32 MeshCacheVersion = 2;
+
+	struct MeshCacheHeader
+	{
+		UINT32 Magic;
+		UINT32 Version;
+
+		// Size and last write time of the text file the cache was built from.
+		// A file from Write has no text file, and keeps 0 and the caller's
+		// stamp instead.
+		UINT64 SourceSize;
+		UINT64 SourceWriteTime;
+
+		UINT32 VertexCount;
+		UINT32 IndexCount;
+		UINT32 IndexByteSize;
+		UINT32 SubmeshCount;
+	};
+
+	struct MeshCacheSubmesh
+	{
+		UINT32 IndexCount;
+		UINT32 StartIndexLocation;
+		INT32 BaseVertexLocation;
+		XMFLOAT3 Center;
+		XMFLOAT3 Extents;
+		char Name[MeshFile::MaxSubmeshNameLength + 1];
+	};
+
+	bool GetFileStamp(const std::wstring& filename, UINT64& size, UINT64& writeTime)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if(!GetFileAttributesExW(filename.c_str(), GetFileExInfoStandard, &data))
+			return false;
+
+		size = ((UINT64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		writeTime = ((UINT64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+
+		return true;
+	}
+
+	bool WriteMeshFile(const std::wstring& filename, MeshCacheHeader header, const MeshFileVertex* vertices,
+		const void* indices, const std::vector<SubmeshGeometry>& submeshes, const std::vector<std::string>* names)
+	{
+		std::ofstream fout(filename, std::ios::binary | std::ios::trunc);
+		if(!fout)
+			return false;
+
+		header.Magic = MeshCacheMagic;
+		header.Version = MeshCacheVersion;
+		header.SubmeshCount = (UINT32)submeshes.size();
+		fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		for(size_t i = 0; i < submeshes.size(); ++i)
+		{
+			MeshCacheSubmesh record = {};
+			record.IndexCount = submeshes[i].IndexCount;
+			record.StartIndexLocation = submeshes[i].StartIndexLocation;
+			record.BaseVertexLocation = submeshes[i].BaseVertexLocation;
+			record.Center = submeshes[i].Bounds.Center;
+			record.Extents = submeshes[i].Bounds.Extents;
+			if(names != nullptr)
+				strncpy_s(record.Name, (*names)[i].c_str(), MeshFile::MaxSubmeshNameLength);
+			fout.write(reinterpret_cast<const char*>(&record), sizeof(record));
+		}
+
+		fout.write(reinterpret_cast<const char*>(vertices), (std::streamsize)header.VertexCount*sizeof(MeshFileVertex));
+		fout.write(reinterpret_cast<const char*>(indices), (std::streamsize)header.IndexCount*header.IndexByteSize);
+
+		fout.close();
+		return !fout.fail();
+	}
+}
+
+MeshFile::~MeshFile()
+{
+	Close();
+}
+
+bool MeshFile::Load(const std::wstring& filename)
+{
+	Close();
+
+	std::wstring cacheFilename = filename + L".mesh";
+
+	UINT64 sourceSize = 0;
+	UINT64 sourceWriteTime = 0;
+	bool haveSource = GetFileStamp(filename, sourceSize, sourceWriteTime);
+
+	// Without the text file there is nothing to check the cache against, so
+	// any valid cache is used as is.
+	if(LoadCache(cacheFilename, sourceSize, haveSource ? sourceWriteTime : 0))
+		return true;
+
+	if(!haveSource || !ParseText(filename))
+		return false;
+
+	WriteCache(cacheFilename, sourceSize, sourceWriteTime);
+
+	return true;
+}
+
+bool MeshFile::LoadBinary(const std::wstring& filename, UINT64 stamp)
+{
+	Close();
+	return LoadCache(filename, 0, stamp);
+}
+
+bool MeshFile::Write(const std::wstring& filename, const MeshFileVertex* vertices, UINT vertexCount,
+	const void* indices, UINT indexCount, UINT indexByteSize,
+	const std::vector<SubmeshGeometry>& submeshes, const std::vector<std::string>& names, UINT64 stamp)
+{
+	if(names.size() != submeshes.size() ||
+		(indexByteSize != sizeof(std::uint16_t) && indexByteSize != sizeof(std::uint32_t)))
+		return false;
+
+	for(auto& name : names)
+	{
+		if(name.size() > MaxSubmeshNameLength)
+			return false;
+	}
+
+	// Stored where a cache keeps its text file's write time, for LoadBinary.
+	MeshCacheHeader header = {};
+	header.SourceWriteTime = stamp;
+	header.VertexCount = vertexCount;
+	header.IndexCount = indexCount;
+	header.IndexByteSize = indexByteSize;
+
+	return WriteMeshFile(filename, header, vertices, indices, submeshes, &names);
+}
+
+const MeshFileVertex* MeshFile::Vertices()const
+{
+	return mVertices;
+}
+
+UINT MeshFile::VertexCount()const
+{
+	return mVertexCount;
+}
+
+const void* MeshFile::Indices()const
+{
+	return mIndices;
+}
+
+UINT MeshFile::IndexCount()const
+{
+	return mIndexCount;
+}
+
+DXGI_FORMAT MeshFile::IndexFormat()const
+{
+	return mIndexByteSize == sizeof(std::uint16_t) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+}
+
+UINT MeshFile::IndexByteSize()const
+{
+	return mIndexByteSize;
+}
+
+const std::vector<SubmeshGeometry>& MeshFile::Submeshes()const
+{
+	return mSubmeshes;
+}
+
+const std::vector<std::string>& MeshFile::SubmeshNames()const
+{
+	return mSubmeshNames;
+}
+
+bool MeshFile::FromCache()const
+{
+	return mView != nullptr;
+}
+
+bool MeshFile::LoadCache(const std::wstring& cacheFilename, UINT64 sourceSize, UINT64 sourceWriteTime)
+{
+	mFile = CreateFileW(cacheFilename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(mFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if(!GetFileSizeEx(mFile, &fileSize) || (UINT64)fileSize.QuadPart < sizeof(MeshCacheHeader))
+	{
+		Close();
+		return false;
+	}
+
+	mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(mMapping != nullptr)
+		mView = static_cast<const BYTE*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+
+	if(mView == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(mView);
+
+	bool valid = header->Magic == MeshCacheMagic &&
+		header->Version == MeshCacheVersion &&
+		(header->IndexByteSize == sizeof(std::uint16_t) || header->IndexByteSize == sizeof(std::uint32_t));
+
+	// A zero write time means the text file is missing; trust the cache then.
+	if(sourceWriteTime != 0)
+		valid = valid && header->SourceSize == sourceSize && header->SourceWriteTime == sourceWriteTime;
+
+	UINT64 submeshOffset = sizeof(MeshCacheHeader);
+	UINT64 vertexOffset = submeshOffset + (UINT64)header->SubmeshCount*sizeof(MeshCacheSubmesh);
+	UINT64 indexOffset = vertexOffset + (UINT64)header->VertexCount*sizeof(MeshFileVertex);
+	UINT64 endOffset = indexOffset + (UINT64)header->IndexCount*header->IndexByteSize;
+
+	if(!valid || endOffset > (UINT64)fileSize.QuadPart)
+	{
+		Close();
+		return false;
+	}
+
+	const MeshCacheSubmesh* submeshes = reinterpret_cast<const MeshCacheSubmesh*>(mView + submeshOffset);
+	for(UINT32 i = 0; i < header->SubmeshCount; ++i)
+	{
+		SubmeshGeometry submesh;
+		submesh.IndexCount = submeshes[i].IndexCount;
+		submesh.StartIndexLocation = submeshes[i].StartIndexLocation;
+		submesh.BaseVertexLocation = submeshes[i].BaseVertexLocation;
+		submesh.Bounds.Center = submeshes[i].Center;
+		submesh.Bounds.Extents = submeshes[i].Extents;
+		mSubmeshes.push_back(submesh);
+
+		// The name is not trusted to be terminated.
+		mSubmeshNames.emplace_back(submeshes[i].Name,
+			strnlen_s(submeshes[i].Name, sizeof(submeshes[i].Name)));
+	}
+
+	mVertices = reinterpret_cast<const MeshFileVertex*>(mView + vertexOffset);
+	mIndices = mView + indexOffset;
+	mVertexCount = header->VertexCount;
+	mIndexCount = header->IndexCount;
+	mIndexByteSize = header->IndexByteSize;
+
+	return true;
+}
+
+bool MeshFile::ParseText(const std::wstring& filename)
+{
+	std::ifstream fin(filename);
+	if(!fin)
+		return false;
+
+	UINT vcount = 0;
+	UINT tcount = 0;
+	std::string ignore;
+
+	fin >> ignore >> vcount;
+	fin >> ignore >> tcount;
+	fin >> ignore >> ignore >> ignore >> ignore;
+
+	if(fin.fail() || vcount == 0)
+		return false;
+
+	mParsedVertices.resize(vcount);
+	for(UINT i = 0; i < vcount; ++i)
+	{
+		fin >> mParsedVertices[i].Pos.x >> mParsedVertices[i].Pos.y >> mParsedVertices[i].Pos.z;
+		fin >> mParsedVertices[i].Normal.x >> mParsedVertices[i].Normal.y >> mParsedVertices[i].Normal.z;
+	}
+
+	fin >> ignore;
+	fin >> ignore;
+	fin >> ignore;
+
+	std::vector<std::uint32_t> indices(3*tcount);
+	for(UINT i = 0; i < tcount; ++i)
+		fin >> indices[i*3 + 0] >> indices[i*3 + 1] >> indices[i*3 + 2];
+
+	if(fin.fail())
+		return false;
+
+	mVertexCount = vcount;
+	mIndexCount = 3*tcount;
+	mVertices = mParsedVertices.data();
+
+	// Use 16-bit indices whenever they can address every vertex.
+	if(vcount <= 0x10000)
+	{
+		mParsedIndices16.assign(indices.begin(), indices.end());
+		mIndices = mParsedIndices16.data();
+		mIndexByteSize = sizeof(std::uint16_t);
+	}
+	else
+	{
+		mParsedIndices32 = std::move(indices);
+		mIndices = mParsedIndices32.data();
+		mIndexByteSize = sizeof(std::uint32_t);
+	}
+
+	SubmeshGeometry submesh;
+	submesh.IndexCount = mIndexCount;
+	submesh.StartIndexLocation = 0;
+	submesh.BaseVertexLocation = 0;
+	BoundingBox::CreateFromPoints(submesh.Bounds, vcount, &mParsedVertices[0].Pos, sizeof(MeshFileVertex));
+	mSubmeshes.push_back(submesh);
+	mSubmeshNames.push_back(std::string());
+
+	return true;
+}
+
+void MeshFile::WriteCache(const std::wstring& cacheFilename, UINT64 sourceSize, UINT64 sourceWriteTime)const
+{
+	// Failing to write the cache only costs the next run a parse.
+	MeshCacheHeader header = {};
+	header.SourceSize = sourceSize;
+	header.SourceWriteTime = sourceWriteTime;
+	header.VertexCount = mVertexCount;
+	header.IndexCount = mIndexCount;
+	header.IndexByteSize = mIndexByteSize;
+
+	if(!WriteMeshFile(cacheFilename, header, mVertices, mIndices, mSubmeshes, nullptr))
+		DeleteFileW(cacheFilename.c_str());
+}
+
+void MeshFile::Close()
+{
+	if(mView != nullptr)
+		UnmapViewOfFile(mView);
+	if(mMapping != nullptr)
+		CloseHandle(mMapping);
+	if(mFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mFile);
+
+	mView = nullptr;
+	mMapping = nullptr;
+	mFile = INVALID_HANDLE_VALUE;
+
+	mVertices = nullptr;
+	mIndices = nullptr;
+	mVertexCount = 0;
+	mIndexCount = 0;
+	mIndexByteSize = 0;
+
+	mSubmeshes.clear();
+	mSubmeshNames.clear();
+	mParsedVertices.clear();
+	mParsedIndices16.clear();
+	mParsedIndices32.clear();
+}
@@ -0,0 +1,93 @@
+//***************************************************************************************
+// MeshFile.h
+//
+// Loads meshes in the text format of the book's Models directory
+// ("VertexCount: ... VertexList (pos, normal) { ... } TriangleList { ... }").
+// The text is parsed once and written to a binary cache next to it; later loads
+// memory-map the cache so the vertex and index data can be copied straight into
+// the upload buffers without any parsing.  Meshes built in code can be written
+// in the same binary format with Write and mapped with LoadBinary.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+
+// Vertex layout of the text format and of the cache.
+struct MeshFileVertex
+{
+	DirectX::XMFLOAT3 Pos;
+	DirectX::XMFLOAT3 Normal;
+};
+
+class MeshFile
+{
+public:
+	MeshFile() = default;
+	MeshFile(const MeshFile& rhs) = delete;
+	MeshFile& operator=(const MeshFile& rhs) = delete;
+	~MeshFile();
+
+	// Loads filename, using filename + L".mesh" as the cache.  The cache is
+	// rebuilt when it is missing or the text file has changed since it was
+	// written.  Returns false if neither file can be read.
+	bool Load(const std::wstring& filename);
+
+	// Maps a binary mesh file, a cache or one written by Write, with no text
+	// file to check it against.  Returns false if it is missing or invalid,
+	// or, for a nonzero stamp, if it was not written with that stamp.
+	bool LoadBinary(const std::wstring& filename, UINT64 stamp = 0);
+
+	// Writes a binary mesh file.  indexByteSize is 2 or 4, and names holds one
+	// name per submesh of at most MaxSubmeshNameLength characters.  The stamp,
+	// a version or hash of whatever the mesh was made from, is checked by
+	// LoadBinary so a file from older inputs is not loaded.
+	static const UINT MaxSubmeshNameLength = 31;
+	static bool Write(const std::wstring& filename, const MeshFileVertex* vertices, UINT vertexCount,
+		const void* indices, UINT indexCount, UINT indexByteSize,
+		const std::vector<SubmeshGeometry>& submeshes, const std::vector<std::string>& names,
+		UINT64 stamp = 0);
+
+	const MeshFileVertex* Vertices()const;
+	UINT VertexCount()const;
+
+	// Indices are 16-bit when every vertex can be addressed with them.
+	const void* Indices()const;
+	UINT IndexCount()const;
+	DXGI_FORMAT IndexFormat()const;
+	UINT IndexByteSize()const;
+
+	const std::vector<SubmeshGeometry>& Submeshes()const;
+
+	// Names of the submeshes, in the same order.  Empty names for a mesh
+	// parsed from text.
+	const std::vector<std::string>& SubmeshNames()const;
+
+	// True if the data came from the memory-mapped cache.
+	bool FromCache()const;
+
+private:
+	bool LoadCache(const std::wstring& cacheFilename, UINT64 sourceSize, UINT64 sourceWriteTime);
+	bool ParseText(const std::wstring& filename);
+	void WriteCache(const std::wstring& cacheFilename, UINT64 sourceSize, UINT64 sourceWriteTime)const;
+	void Close();
+
+private:
+	// Point into the mapped view or into the parsed arrays below.
+	const MeshFileVertex* mVertices = nullptr;
+	const void* mIndices = nullptr;
+	UINT mVertexCount = 0;
+	UINT mIndexCount = 0;
+	UINT mIndexByteSize = 0;
+
+	std::vector<SubmeshGeometry> mSubmeshes;
+	std::vector<std::string> mSubmeshNames;
+
+	std::vector<MeshFileVertex> mParsedVertices;
+	std::vector<std::uint16_t> mParsedIndices16;
+	std::vector<std::uint32_t> mParsedIndices32;
+
+	HANDLE mFile = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = nullptr;
+	const BYTE* mView = nullptr;
+};
@@ -0,0 +1,482 @@
+//***************************************************************************************
+// MeshOptimizer.cpp
+//***************************************************************************************
+
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+using namespace DirectX;
+
+using uint32 = MeshOptimizer::uint32;
+using Vertex = GeometryGenerator::Vertex;
+
+namespace
+{
+	const uint32 NoTriangle = 0xffffffff;
+
+	// Vertex scoring constants from Forsyth, "Linear-Speed Vertex Cache Optimisation".
+	const float CacheDecayPower = 1.5f;
+	const float LastTriangleScore = 0.75f;
+	const float ValenceBoostScale = 2.0f;
+	const float ValenceBoostPower = 0.5f;
+
+	// cachePosition is -1 for a vertex not in the cache.
+	float VertexScore(int cachePosition, uint32 remainingTriangles)
+	{
+		// Vertices with no triangles left never make a triangle worth choosing.
+		if(remainingTriangles == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if(cachePosition >= 0)
+		{
+			// The corners of the last triangle get a fixed score so the next
+			// triangle does not just continue the strip it came from.
+			if(cachePosition < 3)
+			{
+				score = LastTriangleScore;
+			}
+			else
+			{
+				const float scale = 1.0f / (MeshOptimizer::CacheSize - 3);
+				score = powf(1.0f - (cachePosition - 3)*scale, CacheDecayPower);
+			}
+		}
+
+		// Favour vertices with few triangles left, so they are finished off
+		// rather than left behind as lone triangles.
+		score += ValenceBoostScale*powf((float)remainingTriangles, -ValenceBoostPower);
+		return score;
+	}
+
+	// FIFO post-transform cache, as most hardware implements it.  A vertex is
+	// cached while fewer than size misses have happened since it was loaded.
+	class FifoCache
+	{
+	public:
+		FifoCache(size_t vertexCount, uint32 size) : mStamps(vertexCount, 0), mSize(size)
+		{
+		}
+
+		// Returns true on a miss.
+		bool Access(uint32 v)
+		{
+			if(mStamps[v] != 0 && mTime - mStamps[v] <= mSize)
+				return false;
+
+			mStamps[v] = mTime++;
+			return true;
+		}
+
+	private:
+		std::vector<uint32> mStamps;
+		uint32 mSize;
+		uint32 mTime = 1;
+	};
+
+	struct VertexHash
+	{
+		const std::vector<Vertex>* Vertices;
+
+		size_t operator()(uint32 i)const
+		{
+			// FNV-1a over the vertex's bytes.
+			const unsigned char* p = reinterpret_cast<const unsigned char*>(&(*Vertices)[i]);
+			size_t h = 2166136261u;
+			for(size_t k = 0; k < sizeof(Vertex); ++k)
+				h = (h ^ p[k])*16777619u;
+			return h;
+		}
+	};
+
+	struct VertexEqual
+	{
+		const std::vector<Vertex>* Vertices;
+
+		bool operator()(uint32 a, uint32 b)const
+		{
+			return memcmp(&(*Vertices)[a], &(*Vertices)[b], sizeof(Vertex)) == 0;
+		}
+	};
+}
+
+void MeshOptimizer::Optimize(MeshData& mesh)
+{
+	WeldVertices(mesh);
+	OptimizeVertexCache(mesh.Indices32, mesh.Vertices.size());
+	OptimizeOverdraw(mesh.Vertices, mesh.Indices32);
+	OptimizeVertexFetch(mesh);
+}
+
+void MeshOptimizer::WeldVertices(MeshData& mesh)
+{
+	const std::vector<Vertex>& vertices = mesh.Vertices;
+
+	std::unordered_map<uint32, uint32, VertexHash, VertexEqual> unique(
+		vertices.size(), VertexHash{ &vertices }, VertexEqual{ &vertices });
+
+	std::vector<uint32> remap(vertices.size());
+	std::vector<Vertex> welded;
+	welded.reserve(vertices.size());
+
+	for(uint32 i = 0; i < (uint32)vertices.size(); ++i)
+	{
+		auto result = unique.emplace(i, (uint32)welded.size());
+		if(result.second)
+			welded.push_back(vertices[i]);
+
+		remap[i] = result.first->second;
+	}
+
+	for(auto& i : mesh.Indices32)
+		i = remap[i];
+
+	mesh.Vertices.swap(welded);
+}
+
+void MeshOptimizer::OptimizeVertexCache(std::vector<uint32>& indices, size_t vertexCount)
+{
+	const uint32 triangleCount = (uint32)(indices.size() / 3);
+	if(triangleCount == 0)
+		return;
+
+	// The triangles using each vertex, packed into one array.  The triangles
+	// of vertex v start at vertexTriangles[triangleStart[v]]; the first
+	// remaining[v] of them have not been emitted yet.
+	std::vector<uint32> triangleStart(vertexCount + 1, 0);
+	for(uint32 i : indices)
+		++triangleStart[i + 1];
+	for(size_t v = 0; v < vertexCount; ++v)
+		triangleStart[v + 1] += triangleStart[v];
+
+	std::vector<uint32> vertexTriangles(indices.size());
+	std::vector<uint32> remaining(vertexCount, 0);
+	for(uint32 t = 0; t < triangleCount; ++t)
+	{
+		for(uint32 k = 0; k < 3; ++k)
+		{
+			uint32 v = indices[3*t + k];
+			vertexTriangles[triangleStart[v] + remaining[v]++] = t;
+		}
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for(size_t v = 0; v < vertexCount; ++v)
+		vertexScore[v] = VertexScore(-1, remaining[v]);
+
+	std::vector<std::uint8_t> emitted(triangleCount, 0);
+
+	// Start with the best triangle overall.
+	uint32 bestTriangle = 0;
+	float bestScore = -1.0f;
+	for(uint32 t = 0; t < triangleCount; ++t)
+	{
+		const uint32* tri = &indices[3*t];
+		float score = vertexScore[tri[0]] + vertexScore[tri[1]] + vertexScore[tri[2]];
+		if(score > bestScore)
+		{
+			bestScore = score;
+			bestTriangle = t;
+		}
+	}
+
+	std::vector<uint32> result;
+	result.reserve(indices.size());
+
+	// LRU cache, most recently used first.
+	uint32 cache[CacheSize];
+	uint32 cacheCount = 0;
+	uint32 nextUnemitted = 0;
+
+	for(uint32 emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+	{
+		if(bestTriangle == NoTriangle)
+		{
+			// Nothing in the cache has triangles left; restart from the first
+			// triangle not emitted yet.
+			while(emitted[nextUnemitted])
+				++nextUnemitted;
+			bestTriangle = nextUnemitted;
+		}
+
+		const uint32 t = bestTriangle;
+		emitted[t] = 1;
+
+		// Move the corners to the front of the cache.  Up to three vertices
+		// fall off the end.
+		uint32 newCache[CacheSize + 3];
+		uint32 newCount = 0;
+		for(uint32 k = 0; k < 3; ++k)
+		{
+			uint32 v = indices[3*t + k];
+			result.push_back(v);
+
+			if(std::find(newCache, newCache + newCount, v) == newCache + newCount)
+				newCache[newCount++] = v;
+
+			// Remove t from the vertex's remaining triangles.
+			uint32* tris = &vertexTriangles[triangleStart[v]];
+			for(uint32 j = 0; j < remaining[v]; ++j)
+			{
+				if(tris[j] == t)
+				{
+					tris[j] = tris[--remaining[v]];
+					break;
+				}
+			}
+		}
+
+		const uint32 cornerCount = newCount;
+		for(uint32 i = 0; i < cacheCount; ++i)
+		{
+			if(std::find(newCache, newCache + cornerCount, cache[i]) == newCache + cornerCount)
+				newCache[newCount++] = cache[i];
+		}
+
+		// Rescore the cached vertices; those pushed out of the cache lose their
+		// cache score.
+		for(uint32 i = 0; i < newCount; ++i)
+		{
+			uint32 v = newCache[i];
+			cachePosition[v] = i < CacheSize ? (int)i : -1;
+			vertexScore[v] = VertexScore(cachePosition[v], remaining[v]);
+		}
+
+		cacheCount = newCount < CacheSize ? newCount : CacheSize;
+		std::copy(newCache, newCache + cacheCount, cache);
+
+		// Only triangles with a vertex in the cache changed score, so the next
+		// triangle is the best of those.
+		bestTriangle = NoTriangle;
+		bestScore = -1.0f;
+		for(uint32 i = 0; i < cacheCount; ++i)
+		{
+			uint32 v = cache[i];
+			const uint32* tris = &vertexTriangles[triangleStart[v]];
+			for(uint32 j = 0; j < remaining[v]; ++j)
+			{
+				const uint32* tri = &indices[3*tris[j]];
+				float score = vertexScore[tri[0]] + vertexScore[tri[1]] + vertexScore[tri[2]];
+				if(score > bestScore)
+				{
+					bestScore = score;
+					bestTriangle = tris[j];
+				}
+			}
+		}
+	}
+
+	indices.swap(result);
+}
+
+void MeshOptimizer::OptimizeOverdraw(const std::vector<Vertex>& vertices, std::vector<uint32>& indices)
+{
+	const uint32 triangleCount = (uint32)(indices.size() / 3);
+	if(triangleCount == 0 || vertices.empty())
+		return;
+
+	XMVECTOR meshCentre = XMVectorZero();
+	for(auto& v : vertices)
+		meshCentre += XMLoadFloat3(&v.Position);
+	meshCentre /= (float)vertices.size();
+
+	// A cluster starts where a triangle misses the cache on all three corners,
+	// so moving clusters around costs no more than those misses again.
+	std::vector<uint32> clusterStart;
+	FifoCache cache(vertices.size(), 16);
+	for(uint32 t = 0; t < triangleCount; ++t)
+	{
+		uint32 misses = 0;
+		for(uint32 k = 0; k < 3; ++k)
+			misses += cache.Access(indices[3*t + k]) ? 1 : 0;
+
+		if(t == 0 || misses == 3)
+			clusterStart.push_back(t);
+	}
+	clusterStart.push_back(triangleCount);
+
+	const uint32 clusterCount = (uint32)clusterStart.size() - 1;
+	if(clusterCount < 2)
+		return;
+
+	// Draw clusters facing away from the centre first: on a convex mesh they
+	// are in front of those facing inwards from the same view.
+	std::vector<float> clusterKey(clusterCount);
+	for(uint32 c = 0; c < clusterCount; ++c)
+	{
+		XMVECTOR centre = XMVectorZero();
+		XMVECTOR normal = XMVectorZero();
+		float area = 0.0f;
+
+		for(uint32 t = clusterStart[c]; t < clusterStart[c + 1]; ++t)
+		{
+			XMVECTOR p0 = XMLoadFloat3(&vertices[indices[3*t + 0]].Position);
+			XMVECTOR p1 = XMLoadFloat3(&vertices[indices[3*t + 1]].Position);
+			XMVECTOR p2 = XMLoadFloat3(&vertices[indices[3*t + 2]].Position);
+
+			// Twice the area times the unit normal.
+			XMVECTOR n = XMVector3Cross(p1 - p0, p2 - p0);
+			float a = XMVectorGetX(XMVector3Length(n));
+
+			centre += (p0 + p1 + p2)*(a / 3.0f);
+			normal += n;
+			area += a;
+		}
+
+		if(area > 0.0f)
+			centre /= area;
+
+		clusterKey[c] = XMVectorGetX(XMVector3Dot(centre - meshCentre, XMVector3Normalize(normal)));
+	}
+
+	std::vector<uint32> order(clusterCount);
+	for(uint32 c = 0; c < clusterCount; ++c)
+		order[c] = c;
+
+	std::stable_sort(order.begin(), order.end(),
+		[&clusterKey](uint32 a, uint32 b) { return clusterKey[a] > clusterKey[b]; });
+
+	std::vector<uint32> result;
+	result.reserve(indices.size());
+	for(uint32 c : order)
+	{
+		result.insert(result.end(), indices.begin() + 3*clusterStart[c],
+			indices.begin() + 3*clusterStart[c + 1]);
+	}
+
+	indices.swap(result);
+}
+
+void MeshOptimizer::OptimizeVertexFetch(MeshData& mesh)
+{
+	const uint32 unused = 0xffffffff;
+
+	std::vector<uint32> remap(mesh.Vertices.size(), unused);
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh.Vertices.size());
+
+	for(auto& i : mesh.Indices32)
+	{
+		if(remap[i] == unused)
+		{
+			remap[i] = (uint32)vertices.size();
+			vertices.push_back(mesh.Vertices[i]);
+		}
+
+		i = remap[i];
+	}
+
+	mesh.Vertices.swap(vertices);
+}
+
+MeshOptimizer::MeshData MeshOptimizer::Simplify(const MeshData& mesh, uint32 gridResolution)
+{
+	MeshData result;
+	if(mesh.Vertices.empty() || gridResolution == 0)
+		return result;
+
+	XMFLOAT3 low = mesh.Vertices[0].Position;
+	XMFLOAT3 high = low;
+	for(auto& v : mesh.Vertices)
+	{
+		low.x = v.Position.x < low.x ? v.Position.x : low.x;
+		low.y = v.Position.y < low.y ? v.Position.y : low.y;
+		low.z = v.Position.z < low.z ? v.Position.z : low.z;
+		high.x = v.Position.x > high.x ? v.Position.x : high.x;
+		high.y = v.Position.y > high.y ? v.Position.y : high.y;
+		high.z = v.Position.z > high.z ? v.Position.z : high.z;
+	}
+
+	float extent = high.x - low.x;
+	extent = high.y - low.y > extent ? high.y - low.y : extent;
+	extent = high.z - low.z > extent ? high.z - low.z : extent;
+	const float invCellSize = extent > 0.0f ? gridResolution / extent : 0.0f;
+
+	// Map each vertex to a cluster: 20 bits per cell coordinate and 3 bits for
+	// the normal's dominant axis and sign, so hard edges are kept.
+	std::unordered_map<std::uint64_t, uint32> clusterIds;
+	std::vector<uint32> cluster(mesh.Vertices.size());
+	std::vector<XMFLOAT3> positionSums;
+	std::vector<XMFLOAT3> normalSums;
+	std::vector<uint32> counts;
+
+	for(size_t i = 0; i < mesh.Vertices.size(); ++i)
+	{
+		const Vertex& v = mesh.Vertices[i];
+		std::uint64_t cx = (std::uint64_t)((v.Position.x - low.x)*invCellSize) & 0xfffff;
+		std::uint64_t cy = (std::uint64_t)((v.Position.y - low.y)*invCellSize) & 0xfffff;
+		std::uint64_t cz = (std::uint64_t)((v.Position.z - low.z)*invCellSize) & 0xfffff;
+
+		float ax = fabsf(v.Normal.x);
+		float ay = fabsf(v.Normal.y);
+		float az = fabsf(v.Normal.z);
+		std::uint64_t axis = ax >= ay && ax >= az ? (v.Normal.x < 0.0f ? 1 : 0) :
+			(ay >= az ? (v.Normal.y < 0.0f ? 3 : 2) : (v.Normal.z < 0.0f ? 5 : 4));
+
+		std::uint64_t key = (cx << 43) | (cy << 23) | (cz << 3) | axis;
+
+		auto it = clusterIds.emplace(key, (uint32)counts.size());
+		if(it.second)
+		{
+			positionSums.push_back(XMFLOAT3(0.0f, 0.0f, 0.0f));
+			normalSums.push_back(XMFLOAT3(0.0f, 0.0f, 0.0f));
+			counts.push_back(0);
+		}
+
+		uint32 c = it.first->second;
+		cluster[i] = c;
+		positionSums[c].x += v.Position.x;
+		positionSums[c].y += v.Position.y;
+		positionSums[c].z += v.Position.z;
+		normalSums[c].x += v.Normal.x;
+		normalSums[c].y += v.Normal.y;
+		normalSums[c].z += v.Normal.z;
+		++counts[c];
+	}
+
+	result.Vertices.resize(counts.size());
+	for(size_t c = 0; c < counts.size(); ++c)
+	{
+		XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&normalSums[c]));
+
+		Vertex& v = result.Vertices[c];
+		v.Position = XMFLOAT3(positionSums[c].x / counts[c], positionSums[c].y / counts[c], positionSums[c].z / counts[c]);
+		XMStoreFloat3(&v.Normal, n);
+		v.TangentU = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		v.TexC = XMFLOAT2(0.0f, 0.0f);
+	}
+
+	result.Indices32.reserve(mesh.Indices32.size());
+	for(size_t t = 0; t + 2 < mesh.Indices32.size(); t += 3)
+	{
+		uint32 a = cluster[mesh.Indices32[t + 0]];
+		uint32 b = cluster[mesh.Indices32[t + 1]];
+		uint32 c = cluster[mesh.Indices32[t + 2]];
+		if(a == b || b == c || a == c)
+			continue;
+
+		result.Indices32.push_back(a);
+		result.Indices32.push_back(b);
+		result.Indices32.push_back(c);
+	}
+
+	return result;
+}
+
+float MeshOptimizer::AverageCacheMissRatio(const std::vector<uint32>& indices, size_t vertexCount, uint32 cacheSize)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if(triangleCount == 0)
+		return 0.0f;
+
+	FifoCache cache(vertexCount, cacheSize);
+	size_t misses = 0;
+	for(uint32 i : indices)
+		misses += cache.Access(i) ? 1 : 0;
+
+	return (float)misses / triangleCount;
+}
@@ -0,0 +1,58 @@
+//***************************************************************************************
+// MeshOptimizer.h
+//
+// Reorders generated meshes for the GPU.  The generators emit vertices and
+// triangles in generation order, which reuses the post-transform vertex cache
+// poorly on finely subdivided meshes.  Optimize welds duplicate vertices,
+// orders the triangles for the vertex cache (Forsyth's linear-speed
+// algorithm), orders clusters of triangles so that outward facing ones are
+// drawn first to reduce overdraw, and finally renumbers the vertices in the
+// order the triangles use them so vertex fetches walk memory forwards.
+//***************************************************************************************
+
+#pragma once
+
+#include "GeometryGenerator.h"
+
+class MeshOptimizer
+{
+public:
+	using MeshData = GeometryGenerator::MeshData;
+	using uint32 = GeometryGenerator::uint32;
+
+	// Size of the simulated post-transform vertex cache.
+	static const uint32 CacheSize = 32;
+
+	// Every step below, in order.
+	static void Optimize(MeshData& mesh);
+
+	// Merges vertices whose attributes are bitwise identical and remaps the
+	// indices to the merged vertices.
+	static void WeldVertices(MeshData& mesh);
+
+	// Reorders the triangles of indices to maximize vertex cache hits.
+	static void OptimizeVertexCache(std::vector<uint32>& indices, size_t vertexCount);
+
+	// Splits the triangles, in their current order, into clusters at the points
+	// where the vertex cache would start over, and sorts the clusters so those
+	// facing away from the mesh centre are drawn first.  Within a cluster the
+	// order, and so most of the cache efficiency, is kept.
+	static void OptimizeOverdraw(const std::vector<GeometryGenerator::Vertex>& vertices,
+		std::vector<uint32>& indices);
+
+	// Renumbers the vertices in the order the indices first reference them.
+	// Vertices no triangle uses are removed.
+	static void OptimizeVertexFetch(MeshData& mesh);
+
+	// Simplifies a mesh by vertex clustering, for models that have no
+	// tessellation parameters to lower.  The bounds are split into cells, with
+	// gridResolution cells along the longest axis, and the vertices of a cell
+	// whose normals share a dominant axis are merged into their average.
+	// Triangles that collapse are dropped.
+	static MeshData Simplify(const MeshData& mesh, uint32 gridResolution);
+
+	// Vertices transformed per triangle with a FIFO cache of cacheSize entries;
+	// 3 is the worst case and about 0.6 the best for a regular grid.
+	static float AverageCacheMissRatio(const std::vector<uint32>& indices, size_t vertexCount,
+		uint32 cacheSize = 16);
+};
@@ -0,0 +1,84 @@
+//***************************************************************************************
+// ObjectPool.h
+//
+// Arena for scene objects.  Objects are constructed in place in fixed size
+// blocks of storage, so building a scene makes one allocation per block
+// rather than one per object, objects created together sit next to each other
+// in memory, and pointers stay valid until Clear.  Individual objects are not
+// freed; the pool destroys them all at once.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+template<typename T, size_t BlockSize = 256>
+class ObjectPool
+{
+public:
+	ObjectPool() = default;
+	ObjectPool(const ObjectPool& rhs) = delete;
+	ObjectPool& operator=(const ObjectPool& rhs) = delete;
+	~ObjectPool()
+	{
+		Clear();
+	}
+
+	// Constructs an object from args and returns a pointer that stays valid
+	// until Clear.
+	template<typename... Args>
+	T* Allocate(Args&&... args)
+	{
+		if(mCount == mBlocks.size()*BlockSize)
+			mBlocks.push_back(std::make_unique<Block>());
+
+		void* p = &mBlocks[mCount / BlockSize]->Objects[mCount % BlockSize];
+		T* obj = new(p) T(std::forward<Args>(args)...);
+		++mCount;
+		return obj;
+	}
+
+	// Allocates storage for at least count objects up front.
+	void Reserve(size_t count)
+	{
+		while(mBlocks.size()*BlockSize < count)
+			mBlocks.push_back(std::make_unique<Block>());
+	}
+
+	// Destroys every object.  The blocks are kept for reuse.
+	void Clear()
+	{
+		for(size_t i = mCount; i > 0; --i)
+			(*this)[i - 1].~T();
+		mCount = 0;
+	}
+
+	// Objects are numbered in allocation order.
+	T& operator[](size_t i)
+	{
+		return *reinterpret_cast<T*>(&mBlocks[i / BlockSize]->Objects[i % BlockSize]);
+	}
+
+	const T& operator[](size_t i)const
+	{
+		return *reinterpret_cast<const T*>(&mBlocks[i / BlockSize]->Objects[i % BlockSize]);
+	}
+
+	size_t Size()const
+	{
+		return mCount;
+	}
+
+private:
+	struct Block
+	{
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type Objects[BlockSize];
+	};
+
+	std::vector<std::unique_ptr<Block>> mBlocks;
+	size_t mCount = 0;
+};
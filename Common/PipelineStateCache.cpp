@@ -0,0 +1,232 @@
+//***************************************************************************************
+// PipelineStateCache.cpp
+//***************************************************************************************
+
+#include "PipelineStateCache.h"
+
+using Microsoft::WRL::ComPtr;
+
+PipelineStateCache::PipelineStateCache(ID3D12Device* device, const std::wstring& filename)
+	: md3dDevice(device), mFilename(filename), mBackgroundThread(1)
+{
+	// Pipeline libraries need ID3D12Device1.
+	if(FAILED(md3dDevice.As(&md3dDevice1)))
+		return;
+
+	if(GetFileAttributesW(mFilename.c_str()) != INVALID_FILE_ATTRIBUTES)
+	{
+		mLibraryData = d3dUtil::LoadBinary(mFilename);
+		HRESULT hr = md3dDevice1->CreatePipelineLibrary(mLibraryData->GetBufferPointer(),
+			mLibraryData->GetBufferSize(), IID_PPV_ARGS(mLibrary.GetAddressOf()));
+
+		// Saved by another driver or adapter, or corrupt: start again.
+		if(FAILED(hr))
+		{
+			mLibrary.Reset();
+			mLibraryData.Reset();
+		}
+	}
+
+	if(mLibrary == nullptr)
+	{
+		// Fails if the driver does not support pipeline libraries.
+		if(SUCCEEDED(md3dDevice1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(mLibrary.GetAddressOf()))))
+			mLibraryChanged = true;
+		else
+			mLibrary.Reset();
+	}
+}
+
+PipelineStateCache::~PipelineStateCache()
+{
+	WaitIdle();
+}
+
+template<typename Desc, typename LoadFunc, typename CreateFunc>
+HRESULT PipelineStateCache::LoadOrCreate(const std::wstring& name, const Desc& desc, LoadFunc load, CreateFunc create,
+	ComPtr<ID3D12PipelineState>& pso)
+{
+	// Loads fail if the name is new or its pipeline no longer matches desc.
+	if(mLibrary != nullptr)
+	{
+		std::lock_guard<std::mutex> lock(mLibraryMutex);
+		if(SUCCEEDED(load(name.c_str(), &desc, IID_PPV_ARGS(pso.GetAddressOf()))))
+		{
+			++mLoadedCount;
+			return S_OK;
+		}
+	}
+
+	// Compiling is the slow part, so it is done outside the lock.
+	HRESULT hr = create(&desc, IID_PPV_ARGS(pso.ReleaseAndGetAddressOf()));
+	if(FAILED(hr))
+		return hr;
+
+	++mCreatedCount;
+
+	if(mLibrary != nullptr)
+	{
+		std::lock_guard<std::mutex> lock(mLibraryMutex);
+		HRESULT storeHr = mLibrary->StorePipeline(name.c_str(), pso.Get());
+		if(SUCCEEDED(storeHr))
+			mLibraryChanged = true;
+		else if(storeHr == E_INVALIDARG)
+			mLibraryStale = true;
+	}
+
+	return S_OK;
+}
+
+ID3D12PipelineState* PipelineStateCache::Graphics(const std::wstring& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+{
+	if(!Reserve(name))
+		return Wait(name);
+
+	ComPtr<ID3D12PipelineState> pso;
+	HRESULT hr = LoadOrCreate(name, desc,
+		[this](LPCWSTR n, const D3D12_GRAPHICS_PIPELINE_STATE_DESC* d, REFIID riid, void** p) { return mLibrary->LoadGraphicsPipeline(n, d, riid, p); },
+		[this](const D3D12_GRAPHICS_PIPELINE_STATE_DESC* d, REFIID riid, void** p) { return md3dDevice->CreateGraphicsPipelineState(d, riid, p); },
+		pso);
+
+	Complete(name, hr, pso.Get());
+	ThrowIfFailed(hr);
+
+	return pso.Get();
+}
+
+ID3D12PipelineState* PipelineStateCache::Compute(const std::wstring& name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& desc)
+{
+	if(!Reserve(name))
+		return Wait(name);
+
+	ComPtr<ID3D12PipelineState> pso;
+	HRESULT hr = LoadOrCreate(name, desc,
+		[this](LPCWSTR n, const D3D12_COMPUTE_PIPELINE_STATE_DESC* d, REFIID riid, void** p) { return mLibrary->LoadComputePipeline(n, d, riid, p); },
+		[this](const D3D12_COMPUTE_PIPELINE_STATE_DESC* d, REFIID riid, void** p) { return md3dDevice->CreateComputePipelineState(d, riid, p); },
+		pso);
+
+	Complete(name, hr, pso.Get());
+	ThrowIfFailed(hr);
+
+	return pso.Get();
+}
+
+void PipelineStateCache::RequestGraphics(const std::wstring& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+{
+	if(!Reserve(name))
+		return;
+
+	mBackgroundThread.Enqueue([this, name, desc]()
+	{
+		ComPtr<ID3D12PipelineState> pso;
+		HRESULT hr = LoadOrCreate(name, desc,
+			[this](LPCWSTR n, const D3D12_GRAPHICS_PIPELINE_STATE_DESC* d, REFIID riid, void** p) { return mLibrary->LoadGraphicsPipeline(n, d, riid, p); },
+			[this](const D3D12_GRAPHICS_PIPELINE_STATE_DESC* d, REFIID riid, void** p) { return md3dDevice->CreateGraphicsPipelineState(d, riid, p); },
+			pso);
+
+		// Errors are raised by Graphics when the PSO is asked for.
+		Complete(name, hr, pso.Get());
+	});
+}
+
+ID3D12PipelineState* PipelineStateCache::Find(const std::wstring& name)
+{
+	std::lock_guard<std::mutex> lock(mEntryMutex);
+
+	auto it = mEntries.find(name);
+	if(it == mEntries.end() || !it->second.Ready)
+		return nullptr;
+
+	return it->second.Pso.Get();
+}
+
+void PipelineStateCache::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(mEntryMutex);
+	mEntryReady.wait(lock, [this]() { return mPendingCount == 0; });
+}
+
+void PipelineStateCache::Save()
+{
+	WaitIdle();
+
+	std::lock_guard<std::mutex> lock(mLibraryMutex);
+	if(mLibrary == nullptr || (!mLibraryChanged && !mLibraryStale))
+		return;
+
+	// Outdated pipelines cannot be replaced in place, so the library is built
+	// again from the PSOs of this run.
+	if(mLibraryStale)
+	{
+		ComPtr<ID3D12PipelineLibrary> library;
+		if(FAILED(md3dDevice1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(library.GetAddressOf()))))
+			return;
+
+		std::lock_guard<std::mutex> entryLock(mEntryMutex);
+		for(auto& e : mEntries)
+		{
+			if(e.second.Pso != nullptr)
+				library->StorePipeline(e.first.c_str(), e.second.Pso.Get());
+		}
+
+		// The old library is released before the data it was created from.
+		mLibrary = library;
+		mLibraryData.Reset();
+		mLibraryStale = false;
+	}
+
+	std::vector<char> data(mLibrary->GetSerializedSize());
+	ThrowIfFailed(mLibrary->Serialize(data.data(), data.size()));
+
+	size_t slash = mFilename.find_last_of(L"\\/");
+	if(slash != std::wstring::npos)
+		CreateDirectoryW(mFilename.substr(0, slash).c_str(), nullptr);
+
+	std::ofstream fout(mFilename, std::ios::binary);
+	fout.write(data.data(), data.size());
+	mLibraryChanged = false;
+}
+
+UINT PipelineStateCache::LoadedCount()const
+{
+	return mLoadedCount;
+}
+
+UINT PipelineStateCache::CreatedCount()const
+{
+	return mCreatedCount;
+}
+
+bool PipelineStateCache::Reserve(const std::wstring& name)
+{
+	std::lock_guard<std::mutex> lock(mEntryMutex);
+	if(mEntries.find(name) != mEntries.end())
+		return false;
+
+	mEntries[name] = Entry();
+	++mPendingCount;
+	return true;
+}
+
+void PipelineStateCache::Complete(const std::wstring& name, HRESULT result, ID3D12PipelineState* pso)
+{
+	{
+		std::lock_guard<std::mutex> lock(mEntryMutex);
+		Entry& e = mEntries[name];
+		e.Pso = pso;
+		e.Result = result;
+		e.Ready = true;
+		--mPendingCount;
+	}
+	mEntryReady.notify_all();
+}
+
+ID3D12PipelineState* PipelineStateCache::Wait(const std::wstring& name)
+{
+	std::unique_lock<std::mutex> lock(mEntryMutex);
+	Entry& e = mEntries[name];
+	mEntryReady.wait(lock, [&e]() { return e.Ready; });
+
+	ThrowIfFailed(e.Result);
+	return e.Pso.Get();
+}
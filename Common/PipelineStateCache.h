@@ -0,0 +1,100 @@
+//***************************************************************************************
+// PipelineStateCache.h
+//
+// Creates pipeline state objects by name and keeps them in an
+// ID3D12PipelineLibrary that is saved to disk, so later runs load the
+// driver's compiled pipelines instead of compiling them again.  PSOs can also
+// be requested ahead of use; they are then created on a background thread of
+// the cache's own, so a variant that is needed later, for another sample
+// count say, is usually ready by the time it is asked for.
+//
+// A name must always be used with the same description.  If a stored
+// pipeline no longer matches its description, because a shader changed, the
+// PSO is created from scratch and the library is rebuilt when it is saved.
+// Without pipeline library support in the runtime or driver every PSO is
+// simply created.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "ThreadPool.h"
+#include <condition_variable>
+#include <mutex>
+
+class PipelineStateCache
+{
+public:
+	PipelineStateCache(ID3D12Device* device, const std::wstring& filename);
+	PipelineStateCache(const PipelineStateCache& rhs) = delete;
+	PipelineStateCache& operator=(const PipelineStateCache& rhs) = delete;
+
+	// Waits for the background requests; does not save.
+	~PipelineStateCache();
+
+	// Returns the named PSO, loading or creating it on the calling thread if
+	// it was not requested before, or waiting for it if it was.  Throws a
+	// DxException if creation failed.
+	ID3D12PipelineState* Graphics(const std::wstring& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc);
+	ID3D12PipelineState* Compute(const std::wstring& name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& desc);
+
+	// Starts loading or creating the named PSO on the background thread unless
+	// it already exists.  What the description points to, shaders, input
+	// layout and root signature, must stay alive until the PSO is ready.
+	void RequestGraphics(const std::wstring& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc);
+
+	// The named PSO if it is ready, or null.
+	ID3D12PipelineState* Find(const std::wstring& name);
+
+	// Blocks until every request has completed.
+	void WaitIdle();
+
+	// Waits for the requests and writes the library to the file if it gained
+	// or replaced pipelines since it was loaded.
+	void Save();
+
+	UINT LoadedCount()const;
+	UINT CreatedCount()const;
+
+private:
+	struct Entry
+	{
+		Microsoft::WRL::ComPtr<ID3D12PipelineState> Pso;
+		HRESULT Result = S_OK;
+		bool Ready = false;
+	};
+
+	// Loads the pipeline from the library or creates and stores it.  Safe to
+	// call from the background thread.
+	template<typename Desc, typename LoadFunc, typename CreateFunc>
+	HRESULT LoadOrCreate(const std::wstring& name, const Desc& desc, LoadFunc load, CreateFunc create,
+		Microsoft::WRL::ComPtr<ID3D12PipelineState>& pso);
+
+	// Reserves the entry for name.  Returns false if it already existed.
+	bool Reserve(const std::wstring& name);
+	void Complete(const std::wstring& name, HRESULT result, ID3D12PipelineState* pso);
+	ID3D12PipelineState* Wait(const std::wstring& name);
+
+	Microsoft::WRL::ComPtr<ID3D12Device> md3dDevice;
+	Microsoft::WRL::ComPtr<ID3D12Device1> md3dDevice1;
+	std::wstring mFilename;
+
+	// The library reads from the serialized data it was created from, so
+	// the data is kept for the library's lifetime.
+	Microsoft::WRL::ComPtr<ID3DBlob> mLibraryData;
+	Microsoft::WRL::ComPtr<ID3D12PipelineLibrary> mLibrary;
+	std::mutex mLibraryMutex;
+	bool mLibraryChanged = false;
+	bool mLibraryStale = false;
+
+	std::unordered_map<std::wstring, Entry> mEntries;
+	std::mutex mEntryMutex;
+	std::condition_variable mEntryReady;
+	UINT mPendingCount = 0;
+
+	std::atomic<UINT> mLoadedCount{ 0 };
+	std::atomic<UINT> mCreatedCount{ 0 };
+
+	// Declared last so its thread is joined before the rest is destroyed.
+	ThreadPool mBackgroundThread;
+};
@@ -0,0 +1,188 @@
+//***************************************************************************************
+// ShaderCache.cpp
+//***************************************************************************************
+
+#include "ShaderCache.h"
+#include <cstring>
+#include <iterator>
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+	const std::uint64_t FnvOffsetBasis = 14695981039346656037ull;
+	const std::uint64_t FnvPrime = 1099511628211ull;
+
+	// Deeper nesting than this is taken to be an include cycle.
+	const UINT MaxIncludeDepth = 16;
+
+	std::uint64_t Fnv1a(const void* data, size_t byteSize, std::uint64_t hash)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for(size_t i = 0; i < byteSize; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= FnvPrime;
+		}
+		return hash;
+	}
+
+	std::uint64_t Fnv1a(const std::string& s, std::uint64_t hash)
+	{
+		// The terminator keeps "ab" + "c" apart from "a" + "bc".
+		return Fnv1a(s.c_str(), s.size() + 1, hash);
+	}
+
+	std::wstring DirectoryOf(const std::wstring& filename)
+	{
+		size_t slash = filename.find_last_of(L"\\/");
+		return slash == std::wstring::npos ? std::wstring() : filename.substr(0, slash + 1);
+	}
+
+	std::wstring StemOf(const std::wstring& filename)
+	{
+		size_t slash = filename.find_last_of(L"\\/");
+		std::wstring name = slash == std::wstring::npos ? filename : filename.substr(slash + 1);
+		return name.substr(0, name.find_last_of(L'.'));
+	}
+
+	// DXBC container: "DXBC", a 16 byte checksum, a version and the total
+	// size.  A file cut short by a crash mid-write fails the size check.
+	const UINT DxbcHeaderSize = 32;
+
+	bool IsValidBytecode(ID3DBlob* blob)
+	{
+		if(blob == nullptr || blob->GetBufferSize() < DxbcHeaderSize)
+			return false;
+
+		const unsigned char* bytes = static_cast<const unsigned char*>(blob->GetBufferPointer());
+		std::uint32_t totalSize = 0;
+		std::memcpy(&totalSize, bytes + 24, sizeof(totalSize));
+
+		return std::memcmp(bytes, "DXBC", 4) == 0 && totalSize == blob->GetBufferSize();
+	}
+
+	UINT64 FileSize(const std::wstring& filename)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if(!GetFileAttributesExW(filename.c_str(), GetFileExInfoStandard, &data))
+			return 0;
+		return ((UINT64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	}
+}
+
+ShaderCache::ShaderCache(const std::wstring& directory)
+	: mDirectory(directory)
+{
+}
+
+ComPtr<ID3DBlob> ShaderCache::Load(
+	const std::wstring& filename,
+	const D3D_SHADER_MACRO* defines,
+	const std::string& entrypoint,
+	const std::string& target)
+{
+	// A damaged file is compiled again and replaced.
+	std::wstring path = CachePath(filename, defines, entrypoint, target);
+	if(FileSize(path) >= DxbcHeaderSize)
+	{
+		ComPtr<ID3DBlob> byteCode = d3dUtil::LoadBinary(path);
+		if(IsValidBytecode(byteCode.Get()))
+		{
+			++mHitCount;
+			return byteCode;
+		}
+	}
+
+	++mMissCount;
+	ComPtr<ID3DBlob> byteCode = d3dUtil::CompileShader(filename, defines, entrypoint, target);
+
+	// The file is written under a temporary name and moved into place, so a
+	// run killed mid-write never leaves a partial file under the real name.
+	// A cache that cannot be written, on a read-only install say, only costs
+	// the compile next time.
+	CreateDirectoryW(mDirectory.c_str(), nullptr);
+	std::wstring tempPath = path + L"." + std::to_wstring(GetCurrentProcessId()) + L".tmp";
+	std::ofstream fout(tempPath, std::ios::binary);
+	if(fout)
+	{
+		fout.write(static_cast<const char*>(byteCode->GetBufferPointer()), byteCode->GetBufferSize());
+		fout.close();
+		if(!fout || !MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+			DeleteFileW(tempPath.c_str());
+	}
+
+	return byteCode;
+}
+
+UINT ShaderCache::HitCount()const
+{
+	return mHitCount;
+}
+
+UINT ShaderCache::MissCount()const
+{
+	return mMissCount;
+}
+
+std::uint64_t ShaderCache::HashSource(const std::wstring& filename, UINT depth)
+{
+	auto it = mSourceHashes.find(filename);
+	if(it != mSourceHashes.end())
+		return it->second;
+
+	std::ifstream fin(filename, std::ios::binary);
+	std::string source((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+
+	std::uint64_t hash = Fnv1a(source, FnvOffsetBasis);
+
+	// Includes are found relative to the including file, like
+	// D3D_COMPILE_STANDARD_FILE_INCLUDE does.
+	if(depth < MaxIncludeDepth)
+	{
+		std::istringstream lines(source);
+		std::string line;
+		while(std::getline(lines, line))
+		{
+			size_t directive = line.find("#include");
+			if(directive == std::string::npos)
+				continue;
+
+			size_t open = line.find('"', directive);
+			size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+			if(close == std::string::npos)
+				continue;
+
+			std::string include = line.substr(open + 1, close - open - 1);
+			std::uint64_t includeHash = HashSource(DirectoryOf(filename) + AnsiToWString(include), depth + 1);
+			hash = Fnv1a(&includeHash, sizeof(includeHash), hash);
+		}
+	}
+
+	mSourceHashes[filename] = hash;
+	return hash;
+}
+
+std::wstring ShaderCache::CachePath(const std::wstring& filename, const D3D_SHADER_MACRO* defines,
+	const std::string& entrypoint, const std::string& target)
+{
+	std::uint64_t hash = HashSource(filename, 0);
+
+	for(const D3D_SHADER_MACRO* d = defines; d != nullptr && d->Name != nullptr; ++d)
+	{
+		hash = Fnv1a(d->Name, hash);
+		hash = Fnv1a(d->Definition != nullptr ? d->Definition : "", hash);
+	}
+
+	hash = Fnv1a(entrypoint, hash);
+	hash = Fnv1a(target, hash);
+
+	UINT compileFlags = d3dUtil::ShaderCompileFlags();
+	hash = Fnv1a(&compileFlags, sizeof(compileFlags), hash);
+
+	wchar_t hashText[17];
+	swprintf_s(hashText, L"%016llx", (unsigned long long)hash);
+
+	return mDirectory + L"\\" + StemOf(filename) + L"_" + AnsiToWString(entrypoint) + L"_" +
+		AnsiToWString(target) + L"_" + hashText + L".cso";
+}
@@ -0,0 +1,49 @@
+//***************************************************************************************
+// ShaderCache.h
+//
+// Compiled shader bytecode kept on disk between runs.  Each permutation is
+// stored in its own file, named after a hash of the shader source and the
+// files it includes, the defines, the entry point, the target and the compile
+// flags.  Editing any of them changes the name, so the stale file is simply
+// never read again.  A permutation missing from the cache is compiled with
+// d3dUtil::CompileShader and written to the cache for the next run.  A file
+// that is not a whole DXBC container is compiled again and replaced.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+
+class ShaderCache
+{
+public:
+	// The directory is created when the first permutation is stored.
+	explicit ShaderCache(const std::wstring& directory);
+	ShaderCache(const ShaderCache& rhs) = delete;
+	ShaderCache& operator=(const ShaderCache& rhs) = delete;
+
+	// Same arguments as d3dUtil::CompileShader.  defines may be null.
+	Microsoft::WRL::ComPtr<ID3DBlob> Load(
+		const std::wstring& filename,
+		const D3D_SHADER_MACRO* defines,
+		const std::string& entrypoint,
+		const std::string& target);
+
+	UINT HitCount()const;
+	UINT MissCount()const;
+
+private:
+	// FNV-1a over the source and, recursively, every #include "file" it names.
+	std::uint64_t HashSource(const std::wstring& filename, UINT depth);
+
+	std::wstring CachePath(const std::wstring& filename, const D3D_SHADER_MACRO* defines,
+		const std::string& entrypoint, const std::string& target);
+
+	std::wstring mDirectory;
+
+	// Source hashes are computed once per file.
+	std::unordered_map<std::wstring, std::uint64_t> mSourceHashes;
+
+	UINT mHitCount = 0;
+	UINT mMissCount = 0;
+};
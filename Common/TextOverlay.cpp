@@ -0,0 +1,66 @@
+//***************************************************************************************
+// TextOverlay.cpp
+//***************************************************************************************
+
+#include "TextOverlay.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+TextOverlay::TextOverlay()
+{
+	Clear();
+}
+
+void TextOverlay::Clear()
+{
+	std::memset(mText, ' ', sizeof(mText));
+	mUsedRows = 0;
+	mUsedColumns = 0;
+}
+
+void TextOverlay::Print(const char* format, ...)
+{
+	if(mUsedRows == Rows)
+		return;
+
+	// One extra byte for the terminator vsnprintf always writes.
+	char line[Columns + 1];
+
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+
+	if(length < 0)
+		length = 0;
+	if(length > (int)Columns)
+		length = (int)Columns;
+
+	std::memcpy(mText[mUsedRows], line, length);
+	++mUsedRows;
+
+	if((UINT)length > mUsedColumns)
+		mUsedColumns = (UINT)length;
+}
+
+UINT TextOverlay::UsedRows()const
+{
+	return mUsedRows;
+}
+
+UINT TextOverlay::UsedColumns()const
+{
+	return mUsedColumns;
+}
+
+void TextOverlay::CopyTo(UINT* dest)const
+{
+	// Character i of the grid is byte i % 4 of UINT i / 4, lowest byte first.
+	const unsigned char* text = reinterpret_cast<const unsigned char*>(mText);
+	for(UINT i = 0; i < PackedSize; ++i)
+	{
+		dest[i] = (UINT)text[4*i] | ((UINT)text[4*i + 1] << 8) |
+			((UINT)text[4*i + 2] << 16) | ((UINT)text[4*i + 3] << 24);
+	}
+}
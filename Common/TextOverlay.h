@@ -0,0 +1,44 @@
+//***************************************************************************************
+// TextOverlay.h
+//
+// A fixed grid of characters for the on-screen stats, drawn by
+// Shaders/TextOverlay.hlsl in one draw with no font texture.  Lines are
+// printf-formatted into rows, and CopyTo packs the grid four characters to a
+// UINT, the layout the shader reads from a structured buffer.  Only printable
+// ASCII is drawn, with lower case shown as upper case.
+//***************************************************************************************
+
+#pragma once
+
+#include <windows.h>
+
+class TextOverlay
+{
+public:
+	static const UINT Columns = 64;
+	static const UINT Rows = 16;
+
+	// UINTs written by CopyTo.
+	static const UINT PackedSize = Columns*Rows/4;
+
+	TextOverlay();
+
+	// Blanks every row.
+	void Clear();
+
+	// Formats a line into the next row; text past Columns is cut off and rows
+	// past Rows are dropped.
+	void Print(const char* format, ...);
+
+	// The rows printed since Clear and the longest of them, the part of the
+	// grid worth drawing.
+	UINT UsedRows()const;
+	UINT UsedColumns()const;
+
+	void CopyTo(UINT* dest)const;
+
+private:
+	char mText[Rows][Columns];
+	UINT mUsedRows = 0;
+	UINT mUsedColumns = 0;
+};
@@ -0,0 +1,125 @@
+//***************************************************************************************
+// ThreadPool.cpp
+//***************************************************************************************
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+	for(unsigned int i = 0; i < threadCount; ++i)
+		mWorkers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mShutdown = true;
+	}
+	mJobAvailable.notify_all();
+
+	for(auto& worker : mWorkers)
+		worker.join();
+}
+
+unsigned int ThreadPool::ThreadCount()const
+{
+	return (unsigned int)mWorkers.size();
+}
+
+void ThreadPool::Enqueue(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobs.push_back(std::move(job));
+	}
+	mJobAvailable.notify_one();
+}
+
+void ThreadPool::ParallelFor(unsigned int jobCount, const std::function<void(unsigned int)>& job)
+{
+	std::atomic<unsigned int> remaining(jobCount);
+	std::exception_ptr firstError = nullptr;
+	std::mutex errorMutex;
+
+	// Keep the last index for the calling thread so it always has work to do.
+	for(unsigned int i = 0; i + 1 < jobCount; ++i)
+	{
+		Enqueue([&, i]()
+		{
+			try
+			{
+				job(i);
+			}
+			catch(...)
+			{
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if(firstError == nullptr)
+					firstError = std::current_exception();
+			}
+			remaining.fetch_sub(1);
+		});
+	}
+
+	if(jobCount > 0)
+	{
+		try
+		{
+			job(jobCount - 1);
+		}
+		catch(...)
+		{
+			std::lock_guard<std::mutex> lock(errorMutex);
+			if(firstError == nullptr)
+				firstError = std::current_exception();
+		}
+		remaining.fetch_sub(1);
+	}
+
+	// Help drain the queue rather than idle, then wait for jobs still in flight
+	// on the workers.
+	while(remaining.load() > 0)
+	{
+		if(!RunPendingJob())
+			std::this_thread::yield();
+	}
+
+	if(firstError != nullptr)
+		std::rethrow_exception(firstError);
+}
+
+void ThreadPool::WorkerLoop()
+{
+	for(;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mJobAvailable.wait(lock, [this]() { return mShutdown || !mJobs.empty(); });
+
+			if(mShutdown && mJobs.empty())
+				return;
+
+			job = std::move(mJobs.front());
+			mJobs.pop_front();
+		}
+
+		job();
+	}
+}
+
+bool ThreadPool::RunPendingJob()
+{
+	std::function<void()> job;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if(mJobs.empty())
+			return false;
+
+		job = std::move(mJobs.front());
+		mJobs.pop_front();
+	}
+
+	job();
+	return true;
+}
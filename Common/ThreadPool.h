@@ -0,0 +1,52 @@
+//***************************************************************************************
+// ThreadPool.h
+//
+// Fixed-size pool of worker threads.  Independent jobs are queued with Enqueue;
+// ParallelFor fans a job out over an index range and blocks until every index
+// has been processed, with the calling thread helping to drain the queue.
+//***************************************************************************************
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// threadCount may be zero, in which case every job runs on the calling thread
+	// inside ParallelFor.
+	ThreadPool(unsigned int threadCount);
+	ThreadPool(const ThreadPool& rhs) = delete;
+	ThreadPool& operator=(const ThreadPool& rhs) = delete;
+	~ThreadPool();
+
+	unsigned int ThreadCount()const;
+
+	// Queues a job to run on one of the worker threads.
+	void Enqueue(std::function<void()> job);
+
+	// Runs job(i) for i in [0, jobCount) and returns once all of them are done.
+	// If any job throws, the first exception is rethrown on the calling thread.
+	void ParallelFor(unsigned int jobCount, const std::function<void(unsigned int)>& job);
+
+private:
+	void WorkerLoop();
+
+	// Pops and runs one queued job.  Returns false if the queue was empty.
+	bool RunPendingJob();
+
+private:
+	std::vector<std::thread> mWorkers;
+
+	std::deque<std::function<void()>> mJobs;
+	std::mutex mMutex;
+	std::condition_variable mJobAvailable;
+	bool mShutdown = false;
+};
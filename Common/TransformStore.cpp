@@ -0,0 +1,307 @@
+//***************************************************************************************
+// TransformStore.cpp
+//***************************************************************************************
+
+#include "TransformStore.h"
+#include <algorithm>
+#include <cassert>
+
+using namespace DirectX;
+
+// mFlags bits.
+static const std::uint8_t DirtyFlag = 0x1;
+static const std::uint8_t QueuedFlag = 0x2;
+
+std::uint32_t TransformStore::Add(std::uint32_t parent, FXMMATRIX local, CXMMATRIX texTransform)
+{
+	std::uint32_t index = Count();
+	assert(parent == NoParent || parent < index);
+
+	mScaleX.push_back(1.0f);
+	mScaleY.push_back(1.0f);
+	mScaleZ.push_back(1.0f);
+	mRotationX.push_back(0.0f);
+	mRotationY.push_back(0.0f);
+	mRotationZ.push_back(0.0f);
+	mRotationW.push_back(1.0f);
+	mPositionX.push_back(0.0f);
+	mPositionY.push_back(0.0f);
+	mPositionZ.push_back(0.0f);
+	mWorldsT.emplace_back();
+	mTexTransformsT.emplace_back();
+	mFlags.push_back(0);
+
+	mParents.push_back(parent);
+	mFirstChild.push_back(NoParent);
+	mNextSibling.push_back(NoParent);
+	if(parent != NoParent)
+	{
+		mNextSibling[index] = mFirstChild[parent];
+		mFirstChild[parent] = index;
+	}
+
+	SetLocal(index, local);
+	SetTexTransform(index, texTransform);
+
+	return index;
+}
+
+void TransformStore::SetLocal(std::uint32_t index, FXMMATRIX local)
+{
+	XMVECTOR scale, rotation, translation;
+	if(!XMMatrixDecompose(&scale, &rotation, &translation, local))
+	{
+		// Degenerate (zero scale) matrix; keep its translation.
+		scale = XMVectorZero();
+		rotation = XMQuaternionIdentity();
+		translation = local.r[3];
+	}
+
+	SetLocalTransform(index, scale, rotation, translation);
+}
+
+void TransformStore::SetLocalTransform(std::uint32_t index, FXMVECTOR scale, FXMVECTOR rotationQuaternion,
+	FXMVECTOR translation)
+{
+	XMVECTOR q = XMQuaternionNormalize(rotationQuaternion);
+
+	mScaleX[index] = XMVectorGetX(scale);
+	mScaleY[index] = XMVectorGetY(scale);
+	mScaleZ[index] = XMVectorGetZ(scale);
+	mRotationX[index] = XMVectorGetX(q);
+	mRotationY[index] = XMVectorGetY(q);
+	mRotationZ[index] = XMVectorGetZ(q);
+	mRotationW[index] = XMVectorGetW(q);
+	mPositionX[index] = XMVectorGetX(translation);
+	mPositionY[index] = XMVectorGetY(translation);
+	mPositionZ[index] = XMVectorGetZ(translation);
+
+	MarkDirty(index);
+}
+
+void TransformStore::SetTexTransform(std::uint32_t index, FXMMATRIX texTransform)
+{
+	XMStoreFloat4x4(&mTexTransformsT[index], XMMatrixTranspose(texTransform));
+
+	// Not needed for the world matrices, but it reports the node as changed so
+	// its constants are written again.
+	MarkDirty(index);
+}
+
+std::uint32_t TransformStore::Parent(std::uint32_t index)const
+{
+	return mParents[index];
+}
+
+XMMATRIX TransformStore::World(std::uint32_t index)const
+{
+	return XMMatrixTranspose(XMLoadFloat4x4(&mWorldsT[index]));
+}
+
+XMVECTOR TransformStore::Position(std::uint32_t index)const
+{
+	const XMFLOAT4X4& m = mWorldsT[index];
+	return XMVectorSet(m(0, 3), m(1, 3), m(2, 3), 1.0f);
+}
+
+XMMATRIX TransformStore::TexTransform(std::uint32_t index)const
+{
+	return XMMatrixTranspose(XMLoadFloat4x4(&mTexTransformsT[index]));
+}
+
+std::uint32_t TransformStore::Count()const
+{
+	return (std::uint32_t)mParents.size();
+}
+
+void TransformStore::Reserve(std::uint32_t count)
+{
+	mScaleX.reserve(count);
+	mScaleY.reserve(count);
+	mScaleZ.reserve(count);
+	mRotationX.reserve(count);
+	mRotationY.reserve(count);
+	mRotationZ.reserve(count);
+	mRotationW.reserve(count);
+	mPositionX.reserve(count);
+	mPositionY.reserve(count);
+	mPositionZ.reserve(count);
+	mParents.reserve(count);
+	mFirstChild.reserve(count);
+	mNextSibling.reserve(count);
+	mWorldsT.reserve(count);
+	mTexTransformsT.reserve(count);
+	mDirty.reserve(count);
+	mFlags.reserve(count);
+}
+
+void TransformStore::Clear()
+{
+	mScaleX.clear();
+	mScaleY.clear();
+	mScaleZ.clear();
+	mRotationX.clear();
+	mRotationY.clear();
+	mRotationZ.clear();
+	mRotationW.clear();
+	mPositionX.clear();
+	mPositionY.clear();
+	mPositionZ.clear();
+	mParents.clear();
+	mFirstChild.clear();
+	mNextSibling.clear();
+	mWorldsT.clear();
+	mTexTransformsT.clear();
+	mDirty.clear();
+	mFlags.clear();
+}
+
+void TransformStore::MarkDirty(std::uint32_t index)
+{
+	if((mFlags[index] & DirtyFlag) == 0)
+	{
+		mFlags[index] |= DirtyFlag;
+		mDirty.push_back(index);
+	}
+}
+
+void TransformStore::UpdateWorlds(std::vector<std::uint32_t>& changed)
+{
+	if(mDirty.empty())
+		return;
+
+	const size_t first = changed.size();
+
+	// Ancestors have lower indices than their descendants, so taking the dirty
+	// nodes in index order reaches a dirty ancestor before any dirty node below
+	// it, and the nodes below are queued with the ancestor's subtree.
+	std::sort(mDirty.begin(), mDirty.end());
+
+	for(std::uint32_t root : mDirty)
+	{
+		if(mFlags[root] & QueuedFlag)
+			continue;
+
+		// Depth first; a node is queued before any of its children.
+		mStack.push_back(root);
+		while(!mStack.empty())
+		{
+			std::uint32_t node = mStack.back();
+			mStack.pop_back();
+
+			mFlags[node] |= QueuedFlag;
+			changed.push_back(node);
+
+			for(std::uint32_t child = mFirstChild[node]; child != NoParent; child = mNextSibling[child])
+				mStack.push_back(child);
+		}
+	}
+
+	const std::uint32_t* nodes = changed.data() + first;
+	const size_t count = changed.size() - first;
+
+	ComputeLocals(nodes, count);
+
+	// Parents are queued first, so a parent's world matrix is final before
+	// its children use it.  W = L*P, so W^T = P^T*L^T.
+	for(size_t i = 0; i < count; ++i)
+	{
+		std::uint32_t node = nodes[i];
+		mFlags[node] = 0;
+
+		std::uint32_t parent = mParents[node];
+		if(parent != NoParent)
+		{
+			XMMATRIX parentT = XMLoadFloat4x4(&mWorldsT[parent]);
+			XMMATRIX localT = XMLoadFloat4x4(&mWorldsT[node]);
+			XMStoreFloat4x4(&mWorldsT[node], XMMatrixMultiply(parentT, localT));
+		}
+	}
+
+	mDirty.clear();
+}
+
+void TransformStore::ComputeLocals(const std::uint32_t* nodes, size_t count)
+{
+	const XMVECTOR one = XMVectorSplatOne();
+
+	for(size_t i = 0; i < count; i += 4)
+	{
+		// Gather four nodes into the lanes of each register, repeating the
+		// last one to fill a partial batch.
+		size_t batchCount = count - i < 4 ? count - i : 4;
+
+		std::uint32_t idx[4];
+		for(size_t k = 0; k < 4; ++k)
+			idx[k] = nodes[i + (k < batchCount ? k : batchCount - 1)];
+
+		auto gather = [&idx](const std::vector<float>& v)
+		{
+			return XMVectorSet(v[idx[0]], v[idx[1]], v[idx[2]], v[idx[3]]);
+		};
+
+		XMVECTOR sx = gather(mScaleX);
+		XMVECTOR sy = gather(mScaleY);
+		XMVECTOR sz = gather(mScaleZ);
+		XMVECTOR qx = gather(mRotationX);
+		XMVECTOR qy = gather(mRotationY);
+		XMVECTOR qz = gather(mRotationZ);
+		XMVECTOR qw = gather(mRotationW);
+		XMVECTOR tx = gather(mPositionX);
+		XMVECTOR ty = gather(mPositionY);
+		XMVECTOR tz = gather(mPositionZ);
+
+		// Rotation matrix of each quaternion, as in XMMatrixRotationQuaternion.
+		XMVECTOR x2 = qx + qx;
+		XMVECTOR y2 = qy + qy;
+		XMVECTOR z2 = qz + qz;
+		XMVECTOR xx = qx*x2;
+		XMVECTOR yy = qy*y2;
+		XMVECTOR zz = qz*z2;
+		XMVECTOR xy = qx*y2;
+		XMVECTOR xz = qx*z2;
+		XMVECTOR yz = qy*z2;
+		XMVECTOR wx = qw*x2;
+		XMVECTOR wy = qw*y2;
+		XMVECTOR wz = qw*z2;
+
+		XMVECTOR r00 = one - (yy + zz);
+		XMVECTOR r01 = xy + wz;
+		XMVECTOR r02 = xz - wy;
+		XMVECTOR r10 = xy - wz;
+		XMVECTOR r11 = one - (xx + zz);
+		XMVECTOR r12 = yz + wx;
+		XMVECTOR r20 = xz + wy;
+		XMVECTOR r21 = yz - wx;
+		XMVECTOR r22 = one - (xx + yy);
+
+		// L = S*R*T scales row i of R by the i-th scale and puts the translation
+		// in row 3.  Row j of the transpose is column j of L; transposing the
+		// lanes gives that row for each node.
+		XMMATRIX rows0 = XMMatrixTranspose(XMMATRIX(sx*r00, sy*r10, sz*r20, tx));
+		XMMATRIX rows1 = XMMatrixTranspose(XMMATRIX(sx*r01, sy*r11, sz*r21, ty));
+		XMMATRIX rows2 = XMMatrixTranspose(XMMATRIX(sx*r02, sy*r12, sz*r22, tz));
+
+		for(size_t k = 0; k < batchCount; ++k)
+		{
+			XMFLOAT4X4& out = mWorldsT[idx[k]];
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(out.m[0]), rows0.r[k]);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(out.m[1]), rows1.r[k]);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(out.m[2]), rows2.r[k]);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(out.m[3]), g_XMIdentityR3);
+		}
+	}
+}
+
+void TransformStore::WriteConstants(const std::uint32_t* transforms, const std::uint32_t* slots, size_t count,
+	std::uint8_t* dest, std::uint32_t stride)const
+{
+	for(size_t i = 0; i < count; ++i)
+	{
+		size_t slot = slots != nullptr ? slots[i] : i;
+		XMFLOAT4X4* out = reinterpret_cast<XMFLOAT4X4*>(dest + slot*stride);
+
+		out[0] = mWorldsT[transforms[i]];
+		out[1] = mTexTransformsT[transforms[i]];
+	}
+}
@@ -0,0 +1,97 @@
+//***************************************************************************************
+// TransformStore.h
+//
+// A hierarchy of object transforms.  Each node keeps its local scale, rotation
+// quaternion and translation relative to its parent in structure-of-arrays
+// form, and caches its world matrix.  Changing a node marks it dirty; once a
+// frame UpdateWorlds recomputes the world matrices of the dirty nodes and their
+// descendants only, building the local matrices four at a time with
+// DirectXMath SIMD operations.  World matrices are written already transposed
+// into mapped constant or structured buffer memory.
+//***************************************************************************************
+
+#pragma once
+
+#include <DirectXMath.h>
+#include <cstdint>
+#include <vector>
+
+class TransformStore
+{
+public:
+	static const std::uint32_t NoParent = 0xffffffff;
+
+	TransformStore() = default;
+	TransformStore(const TransformStore& rhs) = delete;
+	TransformStore& operator=(const TransformStore& rhs) = delete;
+
+	// Adds a node and returns the index used to refer to it.  A parent must be
+	// added before its children, so nodes are always stored parents first.
+	// local must be a scale followed by a rotation and a translation; it is
+	// decomposed into those parts.
+	std::uint32_t Add(std::uint32_t parent, DirectX::FXMMATRIX local, DirectX::CXMMATRIX texTransform);
+
+	// These mark the node dirty; its world matrix and those of its descendants
+	// change on the next UpdateWorlds.
+	void SetLocal(std::uint32_t index, DirectX::FXMMATRIX local);
+	void SetLocalTransform(std::uint32_t index, DirectX::FXMVECTOR scale, DirectX::FXMVECTOR rotationQuaternion,
+		DirectX::FXMVECTOR translation);
+	void SetTexTransform(std::uint32_t index, DirectX::FXMMATRIX texTransform);
+
+	std::uint32_t Parent(std::uint32_t index)const;
+
+	// World space values as of the last UpdateWorlds.
+	DirectX::XMMATRIX World(std::uint32_t index)const;
+	DirectX::XMVECTOR Position(std::uint32_t index)const;
+	DirectX::XMMATRIX TexTransform(std::uint32_t index)const;
+
+	std::uint32_t Count()const;
+	void Reserve(std::uint32_t count);
+	void Clear();
+
+	// Recomputes the world matrix of every dirty node and its descendants,
+	// parents before children, and appends the index of each recomputed node
+	// to changed.
+	void UpdateWorlds(std::vector<std::uint32_t>& changed);
+
+	// For each i < count, writes the transposed world matrix followed by the
+	// transposed texture transform of transforms[i] to dest + slots[i]*stride,
+	// which is the layout of ObjectConstants and InstanceData.  With slots null
+	// the transforms are written to consecutive slots starting at 0.
+	void WriteConstants(const std::uint32_t* transforms, const std::uint32_t* slots, size_t count,
+		std::uint8_t* dest, std::uint32_t stride)const;
+
+private:
+	void MarkDirty(std::uint32_t index);
+
+	// Writes the transposed local matrix of each listed node over its entry
+	// in mWorldsT.
+	void ComputeLocals(const std::uint32_t* nodes, size_t count);
+
+private:
+	std::vector<float> mScaleX;
+	std::vector<float> mScaleY;
+	std::vector<float> mScaleZ;
+	std::vector<float> mRotationX;
+	std::vector<float> mRotationY;
+	std::vector<float> mRotationZ;
+	std::vector<float> mRotationW;
+	std::vector<float> mPositionX;
+	std::vector<float> mPositionY;
+	std::vector<float> mPositionZ;
+
+	// Children of a node are linked through mNextSibling.
+	std::vector<std::uint32_t> mParents;
+	std::vector<std::uint32_t> mFirstChild;
+	std::vector<std::uint32_t> mNextSibling;
+
+	// World matrices and texture transforms are kept transposed, ready to copy.
+	std::vector<DirectX::XMFLOAT4X4> mWorldsT;
+	std::vector<DirectX::XMFLOAT4X4> mTexTransformsT;
+
+	// Nodes changed since the last UpdateWorlds.  mFlags marks the nodes in
+	// mDirty, and during UpdateWorlds the nodes already queued for update.
+	std::vector<std::uint32_t> mDirty;
+	std::vector<std::uint8_t> mFlags;
+	std::vector<std::uint32_t> mStack;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "d3dUtil.h"
+#include "Instrumentation.h"
 
 template<typename T>
 class UploadBuffer
@@ -53,6 +54,20 @@ public:
     void CopyData(int elementIndex, const T& data)
     {
         memcpy(&mMappedData[elementIndex*mElementByteSize], &data, sizeof(T));
+
+        if(mIsConstantBuffer)
+            INSTRUMENT_COUNT(ConstantBytes, sizeof(T));
+    }
+
+    // For code that writes many elements in place, such as TransformStore.
+    BYTE* MappedData()const
+    {
+        return mMappedData;
+    }
+
+    UINT ElementByteSize()const
+    {
+        return mElementByteSize;
     }
 
 private:
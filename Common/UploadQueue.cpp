@@ -0,0 +1,209 @@
+//***************************************************************************************
+// UploadQueue.cpp
+//***************************************************************************************
+
+#include "UploadQueue.h"
+
+using Microsoft::WRL::ComPtr;
+
+UploadQueue::UploadQueue(ID3D12Device* device) :
+	mDevice(device)
+{
+	D3D12_COMMAND_QUEUE_DESC queueDesc = {};
+	queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+	queueDesc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+	ThrowIfFailed(mDevice->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&mQueue)));
+
+	ThrowIfFailed(mDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mFence)));
+
+	mFenceEvent = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
+	if(mFenceEvent == nullptr)
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+}
+
+UploadQueue::~UploadQueue()
+{
+	// The staging buffers must outlive the copies that read them.
+	if(mLastSubmittedFence != 0 && mFence->GetCompletedValue() < mLastSubmittedFence)
+	{
+		mFence->SetEventOnCompletion(mLastSubmittedFence, mFenceEvent);
+		WaitForSingleObject(mFenceEvent, INFINITE);
+	}
+
+	if(mFenceEvent != nullptr)
+		CloseHandle(mFenceEvent);
+}
+
+ComPtr<ID3D12Resource> UploadQueue::CreateDefaultBuffer(const void* data, UINT64 byteSize)
+{
+	ComPtr<ID3D12Resource> defaultBuffer;
+	ComPtr<ID3D12Resource> stagingBuffer;
+
+	// Buffers created in the COMMON state are promoted to COPY_DEST by the copy
+	// queue and decay back to COMMON when the copy list finishes, so no barriers
+	// are needed on either queue.
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(byteSize),
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(defaultBuffer.GetAddressOf())));
+
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(byteSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(stagingBuffer.GetAddressOf())));
+
+	BYTE* mappedData = nullptr;
+	ThrowIfFailed(stagingBuffer->Map(0, nullptr, reinterpret_cast<void**>(&mappedData)));
+	memcpy(mappedData, data, (size_t)byteSize);
+	stagingBuffer->Unmap(0, nullptr);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	BeginBatch();
+	mCmdList->CopyBufferRegion(defaultBuffer.Get(), 0, stagingBuffer.Get(), 0, byteSize);
+	mCurrentBatch.StagingBuffers.push_back(stagingBuffer);
+
+	return defaultBuffer;
+}
+
+void UploadQueue::UploadTexture(ID3D12Resource* texture, UINT firstSubresource, UINT numSubresources,
+	const D3D12_SUBRESOURCE_DATA* data)
+{
+	ComPtr<ID3D12Resource> stagingBuffer;
+
+	const UINT64 stagingByteSize = GetRequiredIntermediateSize(texture, firstSubresource, numSubresources);
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(stagingByteSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(stagingBuffer.GetAddressOf())));
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	BeginBatch();
+	UpdateSubresources(mCmdList.Get(), texture, stagingBuffer.Get(), 0, firstSubresource, numSubresources, data);
+	mCurrentBatch.StagingBuffers.push_back(stagingBuffer);
+}
+
+UINT64 UploadQueue::Submit(std::function<void()> onComplete)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	// An empty batch still gets a fence value so the callback runs in order.
+	BeginBatch();
+
+	ThrowIfFailed(mCmdList->Close());
+	ID3D12CommandList* cmdsLists[] = { mCmdList.Get() };
+	mQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
+
+	mCurrentBatch.FenceValue = ++mLastSubmittedFence;
+	ThrowIfFailed(mQueue->Signal(mFence.Get(), mCurrentBatch.FenceValue));
+
+	mCurrentBatch.OnComplete = std::move(onComplete);
+	mPendingBatches.push_back(std::move(mCurrentBatch));
+
+	mCurrentBatch = Batch();
+	mRecording = false;
+
+	return mLastSubmittedFence;
+}
+
+void UploadQueue::Poll()
+{
+	UINT64 completedValue = mFence->GetCompletedValue();
+
+	// Take the completed batches under the lock, but run the callbacks outside
+	// it so they can queue further uploads.
+	std::vector<Batch> completed;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		while(!mPendingBatches.empty() && mPendingBatches.front().FenceValue <= completedValue)
+		{
+			Batch& batch = mPendingBatches.front();
+
+			ThrowIfFailed(batch.CmdListAlloc->Reset());
+			mFreeAllocators.push_back(batch.CmdListAlloc);
+
+			completed.push_back(std::move(batch));
+			mPendingBatches.pop_front();
+		}
+	}
+
+	for(auto& batch : completed)
+	{
+		batch.StagingBuffers.clear();
+
+		if(batch.OnComplete)
+			batch.OnComplete();
+	}
+}
+
+void UploadQueue::WaitIdle()
+{
+	UINT64 fenceValue = 0;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		fenceValue = mLastSubmittedFence;
+	}
+
+	if(mFence->GetCompletedValue() < fenceValue)
+	{
+		ThrowIfFailed(mFence->SetEventOnCompletion(fenceValue, mFenceEvent));
+		WaitForSingleObject(mFenceEvent, INFINITE);
+	}
+
+	Poll();
+}
+
+bool UploadQueue::IsComplete(UINT64 fenceValue)const
+{
+	return mFence->GetCompletedValue() >= fenceValue;
+}
+
+ID3D12CommandQueue* UploadQueue::Queue()const
+{
+	return mQueue.Get();
+}
+
+ID3D12Fence* UploadQueue::Fence()const
+{
+	return mFence.Get();
+}
+
+void UploadQueue::BeginBatch()
+{
+	if(mRecording)
+		return;
+
+	if(!mFreeAllocators.empty())
+	{
+		mCurrentBatch.CmdListAlloc = mFreeAllocators.back();
+		mFreeAllocators.pop_back();
+	}
+	else
+	{
+		ThrowIfFailed(mDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY,
+			IID_PPV_ARGS(mCurrentBatch.CmdListAlloc.GetAddressOf())));
+	}
+
+	// The list is created on first use and reset for every later batch.
+	if(mCmdList == nullptr)
+	{
+		ThrowIfFailed(mDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY,
+			mCurrentBatch.CmdListAlloc.Get(), nullptr, IID_PPV_ARGS(mCmdList.GetAddressOf())));
+	}
+	else
+	{
+		ThrowIfFailed(mCmdList->Reset(mCurrentBatch.CmdListAlloc.Get(), nullptr));
+	}
+
+	mRecording = true;
+}
@@ -0,0 +1,82 @@
+//***************************************************************************************
+// UploadQueue.h
+//
+// Uploads buffer and texture data to default heap resources on a dedicated
+// D3D12_COMMAND_LIST_TYPE_COPY queue.  Copies are recorded into a batch, and
+// each submitted batch signals the queue's own fence.  Once the fence passes,
+// Poll releases the batch's staging buffers and runs its completion callback,
+// after which the resources can be used by the graphics queue.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include <deque>
+#include <functional>
+#include <mutex>
+
+class UploadQueue
+{
+public:
+	UploadQueue(ID3D12Device* device);
+	UploadQueue(const UploadQueue& rhs) = delete;
+	UploadQueue& operator=(const UploadQueue& rhs) = delete;
+	~UploadQueue();
+
+	// Creates a default heap buffer and records a copy of data into it.  data is
+	// copied to a staging buffer before returning.  The buffer is created in the
+	// COMMON state and is promoted implicitly by the graphics queue when used.
+	Microsoft::WRL::ComPtr<ID3D12Resource> CreateDefaultBuffer(const void* data, UINT64 byteSize);
+
+	// Records an upload of subresource data into a texture created in the
+	// COMMON state.
+	void UploadTexture(ID3D12Resource* texture, UINT firstSubresource, UINT numSubresources,
+		const D3D12_SUBRESOURCE_DATA* data);
+
+	// Submits everything recorded since the last Submit and returns the fence
+	// value that marks its completion.  onComplete may be empty.  Recording and
+	// submitting may happen on any thread.
+	UINT64 Submit(std::function<void()> onComplete);
+
+	// Runs the callbacks of completed batches on the calling thread and frees
+	// their staging memory.  Call once per frame from the render thread.
+	void Poll();
+
+	// Blocks until every submitted batch has completed, then runs Poll.
+	void WaitIdle();
+
+	bool IsComplete(UINT64 fenceValue)const;
+
+	ID3D12CommandQueue* Queue()const;
+	ID3D12Fence* Fence()const;
+
+private:
+	void BeginBatch();
+
+private:
+	struct Batch
+	{
+		UINT64 FenceValue = 0;
+		Microsoft::WRL::ComPtr<ID3D12CommandAllocator> CmdListAlloc;
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> StagingBuffers;
+		std::function<void()> OnComplete;
+	};
+
+	Microsoft::WRL::ComPtr<ID3D12Device> mDevice;
+	Microsoft::WRL::ComPtr<ID3D12CommandQueue> mQueue;
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> mCmdList;
+
+	Microsoft::WRL::ComPtr<ID3D12Fence> mFence;
+	UINT64 mLastSubmittedFence = 0;
+	HANDLE mFenceEvent = nullptr;
+
+	// The batch being recorded.  mRecording is false until the first copy.
+	Batch mCurrentBatch;
+	bool mRecording = false;
+
+	// Submitted batches in fence order, and allocators ready for reuse.
+	std::deque<Batch> mPendingBatches;
+	std::vector<Microsoft::WRL::ComPtr<ID3D12CommandAllocator>> mFreeAllocators;
+
+	std::mutex mMutex;
+};
@@ -0,0 +1,126 @@
+//***************************************************************************************
+// UploadRingBuffer.cpp
+//***************************************************************************************
+
+#include "UploadRingBuffer.h"
+
+using Microsoft::WRL::ComPtr;
+
+UploadRingBuffer::UploadRingBuffer(ID3D12Device* device, ID3D12Fence* fence, UINT64 byteSize) :
+	mFence(fence),
+	mCapacity(byteSize)
+{
+	ThrowIfFailed(device->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(mCapacity),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&mBuffer)));
+
+	// Upload heaps can stay mapped for the lifetime of the resource.
+	ThrowIfFailed(mBuffer->Map(0, nullptr, reinterpret_cast<void**>(&mMappedData)));
+
+	mFenceEvent = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
+	if(mFenceEvent == nullptr)
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+}
+
+UploadRingBuffer::~UploadRingBuffer()
+{
+	if(mBuffer != nullptr)
+		mBuffer->Unmap(0, nullptr);
+
+	if(mFenceEvent != nullptr)
+		CloseHandle(mFenceEvent);
+}
+
+UploadRingBuffer::Allocation UploadRingBuffer::Allocate(UINT64 byteSize, UINT64 alignment)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if(byteSize > mCapacity)
+		ThrowIfFailed(E_INVALIDARG);
+
+	Retire(mFence->GetCompletedValue());
+
+	UINT64 offset = 0;
+	while(!TryAllocate(byteSize, alignment, offset))
+	{
+		// Nothing left to wait for means the current frame alone needs more
+		// than the whole ring.
+		if(mPendingFrames.empty())
+			ThrowIfFailed(E_OUTOFMEMORY);
+
+		// Wait for the GPU to finish with the oldest frame and take its space.
+		UINT64 fenceValue = mPendingFrames.front().FenceValue;
+		if(mFence->GetCompletedValue() < fenceValue)
+		{
+			ThrowIfFailed(mFence->SetEventOnCompletion(fenceValue, mFenceEvent));
+			WaitForSingleObject(mFenceEvent, INFINITE);
+		}
+
+		Retire(mFence->GetCompletedValue());
+	}
+
+	Allocation alloc;
+	alloc.CpuAddress = mMappedData + offset;
+	alloc.GpuAddress = mBuffer->GetGPUVirtualAddress() + offset;
+
+	return alloc;
+}
+
+void UploadRingBuffer::EndFrame(UINT64 fenceValue)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if(mCurrentFrameBytes == 0)
+		return;
+
+	PendingFrame frame;
+	frame.FenceValue = fenceValue;
+	frame.ByteCount = mCurrentFrameBytes;
+	mPendingFrames.push_back(frame);
+
+	mCurrentFrameBytes = 0;
+}
+
+ID3D12Resource* UploadRingBuffer::Resource()const
+{
+	return mBuffer.Get();
+}
+
+UINT64 UploadRingBuffer::Capacity()const
+{
+	return mCapacity;
+}
+
+bool UploadRingBuffer::TryAllocate(UINT64 byteSize, UINT64 alignment, UINT64& offset)
+{
+	UINT64 start = (mHead + alignment - 1) & ~(alignment - 1);
+
+	// Allocations are never split, so skip to the start of the ring if this
+	// one does not fit before the end.
+	if(start + byteSize > mCapacity)
+		start = 0;
+
+	UINT64 skipped = (start >= mHead) ? start - mHead : mCapacity - mHead;
+	if(mUsedBytes + skipped + byteSize > mCapacity)
+		return false;
+
+	offset = start;
+	mHead = (start + byteSize) % mCapacity;
+	mUsedBytes += skipped + byteSize;
+	mCurrentFrameBytes += skipped + byteSize;
+
+	return true;
+}
+
+void UploadRingBuffer::Retire(UINT64 completedFenceValue)
+{
+	while(!mPendingFrames.empty() && mPendingFrames.front().FenceValue <= completedFenceValue)
+	{
+		mUsedBytes -= mPendingFrames.front().ByteCount;
+		mPendingFrames.pop_front();
+	}
+}
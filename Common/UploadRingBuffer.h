@@ -0,0 +1,72 @@
+//***************************************************************************************
+// UploadRingBuffer.h
+//
+// One large, persistently mapped upload heap that hands out aligned
+// suballocations in ring order.  Each frame's allocations are retired when the
+// GPU fence passes the value given to EndFrame, so per-draw data can be
+// streamed without a fixed element count per frame resource.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include <deque>
+#include <mutex>
+
+class UploadRingBuffer
+{
+public:
+	// CPU pointer and GPU address of a suballocation.
+	struct Allocation
+	{
+		BYTE* CpuAddress = nullptr;
+		D3D12_GPU_VIRTUAL_ADDRESS GpuAddress = 0;
+	};
+
+	UploadRingBuffer(ID3D12Device* device, ID3D12Fence* fence, UINT64 byteSize);
+	UploadRingBuffer(const UploadRingBuffer& rhs) = delete;
+	UploadRingBuffer& operator=(const UploadRingBuffer& rhs) = delete;
+	~UploadRingBuffer();
+
+	// Returns byteSize bytes at the given power of two alignment, 256 bytes by
+	// default so the allocation can be bound as a root CBV.  Safe to call from
+	// several threads.  If the ring is full, blocks until the GPU retires the
+	// oldest frame.
+	Allocation Allocate(UINT64 byteSize, UINT64 alignment = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+
+	// Everything allocated since the previous call stays in use until the fence
+	// reaches fenceValue.  Call once per frame after signaling the fence.
+	void EndFrame(UINT64 fenceValue);
+
+	ID3D12Resource* Resource()const;
+	UINT64 Capacity()const;
+
+private:
+	bool TryAllocate(UINT64 byteSize, UINT64 alignment, UINT64& offset);
+	void Retire(UINT64 completedFenceValue);
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Resource> mBuffer;
+	BYTE* mMappedData = nullptr;
+
+	Microsoft::WRL::ComPtr<ID3D12Fence> mFence;
+	HANDLE mFenceEvent = nullptr;
+
+	// Allocations are made at mHead and retired in the same order a frame at a
+	// time.  mUsedBytes includes the bytes skipped when an allocation wraps to
+	// the start of the ring.
+	UINT64 mCapacity = 0;
+	UINT64 mHead = 0;
+	UINT64 mUsedBytes = 0;
+
+	// Bytes taken by each frame still in flight, oldest first.
+	struct PendingFrame
+	{
+		UINT64 FenceValue = 0;
+		UINT64 ByteCount = 0;
+	};
+	std::deque<PendingFrame> mPendingFrames;
+	UINT64 mCurrentFrameBytes = 0;
+
+	std::mutex mMutex;
+};
@@ -35,6 +35,12 @@ D3DApp::~D3DApp()
 {
 	if(md3dDevice != nullptr)
 		FlushCommandQueue();
+
+	if(mFrameLatencyWaitableObject != nullptr)
+		CloseHandle(mFrameLatencyWaitableObject);
+
+	if(mFenceEvent != nullptr)
+		CloseHandle(mFenceEvent);
 }
 
 HINSTANCE D3DApp::AppInst()const
@@ -69,6 +75,26 @@ void D3DApp::Set4xMsaaState(bool value)
     }
 }
 
+float D3DApp::GetRenderScale()const
+{
+	return mRenderScale;
+}
+
+void D3DApp::SetRenderScale(float scale)
+{
+	mRenderScale = MathHelper::Clamp(scale, 0.01f, 1.0f);
+
+	// Update the viewport transform to cover the drawn part of the scene.
+	mScreenViewport.TopLeftX = 0;
+	mScreenViewport.TopLeftY = 0;
+	mScreenViewport.Width    = static_cast<float>(RenderWidth());
+	mScreenViewport.Height   = static_cast<float>(RenderHeight());
+	mScreenViewport.MinDepth = 0.0f;
+	mScreenViewport.MaxDepth = 1.0f;
+
+    mScissorRect = { 0, 0, (LONG)RenderWidth(), (LONG)RenderHeight() };
+}
+
 int D3DApp::Run()
 {
 	MSG msg = {0};
@@ -86,13 +112,28 @@ int D3DApp::Run()
 		// Otherwise, do animation/game stuff.
 		else
         {	
+			if( !mAppPaused )
+				WaitForSwapChain();
+
 			mTimer.Tick();
 
 			if( !mAppPaused )
 			{
 				CalculateFrameStats();
-				Update(mTimer);	
-                Draw(mTimer);
+
+				mProfiler->BeginFrame();
+				{
+					ProfileScope scope(mProfiler.get(), "Update");
+					INSTRUMENT_ZONE("Update");
+					Update(mTimer);	
+				}
+				{
+					ProfileScope scope(mProfiler.get(), "Draw");
+					INSTRUMENT_ZONE("Draw");
+					Draw(mTimer);
+				}
+				mProfiler->EndFrame();
+				Instrumentation::EndFrame();
 			}
 			else
 			{
@@ -112,6 +153,8 @@ bool D3DApp::Initialize()
 	if(!InitDirect3D())
 		return false;
 
+	mProfiler = std::make_unique<FrameProfiler>(md3dDevice.Get(), mCommandQueue.Get());
+
     // Do the initial resize code.
     OnResize();
 
@@ -121,7 +164,7 @@ bool D3DApp::Initialize()
 void D3DApp::CreateRtvAndDsvDescriptorHeaps()
 {
     D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDesc;
-    rtvHeapDesc.NumDescriptors = SwapChainBufferCount;
+    rtvHeapDesc.NumDescriptors = SwapChainBufferCount + 1;
     rtvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
     rtvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
 	rtvHeapDesc.NodeMask = 0;
@@ -153,13 +196,14 @@ void D3DApp::OnResize()
 	for (int i = 0; i < SwapChainBufferCount; ++i)
 		mSwapChainBuffer[i].Reset();
     mDepthStencilBuffer.Reset();
+	mSceneBuffer.Reset();
 	
 	// Resize the swap chain.
     ThrowIfFailed(mSwapChain->ResizeBuffers(
 		SwapChainBufferCount, 
 		mClientWidth, mClientHeight, 
 		mBackBufferFormat, 
-		DXGI_SWAP_CHAIN_FLAG_ALLOW_MODE_SWITCH));
+		SwapChainFlags()));
 
 	mCurrBackBuffer = 0;
  
@@ -171,6 +215,22 @@ void D3DApp::OnResize()
 		rtvHeapHandle.Offset(1, mRtvDescriptorSize);
 	}
 
+	// The dynamic resolution target.  The viewport, not the resource, is
+	// scaled, so it is only recreated here.
+	if(mDynamicResolution && !m4xMsaaState)
+	{
+		D3D12_RESOURCE_DESC sceneDesc = CD3DX12_RESOURCE_DESC::Tex2D(mBackBufferFormat,
+			mClientWidth, mClientHeight, 1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET);
+		ThrowIfFailed(md3dDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&sceneDesc,
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+			nullptr,
+			IID_PPV_ARGS(mSceneBuffer.GetAddressOf())));
+		md3dDevice->CreateRenderTargetView(mSceneBuffer.Get(), nullptr, rtvHeapHandle);
+	}
+
     // Create the depth/stencil buffer and view.
     D3D12_RESOURCE_DESC depthStencilDesc;
     depthStencilDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
@@ -224,15 +284,9 @@ void D3DApp::OnResize()
 	// Wait until resize is complete.
 	FlushCommandQueue();
 
-	// Update the viewport transform to cover the client area.
-	mScreenViewport.TopLeftX = 0;
-	mScreenViewport.TopLeftY = 0;
-	mScreenViewport.Width    = static_cast<float>(mClientWidth);
-	mScreenViewport.Height   = static_cast<float>(mClientHeight);
-	mScreenViewport.MinDepth = 0.0f;
-	mScreenViewport.MaxDepth = 1.0f;
-
-    mScissorRect = { 0, 0, mClientWidth, mClientHeight };
+	// Update the viewport transform to cover the client area, or the scaled
+	// part of it.
+	SetRenderScale(mRenderScale);
 }
  
 LRESULT D3DApp::MsgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
@@ -243,6 +297,9 @@ LRESULT D3DApp::MsgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 	// We pause the game when the window is deactivated and unpause it 
 	// when it becomes active.  
 	case WM_ACTIVATE:
+		// A headless window is never active, so it must not pause on that.
+		if( mHeadless )
+			return 0;
 		if( LOWORD(wParam) == WA_INACTIVE )
 		{
 			mAppPaused = true;
@@ -365,6 +422,8 @@ LRESULT D3DApp::MsgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
         }
         else if((int)wParam == VK_F2)
             Set4xMsaaState(!m4xMsaaState);
+        else
+            OnKeyUp(wParam);
 
         return 0;
 	}
@@ -406,7 +465,7 @@ bool D3DApp::InitMainWindow()
 		return false;
 	}
 
-	ShowWindow(mhMainWnd, SW_SHOW);
+	ShowWindow(mhMainWnd, mHeadless ? SW_HIDE : SW_SHOW);
 	UpdateWindow(mhMainWnd);
 
 	return true;
@@ -446,6 +505,10 @@ bool D3DApp::InitDirect3D()
 	ThrowIfFailed(md3dDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE,
 		IID_PPV_ARGS(&mFence)));
 
+	mFenceEvent = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
+	if(mFenceEvent == nullptr)
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+
 	mRtvDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
 	mDsvDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_DSV);
 	mCbvSrvUavDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
@@ -507,6 +570,12 @@ void D3DApp::CreateSwapChain()
     // Release the previous swapchain we will be recreating.
     mSwapChain.Reset();
 
+	if(mFrameLatencyWaitableObject != nullptr)
+	{
+		CloseHandle(mFrameLatencyWaitableObject);
+		mFrameLatencyWaitableObject = nullptr;
+	}
+
     DXGI_SWAP_CHAIN_DESC sd;
     sd.BufferDesc.Width = mClientWidth;
     sd.BufferDesc.Height = mClientHeight;
@@ -522,13 +591,31 @@ void D3DApp::CreateSwapChain()
     sd.OutputWindow = mhMainWnd;
     sd.Windowed = true;
 	sd.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
-    sd.Flags = DXGI_SWAP_CHAIN_FLAG_ALLOW_MODE_SWITCH;
+    sd.Flags = SwapChainFlags();
 
 	// Note: Swap chain uses queue to perform flush.
     ThrowIfFailed(mdxgiFactory->CreateSwapChain(
 		mCommandQueue.Get(),
 		&sd, 
 		mSwapChain.GetAddressOf()));
+
+	if(mWaitableSwapChain)
+	{
+		ComPtr<IDXGISwapChain2> swapChain2;
+		ThrowIfFailed(mSwapChain.As(&swapChain2));
+		ThrowIfFailed(swapChain2->SetMaximumFrameLatency(mMaxFrameLatency));
+		mFrameLatencyWaitableObject = swapChain2->GetFrameLatencyWaitableObject();
+	}
+}
+
+UINT D3DApp::SwapChainFlags()const
+{
+	// ResizeBuffers must be passed the flags the swap chain was created with.
+	UINT flags = DXGI_SWAP_CHAIN_FLAG_ALLOW_MODE_SWITCH;
+	if(mWaitableSwapChain)
+		flags |= DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+
+	return flags;
 }
 
 void D3DApp::FlushCommandQueue()
@@ -542,19 +629,27 @@ void D3DApp::FlushCommandQueue()
     ThrowIfFailed(mCommandQueue->Signal(mFence.Get(), mCurrentFence));
 
 	// Wait until the GPU has completed commands up to this fence point.
-    if(mFence->GetCompletedValue() < mCurrentFence)
-	{
-		HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
+	WaitForFence(mCurrentFence);
+}
 
-        // Fire event when GPU hits current fence.  
-        ThrowIfFailed(mFence->SetEventOnCompletion(mCurrentFence, eventHandle));
+void D3DApp::WaitForFence(UINT64 fenceValue)
+{
+    if(mFence->GetCompletedValue() < fenceValue)
+	{
+        // Fire event when GPU hits the fence value.  
+        ThrowIfFailed(mFence->SetEventOnCompletion(fenceValue, mFenceEvent));
 
-        // Wait until the GPU hits current fence event is fired.
-		WaitForSingleObject(eventHandle, INFINITE);
-        CloseHandle(eventHandle);
+        // Wait until the fence event is fired.
+		WaitForSingleObject(mFenceEvent, INFINITE);
 	}
 }
 
+void D3DApp::WaitForSwapChain()
+{
+	if(mFrameLatencyWaitableObject != nullptr)
+		WaitForSingleObjectEx(mFrameLatencyWaitableObject, 1000, true);
+}
+
 ID3D12Resource* D3DApp::CurrentBackBuffer()const
 {
 	return mSwapChainBuffer[mCurrBackBuffer].Get();
@@ -573,6 +668,43 @@ D3D12_CPU_DESCRIPTOR_HANDLE D3DApp::DepthStencilView()const
 	return mDsvHeap->GetCPUDescriptorHandleForHeapStart();
 }
 
+bool D3DApp::DynamicResolutionActive()const
+{
+	return mSceneBuffer != nullptr;
+}
+
+ID3D12Resource* D3DApp::SceneBuffer()const
+{
+	return DynamicResolutionActive() ? mSceneBuffer.Get() : CurrentBackBuffer();
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE D3DApp::SceneBufferView()const
+{
+	if(!DynamicResolutionActive())
+		return CurrentBackBufferView();
+
+	return CD3DX12_CPU_DESCRIPTOR_HANDLE(
+		mRtvHeap->GetCPUDescriptorHandleForHeapStart(),
+		SwapChainBufferCount,
+		mRtvDescriptorSize);
+}
+
+UINT D3DApp::RenderWidth()const
+{
+	if(!DynamicResolutionActive())
+		return mClientWidth;
+	UINT width = static_cast<UINT>(mClientWidth*mRenderScale + 0.5f);
+	return width > 0 ? width : 1;
+}
+
+UINT D3DApp::RenderHeight()const
+{
+	if(!DynamicResolutionActive())
+		return mClientHeight;
+	UINT height = static_cast<UINT>(mClientHeight*mRenderScale + 0.5f);
+	return height > 0 ? height : 1;
+}
+
 void D3DApp::CalculateFrameStats()
 {
 	// Code computes the average frames per second, and also the 
@@ -595,7 +727,8 @@ void D3DApp::CalculateFrameStats()
 
         wstring windowText = mMainWndCaption +
             L"    fps: " + fpsStr +
-            L"   mspf: " + mspfStr;
+            L"   mspf: " + mspfStr +
+            FrameStatsText();
 
         SetWindowText(mhMainWnd, windowText.c_str());
 		
@@ -11,6 +11,8 @@
 
 #include "d3dUtil.h"
 #include "GameTimer.h"
+#include "FrameProfiler.h"
+#include "Instrumentation.h"
 
 // Link necessary d3d12 libraries.
 #pragma comment(lib,"d3dcompiler.lib")
@@ -37,6 +39,11 @@ public:
     bool Get4xMsaaState()const;
     void Set4xMsaaState(bool value);
 
+	// Fraction of the client width and height the scene is drawn at, see
+	// mDynamicResolution.  Clamped to (0, 1]; updates the viewport.
+	float GetRenderScale()const;
+	void SetRenderScale(float scale);
+
 	int Run();
  
     virtual bool Initialize();
@@ -53,6 +60,9 @@ protected:
 	virtual void OnMouseUp(WPARAM btnState, int x, int y)  { }
 	virtual void OnMouseMove(WPARAM btnState, int x, int y){ }
 
+	// Convenience override for toggling app features from the keyboard.
+	virtual void OnKeyUp(WPARAM key){ }
+
 protected:
 
 	bool InitMainWindow();
@@ -62,12 +72,35 @@ protected:
 
 	void FlushCommandQueue();
 
+	// Block until mFence reaches fenceValue, using the persistent fence event.
+	void WaitForFence(UINT64 fenceValue);
+
+	// Block until the waitable swap chain can queue another frame.  Does
+	// nothing when mWaitableSwapChain is false.
+	void WaitForSwapChain();
+
+	UINT SwapChainFlags()const;
+
 	ID3D12Resource* CurrentBackBuffer()const;
 	D3D12_CPU_DESCRIPTOR_HANDLE CurrentBackBufferView()const;
 	D3D12_CPU_DESCRIPTOR_HANDLE DepthStencilView()const;
 
+	// The target the scene is drawn to: mSceneBuffer while dynamic resolution
+	// is active, the current back buffer otherwise.
+	bool DynamicResolutionActive()const;
+	ID3D12Resource* SceneBuffer()const;
+	D3D12_CPU_DESCRIPTOR_HANDLE SceneBufferView()const;
+
+	// Size of the scene as drawn, the client size times the render scale.
+	UINT RenderWidth()const;
+	UINT RenderHeight()const;
+
 	void CalculateFrameStats();
 
+	// Derived classes can append their own statistics to the frame stats
+	// shown in the window caption.
+	virtual std::wstring FrameStatsText()const { return std::wstring(); }
+
     void LogAdapters();
     void LogAdapterOutputs(IDXGIAdapter* adapter);
     void LogOutputDisplayModes(IDXGIOutput* output, DXGI_FORMAT format);
@@ -83,6 +116,7 @@ protected:
 	bool      mMaximized = false;  // is the application maximized?
 	bool      mResizing = false;   // are the resize bars being dragged?
     bool      mFullscreenState = false;// fullscreen enabled
+	bool      mHeadless = false;       // window stays hidden and is never paused
 
 	// Set true to use 4X MSAA (4.1.8).  The default is false.
     bool      m4xMsaaState = false;    // 4X MSAA enabled
@@ -90,6 +124,10 @@ protected:
 
 	// Used to keep track of the delta-time and game time (4.4).
 	GameTimer mTimer;
+
+	// CPU and GPU timings of each frame.  Run times Update and Draw; derived
+	// classes add GPU scopes and pipeline statistics on the main queue.
+	std::unique_ptr<FrameProfiler> mProfiler;
 	
     Microsoft::WRL::ComPtr<IDXGIFactory4> mdxgiFactory;
     Microsoft::WRL::ComPtr<IDXGISwapChain> mSwapChain;
@@ -97,6 +135,16 @@ protected:
 
     Microsoft::WRL::ComPtr<ID3D12Fence> mFence;
     UINT64 mCurrentFence = 0;
+
+	// Signaled by mFence; created once and reused by every CPU wait on the queue.
+	HANDLE mFenceEvent = nullptr;
+
+	// Frame pacing.  With a waitable swap chain each frame starts by waiting on
+	// the frame latency object, so at most mMaxFrameLatency frames are queued
+	// for presentation.  Derived classes set these before Initialize.
+	bool mWaitableSwapChain = false;
+	UINT mMaxFrameLatency = 1;
+	HANDLE mFrameLatencyWaitableObject = nullptr;
 	
     Microsoft::WRL::ComPtr<ID3D12CommandQueue> mCommandQueue;
     Microsoft::WRL::ComPtr<ID3D12CommandAllocator> mDirectCmdListAlloc;
@@ -107,6 +155,19 @@ protected:
     Microsoft::WRL::ComPtr<ID3D12Resource> mSwapChainBuffer[SwapChainBufferCount];
     Microsoft::WRL::ComPtr<ID3D12Resource> mDepthStencilBuffer;
 
+	// Dynamic resolution.  Derived classes set mDynamicResolution before
+	// Initialize.  OnResize then also creates mSceneBuffer, a single sample
+	// target of the back buffer size, and its RTV after the back buffers'.
+	// The scene is drawn into its top left RenderWidth() x RenderHeight(),
+	// which mScreenViewport and mScissorRect cover, and the derived class
+	// upscales that to the back buffer.  The scale can change every frame
+	// without creating resources.  With 4X MSAA the scene is drawn to the back
+	// buffer at the full size instead.  mSceneBuffer is created in
+	// D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE.
+	bool mDynamicResolution = false;
+	float mRenderScale = 1.0f;
+	Microsoft::WRL::ComPtr<ID3D12Resource> mSceneBuffer;
+
     Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mRtvHeap;
     Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mDsvHeap;
 